@@ -1,6 +1,7 @@
 #include "argparse.h"
 #include "main.h"
 #include "parse.h"
+#include "lexer.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -69,14 +70,9 @@ char * trimWhitespaceAlloc(char * str) {
 // Parse register name to number
 int parseRegister(char * reg) {
     reg = trimWhitespace(reg);
-    if (reg[0] != 'r') {
-        fprintf(stderr, "Error: Invalid register '%s'\n", reg);
-        error();
-    }
-    int regNum = atoi(reg + 1);  // Skip 'r'
-    if (regNum < 0 || regNum > 31) {
-        fprintf(stderr, "Error: Register out of range (0-31): r%d\n", regNum);
-        error();
+    int regNum = lexRegister(reg, strlen(reg), 'r');
+    if (regNum < 0) {
+        asmOperandError(reg, "Invalid register '%s' (r0-r31)", reg);
     }
     return regNum;
 }
@@ -90,9 +86,7 @@ unsigned long long parseLiteral(char * lit) {
     
     // Check if it's a label reference
     if (lit[0] == ':') {
-        fprintf(stderr, "Error: parseLiteral called with unresolved label '%s'\n", lit);
-        fprintf(stderr, "Labels must be resolved before parsing\n");
-        error();
+        asmError("unresolved label '%s', labels must be resolved before parsing", lit);
     }
     
     // Handle hex (0x...)
@@ -120,14 +114,15 @@ int isLabel(char * str) {
 void parseThreeReg(char * args, int * rd, int * rs, int * rt) {
     char * argsCopy = strdup(args);
     char * token;
+    char * save;
     
-    token = strtok(argsCopy, ",");
+    token = strtok_r(argsCopy, ",", &save);
     if (token) *rd = parseRegister(token);
     
-    token = strtok(NULL, ",");
+    token = strtok_r(NULL, ",", &save);
     if (token) *rs = parseRegister(token);
     
-    token = strtok(NULL, ",");
+    token = strtok_r(NULL, ",", &save);
     if (token) *rt = parseRegister(token);
     
     free(argsCopy);
@@ -137,11 +132,12 @@ void parseThreeReg(char * args, int * rd, int * rs, int * rt) {
 void parseTwoReg(char * args, int * rd, int * rs) {
     char * argsCopy = strdup(args);
     char * token;
+    char * save;
     
-    token = strtok(argsCopy, ",");
+    token = strtok_r(argsCopy, ",", &save);
     if (token) *rd = parseRegister(token);
     
-    token = strtok(NULL, ",");
+    token = strtok_r(NULL, ",", &save);
     if (token) *rs = parseRegister(token);
     
     free(argsCopy);
@@ -151,11 +147,12 @@ void parseTwoReg(char * args, int * rd, int * rs) {
 void parseRegLit(char * args, int * rd, int * L) {
     char * argsCopy = strdup(args);
     char * token;
+    char * save;
     
-    token = strtok(argsCopy, ",");
+    token = strtok_r(argsCopy, ",", &save);
     if (token) *rd = parseRegister(token);
     
-    token = strtok(NULL, ",");
+    token = strtok_r(NULL, ",", &save);
     if (token) *L = parseLiteral(token);
     
     free(argsCopy);
@@ -168,8 +165,7 @@ void parseMemoryLoad(char * args, int * rd, int * rs, int * offset) {
     // Find the comma
     char * comma = strchr(argsCopy, ',');
     if (!comma) {
-        fprintf(stderr, "Error: Invalid memory load format\n");
-        error();
+        asmError("Invalid memory load format");
     }
     
     *comma = '\0';
@@ -182,15 +178,13 @@ void parseMemoryLoad(char * args, int * rd, int * rs, int * offset) {
     // Find first (
     char * paren1 = strchr(rest, '(');
     if (!paren1) {
-        fprintf(stderr, "Error: Invalid memory format\n");
-        error();
+        asmError("Invalid memory format");
     }
     
     // Find first )
     char * paren2 = strchr(paren1, ')');
     if (!paren2) {
-        fprintf(stderr, "Error: Invalid memory format\n");
-        error();
+        asmError("Invalid memory format");
     }
     
     // Extract register between first ( and )
@@ -219,8 +213,7 @@ void parseMemoryStore(char * args, int * rd, int * rs, int * offset) {
     // Find the comma
     char * comma = strchr(argsCopy, ',');
     if (!comma) {
-        fprintf(stderr, "Error: Invalid memory store format\n");
-        error();
+        asmError("Invalid memory store format");
     }
     
     *comma = '\0';
@@ -232,14 +225,12 @@ void parseMemoryStore(char * args, int * rd, int * rs, int * offset) {
     // Parse (rd)(offset)
     char * paren1 = strchr(memPart, '(');
     if (!paren1) {
-        fprintf(stderr, "Error: Invalid memory format\n");
-        error();
+        asmError("Invalid memory format");
     }
     
     char * paren2 = strchr(paren1, ')');
     if (!paren2) {
-        fprintf(stderr, "Error: Invalid memory format\n");
-        error();
+        asmError("Invalid memory format");
     }
     
     *paren2 = '\0';
@@ -1,5 +1,8 @@
 #pragma once
 
+// Trim whitespace in place, returns the adjusted start
+char * trimWhitespace(char * str);
+
 // Parse register name to number (e.g., "r5" -> 5, "r31" -> 31)
 int parseRegister(char * reg);
 
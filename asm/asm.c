@@ -0,0 +1,587 @@
+#include "asm.h"
+#include "main.h"
+#include "parse.h"
+#include "macro.h"
+#include "encode.h"
+#include "tko.h"
+#include "object.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#define ull unsigned long long
+
+// Steps:
+// 1: parse the source into a script object
+// 2: go through the commands and turn each entry into machine bytecode
+// 3: write the image into a buffer
+
+// An instruction as written, before macro expansion, for the map and listing
+typedef struct CodeLine {
+	uint64_t address;
+	long srcOffset;
+	CommandType type;
+} CodeLine;
+
+// Everything one assemble() call works on
+typedef struct Assembler {
+	AsmTrap trap;
+	const char * src;
+	size_t srcSize;
+	AsmOptions options;
+	Layout layout;
+	uint64_t codeSize, dataSize, bssSize;
+	Script * script;
+
+	// object mode: relocations collected before macro expansion, and the labels
+	// that were referenced without being defined
+	ObjReloc * relocs;
+	int numRelocs;
+	int firstExternal;
+
+	unsigned char * image; // header, code and data before they are written out
+	FILE * out;
+	char * bytes;
+	size_t size;
+	char * map;
+	size_t mapSize;
+	char * listing;
+	size_t listingSize;
+	CodeLine * lines;
+	int numLines;
+	AsmDiag * diags;
+	int numDiags;
+	long lastDiagOffset; // one diagnostic per line, even for a macro's expansion
+} Assembler;
+
+__thread AsmTrap * asmTrap;
+static __thread Assembler * current;
+
+// Where operand is written on the line at offset, past its mnemonic, -1 if
+// it is not there as a whole word (a label already replaced by its address)
+static long operandAt(Assembler * as, long offset, const char * operand) {
+	size_t len = strlen(operand);
+	const char * src = as->src, * end = src + as->srcSize;
+	const char * at = src + offset;
+	if (!len) return -1;
+	while (at < end && *at != ' ' && *at != '\t' && *at != '\n') at++;
+	for (; at + len <= end && *at != '\n' && *at != ';'; at++)
+		if (memcmp(at, operand, len) == 0 && (at == src || !isalnum((unsigned char)at[-1])) &&
+			(at + len == end || !isalnum((unsigned char)at[len])))
+			return at - src;
+	return -1;
+}
+
+static void addDiag(Assembler * as, const AsmTrap * trap) {
+	if (as->numDiags == ASM_MAX_DIAGS || (as->numDiags && trap->offset >= 0 && trap->offset == as->lastDiagOffset))
+		return;
+	as->lastDiagOffset = trap->offset;
+	as->diags = realloc(as->diags, (as->numDiags + 1) * sizeof(AsmDiag));
+	AsmDiag * diag = &as->diags[as->numDiags++];
+	diag->line = diag->column = 0;
+	long offset = trap->offset;
+	if (offset >= 0 && offset <= (long)as->srcSize) {
+		long lineStart = 0;
+		diag->line = 1;
+		for (long i = 0; i < offset; i++)
+			if (as->src[i] == '\n') diag->line++, lineStart = i + 1;
+		long at = operandAt(as, offset, trap->operand);
+		diag->column = (at >= 0 ? at : offset) - lineStart + 1;
+	}
+	snprintf(diag->message, sizeof(diag->message), "%s", trap->message);
+}
+
+static void __attribute__((noreturn)) fail(const char * operand, const char * fmt, va_list args) {
+	if (!asmTrap) {
+		fprintf(stderr, "Error: ");
+		vfprintf(stderr, fmt, args);
+		fprintf(stderr, "\n");
+		exit(1);
+	}
+	vsnprintf(asmTrap->message, sizeof(asmTrap->message), fmt, args);
+	snprintf(asmTrap->operand, sizeof(asmTrap->operand), "%s", operand);
+	longjmp(asmTrap->jump, 1);
+}
+
+void asmError(const char * fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	fail("", fmt, args);
+}
+
+void asmOperandError(const char * operand, const char * fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	fail(operand, fmt, args);
+}
+
+void asmDiag(AsmTrap * trap) {
+	if (current) addDiag(current, trap);
+}
+
+// The passes over the entries below catch errors in a trap of their own
+// and go on with the next line, so there is one diagnostic per bad line.
+// Records the error and returns the entry to resume at.
+static int resumeAfter(Assembler * as, AsmTrap * trap, int i, int numEntries) {
+	addDiag(as, trap);
+	return as->numDiags == ASM_MAX_DIAGS ? numEntries : i + 1;
+}
+
+static void expandMacros(Assembler * as, Script * script) {
+	int size = 0;
+	for (int i = 0; i < script->numEntries; i++)
+		size += script->entries[i].type == 0 ? cmdTable[script->entries[i].cmd.type].cnt : 1;
+
+	volatile int newNumEntries = 0;
+	Entry * newEntries = malloc((size + 1) * sizeof(Entry));
+	AsmTrap trap;
+	AsmTrap * outer = asmTrap;
+	asmTrap = &trap;
+	volatile int i = 0;
+	if (setjmp(trap.jump)) { // the line is dropped
+		free(script->entries[i].str);
+		i = resumeAfter(as, &trap, i, script->numEntries);
+	}
+	for (; i < script->numEntries; i++) {
+		Entry * entry = &script->entries[i];
+		if (entry->type != 0) {
+			newEntries[newNumEntries++] = *entry;
+			continue;
+		}
+
+		Entry add[13];
+		trap.offset = entry->srcOffset;
+		int toAdd = expandMacro(entry, add, script->ltable);
+		if (isMacro(entry->cmd.type)) {
+			free(entry->str);
+			entry->str = null;
+		}
+
+		for (int j = 0; j < toAdd; j++)
+			newEntries[newNumEntries++] = add[j];
+	}
+	asmTrap = outer;
+
+	free(script->entries);
+	script->entries = newEntries;
+	script->numEntries = newNumEntries;
+}
+
+static void bindLabels(Script * script, int * labelbuf, int * bufs, uint64_t address) {
+	while (*bufs > 0) {
+		(*bufs)--;
+		int j = labelbuf[*bufs];
+		script->entries[j].address = address;
+		insertLabel(script->entries[j].lbl, address, script->ltable);
+	}
+}
+
+static void fillLabelTable(Assembler * as, Script * script) {
+	as->codeSize = script->codeSize;
+	as->dataSize = script->dataSize;
+	as->bssSize = script->bssSize;
+
+	Layout * layout = &as->layout;
+	if (as->options.object) {
+		// sections are laid out back to back from 0 so a label's address tells its section
+		layout->code = 0;
+		layout->data = (as->codeSize + 7) & ~7;
+		layout->bss = layout->data + as->dataSize;
+	} else placeSegments(layout, as->codeSize, as->dataSize, as->bssSize);
+	uint64_t caddress = layout->code;
+	uint64_t daddress = layout->data;
+	uint64_t baddress = layout->bss;
+	int * labelbuf = malloc((script->numEntries + 1) * sizeof(int)); // labels waiting for the next item
+	int bufs = 0;
+	if (as->options.symbols || as->options.listing) as->lines = malloc((script->numEntries + 1) * sizeof(CodeLine));
+	for (int i = 0; i < script->numEntries; i++) {
+		as->trap.offset = script->entries[i].srcOffset;
+		if (script->entries[i].type == 2) {
+			labelbuf[bufs++] = i;
+		} else if (script->entries[i].type == 1) {
+			bindLabels(script, labelbuf, &bufs, daddress);
+			daddress += 8;
+		} else if (script->entries[i].type == 5) {
+			bindLabels(script, labelbuf, &bufs, baddress);
+			baddress += script->entries[i].value;
+		} else if (script->entries[i].type == 0) {
+			bindLabels(script, labelbuf, &bufs, caddress);
+			if (as->lines)
+				as->lines[as->numLines++] = (CodeLine){caddress, script->entries[i].srcOffset, script->entries[i].cmd.type};
+			caddress += 4 * cmdTable[script->entries[i].cmd.type].cnt;
+		}
+	}
+	free(labelbuf);
+}
+
+// Finds the next label reference (":name") in str, copies it into name and
+// returns where it starts, or null when there are no more
+static char * nextLabelRef(char * str, char * name) {
+	char * ref = strchr(str, ':');
+	if (!ref) return null;
+	int len = strcspn(ref, " \t,()");
+	if (len > 63) len = 63;
+	strncpy(name, ref, len);
+	name[len] = '\0';
+	return ref;
+}
+
+static int isCodeAddress(Assembler * as, uint64_t address) {
+	return address >= as->layout.code && address < as->layout.code + as->codeSize;
+}
+
+// Object mode only: records a relocation for every label reference and
+// enters undefined labels into the table as externals at address 0
+static void collectRelocations(Assembler * as, Script * script) {
+	as->relocs = malloc(sizeof(ObjReloc) * (script->numEntries + 1));
+	as->firstExternal = script->ltable->count;
+	uint64_t caddress = 0;
+	for (int i = 0; i < script->numEntries; i++) {
+		Entry * entry = &script->entries[i];
+		if (entry->type != 0) continue;
+		as->trap.offset = entry->srcOffset;
+
+		char name[64];
+		char * at = entry->str;
+		while (at && (at = nextLabelRef(at, name)) != null) {
+			int sym = findLabel(name, script->ltable);
+			if (sym < 0) {
+				sym = script->ltable->count;
+				insertLabel(name, 0, script->ltable);
+			}
+			at += strlen(name);
+
+			ObjReloc rel = {TKO_CODE, caddress, RELOC_ABS12, sym};
+			if (entry->cmd.type == LD) rel.kind = RELOC_LD64;
+			else if (entry->cmd.type == BRR) {
+				// a branch inside this object's code is already final
+				if (sym < as->firstExternal && isCodeAddress(as, script->ltable->addresses[sym])) continue;
+				rel.kind = RELOC_PCREL12;
+			}
+			as->relocs[as->numRelocs++] = rel;
+		}
+		caddress += 4 * cmdTable[entry->cmd.type].cnt;
+	}
+}
+
+// Substitutes label references with addresses. brr takes the distance
+// from the branch instead; in object mode references left to the linker
+// become 0.
+static void replaceLabels(Assembler * as, Script * script) {
+	volatile uint64_t caddress = as->layout.code;
+	AsmTrap trap;
+	AsmTrap * outer = asmTrap;
+	asmTrap = &trap;
+	volatile int i = 0;
+	if (setjmp(trap.jump)) i = resumeAfter(as, &trap, i, script->numEntries);
+	for (; i < script->numEntries; i++) {
+		Entry * entry = &script->entries[i];
+		if (entry->type != 0) continue;
+		uint64_t pc = caddress;
+		caddress += 4;
+		if (entry->str == null || !strchr(entry->str, ':')) continue;
+		trap.offset = entry->srcOffset;
+
+		char * modified = malloc(strlen(entry->str) + 32 * 4);
+		int len = 0;
+		char name[64];
+		char * at = entry->str;
+		char * ref;
+		while ((ref = nextLabelRef(at, name)) != null) {
+			memcpy(modified + len, at, ref - at);
+			len += ref - at;
+
+			int sym = findLabel(name, script->ltable);
+			if (sym < 0) {
+				free(modified);
+				asmOperandError(name, "Label '%s' not found!", name);
+			}
+			uint64_t address = script->ltable->addresses[sym];
+			int local = sym < as->firstExternal || as->firstExternal < 0;
+			if (entry->cmd.type == BRR && local && isCodeAddress(as, address))
+				len += sprintf(modified + len, "%lld", (long long)(address - pc));
+			else if (as->options.object)
+				len += sprintf(modified + len, "0");
+			else
+				len += sprintf(modified + len, "%" PRIu64, address);
+			at = ref + strlen(name);
+		}
+		strcpy(modified + len, at);
+		free(entry->str);
+		entry->str = modified;
+	}
+	asmTrap = outer;
+}
+
+static void loadMem(ull add, ull v, int size, unsigned char * mem) {
+    for (int i = 0; i < size; i++) {
+        mem[add + i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+// Encodes the instructions into code and the data words into data
+static void encodeScript(Assembler * as, Script * script, unsigned char * code, unsigned char * data) {
+	volatile uint64_t dadd = 0;
+	volatile uint64_t cadd = 0;
+	AsmTrap trap;
+	AsmTrap * outer = asmTrap;
+	asmTrap = &trap;
+	volatile int i = 0;
+	if (setjmp(trap.jump)) {
+		cadd += 4;
+		i = resumeAfter(as, &trap, i, script->numEntries);
+	}
+	for (; i < script->numEntries; i++) {
+		Entry entry = script->entries[i];
+		if (entry.type == 2) continue;
+		trap.offset = entry.srcOffset;
+		if (entry.type == 1) { // data
+			loadMem(dadd, (ull)entry.value, 8, data);
+			dadd += 8;
+		} else if (entry.type == 0) { // instruction
+			uint32_t x = getInstruction(&entry);
+			loadMem(cadd, (ull)x, 4, code);
+			cadd += 4;
+		}
+	}
+	asmTrap = outer;
+}
+
+static __thread const ltable * sortTable;
+
+static int byAddress(const void * a, const void * b) {
+	uint64_t x = sortTable->addresses[*(const int *)a], y = sortTable->addresses[*(const int *)b];
+	if (x != y) return x < y ? -1 : 1;
+	return *(const int *)a - *(const int *)b;
+}
+
+// Source line numbers for ascending offsets, counted on from the last one
+typedef struct LineCounter {
+	const char * src;
+	long offset;
+	int line;
+} LineCounter;
+
+static int lineAt(LineCounter * counter, long offset) {
+	if (offset < counter->offset) counter->offset = 0, counter->line = 1;
+	for (; counter->offset < offset; counter->offset++)
+		if (counter->src[counter->offset] == '\n') counter->line++;
+	return counter->line;
+}
+
+// Writes the symbol map (see asm.h) and the listing, as the options ask,
+// with the encoded code in hand
+static void printMap(Assembler * as, Script * script, const unsigned char * code) {
+	ltable * table = script->ltable;
+	int * order = malloc((table->count + 1) * sizeof(int));
+	for (int i = 0; i < table->count; i++) order[i] = i;
+	sortTable = table;
+	qsort(order, table->count, sizeof(int), byAddress);
+
+	if (as->options.symbols) {
+		FILE * file = open_memstream(&as->map, &as->mapSize);
+		for (int i = 0; i < table->count; i++) {
+			uint64_t address = table->addresses[order[i]];
+			const char * segment = "bss";
+			if (isCodeAddress(as, address)) segment = "code";
+			else if (address >= as->layout.data && address <= as->layout.data + as->dataSize) segment = "data";
+			fprintf(file, "%s %#" PRIx64 " %s\n", segment, address, table->labels[order[i]] + 1);
+		}
+		LineCounter counter = {as->src, 0, 1};
+		for (int i = 0; i < as->numLines; i++) {
+			CodeLine * line = &as->lines[i];
+			fprintf(file, "line %#" PRIx64 " %d %s %d\n", line->address, lineAt(&counter, line->srcOffset),
+				cmdTable[line->type].name, cmdTable[line->type].cnt);
+		}
+		fclose(file);
+	}
+
+	if (as->options.listing) {
+		FILE * file = open_memstream(&as->listing, &as->listingSize);
+		LineCounter counter = {as->src, 0, 1};
+		int label = 0;
+		for (int i = 0; i < as->numLines; i++) {
+			CodeLine * line = &as->lines[i];
+			for (; label < table->count && table->addresses[order[label]] <= line->address; label++)
+				if (isCodeAddress(as, table->addresses[order[label]]))
+					fprintf(file, "%28s%s\n", "", table->labels[order[label]]);
+
+			const char * text = as->src + line->srcOffset;
+			const char * end = as->src + as->srcSize;
+			while (text < end && (*text == ' ' || *text == '\t')) text++;
+			int len = 0;
+			while (text + len < end && text[len] != '\n' && text[len] != '\r') len++;
+			uint64_t offset = line->address - as->layout.code;
+			for (int j = 0; j < cmdTable[line->type].cnt; j++, offset += 4) {
+				uint32_t word = code[offset] | code[offset + 1] << 8 | code[offset + 2] << 16 | (uint32_t)code[offset + 3] << 24;
+				if (j) fprintf(file, "%08" PRIx64 "  %08x\n", line->address + 4 * j, word);
+				else fprintf(file, "%08" PRIx64 "  %08x  %6d  %.*s\n", line->address, word,
+					lineAt(&counter, line->srcOffset), len, text);
+			}
+		}
+		fclose(file);
+	}
+	free(order);
+}
+
+static void printToBinary(Assembler * as, Script * script, FILE * file) {
+	Layout * layout = &as->layout;
+	uint64_t codeSize = as->codeSize, dataSize = as->dataSize, bssSize = as->bssSize;
+
+	// version 1 layout: header, code, then one data segment that runs
+	// through the end of the BSS, zero filled
+	uint64_t legacyData = dataSize;
+	if (bssSize) legacyData = layout->bss + bssSize - layout->data;
+	as->trap.offset = -1;
+	if (as->options.legacy && (layout->bss < layout->data || layout->memory != 0x80000))
+		asmError("this layout needs the version 2 .tko format");
+
+	uint64_t size = (40+codeSize+(as->options.legacy ? legacyData : dataSize));
+	unsigned char * mem = as->image = calloc(size, sizeof(char));
+	if (!mem) asmError("out of memory for a %" PRIu64 " byte image", size);
+
+	// header file
+	loadMem(0,  0,                  8, mem);
+	loadMem(8,  layout->code,       8, mem);
+	loadMem(16, (ull)codeSize,      8, mem);
+	loadMem(24, layout->data,       8, mem);
+	loadMem(32, (ull)legacyData,    8, mem);
+
+	encodeScript(as, script, mem + 40, mem + 40 + codeSize);
+	if (as->numDiags) return;
+	if (as->lines) printMap(as, script, mem + 40);
+
+	if (as->options.legacy) {
+		fwrite(mem, 1, size, file);
+	} else {
+		// the stack section has no payload, its end is the memory size
+		TkoSection sections[4];
+		int n = 0;
+		sections[n++] = (TkoSection){TKO_CODE, layout->code, codeSize, mem + 40};
+		if (dataSize) sections[n++] = (TkoSection){TKO_DATA, layout->data, dataSize, mem + 40 + codeSize};
+		if (bssSize) sections[n++] = (TkoSection){TKO_BSS, layout->bss, bssSize, null};
+		sections[n++] = (TkoSection){TKO_STACK, stackBase(layout), layout->stack, null};
+		writeTko(file, layout->code, sections, n, as->options.compress);
+	}
+	free(mem);
+	as->image = null;
+}
+
+// Relocatable object: every label becomes a symbol (its index in the label
+// table), global when named by .global or when it is an external
+static void printToObject(Assembler * as, Script * script, FILE * file) {
+	Object obj;
+	obj.codeSize = as->codeSize;
+	obj.dataSize = as->dataSize;
+	obj.bssSize = as->bssSize;
+	obj.code = calloc(as->codeSize + 1, 1);
+	obj.data = calloc(as->dataSize + 1, 1);
+	encodeScript(as, script, obj.code, obj.data);
+	if (as->numDiags) {
+		free(obj.code);
+		free(obj.data);
+		return;
+	}
+
+	ltable * table = script->ltable;
+	obj.numSymbols = table->count;
+	obj.symbols = calloc(table->count + 1, sizeof(ObjSymbol));
+	for (int i = 0; i < table->count; i++) {
+		ObjSymbol * sym = &obj.symbols[i];
+		uint64_t address = table->addresses[i];
+		sym->name = table->labels[i] + 1;
+		if (i >= as->firstExternal) {
+			sym->section = OBJ_UNDEF;
+			sym->global = 1;
+			continue;
+		}
+		if (isCodeAddress(as, address)) sym->section = TKO_CODE, sym->offset = address - as->layout.code;
+		else if (address < as->layout.bss) sym->section = TKO_DATA, sym->offset = address - as->layout.data;
+		else sym->section = TKO_BSS, sym->offset = address - as->layout.bss;
+	}
+	for (int i = 0; i < script->numEntries; i++) {
+		if (script->entries[i].type != 6) continue;
+		as->trap.offset = script->entries[i].srcOffset;
+		int sym = findLabel(script->entries[i].lbl, table);
+		if (sym < 0 || sym >= as->firstExternal)
+			asmError(".global label '%s' is not defined", script->entries[i].lbl);
+		obj.symbols[sym].global = 1;
+	}
+
+	obj.numRelocs = as->numRelocs;
+	obj.relocs = as->relocs;
+	writeObject(file, &obj);
+	free(obj.code);
+	free(obj.data);
+	free(obj.symbols);
+}
+
+// Runs the steps above. Errors anywhere below unwind back here through
+// as->trap; the parser workers catch their own and record them.
+int assemble(const char * src, size_t size, const AsmOptions * options, AsmResult * result) {
+	Assembler * as = calloc(1, sizeof(Assembler));
+	as->src = src;
+	as->srcSize = size;
+	as->options = *options;
+	as->firstExternal = -1;
+	as->trap.offset = -1;
+	if (options->layout) as->layout = *options->layout;
+	else defaultLayout(&as->layout);
+
+	AsmTrap * outerTrap = asmTrap;
+	Assembler * outer = current;
+	asmTrap = &as->trap;
+	current = as;
+	if (setjmp(as->trap.jump)) {
+		addDiag(as, &as->trap);
+	} else if ((as->script = getScript(src, size, options->threads)) != null) {
+		// each pass needs the one before it to have gone through
+		Script * script = as->script;
+		fillLabelTable(as, script);
+		if (as->options.object) collectRelocations(as, script);
+		expandMacros(as, script);
+		if (!as->numDiags) replaceLabels(as, script);
+		if (!as->numDiags) {
+			as->out = open_memstream(&as->bytes, &as->size);
+			if (as->options.object) printToObject(as, script, as->out);
+			else printToBinary(as, script, as->out);
+			fclose(as->out);
+			as->out = null;
+		}
+	}
+	asmTrap = outerTrap;
+	current = outer;
+
+	memset(result, 0, sizeof(AsmResult));
+	result->codeSize = as->codeSize;
+	result->dataSize = as->dataSize;
+	result->diags = as->diags;
+	result->numDiags = as->numDiags;
+	if (as->out) fclose(as->out); // failed while writing
+	if (!as->numDiags) {
+		result->bytes = (unsigned char *)as->bytes;
+		result->size = as->size;
+		result->map = as->map;
+		result->mapSize = as->mapSize;
+		result->listing = as->listing;
+		result->listingSize = as->listingSize;
+		as->bytes = as->map = as->listing = null;
+	}
+	if (as->script) freeScript(as->script);
+	free(as->bytes);
+	free(as->image);
+	free(as->map);
+	free(as->listing);
+	free(as->lines);
+	free(as->relocs);
+	free(as);
+	return result->bytes ? 0 : -1;
+}
+
+void freeAsmResult(AsmResult * result) {
+	free(result->bytes);
+	free(result->diags);
+	free(result->map);
+	free(result->listing);
+	memset(result, 0, sizeof(AsmResult));
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "layout.h"
+
+// In-process assembler: source in memory to a .tko or object image in
+// memory. Every call keeps its state to itself, so calls can run on
+// several threads at once.
+
+// Changes whenever the same source could assemble to different bytes, so
+// caches of assembled images (tinker run) know to start over
+#define ASM_VERSION "hw5-asm 3"
+
+typedef struct AsmOptions {
+	int legacy;            // write the version 1 .tko format
+	int compress;          // lz compress sections that shrink
+	int object;            // write a relocatable object for hw5-ld
+	const Layout * layout; // segment layout, null for defaultLayout
+	int threads;           // parser threads, 0 picks from the source size
+	int symbols;           // also write a symbol map into result->map
+	int listing;           // also write a listing into result->listing
+} AsmOptions;
+
+// Errors are reported one per bad line, up to ASM_MAX_DIAGS, from the
+// first pass that finds any: parsing, then macros, labels and encoding, as
+// each needs the one before it to have gone through.
+#define ASM_MAX_DIAGS 100
+
+typedef struct AsmDiag {
+	int line;   // 1-based, 0 when the error is not tied to a line
+	int column; // 1-based, of the operand at fault or else of the line's first word
+	char message[256];
+} AsmDiag;
+
+typedef struct AsmResult {
+	unsigned char * bytes; // the image, null when assembly failed
+	size_t size;
+	uint64_t codeSize, dataSize;
+	AsmDiag * diags;
+	int numDiags;
+	char * map; // symbol map, null unless options->symbols was set
+	size_t mapSize;
+	char * listing; // null unless options->listing was set
+	size_t listingSize;
+} AsmResult;
+
+// A symbol map is text, one label per line in address order:
+//
+//   code 0x2000 Main
+//   data 0x10000 Table
+//
+// giving the segment the label is in, its address and its name without
+// the ':'. Then one line record per instruction as written:
+//
+//   line 0x2000 3 ld 12
+//
+// its address, its line in the source, its mnemonic and how many
+// instructions it became, so a pc inside a macro's expansion can be traced
+// back to it. The simulator reads the map to name pcs (hw5-asm --map=file).
+//
+// A listing has the code's labels and, per instruction as written, its
+// address, the words it encoded to, its line and the line's text.
+
+// Assembles size bytes of source. Returns 0, or -1 with the errors in
+// result->diags. Release the result with freeAsmResult either way.
+int assemble(const char * src, size_t size, const AsmOptions * options, AsmResult * result);
+
+void freeAsmResult(AsmResult * result);
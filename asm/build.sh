@@ -1 +1 @@
-gcc -o hw5-asm main.c parse.c argparse.c labletable.c macro.c encode.c
+gcc -o hw5-asm main.c asm.c parse.c lexer.c argparse.c labletable.c macro.c encode.c tko.c layout.c object.c -pthread
@@ -8,15 +8,22 @@
 // Bits are filled from MSB (31) to LSB (0)
 #include "argparse.h"
 #include "encode.h"
+#include "main.h"
+#include "lexer.h"
+
+// first non-blank character, looked at without copying the argument
+static char firstChar(const char * arg) {
+	while (*arg == ' ' || *arg == '\t') arg++;
+	return *arg;
+}
 
 int isLiteralArg(char * arg) {
-	char new = trim(arg)[0];
+	char new = firstChar(arg);
 	return new == 'r' ? 0 : new == '(' ? 0 : 1;
 }
 
 int isParArg(char * arg) {
-	char new = trim(arg)[0];
-	return new == '(';
+	return firstChar(arg) == '(';
 }
 
 int isRegArg(char * arg) {
@@ -41,29 +48,34 @@ int instructionList(char ** list, char * args) {
     
     char * argsCopy = strdup(args);
     int count = 0;
-    char * token = strtok(argsCopy, ",");
+    char * save;
+    char * token = strtok_r(argsCopy, ",", &save);
     
     while (token != NULL && count < 4) {
         list[count] = trim(token);
         count++;
-        token = strtok(NULL, ",");
+        token = strtok_r(NULL, ",", &save);
     }
     
     free(argsCopy);
     return count;
 }
 
-void checkSigned(long long val) {
+void freeList(char ** list, int count) {
+	for (int i = 0; i < count; i++)
+		free(list[i]);
+}
+
+// arg is the literal as written, null when it is inside a memory operand
+void checkSigned(long long val, char * arg) {
 	if (val < -2048 || val > 2047) {
-		fprintf(stderr, "Literal out of range\n");
-		exit(1);
+		asmOperandError(arg ? trimWhitespace(arg) : "", "Literal out of range");
 	}
 }
 
-void checkUnsigned(long long val) {
+void checkUnsigned(long long val, char * arg) {
 	if (val < 0 || val > 4095) {
-		fprintf(stderr, "Literal out of range\n");
-		exit(1);
+		asmOperandError(arg ? trimWhitespace(arg) : "", "Literal out of range");
 	}
 }
 
@@ -73,14 +85,15 @@ uint32_t getMovInstruction(Entry * entry) {
 	int imm = 0;
 	
 	char * args[4];
-	for (int i = 0; i < 4; i++) 
-		args[i] = malloc(500*sizeof(char));
 	
 	char *rr = entry->str;
 	int len = instructionList(args, rr);
+	if (len != 2) {
+		asmError("Command mov has wrong number of arguments");
+	}
 	if (isRegArg(args[0]) && isParArg(args[1])) {
 		parseMemoryLoad(rr, &r[0], &r[1], &imm);
-		checkSigned(imm);
+		checkSigned(imm, NULL);
 	} else if (isRegArg(args[0]) && isRegArg(args[1])) {
 		opcode += 1;
 		r[0] = parseSingleReg(args[0]);
@@ -89,13 +102,16 @@ uint32_t getMovInstruction(Entry * entry) {
 		opcode += 2;
 		r[0] = parseSingleReg(args[0]);
 		imm = parseLiteral(args[1]);
-		checkUnsigned(imm);
+		checkUnsigned(imm, args[1]);
 	} else if (isParArg(args[0]) && isRegArg(args[1])) {
 		opcode += 3;
 		parseMemoryStore(rr, &r[0], &r[1], &imm);
-		checkSigned(imm);
+		checkSigned(imm, NULL);
+	} else {
+		asmError("mov cannot take %s, %s", args[0], args[1]);
 	}
 
+	freeList(args, len);
 	return build_instruction(opcode, r[0], r[1], r[2], imm);
 }
 
@@ -105,61 +121,123 @@ uint32_t getBrrInstruction(Entry * entry) {
 	
 	if (isLiteralArg(arg)) {
 		long long x = parseLiteral(arg);
-		checkSigned(x);
+		checkSigned(x, arg);
 		return build_instruction(opcode + 1, 0, 0, 0, x);
 	}
 	return build_instruction(opcode, parseSingleReg(arg), 0, 0, 0);
 
 }
 
+int isVectorCmd(CommandType type) {
+	return type >= VADD && type <= VST;
+}
+
+// Parse vector register name: "v3" -> 3
+int parseVecRegister(char * reg) {
+	reg = trimWhitespace(reg);
+	int regNum = lexRegister(reg, strlen(reg), 'v');
+	if (regNum < 0) {
+		asmOperandError(reg, "Invalid vector register '%s' (v0-v31)", reg);
+	}
+	return regNum;
+}
+
+// Parse a bare memory operand: "(r5)" -> 5
+int parseVecAddress(char * arg) {
+	char * open = strchr(arg, '(');
+	char * close = open ? strchr(open, ')') : NULL;
+	if (!open || !close || *trim(close + 1) != '\0') {
+		asmOperandError(arg, "Vector memory operand must be (rN): %s", arg);
+	}
+	*close = '\0';
+	return parseRegister(open + 1);
+}
+
+// Vector commands all share opcode 0x1e; the operation goes in the literal
+// vadd vd, vs, vt | vsplat vd, rs | vsum rd, vs | vld vd, (rs) | vst (rd), vs
+uint32_t getVecInstruction(Entry * entry) {
+	CmdMap cmd = cmdTable[entry->cmd.type];
+	int r[3] = {0, 0, 0}; // rd rs rt
+
+	char * args[4];
+	int len = instructionList(args, entry->str);
+	if (len != cmd.arglenth) {
+		asmError("Command %s has wrong number of arguments", cmd.name);
+	}
+
+	switch (entry->cmd.type) {
+		case VSPLAT:
+			r[0] = parseVecRegister(args[0]);
+			r[1] = parseSingleReg(args[1]);
+			break;
+		case VSUM:
+		case VSUMF:
+			r[0] = parseSingleReg(args[0]);
+			r[1] = parseVecRegister(args[1]);
+			break;
+		case VLD:
+			r[0] = parseVecRegister(args[0]);
+			r[1] = parseVecAddress(args[1]);
+			break;
+		case VST:
+			r[0] = parseVecAddress(args[0]);
+			r[1] = parseVecRegister(args[1]);
+			break;
+		default:
+			for (int i = 0; i < 3; i++)
+				r[i] = parseVecRegister(args[i]);
+	}
+
+	freeList(args, len);
+	return build_instruction(cmd.opcode, r[0], r[1], r[2], cmd.subop);
+}
+
 uint32_t getInstruction(Entry * entry) {
+	if (isVectorCmd(entry->cmd.type)) return getVecInstruction(entry);
 	if (entry->cmd.type == MOV) return getMovInstruction(entry);
 	if (entry->cmd.type == BRR) return getBrrInstruction(entry);
 	uint32_t opcode = cmdTable[entry->cmd.type].opcode;
 	int r[3] = {-1, -1, -1}; // rd rs rt
 	int imm = 0;
 	int hasim = 0;
+	char * literal = NULL;
 	
 	char * args[4];
-	for (int i = 0; i < 4; i++) 
-		args[i] = malloc(500*sizeof(char));
 	int len = instructionList(args, entry->str);
 
 	if (len != cmdTable[entry->cmd.type].arglenth) {
-		fprintf(stderr, "Command %s has wrong number of arguments", cmdTable[entry->cmd.type].name);
-		exit(1);
+		asmError("Command %s has wrong number of arguments", cmdTable[entry->cmd.type].name);
 	}
 
 	for (int i = 0; i < len; i++) {
 		if (isLiteralArg(args[i])) {
 			imm = parseLiteral(args[i]);
+			literal = args[i];
 			hasim = 1;
 			break;
 		}
 		r[i] = parseSingleReg(args[i]);
 	}
-	if (hasim) checkUnsigned(imm);
+	if (hasim) checkUnsigned(imm, literal);
 	
 	int ln = cmdTable[entry->cmd.type].arglenth;
 	int lit = cmdTable[entry->cmd.type].hasLit;
 	
 	for (int i = 0; i < ln - lit; i++)
 		if (r[i] == -1) {
-			fprintf(stderr, "Command %s has too few arguments\n", cmdTable[entry->cmd.type].name);
-			exit(1);
+			asmError("Command %s has too few arguments", cmdTable[entry->cmd.type].name);
 		}
 
 	for (int i = ln -lit + 1; i < 3; i++)
 		if (r[i] != -1) {
-			fprintf(stderr, "Command %s has too many of arguments\n", cmdTable[entry->cmd.type].name);
-			exit(1);
+			asmError("Command %s has too many of arguments", cmdTable[entry->cmd.type].name);
 		}
 
 	if ((lit ^ hasim)&1) {
-			fprintf(stderr, "Command %s has wrong number of arguments\n", cmdTable[entry->cmd.type].name);
-			exit(1);
+			asmError("Command %s has wrong number of arguments", cmdTable[entry->cmd.type].name);
 	}
 	
+	freeList(args, len);
 	return build_instruction(opcode, 
 			r[0] == -1 ? 0 : r[0], 
 			r[1] == -1 ? 0 : r[1], 
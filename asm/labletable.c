@@ -1,27 +1,82 @@
-// TODO: IMPLEMENT
 #include "labletable.h"
 #include "main.h"
 #include <string.h>
 #include <stdlib.h>
 
+// Names are kept to 63 characters, as label references are read
+#define MAX_LABEL_LEN 63
+
+// FNV-1a over the name as it is kept
+static uint32_t hashLabel(const char * label) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; label[i] && i < MAX_LABEL_LEN; i++) h = (h ^ (unsigned char)label[i]) * 0x100000001b3ULL;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static void outOfMemory() {
+    asmError("out of memory for the labels");
+}
+
+// labels earlier in the table come first along a probe sequence, so a
+// repeated name finds the first one, as a scan in order would
+static void rehash(ltable * table) {
+    int numSlots = table->numSlots ? 2 * table->numSlots : 1024;
+    int * slots = malloc(numSlots * sizeof(int));
+    if (!slots) outOfMemory();
+    memset(slots, -1, numSlots * sizeof(int));
+    for (int i = 0; i < table->count; i++) {
+        uint32_t at = hashLabel(table->labels[i]) & (numSlots - 1);
+        while (slots[at] >= 0) at = (at + 1) & (numSlots - 1);
+        slots[at] = i;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->numSlots = numSlots;
+}
+
 void insertLabel(char * label, uint64_t address, ltable *table) {
-    if (table->count >= MAX_LABELS) {
-        fprintf(stderr, "Error: Too many labels!\n");
-        error();
+    if (table->count == table->max) {
+        int max = table->max ? 2 * table->max : 1024;
+        char ** labels = realloc(table->labels, max * sizeof(char *));
+        if (labels) table->labels = labels;
+        uint64_t * addresses = realloc(table->addresses, max * sizeof(uint64_t));
+        if (addresses) table->addresses = addresses;
+        if (!labels || !addresses) outOfMemory();
+        table->max = max;
     }
-    
-    strncpy(table->labels[table->count], label, 63);
-    table->labels[table->count][63] = '\0';
+    if (2 * (table->count + 1) > table->numSlots) rehash(table);
+
+    char * name = strndup(label, MAX_LABEL_LEN);
+    if (!name) outOfMemory();
+    uint32_t at = hashLabel(name) & (table->numSlots - 1);
+    while (table->slots[at] >= 0) at = (at + 1) & (table->numSlots - 1);
+    table->slots[at] = table->count;
+    table->labels[table->count] = name;
     table->addresses[table->count] = address;
     table->count++;
 }
 
+int findLabel(const char * label, const ltable * table) {
+    if (!table->numSlots) return -1;
+    uint32_t at = hashLabel(label) & (table->numSlots - 1);
+    for (; table->slots[at] >= 0; at = (at + 1) & (table->numSlots - 1)) {
+        int i = table->slots[at];
+        if (strncmp(table->labels[i], label, MAX_LABEL_LEN) == 0) return i;
+    }
+    return -1;
+}
+
 uint64_t getintAddress(char *label, ltable *table) {
+    int i = findLabel(label, table);
+    if (i < 0) asmOperandError(label, "Label '%s' not found!", label);
+    return table->addresses[i];
+}
+
+void freeLabelTable(ltable * table) {
     for (int i = 0; i < table->count; i++)
-        if (strcmp(table->labels[i], label) == 0)
-			return table->addresses[i];
-    
-    fprintf(stderr, "Error: Label '%s' not found!\n", label);
-    error();
-	return 1;
+        free(table->labels[i]);
+    free(table->labels);
+    free(table->addresses);
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
 }
@@ -2,15 +2,22 @@
 #include <stdio.h>
 #include <inttypes.h>
 
-#define MAX_LABELS 100000
-
+// Labels in the order they were added, found through an open addressing
+// hash over the names. Both grow as needed; start from a zeroed table.
 typedef struct ltable {
-    char labels[MAX_LABELS][64];  // Array of label strings
-    uint64_t addresses[MAX_LABELS];     // Array of addresses
-    int count;                     // Number of labels
+    char ** labels;       // Label strings, ':' included
+    uint64_t * addresses; // Address of each label
+    int count;            // Number of labels
+    int max;              // Room in labels and addresses
+    int * slots;          // Index of a label per slot, -1 for an empty one
+    int numSlots;         // A power of two, at least twice count
 } ltable;
 
 uint64_t getintAddress(char * label, ltable *table);
 void insertLabel(char * label, uint64_t address, ltable *table);
 
+// Index of the first label added under this name, -1 if there is none
+int findLabel(const char * label, const ltable * table);
 
+// Releases what the table holds, leaving it empty
+void freeLabelTable(ltable * table);
@@ -0,0 +1,110 @@
+#include "layout.h"
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+void defaultLayout(Layout * layout) {
+	memset(layout, 0, sizeof(Layout));
+	layout->code = 0x2000;
+	layout->data = 0x10000;
+	layout->align = 8;
+	layout->stack = 0x1000;
+	layout->memory = 0x80000;
+}
+
+static uint64_t alignUp(uint64_t address, uint64_t align) {
+	return (address + align - 1) / align * align;
+}
+
+void readLayout(char * filename, Layout * layout) {
+	FILE * file = fopen(filename, "r");
+	if (!file) {
+		asmError("cannot open layout file %s", filename);
+	}
+
+	char line[500];
+	int lineNum = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		lineNum++;
+		char key[64];
+		char value[64];
+		char * hash = strchr(line, '#');
+		if (hash) *hash = '\0';
+
+		int n = sscanf(line, "%63s %63s", key, value);
+		if (n <= 0) continue;
+
+		char * end;
+		uint64_t v = n == 2 ? strtoull(value, &end, 0) : 0;
+		if (n != 2 || *end != '\0' || value[0] == '-') {
+			asmError("%s:%d: expected '<key> <number>'", filename, lineNum);
+		}
+
+		if (strcmp(key, "code") == 0) layout->code = v;
+		else if (strcmp(key, "data") == 0) layout->data = v, layout->fixedData = 1;
+		else if (strcmp(key, "bss") == 0) layout->bss = v, layout->fixedBss = 1;
+		else if (strcmp(key, "align") == 0) layout->align = v;
+		else if (strcmp(key, "stack") == 0) layout->stack = v;
+		else if (strcmp(key, "memory") == 0) layout->memory = v;
+		else {
+			asmError("%s:%d: unknown layout key '%s'", filename, lineNum, key);
+		}
+	}
+	fclose(file);
+
+	if (layout->align < 8 || (layout->align & (layout->align - 1))) {
+		asmError("layout alignment must be a power of two of at least 8");
+	}
+}
+
+uint64_t stackBase(Layout * layout) {
+	return layout->memory - layout->stack;
+}
+
+typedef struct Segment {
+	const char * name;
+	uint64_t base;
+	uint64_t size;
+} Segment;
+
+void placeSegments(Layout * layout, uint64_t codeSize, uint64_t dataSize, uint64_t bssSize) {
+	// without an explicit base, data keeps its usual 0x10000 unless the code runs into it
+	if (!layout->fixedData && layout->data < layout->code + codeSize)
+		layout->data = alignUp(layout->code + codeSize, layout->align);
+	if (!layout->fixedBss)
+		layout->bss = alignUp(layout->data + dataSize, layout->align);
+
+	if (layout->stack > layout->memory) {
+		asmError("stack of %" PRIu64 " bytes does not fit in %" PRIu64 " bytes of memory",
+				layout->stack, layout->memory);
+	}
+
+	Segment segs[4] = {
+		{"code", layout->code, codeSize},
+		{"data", layout->data, dataSize},
+		{"bss", layout->bss, bssSize},
+		{"stack", stackBase(layout), layout->stack},
+	};
+
+	for (int i = 0; i < 4; i++) {
+		if (segs[i].size == 0) continue;
+		if (segs[i].base % layout->align) {
+			asmError("%s segment at 0x%" PRIx64 " is not aligned to %" PRIu64 "",
+					segs[i].name, segs[i].base, layout->align);
+		}
+		if (segs[i].base > layout->memory || segs[i].size > layout->memory - segs[i].base) {
+			asmError("%s segment [0x%" PRIx64 ", 0x%" PRIx64 ") is outside of memory (0x%" PRIx64 ")",
+					segs[i].name, segs[i].base, segs[i].base + segs[i].size, layout->memory);
+		}
+		for (int j = 0; j < i; j++) {
+			if (segs[j].size == 0) continue;
+			if (segs[i].base < segs[j].base + segs[j].size && segs[j].base < segs[i].base + segs[i].size) {
+				asmError("%s segment [0x%" PRIx64 ", 0x%" PRIx64 ") overlaps %s segment [0x%" PRIx64 ", 0x%" PRIx64 ")",
+						segs[i].name, segs[i].base, segs[i].base + segs[i].size,
+						segs[j].name, segs[j].base, segs[j].base + segs[j].size);
+			}
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+
+// Segment layout of an assembled program, read from a layout file:
+//
+//   # comment
+//   code   0x2000     code segment base
+//   data   0x10000    data segment base (default: 0x10000, or after the code)
+//   bss    0x40000    BSS base (default: after the data)
+//   align  8          alignment of the segment bases
+//   stack  0x1000     bytes reserved for the stack at the top of memory
+//   memory 0x80000    guest memory size
+typedef struct Layout {
+	uint64_t code, data, bss;
+	int fixedData, fixedBss; // set when the layout file gives the base
+	uint64_t align;
+	uint64_t stack;
+	uint64_t memory;
+} Layout;
+
+void defaultLayout(Layout * layout);
+void readLayout(char * filename, Layout * layout);
+
+// Places the segments the layout left open and reports overlapping
+// segments or segments past the end of memory.
+void placeSegments(Layout * layout, uint64_t codeSize, uint64_t dataSize, uint64_t bssSize);
+
+// Address of the lowest byte of the stack reservation
+uint64_t stackBase(Layout * layout);
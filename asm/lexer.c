@@ -0,0 +1,151 @@
+#include "lexer.h"
+#include "parse.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+// delimiter scans: each one returns the first byte of [p, end) that is in set
+
+static const char * scanScalar(const char * p, const char * end, const char * set, int n) {
+	for (; p < end; p++)
+		for (int i = 0; i < n; i++)
+			if (*p == set[i]) return p;
+	return end;
+}
+
+#ifdef HAVE_X86
+static const char * scanSSE2(const char * p, const char * end, const char * set, int n) {
+	while (end - p >= 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)p);
+		__m128i hit = _mm_setzero_si128();
+		for (int i = 0; i < n; i++)
+			hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, _mm_set1_epi8(set[i])));
+		int mask = _mm_movemask_epi8(hit);
+		if (mask) return p + __builtin_ctz(mask);
+		p += 16;
+	}
+	return scanScalar(p, end, set, n);
+}
+
+__attribute__((target("avx2")))
+static const char * scanAVX2(const char * p, const char * end, const char * set, int n) {
+	while (end - p >= 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *)p);
+		__m256i hit = _mm256_setzero_si256();
+		for (int i = 0; i < n; i++)
+			hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(set[i])));
+		unsigned mask = _mm256_movemask_epi8(hit);
+		if (mask) return p + __builtin_ctz(mask);
+		p += 32;
+	}
+	return scanSSE2(p, end, set, n);
+}
+#endif
+
+typedef const char * (*scanFn)(const char *, const char *, const char *, int);
+
+static const char * scanPick(const char * p, const char * end, const char * set, int n);
+static scanFn scan = scanPick;
+
+// picks the widest scan the host supports on first use
+static const char * scanPick(const char * p, const char * end, const char * set, int n) {
+	scanFn best = scanScalar;
+#ifdef HAVE_X86
+	best = scanSSE2;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) best = scanAVX2;
+#endif
+	scan = best;
+	return best(p, end, set, n);
+}
+
+const char * lexFindDelim(const char * p, const char * end) {
+	return scan(p, end, "\n, \t;", 5);
+}
+
+const char * lexFindEnd(const char * p, const char * end) {
+	return scan(p, end, "\n;", 2);
+}
+
+static int isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+const char * lexLine(const char * p, const char * end, LexLine * line) {
+	memset(line, 0, sizeof(LexLine));
+	switch (*p) {
+		case '\t': line->kind = LEX_ITEM; break;
+		case ':': line->kind = LEX_LABEL; break;
+		case '.': line->kind = LEX_DIRECTIVE; break;
+	}
+
+	const char * stop = lexFindEnd(p, end);
+	const char * next = stop;
+	if (next < end && *next == ';') {
+		const char * nl = memchr(next, '\n', end - next);
+		next = nl ? nl : end;
+	}
+	if (next < end) next++;
+	if (line->kind == LEX_BLANK) return next;
+
+	while (p < stop && isBlank(*p)) p++;
+	while (stop > p && isBlank(stop[-1])) stop--;
+
+	const char * word = lexFindDelim(p, stop);
+	line->word = p;
+	line->wordLen = word - p;
+	while (word < stop && isBlank(*word)) word++;
+	line->rest = word;
+	line->restLen = stop - word;
+	return next;
+}
+
+// Perfect hash over the cmdTable names: h = sum of c * 31^k over the name,
+// slot = top 7 bits of h * MNEMONIC_MUL. The multiplier was found by a
+// search that left every name in its own slot; cmdTable changes need a
+// new search (asm/test.c checks every name still maps to itself).
+#define MNEMONIC_MUL 0x64133131u
+#define MNEMONIC_BITS 7
+
+static const signed char mnemonicSlots[1 << MNEMONIC_BITS] = {
+	-1, -1, -1, HALT, BRNZ, -1, -1, -1,
+	REALLOC, -1, -1, FREE, MEMCPY, VFMAF, -1, VSUM,
+	ADD, SHFTL, VDIV, SUBI, MULF, -1, BR, VLD,
+	-1, POP, -1, DATA, MALLOC, -1, VDIVF, VADDF,
+	SHFTLI, -1, VST, PUSH, -1, -1, -1, AND,
+	-1, -1, MUL, -1, REGION, XOR, -1, -1,
+	-1, -1, -1, -1, -1, NOT, -1, VSUBF,
+	IN, -1, SUB, ICOUNT, -1, SHFTR, -1, VADD,
+	-1, -1, -1, MOV, -1, -1, PRIV, -1,
+	-1, -1, -1, MEMSET, INN, RETURN, -1, VMULF,
+	CLOCK, -1, -1, -1, -1, -1, -1, -1,
+	-1, VMUL, -1, OR, -1, CALL, VSUMF, VFMA,
+	-1, -1, DIV, DIVF, ADDF, -1, OUT, -1,
+	ENDREGION, VSUB, -1, -1, -1, BRGT, OUTS, VSPLAT,
+	-1, LD, CLR, OUTN, -1, -1, BRR, -1,
+	-1, -1, ADDI, SHFTRI, -1, SUBF, -1, -1,
+};
+
+int lookupMnemonic(const char * name, int len) {
+	uint32_t h = 0;
+	for (int i = 0; i < len; i++) h = h * 31 + (unsigned char)name[i];
+	int type = mnemonicSlots[(uint32_t)(h * MNEMONIC_MUL) >> (32 - MNEMONIC_BITS)];
+	if (type < 0) return -1;
+	const char * want = cmdTable[type].name;
+	if (strncmp(want, name, len) != 0 || want[len] != '\0') return -1;
+	return type;
+}
+
+int lexRegister(const char * s, int len, char prefix) {
+	if (len < 2 || len > 3 || s[0] != prefix) return -1;
+	int num = 0;
+	for (int i = 1; i < len; i++) {
+		if (s[i] < '0' || s[i] > '9') return -1;
+		num = num * 10 + s[i] - '0';
+	}
+	return num > 31 ? -1 : num;
+}
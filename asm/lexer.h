@@ -0,0 +1,35 @@
+#pragma once
+
+// Allocation-free scanner for assembly source. Lines are lexed in place
+// (straight out of the mmap'd file), delimiters are found 16 or 32 bytes
+// at a time and mnemonics are resolved with a perfect hash.
+
+typedef enum LexKind {
+	LEX_BLANK,     // empty line or ';' comment
+	LEX_ITEM,      // tab line: an instruction, a data word or .space
+	LEX_LABEL,     // :Name
+	LEX_DIRECTIVE, // .code, .data, .global
+} LexKind;
+
+typedef struct LexLine {
+	LexKind kind;
+	const char * word; // mnemonic, label, directive or data literal
+	int wordLen;
+	const char * rest; // everything after the word, trimmed, up to ';' or the newline
+	int restLen;
+} LexLine;
+
+// Lexes the line starting at p and returns the start of the next one
+const char * lexLine(const char * p, const char * end, LexLine * line);
+
+// First '\n', ',', ' ', '\t' or ';' in [p, end), end if there is none
+const char * lexFindDelim(const char * p, const char * end);
+
+// First '\n' or ';' in [p, end), end if there is none
+const char * lexFindEnd(const char * p, const char * end);
+
+// CommandType for a mnemonic, -1 if it is not one
+int lookupMnemonic(const char * name, int len);
+
+// Number of a register written as prefix followed by 0-31 ("r7", "v12"), -1 if malformed
+int lexRegister(const char * s, int len, char prefix);
@@ -2,6 +2,7 @@
 #include "parse.h"
 #include "main.h"
 #include "argparse.h"
+#include "lexer.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -13,38 +14,32 @@ extern char * trimWhitespace(char * str);
 int isMacro(CommandType type) {
     return (type == CLR || type == IN || type == OUT || 
             type == LD || type == PUSH || type == POP || 
-			type == HALT);
+			type == INN || type == OUTN || type == OUTS ||
+			type == MEMCPY || type == MEMSET || type == MALLOC ||
+			type == FREE || type == REALLOC || type == ICOUNT ||
+			type == CLOCK || type == REGION || type == ENDREGION || type == HALT);
 }
 
 
 
 // Helper to create an entry for an expanded instruction
 Entry createExpandedEntry(Entry * original, const char * instruction, int addressOffset) {
-    Entry entry;
+    Entry entry = {0};
+    entry.srcOffset = original->srcOffset;
     entry.address = original->address + addressOffset;
     entry.size = 4;  // Instructions are 4 bytes
     entry.type = 0;  // 0 = instruction
-    entry.str = strdup(instruction);
    	
-    // Parse the instruction to set cmd.type
-    char * cmd = extractCommandName((char*)instruction);
-    char * args = extractArguments((char*)instruction);
-    
-    entry.str = args;
-    
-    // Determine command type
-    if (strcmp(cmd, "xor") == 0) entry.cmd.type = XOR;
-    else if (strcmp(cmd, "priv") == 0) entry.cmd.type = PRIV;
-    else if (strcmp(cmd, "subi") == 0) entry.cmd.type = SUBI;
-    else if (strcmp(cmd, "addi") == 0) entry.cmd.type = ADDI;
-    else if (strcmp(cmd, "mov") == 0) entry.cmd.type = MOV;
-    else if (strcmp(cmd, "shftli") == 0) entry.cmd.type = SHFTLI;
-    else {
-        fprintf(stderr, "Error: Unknown command in macro expansion: %s\n", cmd);
-        error();
+    // Split off the mnemonic and look it up, the rest are the arguments
+    const char * space = strchr(instruction, ' ');
+    int len = space ? space - instruction : strlen(instruction);
+    int type = lookupMnemonic(instruction, len);
+    if (type < 0) {
+        asmError("Unknown command in macro expansion: %.*s", len, instruction);
     }
+    entry.cmd.type = type;
+    entry.str = strdup(space ? space + 1 : "");
     
-    free(cmd);
     return entry;
 }
 
@@ -91,16 +86,86 @@ int expandOut(Entry * original, Entry * output) {
     return 1;
 }
 
+// Block transfers, one priv each; the simulator checks the whole range
+// against guest memory before touching it.
+// inn rd, rs -> priv rd, rs, r0, 5: read r[rs] integers into words at r[rd]
+// outn rd, rs -> priv rd, rs, r0, 6: print r[rs] words from r[rd]
+// outs rd, rs -> priv rd, rs, r0, 7: write r[rs] bytes from r[rd]
+int expandBlockIo(Entry * original, Entry * output, int imm) {
+    int rd = -1, rs = -1;
+    parseTwoReg(original->str, &rd, &rs);
+    if (rd < 0 || rs < 0) asmError("%s needs two registers", cmdTable[original->cmd.type].name);
+
+    char instruction[64];
+    snprintf(instruction, sizeof(instruction), "priv r%d, r%d, r0, %d", rd, rs, imm);
+
+    output[0] = createExpandedEntry(original, instruction, 0);
+    return 1;
+}
+
+// memcpy rd, rs, rt -> priv rd, rs, rt, 8: copy r[rt] bytes from r[rs] to r[rd]
+// memset rd, rs, rt -> priv rd, rs, rt, 9: set r[rt] bytes at r[rd] to r[rs]
+int expandBulkMemory(Entry * original, Entry * output, int imm) {
+    int rd = -1, rs = -1, rt = -1;
+    parseThreeReg(original->str, &rd, &rs, &rt);
+    if (rd < 0 || rs < 0 || rt < 0) asmError("%s needs three registers", cmdTable[original->cmd.type].name);
+
+    char instruction[64];
+    snprintf(instruction, sizeof(instruction), "priv r%d, r%d, r%d, %d", rd, rs, rt, imm);
+
+    output[0] = createExpandedEntry(original, instruction, 0);
+    return 1;
+}
+
+// Heap services, allocated natively by the simulator (sim/heap.c)
+// malloc rd, rs -> priv rd, rs, r0, 10: r[rd] = r[rs] bytes, 0 when the heap is full
+// free rd -> priv rd, r0, r0, 11: frees r[rd], 0 is ignored
+// realloc rd, rs, rt -> priv rd, rs, rt, 12: r[rd] = r[rs] resized to r[rt] bytes
+int expandHeap(Entry * original, Entry * output, int imm) {
+    int rd = -1, rs = -1, rt = -1;
+    if (imm == 11) {
+        rd = parseSingleReg(original->str);
+        rs = rt = 0;
+    } else if (imm == 10) {
+        parseTwoReg(original->str, &rd, &rs);
+        rt = 0;
+    } else {
+        parseThreeReg(original->str, &rd, &rs, &rt);
+    }
+    if (rd < 0 || rs < 0 || rt < 0)
+        asmError("%s is missing a register", cmdTable[original->cmd.type].name);
+
+    char instruction[64];
+    snprintf(instruction, sizeof(instruction), "priv r%d, r%d, r%d, %d", rd, rs, rt, imm);
+
+    output[0] = createExpandedEntry(original, instruction, 0);
+    return 1;
+}
+
+// Timing services (sim/stats.c), for programs that measure themselves
+// icount rd -> priv rd, r0, r0, 13: r[rd] = instructions run before it
+// clock rd -> priv rd, r0, r0, 14: r[rd] = host monotonic nanoseconds
+// region rd -> priv rd, r0, r0, 15: starts timed region r[rd]
+// endregion rd -> priv rd, r0, r0, 16: ends it
+int expandTiming(Entry * original, Entry * output, int imm) {
+    int rd = parseSingleReg(original->str);
+    if (rd < 0)
+        asmError("%s is missing a register", cmdTable[original->cmd.type].name);
+
+    char instruction[64];
+    snprintf(instruction, sizeof(instruction), "priv r%d, r0, r0, %d", rd, imm);
+
+    output[0] = createExpandedEntry(original, instruction, 0);
+    return 1;
+}
+
 // ld rd, L -> Expands to multiple instructions to load full 64-bit value
 int expandLd(Entry * original, Entry * output, uint64_t addr) {
-	    fprintf(stderr, "DEBUG expandLd: address=%llu (0x%llu)\n", addr, addr);
 // Parse register from args (format: "r5, :label" or "r5, 0x1000")
     char * argsCopy = strdup(original->str);
-
-		
-
-    char * reg = strtok(argsCopy, ",");
-    int rd = parseRegister(reg);
+    char * comma = strchr(argsCopy, ',');
+    if (comma) *comma = '\0'; // "ld , 5" has no register to find
+    int rd = parseRegister(argsCopy);
     free(argsCopy);
     
     int count = 0;
@@ -193,6 +258,30 @@ int expandMacro(Entry * original, Entry * output, ltable * table) {
             return expandPush(original, output);
         case POP:
             return expandPop(original, output);
+        case INN:
+            return expandBlockIo(original, output, 5);
+        case OUTN:
+            return expandBlockIo(original, output, 6);
+        case OUTS:
+            return expandBlockIo(original, output, 7);
+        case MEMCPY:
+            return expandBulkMemory(original, output, 8);
+        case MEMSET:
+            return expandBulkMemory(original, output, 9);
+        case MALLOC:
+            return expandHeap(original, output, 10);
+        case FREE:
+            return expandHeap(original, output, 11);
+        case REALLOC:
+            return expandHeap(original, output, 12);
+        case ICOUNT:
+            return expandTiming(original, output, 13);
+        case CLOCK:
+            return expandTiming(original, output, 14);
+        case REGION:
+            return expandTiming(original, output, 15);
+        case ENDREGION:
+            return expandTiming(original, output, 16);
         case LD: {
             // Need to resolve label if present
             char * argsCopy = strdup(original->str);
@@ -210,14 +299,12 @@ int expandMacro(Entry * original, Entry * output, ltable * table) {
                 free(argsCopy);
                 return expandLd(original, output, address);
             }
-            fprintf(stderr, "Error: Invalid ld macro format\n");
-            error();
+            asmError("Invalid ld macro format");
         }
 		case HALT: 
 			return expandHalt(original, output);
 		default:
-            fprintf(stderr, "Error: Unknown macro type\n");
-            error();
+            asmError("Unknown macro type");
 		return 1;
     }
 }
@@ -21,6 +21,18 @@ int expandIn(Entry * original, Entry * output);
 // out rd, rs -> priv rd, rs, 0, 0x4
 int expandOut(Entry * original, Entry * output);
 
+// inn/outn/outs rd, rs -> priv rd, rs, r0, 5/6/7
+int expandBlockIo(Entry * original, Entry * output, int imm);
+
+// memcpy/memset rd, rs, rt -> priv rd, rs, rt, 8/9
+int expandBulkMemory(Entry * original, Entry * output, int imm);
+
+// malloc rd, rs / free rd / realloc rd, rs, rt -> priv ..., 10/11/12
+int expandHeap(Entry * original, Entry * output, int imm);
+
+// icount/clock/region/endregion rd -> priv rd, r0, r0, 13/14/15/16
+int expandTiming(Entry * original, Entry * output, int imm);
+
 // ld rd, L -> multiple instructions to build 64-bit value
 // NOTE: L should be the resolved address (label already looked up)
 int expandLd(Entry * original, Entry * output, uint64_t address);
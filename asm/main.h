@@ -1 +1,25 @@
-void error();
+#pragma once
+#include <setjmp.h>
+
+// Where asmError unwinds to. assemble() keeps one for the calling thread
+// and each parser worker has its own.
+typedef struct AsmTrap {
+	jmp_buf jump;
+	long offset;       // source offset of the line being worked on, -1 for none
+	char message[256];
+	char operand[64];  // text of the operand at fault, empty when it is the whole line
+} AsmTrap;
+
+// the trap of the assemble() call running on this thread, null outside of one
+extern __thread AsmTrap * asmTrap;
+
+// Reports an error in the source and unwinds to asmTrap. With no trap
+// (tools and unit tests) it prints the message and exits.
+void asmError(const char * fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+// asmError for one operand of the line, as written, so the diagnostic
+// points at its column
+void asmOperandError(const char * operand, const char * fmt, ...) __attribute__((noreturn, format(printf, 2, 3)));
+
+// Records the error a worker's trap caught against the running assemble() call
+void asmDiag(AsmTrap * trap);
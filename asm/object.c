@@ -0,0 +1,135 @@
+#include "object.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void putWord(FILE * file, uint64_t v) {
+	unsigned char b[8];
+	for (int i = 0; i < 8; i++)
+		b[i] = (v >> (8 * i)) & 0xFF;
+	fwrite(b, 1, 8, file);
+}
+
+static int getWord(FILE * file, uint64_t * v) {
+	unsigned char b[8];
+	if (fread(b, 1, 8, file) != 8) return -1;
+	*v = 0;
+	for (int i = 7; i >= 0; i--)
+		*v = (*v << 8) | b[i];
+	return 0;
+}
+
+void writeObject(FILE * file, Object * obj) {
+	putWord(file, OBJ_MAGIC);
+	putWord(file, OBJ_VERSION);
+	putWord(file, obj->codeSize);
+	putWord(file, obj->dataSize);
+	putWord(file, obj->bssSize);
+	putWord(file, obj->numSymbols);
+	putWord(file, obj->numRelocs);
+	fwrite(obj->code, 1, obj->codeSize, file);
+	fwrite(obj->data, 1, obj->dataSize, file);
+
+	for (int i = 0; i < obj->numSymbols; i++) {
+		ObjSymbol * sym = &obj->symbols[i];
+		putWord(file, sym->section);
+		putWord(file, sym->global);
+		putWord(file, sym->offset);
+		putWord(file, strlen(sym->name));
+		fwrite(sym->name, 1, strlen(sym->name), file);
+	}
+	for (int i = 0; i < obj->numRelocs; i++) {
+		putWord(file, obj->relocs[i].section);
+		putWord(file, obj->relocs[i].offset);
+		putWord(file, obj->relocs[i].kind);
+		putWord(file, obj->relocs[i].symbol);
+	}
+}
+
+Object * readObject(char * filename) {
+	FILE * file = fopen(filename, "rb");
+	if (!file) return NULL;
+
+	Object * obj = calloc(1, sizeof(Object));
+	uint64_t magic, version, numSymbols, numRelocs;
+	if (getWord(file, &magic) || magic != OBJ_MAGIC || getWord(file, &version) || version != OBJ_VERSION
+			|| getWord(file, &obj->codeSize) || getWord(file, &obj->dataSize) || getWord(file, &obj->bssSize)
+			|| getWord(file, &numSymbols) || getWord(file, &numRelocs))
+		goto bad;
+
+	// sizes come from the file, so make sure it is long enough before allocating
+	long here = ftell(file);
+	fseek(file, 0, SEEK_END);
+	uint64_t remaining = ftell(file) - here;
+	fseek(file, here, SEEK_SET);
+	if (obj->codeSize > remaining || obj->dataSize > remaining - obj->codeSize
+			|| numSymbols > remaining / 32 || numRelocs > remaining / 32)
+		goto bad;
+
+	obj->code = malloc(obj->codeSize + 1);
+	obj->data = malloc(obj->dataSize + 1);
+	if (fread(obj->code, 1, obj->codeSize, file) != obj->codeSize
+			|| fread(obj->data, 1, obj->dataSize, file) != obj->dataSize)
+		goto bad;
+
+	obj->numSymbols = numSymbols;
+	obj->symbols = calloc(numSymbols + 1, sizeof(ObjSymbol));
+	for (int i = 0; i < obj->numSymbols; i++) {
+		ObjSymbol * sym = &obj->symbols[i];
+		uint64_t len;
+		if (getWord(file, &sym->section) || getWord(file, &sym->global) || getWord(file, &sym->offset)
+				|| getWord(file, &len) || len > remaining)
+			goto bad;
+		sym->name = malloc(len + 1);
+		if (fread(sym->name, 1, len, file) != len) goto bad;
+		sym->name[len] = '\0';
+	}
+
+	obj->numRelocs = numRelocs;
+	obj->relocs = calloc(numRelocs + 1, sizeof(ObjReloc));
+	for (int i = 0; i < obj->numRelocs; i++) {
+		ObjReloc * rel = &obj->relocs[i];
+		if (getWord(file, &rel->section) || getWord(file, &rel->offset) || getWord(file, &rel->kind)
+				|| getWord(file, &rel->symbol) || rel->symbol >= numSymbols)
+			goto bad;
+	}
+
+	fclose(file);
+	return obj;
+
+bad:
+	fclose(file);
+	return NULL;
+}
+
+static void setLiteral(unsigned char * bytes, uint64_t offset, uint64_t imm) {
+	uint32_t instr = bytes[offset] | bytes[offset + 1] << 8 | bytes[offset + 2] << 16 | (uint32_t)bytes[offset + 3] << 24;
+	instr = (instr & ~0xFFFu) | (imm & 0xFFF);
+	for (int i = 0; i < 4; i++)
+		bytes[offset + i] = (instr >> (8 * i)) & 0xFF;
+}
+
+int applyReloc(unsigned char * bytes, uint64_t offset, uint64_t kind, uint64_t site, uint64_t value) {
+	switch (kind) {
+		case RELOC_LD64: {
+			// xor, then addi/shftli pairs carrying the chunks from expandLd
+			uint64_t chunks[6] = {
+				(value >> 52) & 0xFFF, (value >> 40) & 0xFFF, (value >> 28) & 0xFFF,
+				(value >> 16) & 0xFFF, (value >> 4) & 0xFFF, value & 0xF,
+			};
+			for (int i = 0; i < 6; i++)
+				setLiteral(bytes, offset + 4 + 8 * i, chunks[i]);
+			return 0;
+		}
+		case RELOC_PCREL12: {
+			long long dist = (long long)(value - site);
+			if (dist < -2048 || dist > 2047) return -1;
+			setLiteral(bytes, offset, dist);
+			return 0;
+		}
+		case RELOC_ABS12:
+			if (value > 2047) return -1;
+			setLiteral(bytes, offset, value);
+			return 0;
+	}
+	return -1;
+}
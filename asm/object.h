@@ -0,0 +1,58 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+
+// Relocatable object written by hw5-asm --object and combined by hw5-ld.
+// Every field is a little-endian 64-bit word:
+//
+//   magic, version
+//   code size, data size, bss size, symbol count, relocation count
+//   code bytes, data bytes
+//   symbols: section, global flag, offset, name length, name bytes
+//   relocations: section, offset, kind, symbol index
+//
+// Sections are numbered like the .tko kinds: 1 code, 2 data, 3 bss, and
+// 0 marks an undefined (external) symbol. Symbol names have no ':'.
+#define OBJ_MAGIC 0x4a424f52454b4e54ULL // "TNKEROBJ"
+#define OBJ_VERSION 1
+
+#define OBJ_UNDEF 0
+
+// Relocation kinds, patched at the instruction at offset:
+#define RELOC_LD64 1    // the 12 instructions of an ld macro, full address
+#define RELOC_PCREL12 2 // brr, signed distance from the brr itself
+#define RELOC_ABS12 3   // 12-bit literal such as a memory offset, at most 2047
+
+typedef struct ObjSymbol {
+	char * name;
+	uint64_t section;
+	uint64_t global;
+	uint64_t offset;
+} ObjSymbol;
+
+typedef struct ObjReloc {
+	uint64_t section;
+	uint64_t offset;
+	uint64_t kind;
+	uint64_t symbol;
+} ObjReloc;
+
+typedef struct Object {
+	unsigned char * code;
+	unsigned char * data;
+	uint64_t codeSize, dataSize, bssSize;
+	ObjSymbol * symbols;
+	int numSymbols;
+	ObjReloc * relocs;
+	int numRelocs;
+} Object;
+
+void writeObject(FILE * file, Object * obj);
+
+// Returns null when the file is missing or not an object
+Object * readObject(char * filename);
+
+// Writes value into the instruction(s) at bytes + offset for a relocation
+// of the given kind; site is the final address of the patched instruction.
+// Returns 0, or -1 when the value does not fit the field.
+int applyReloc(unsigned char * bytes, uint64_t offset, uint64_t kind, uint64_t site, uint64_t value);
@@ -1,11 +1,15 @@
 #include "parse.h"
 #include "main.h"
+#include "asm.h"
+#include "lexer.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
 
 // FIXED: Properly trim leading and trailing whitespace
 char * trim(char * totrim) {
@@ -41,122 +45,358 @@ char * trim(char * totrim) {
     return ret;
 }
 
-static CommandType lookupCommand(const char *cmd) {
-    size_t n = sizeof(cmdTable) / sizeof(cmdTable[0]);
-    for (size_t i = 0; i < n; i++) {
-        if (strcmp(cmd, cmdTable[i].name) == 0)
-            return cmdTable[i].type;
-    }
-	fprintf(stderr, "unknown command %s\n", cmd);
-	exit(1);
+static CommandType lookupCommand(const char *cmd, int len) {
+	int type = lookupMnemonic(cmd, len);
+	if (type < 0) {
+		asmError("unknown command %.*s", len, cmd);
+	}
+	return type;
 }
 
 Entry * handleData(char * dataline, int address) {
-	Entry * ret = malloc(sizeof(Entry));
+	Entry * ret = calloc(1, sizeof(Entry));
 	ret->address = address;
 	ret->size = 8; 
 	ret->type = 1;
-	if (trim(dataline)[0] == '-') {
-		fprintf(stderr, "no negatives allowed\n");
-		exit(1);
+	if (dataline[0] == '-') {
+		asmError("no negatives allowed");
 	}
 	char * ptr;
 
+	errno = 0;
 	ret->value = strtoull(dataline, &ptr, 10);
 	if (*ptr != '\0' || ptr == dataline) {
-		fprintf(stderr, "invalid data\n");
-		exit(1);
+		asmError("invalid data");
 	}
 	if (errno == ERANGE) {
-		fprintf(stderr, "data exceeds maximum limit\n");
-		exit(1);
+		asmError("data exceeds maximum limit");
 	}
 	return ret;
 }
 
-Entry * handleCmd(char * line, int address) {
-	Entry * newEntry = malloc(sizeof(Entry));
-	char * cmd = extractCommandName(line);
-	char * args = extractArguments(line);
-	newEntry->str = args;
+// .space N reserves N zero bytes (rounded up to whole words) in the BSS section
+Entry * handleSpace(char * arg, int address) {
+	Entry * ret = calloc(1, sizeof(Entry));
+	ret->address = address;
+	ret->type = 5;
+	char * ptr;
+
+	errno = 0;
+	ret->value = strtoull(arg, &ptr, 0);
+	if (arg[0] == '-' || *ptr != '\0' || ptr == arg || errno == ERANGE) {
+		asmError("invalid .space size: %s", arg);
+	}
+	ret->value = (ret->value + 7) & ~7ULL;
+	ret->size = ret->value;
+	return ret;
+}
+
+// .global :Name, the label keeps its leading ':' like everywhere else
+Entry * handleGlobal(const char * name, int len) {
+	Entry * ret = calloc(1, sizeof(Entry));
+	ret->type = 6;
+	ret->lbl = malloc(len + 2);
+	sprintf(ret->lbl, "%s%.*s", name[0] == ':' ? "" : ":", len, name);
+	if (strlen(ret->lbl) < 2 || strpbrk(ret->lbl, " \t,()")) {
+		asmError("invalid .global name: %.*s", len, name);
+	}
+	return ret;
+}
+
+Entry * handleCmd(const LexLine * line, int address) {
+	Entry * newEntry = calloc(1, sizeof(Entry));
+	newEntry->str = strndup(line->rest, line->restLen);
 	newEntry->address = address;
-	newEntry->cmd.type = lookupCommand(cmd);
-	free(cmd);  // Free the command string since we don't need it anymore
+	newEntry->cmd.type = lookupCommand(line->word, line->wordLen);
 	return newEntry;
 }
 
-Script * getScript(char * filename) {
+#define MIN_CHUNK (1 << 16) // bytes of source per worker before another thread pays off
+#define MAX_WORKERS 64
+#define MODE_UNKNOWN -2      // chunk starts after a directive we have not seen yet
+#define DEFERRED 7           // tab line parsed once the chunk's starting mode is known
 
-	Script * ret = malloc(sizeof(Script));
-	FILE * file = fopen(filename, "r");
-	ltable * table = malloc(sizeof(ltable));
-	ret->ltable = table;
-	char line[5000];
+// A newline-aligned slice of the source, parsed by one worker
+typedef struct Chunk {
+	const char * begin;
+	const char * end;
+	Entry * entries;
+	int numEntries;
+	int cap;
+	int modeIn;  // mode in effect at the first line
+	int mode;    // while parsing
+	int modeOut; // mode after the last directive, MODE_UNKNOWN if there is none
+	int firstEntry;
+	uint64_t codeBase, dataBase, bssBase; // prefix sums over the earlier chunks
+	uint64_t codeBytes, dataBytes, bssBytes;
+	Entry * merged;
+	const char * src;
+	AsmTrap trap;
+	AsmTrap * errors; // one per bad line
+	int numErrors;
+} Chunk;
 
-	int numEntries = 0;
-	Entry * allEntries = malloc(50000 * sizeof(Entry));	
-
-	// first passthrough:
-	// 1: Create label table
-	// 2: Expand macros
-	// 3: create a sequential list of the instructions/data
-	// 4: return a script object that contains a list of all entries 
-	
-	// first passthrough, create label table and expand macros
-	int mode = -1; // 0 for code, 1 for data
-	int address = 0x1000;
-	
-	while (fgets(line, sizeof(line), file) != NULL) {
-		int val;
-		Entry * entry = NULL;
-		switch (line[0]) {
-			case '\t': // save either the data or instruction at the current address and increment counter
-				entry = malloc(sizeof(Entry));
-				if (mode) {
-					entry = handleData(trim(line), address);
-					address += 8;
-				} else {
-					entry = handleCmd(trim(line), address);
-					address += 4;
-				}
-				break;
-				
-			case ':': // save this label as the current address, but don't increment current counter
-				entry = malloc(sizeof(Entry));
-				char * label = trim(line);
-				for (int i = 0; i < strlen(label); i++)
-					if (label[i] == ' ') {
-						fprintf(stderr, "label is wrong: %s\n", label);
-						exit(1);
-					}
-				entry->size = 0;
-				entry->type = 2;
-				entry->lbl = label;
-				break;
+static void addEntry(Chunk * chunk, Entry * entry) {
+	if (chunk->numEntries == chunk->cap) {
+		chunk->cap = chunk->cap ? 2 * chunk->cap : 256;
+		chunk->entries = realloc(chunk->entries, chunk->cap * sizeof(Entry));
+	}
+	chunk->entries[chunk->numEntries++] = *entry;
+	free(entry);
+}
+
+// copies a literal out of the source so strtoull stops at its end
+static char * literal(char * buf, int cap, const char * s, int len) {
+	if (len >= cap) len = cap - 1; // longer than any valid literal, still rejected
+	memcpy(buf, s, len);
+	buf[len] = '\0';
+	return buf;
+}
+
+// a tab line in code (mode 0) or data (any other mode, -1 included, as before)
+static Entry * handleItem(const LexLine * line, int mode) {
+	char buf[64];
+	if (mode && line->wordLen == 6 && strncmp(line->word, ".space", 6) == 0)
+		return handleSpace(literal(buf, sizeof(buf), line->rest, line->restLen), 0);
+	if (mode) // the whole item, so "5 6" is still invalid data
+		return handleData(literal(buf, sizeof(buf), line->word, line->rest + line->restLen - line->word), 0);
+	return handleCmd(line, 0);
+}
+
+static void parseLine(Chunk * chunk, const LexLine * line, int * mode) {
+	Entry * entry = NULL;
+	switch (line->kind) {
+		case LEX_BLANK:
+			break;
 
-			case '.': // switch modes
-				if (line[1] == 'd') mode = 1;
-				else mode = 0;
-				entry = malloc(sizeof(Entry));
-				entry->type = 3 + mode; // 3 for code, 4 for data
+		case LEX_ITEM: // an instruction or data word, depending on the mode
+			if (*mode == MODE_UNKNOWN) { // kept as text and lexed again later
+				entry = calloc(1, sizeof(Entry));
+				entry->type = DEFERRED;
+				int len = line->rest + line->restLen - line->word;
+				entry->str = malloc(len + 2);
+				sprintf(entry->str, "\t%.*s", len, line->word);
+			} else entry = handleItem(line, *mode);
+			break;
+
+		case LEX_LABEL: // save this label, its address is filled in later
+			if (line->restLen) {
+				asmError("label is wrong: %.*s",
+						(int)(line->rest + line->restLen - line->word), line->word);
+			}
+			entry = calloc(1, sizeof(Entry));
+			entry->size = 0;
+			entry->type = 2;
+			entry->lbl = strndup(line->word, line->wordLen);
+			break;
+
+		case LEX_DIRECTIVE: // switch modes
+			if (line->wordLen == 7 && strncmp(line->word, ".global", 7) == 0) { // export a label to the linker
+				entry = handleGlobal(line->rest, line->restLen);
 				break;
+			}
+			*mode = line->word[1] == 'd' ? 1 : 0;
+			chunk->modeOut = *mode;
+			entry = calloc(1, sizeof(Entry));
+			entry->type = 3 + *mode; // 3 for code, 4 for data
+			break;
+	}
+	if (entry) {
+		entry->srcOffset = line->word - chunk->src;
+		addEntry(chunk, entry);
+	}
+}
+
+static void addError(Chunk * chunk, const AsmTrap * trap) {
+	chunk->errors = realloc(chunk->errors, (chunk->numErrors + 1) * sizeof(AsmTrap));
+	chunk->errors[chunk->numErrors++] = *trap;
+}
+
+// first pass: lex the chunk in place and parse each line, recording an
+// error per bad line and going on with the next
+static void * parseChunk(void * arg) {
+	Chunk * chunk = arg;
+	chunk->mode = chunk->modeIn;
+	LexLine line;
+	AsmTrap * outer = asmTrap; // chunk 0 runs on the calling thread
+	asmTrap = &chunk->trap;
+	const char * volatile at = chunk->begin;
+	if (setjmp(chunk->trap.jump)) {
+		addError(chunk, &chunk->trap);
+		if (chunk->numErrors == ASM_MAX_DIAGS) at = chunk->end;
+	}
+
+	while (at < chunk->end) {
+		chunk->trap.offset = at - chunk->src;
+		at = lexLine(at, chunk->end, &line);
+		if (line.word) chunk->trap.offset = line.word - chunk->src;
+		parseLine(chunk, &line, &chunk->mode);
+	}
+	asmTrap = outer;
+	return NULL;
+}
+
+// second pass: copy into the merged list and assign segment offsets
+static void * placeChunk(void * arg) {
+	Chunk * chunk = arg;
+	uint64_t code = chunk->codeBase, data = chunk->dataBase, bss = chunk->bssBase;
+	for (int i = 0; i < chunk->numEntries; i++) {
+		Entry * entry = &chunk->entries[i];
+		if (entry->type == 0) {
+			entry->address = code;
+			code += 4 * cmdTable[entry->cmd.type].cnt;
+		} else if (entry->type == 1) {
+			entry->address = data;
+			data += 8;
+		} else if (entry->type == 5) {
+			entry->address = bss;
+			bss += entry->value;
 		}
+	}
+	memcpy(chunk->merged + chunk->firstEntry, chunk->entries, chunk->numEntries * sizeof(Entry));
+	free(chunk->entries);
+	return NULL;
+}
 
+static void runChunks(void * (*work)(void *), Chunk * chunks, int n) {
+	pthread_t threads[MAX_WORKERS];
+	for (int i = 1; i < n; i++)
+		pthread_create(&threads[i], NULL, work, &chunks[i]);
+	work(&chunks[0]);
+	for (int i = 1; i < n; i++)
+		pthread_join(threads[i], NULL);
+}
 
-		if (entry) allEntries[numEntries++] = *entry;
+// carries the mode across chunks and parses the deferred lines in it, with
+// an error per bad line as in parseChunk, kept with the chunk's own errors
+static void finishDeferred(Chunk * chunks, int n) {
+	AsmTrap trap;
+	AsmTrap * outer = asmTrap;
+	asmTrap = &trap;
+	volatile int mode = -1;
+	volatile int i = 0, j = 0;
+	if (setjmp(trap.jump)) {
+		addError(&chunks[i], &trap);
+		j++;
+	}
+	for (; i < n; i++, j = 0) {
+		Chunk * chunk = &chunks[i];
+		for (; j < chunk->numEntries; j++) {
+			Entry * entry = &chunk->entries[j];
+			if (entry->type == 3 || entry->type == 4) break;
+			if (entry->type != DEFERRED) continue;
+			LexLine line;
+			char * text = entry->str;
+			long offset = entry->srcOffset;
+			trap.offset = offset;
+			lexLine(text, text + strlen(text), &line);
+			Entry * parsed = handleItem(&line, mode);
+			*entry = *parsed;
+			entry->srcOffset = offset;
+			free(parsed);
+			free(text);
+		}
+		if (chunk->modeOut != MODE_UNKNOWN) mode = chunk->modeOut;
 	}
+	asmTrap = outer;
+}
 
-	Entry * orderedEntries = malloc(numEntries * sizeof(Entry));
-	for (int i = 0; i < numEntries; i++)
-		orderedEntries[i] = allEntries[i];
+static int byOffset(const void * a, const void * b) {
+	long x = ((const AsmTrap *)a)->offset, y = ((const AsmTrap *)b)->offset;
+	return (x > y) - (x < y);
+}
 
-	ret->numEntries = numEntries;
-	ret->entries = orderedEntries;
+// Parses newline-aligned chunks of the source in parallel. A chunk only
+// learns which mode (.code or .data) it starts in once the chunks before
+// it are parsed, so tab lines ahead of its first directive are parsed
+// afterwards. Entry addresses are offsets into their segment (code, data
+// or bss), from a prefix sum over the chunk sizes.
+Script * getScript(const char * src, size_t size, int threads) {
+	int n = threads;
+	if (n <= 0) { // sysconf reads /sys, not worth it for the callers that say
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n = size / MIN_CHUNK + 1;
+		if (n > cpus) n = cpus > 0 ? cpus : 1;
+	}
+	if (n > MAX_WORKERS) n = MAX_WORKERS;
 
-	
-	fclose(file);
+	Chunk chunks[MAX_WORKERS];
+	memset(chunks, 0, sizeof(chunks));
+	const char * at = src;
+	for (int i = 0; i < n; i++) {
+		const char * end = src + size * (i + 1) / n;
+		while (end < src + size && end > at && end[-1] != '\n') end++;
+		chunks[i].begin = at;
+		chunks[i].end = end < at ? at : end;
+		chunks[i].modeIn = i == 0 ? -1 : MODE_UNKNOWN;
+		chunks[i].modeOut = MODE_UNKNOWN;
+		chunks[i].src = src;
+		at = chunks[i].end;
+	}
+	runChunks(parseChunk, chunks, n);
+	finishDeferred(chunks, n);
+
+	// in source order, as one chunk would have found them
+	int failed = 0;
+	for (int i = 0; i < n; i++) {
+		qsort(chunks[i].errors, chunks[i].numErrors, sizeof(AsmTrap), byOffset);
+		for (int j = 0; j < chunks[i].numErrors; j++)
+			asmDiag(&chunks[i].errors[j]);
+		failed |= chunks[i].numErrors;
+		free(chunks[i].errors);
+	}
+	if (failed) {
+		for (int i = 0; i < n; i++) {
+			for (int j = 0; j < chunks[i].numEntries; j++) {
+				free(chunks[i].entries[j].str);
+				free(chunks[i].entries[j].lbl);
+			}
+			free(chunks[i].entries);
+		}
+		return NULL;
+	}
+
+	Script * ret = calloc(1, sizeof(Script));
+	ret->ltable = calloc(1, sizeof(ltable));
+
+	// sum up sizes
+	int numEntries = 0;
+	for (int i = 0; i < n; i++) {
+		Chunk * chunk = &chunks[i];
+		for (int j = 0; j < chunk->numEntries; j++) {
+			Entry * entry = &chunk->entries[j];
+			if (entry->type == 0) chunk->codeBytes += 4 * cmdTable[entry->cmd.type].cnt;
+			else if (entry->type == 1) chunk->dataBytes += 8;
+			else if (entry->type == 5) chunk->bssBytes += entry->value;
+		}
+		chunk->firstEntry = numEntries;
+		chunk->codeBase = ret->codeSize;
+		chunk->dataBase = ret->dataSize;
+		chunk->bssBase = ret->bssSize;
+		numEntries += chunk->numEntries;
+		ret->codeSize += chunk->codeBytes;
+		ret->dataSize += chunk->dataBytes;
+		ret->bssSize += chunk->bssBytes;
+	}
+
+	ret->entries = malloc((numEntries + 1) * sizeof(Entry));
+	ret->numEntries = numEntries;
+	for (int i = 0; i < n; i++)
+		chunks[i].merged = ret->entries;
+	runChunks(placeChunk, chunks, n);
 	return ret;
 }
 
+void freeScript(Script * script) {
+	for (int i = 0; i < script->numEntries; i++) {
+		free(script->entries[i].str);
+		free(script->entries[i].lbl);
+	}
+	free(script->entries);
+	freeLabelTable(script->ltable);
+	free(script->ltable);
+	free(script);
+}
+
 void printScript(Script * script, char * outputFile) { // prints to a new file the parsed assembly code with macros expanded and labels replaced 
 };
@@ -37,6 +37,22 @@ typedef enum CommandType {
 	SUBF,
 	MULF,
 	DIVF,
+// VECTOR (opcode 0x1e, operation in the literal field)
+	VADD,
+	VSUB,
+	VMUL,
+	VDIV,
+	VADDF,
+	VSUBF,
+	VMULF,
+	VDIVF,
+	VFMA,
+	VFMAF,
+	VSPLAT,
+	VSUM,
+	VSUMF,
+	VLD,
+	VST,
 // MACROS
 	IN,
 	OUT,
@@ -44,6 +60,18 @@ typedef enum CommandType {
 	LD,
 	PUSH,
 	POP,
+	INN,
+	OUTN,
+	OUTS,
+	MEMCPY,
+	MEMSET,
+	MALLOC,
+	FREE,
+	REALLOC,
+	ICOUNT,
+	CLOCK,
+	REGION,
+	ENDREGION,
 // data
 	DATA,
 	HALT,
@@ -55,6 +83,8 @@ struct Command {
 	CommandType type;
 };
 
+// Entry types: 0 instruction, 1 data word, 2 label, 3 .code, 4 .data,
+// 5 .space reservation (value holds the byte count), 6 .global (lbl holds the name)
 struct Entry {
 	unsigned long long value;
 	int address;
@@ -65,6 +95,7 @@ struct Entry {
 	char * str;
 	char * lbl;
 	Command cmd;
+	long srcOffset; // where the line starts in the source, for diagnostics
 };
 
 struct Script {
@@ -72,6 +103,7 @@ struct Script {
 	ltable * ltable;
 	int numEntries;
 	int byteSize;
+	uint64_t codeSize, dataSize, bssSize; // bytes in each segment
 };
 
 typedef struct {
@@ -81,6 +113,7 @@ typedef struct {
 	int opcode;
 	int arglenth;
 	int hasLit;
+	int subop;
 } CmdMap;
 
 static CmdMap cmdTable[] = {
@@ -110,14 +143,44 @@ static CmdMap cmdTable[] = {
 	{"subf", SUBF, 1, 0x15, 3, 0},
     {"mulf", MULF, 1, 0x16, 3, 0}, 
 	{"divf", DIVF, 1, 0x17, 3, 0},
+    {"vadd", VADD, 1, 0x1e, 3, 0, 0x0},
+	{"vsub", VSUB, 1, 0x1e, 3, 0, 0x1},
+    {"vmul", VMUL, 1, 0x1e, 3, 0, 0x2},
+	{"vdiv", VDIV, 1, 0x1e, 3, 0, 0x3},
+    {"vaddf", VADDF, 1, 0x1e, 3, 0, 0x4},
+	{"vsubf", VSUBF, 1, 0x1e, 3, 0, 0x5},
+    {"vmulf", VMULF, 1, 0x1e, 3, 0, 0x6},
+	{"vdivf", VDIVF, 1, 0x1e, 3, 0, 0x7},
+    {"vfma", VFMA, 1, 0x1e, 3, 0, 0x8},
+	{"vfmaf", VFMAF, 1, 0x1e, 3, 0, 0x9},
+    {"vsplat", VSPLAT, 1, 0x1e, 2, 0, 0xa},
+	{"vsum", VSUM, 1, 0x1e, 2, 0, 0xb},
+    {"vsumf", VSUMF, 1, 0x1e, 2, 0, 0xc},
+	{"vld", VLD, 1, 0x1e, 2, 0, 0xd},
+    {"vst", VST, 1, 0x1e, 2, 0, 0xe},
     {"in", IN, 1, -1},
 	{"out", OUT, 1, -1},
     {"clr", CLR, 1, -1}, 
 	{"ld", LD, 12, -1},
     {"push", PUSH, 2, -1}, 
 	{"pop", POP, 2, -1},
+    {"inn", INN, 1, -1},
+	{"outn", OUTN, 1, -1},
+    {"outs", OUTS, 1, -1},
+	{"memcpy", MEMCPY, 1, -1},
+    {"memset", MEMSET, 1, -1},
+	{"malloc", MALLOC, 1, -1},
+    {"free", FREE, 1, -1},
+	{"realloc", REALLOC, 1, -1},
+    {"icount", ICOUNT, 1, -1},
+	{"clock", CLOCK, 1, -1},
+    {"region", REGION, 1, -1},
+	{"endregion", ENDREGION, 1, -1},
     {"data", DATA, 1, -1},
 	{"halt", HALT, 1, -1}
 };
 
-Script * getScript(char * filename);
+// Parses size bytes of source on the given number of threads (0 picks
+// from the size). Returns null after recording the errors.
+Script * getScript(const char * src, size_t size, int threads);
+void freeScript(Script * script);
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <pthread.h>
 
 // Include all headers
 #include "argparse.h"
@@ -10,6 +11,10 @@
 #include "macro.h"
 #include "parse.h"
 #include "encode.h"
+#include "tko.h"
+#include "object.h"
+#include "lexer.h"
+#include "asm.h"
 
 // Forward declarations for functions not in headers
 int isLiteralArg(char * arg);
@@ -321,41 +326,56 @@ TEST(extractArguments_no_args) {
 // ============ LABLETABLE TESTS ============
 
 TEST(insertLabel_single) {
-    ltable table;
-    table.count = 0;
+    ltable table = {0};
     insertLabel((char *)"start", 0x1000, &table);
     assert_equal_int(table.count, 1, "insert single label");
+    freeLabelTable(&table);
 }
 
 TEST(insertLabel_multiple) {
-    ltable table;
-    table.count = 0;
+    ltable table = {0};
     insertLabel((char *)"start", 0x1000, &table);
     insertLabel((char *)"loop", 0x2000, &table);
     insertLabel((char *)"end", 0x3000, &table);
     assert_equal_int(table.count, 3, "insert multiple labels");
+    freeLabelTable(&table);
 }
 
 TEST(getintAddress_exists) {
-    ltable table;
-    table.count = 0;
+    ltable table = {0};
     insertLabel((char *)"target", 0x5000, &table);
     uint64_t addr = getintAddress((char *)"target", &table);
     assert_equal_ull(addr, 0x5000, "retrieve existing label address");
+    freeLabelTable(&table);
 }
 
 TEST(insertLabel_name_preserved) {
-    ltable table;
-    table.count = 0;
+    ltable table = {0};
     insertLabel((char *)"myLabel", 0x1234, &table);
     assert_equal_str(table.labels[0], "myLabel", "label name preserved");
+    freeLabelTable(&table);
 }
 
 TEST(insertLabel_address_preserved) {
-    ltable table;
-    table.count = 0;
+    ltable table = {0};
     insertLabel((char *)"test", 0x1234, &table);
     assert_equal_ull(table.addresses[0], 0x1234, "label address preserved");
+    freeLabelTable(&table);
+}
+
+TEST(insertLabel_many) {
+    ltable table = {0};
+    char name[32];
+    for (int i = 0; i < 300000; i++) {
+        sprintf(name, ":L%d", i);
+        insertLabel(name, 8 * i, &table);
+    }
+    insertLabel((char *)":L7", 1, &table);
+    assert_equal_int(table.count, 300001, "no limit on the number of labels");
+    assert_equal_ull(getintAddress((char *)":L123456", &table), 8 * 123456, "find a label among many");
+    assert_equal_ull(getintAddress((char *)":L7", &table), 56, "a repeated name finds the first");
+    assert_equal_int(findLabel(":L300000", &table), -1, "missing label");
+    freeLabelTable(&table);
 }
 
 // ============ ENCODE TESTS ============
@@ -429,6 +449,230 @@ TEST(build_instruction_opcode) {
     assert_equal_int(opcode, 0x1F, "build instruction preserves opcode");
 }
 
+TEST(getInstruction_vector) {
+    Entry entry;
+    entry.cmd.type = VFMAF;
+    entry.str = strdup("v1, v2, v3");
+    uint32_t instr = getInstruction(&entry);
+    assert_equal_int((instr >> 27) & 0x1F, 0x1e, "vector opcode");
+    assert_equal_int((instr >> 22) & 0x1F, 1, "vector rd");
+    assert_equal_int((instr >> 17) & 0x1F, 2, "vector rs");
+    assert_equal_int((instr >> 12) & 0x1F, 3, "vector rt");
+    assert_equal_int(instr & 0xFFF, 0x9, "vector operation in literal");
+}
+
+TEST(getInstruction_vector_store) {
+    Entry entry;
+    entry.cmd.type = VST;
+    entry.str = strdup("(r7), v4");
+    uint32_t instr = getInstruction(&entry);
+    assert_equal_int((instr >> 22) & 0x1F, 7, "vst address register");
+    assert_equal_int((instr >> 17) & 0x1F, 4, "vst source vector");
+    assert_equal_int(instr & 0xFFF, 0xe, "vst operation");
+}
+
+TEST(lzCompress_zero_run) {
+    unsigned char in[4096] = {0};
+    unsigned char out[4200];
+    size_t n = lzCompress(in, sizeof(in), out);
+    assert_true(n < 128, "zero run compresses to a few tokens");
+    assert_equal_int(out[0], 0, "first token is a single literal");
+    assert_equal_int(out[2], 0xff, "longest match token");
+    assert_equal_int(out[3], 1, "match distance low byte");
+}
+
+TEST(lzCompress_incompressible) {
+    unsigned char in[200], out[300];
+    for (int i = 0; i < 200; i++) in[i] = (i * 97 + 13) & 0xFF;
+    size_t n = lzCompress(in, sizeof(in), out);
+    assert_true(n <= lzBound(sizeof(in)), "output stays within lzBound");
+    assert_equal_int(out[0], 0x7f, "literal run capped at 128 bytes");
+}
+
+TEST(applyReloc_pcrel) {
+    unsigned char code[4] = {0};
+    uint32_t brr = build_instruction(0xa, 0, 0, 0, 0);
+    memcpy(code, &brr, 4);
+    assert_equal_int(applyReloc(code, 0, RELOC_PCREL12, 0x2100, 0x2000), 0, "backward branch fits");
+    uint32_t instr;
+    memcpy(&instr, code, 4);
+    assert_equal_int(instr & 0xFFF, 0xF00, "distance -256 in the literal");
+    assert_equal_int(instr >> 27, 0xa, "opcode untouched");
+    assert_equal_int(applyReloc(code, 0, RELOC_PCREL12, 0x2000, 0x3000), -1, "far branch rejected");
+}
+
+TEST(applyReloc_ld64) {
+    unsigned char code[48] = {0};
+    assert_equal_int(applyReloc(code, 0, RELOC_LD64, 0x2000, 0x123456789ULL), 0, "ld accepts any address");
+    uint32_t last, first;
+    memcpy(&first, code + 4, 4);
+    memcpy(&last, code + 44, 4);
+    assert_equal_int(first & 0xFFF, 0, "top chunk");
+    assert_equal_int(last & 0xFFF, 0x9, "low 4 bits in the last addi");
+}
+
+// ============ LEXER TESTS ============
+
+TEST(lookupMnemonic_all) {
+    int n = sizeof(cmdTable) / sizeof(cmdTable[0]);
+    int ok = 1;
+    for (int i = 0; i < n; i++)
+        if (lookupMnemonic(cmdTable[i].name, strlen(cmdTable[i].name)) != (int)cmdTable[i].type) ok = 0;
+    assert_true(ok, "every cmdTable name hashes to itself");
+    assert_equal_int(lookupMnemonic("addx", 4), -1, "reject unknown mnemonic");
+    assert_equal_int(lookupMnemonic("addi", 3), ADD, "length bounds the name");
+}
+
+TEST(lexFindDelim_long_line) {
+    char line[100];
+    memset(line, 'a', sizeof(line));
+    line[70] = ';';
+    assert_equal_int(lexFindDelim(line, line + 100) - line, 70, "find past the first blocks");
+    assert_equal_int(lexFindDelim(line, line + 60) - line, 60, "end when there is none");
+    assert_equal_int(lexFindEnd(line, line + 100) - line, 70, "';' ends the line");
+}
+
+TEST(lexLine_item) {
+    const char *src = "\tadd  r1, r2, r3 ; sum\n:L1\n";
+    LexLine line;
+    const char *next = lexLine(src, src + strlen(src), &line);
+    assert_equal_int(line.kind, LEX_ITEM, "tab line is an item");
+    assert_true(line.wordLen == 3 && strncmp(line.word, "add", 3) == 0, "mnemonic");
+    assert_true(line.restLen == 10 && strncmp(line.rest, "r1, r2, r3", 10) == 0, "arguments without the comment");
+    lexLine(next, src + strlen(src), &line);
+    assert_true(line.kind == LEX_LABEL && line.wordLen == 3, "next line is the label");
+}
+
+TEST(lexRegister_bounds) {
+    assert_equal_int(lexRegister("r31", 3, 'r'), 31, "r31");
+    assert_equal_int(lexRegister("v7", 2, 'v'), 7, "v7");
+    assert_equal_int(lexRegister("r32", 3, 'r'), -1, "r32 out of range");
+    assert_equal_int(lexRegister("r1x", 3, 'r'), -1, "trailing junk");
+}
+
+// ============ LIBRARY TESTS ============
+
+TEST(assemble_buffer) {
+    const char *src = ".code\n\taddi r1, 5\n\tld r2, :Word\n.data\n:Word\n\t7\n";
+    AsmOptions options = {0};
+    AsmResult result;
+    assert_equal_int(assemble(src, strlen(src), &options, &result), 0, "assemble from memory");
+    assert_true(result.size > 8 && memcmp(result.bytes, "TNKERTKO", 8) == 0, "image starts with the .tko magic");
+    assert_equal_ull(result.codeSize, 4 * 13, "addi plus the ld expansion");
+    assert_equal_ull(result.dataSize, 8, "one data word");
+    freeAsmResult(&result);
+}
+
+TEST(assemble_diagnostics) {
+    const char *src = ".code\n\tadd r1, r2, r3\n\tfoo r1\n";
+    AsmOptions options = {0};
+    AsmResult result;
+    assert_equal_int(assemble(src, strlen(src), &options, &result), -1, "unknown mnemonic fails");
+    assert_equal_int(result.numDiags, 1, "one diagnostic");
+    assert_equal_int(result.diags[0].line, 3, "diagnostic line");
+    assert_equal_int(result.diags[0].column, 2, "diagnostic column");
+    assert_true(strstr(result.diags[0].message, "foo") != NULL, "message names the mnemonic");
+    freeAsmResult(&result);
+
+    src = ".code\n\tbrr :Nowhere\n";
+    assert_equal_int(assemble(src, strlen(src), &options, &result), -1, "missing label fails");
+    assert_equal_int(result.diags[0].line, 2, "label error line");
+    freeAsmResult(&result);
+
+    // once crashed the encoder, found by fuzz-assemble
+    src = ".code\n\tmov (r8)(0ts\n";
+    assert_equal_int(assemble(src, strlen(src), &options, &result), -1, "mov with one operand fails");
+    freeAsmResult(&result);
+    src = ".code\n\tld, 5\n";
+    assert_equal_int(assemble(src, strlen(src), &options, &result), -1, "ld without a register fails");
+    freeAsmResult(&result);
+    src = ".code\n\tmov 5, r1\n";
+    assert_equal_int(assemble(src, strlen(src), &options, &result), -1, "mov to a literal fails");
+    freeAsmResult(&result);
+
+    // one diagnostic per bad line, pointing at the operand at fault
+    src = ".code\n\tadd r1, r2, r99\n\tsub r1, r1, r1\n\taddi r10, 5000\n";
+    assert_equal_int(assemble(src, strlen(src), &options, &result), -1, "bad operands fail");
+    assert_equal_int(result.numDiags, 2, "one diagnostic per bad instruction");
+    assert_equal_int(result.diags[0].line, 2, "bad register line");
+    assert_equal_int(result.diags[0].column, 14, "bad register column");
+    assert_equal_int(result.diags[1].line, 4, "bad literal line");
+    assert_equal_int(result.diags[1].column, 12, "bad literal column");
+    freeAsmResult(&result);
+    src = ".code\n\tfoo\n\tadd r1, r2, r3\n\tbar r1\n";
+    assert_equal_int(assemble(src, strlen(src), &options, &result), -1, "unknown mnemonics fail");
+    assert_equal_int(result.numDiags, 2, "both unknown mnemonics reported");
+    assert_equal_int(result.diags[1].line, 4, "second mnemonic line");
+    freeAsmResult(&result);
+}
+
+TEST(assemble_line_records) {
+    const char *src = ".code\n:Start\n\tld r2, 7\n\n\tpush r2\n\thalt\n";
+    AsmOptions options = {0};
+    options.symbols = options.listing = 1;
+    AsmResult result;
+    assert_equal_int(assemble(src, strlen(src), &options, &result), 0, "assemble with a map and listing");
+    assert_true(result.map && strstr(result.map, "code 0x2000 Start\n") != NULL, "map has the label");
+    assert_true(strstr(result.map, "line 0x2000 3 ld 12\nline 0x2030 5 push 2\nline 0x2038 6 halt 1\n") != NULL,
+                "one line record per instruction as written");
+    assert_true(result.listing && strstr(result.listing, "00002030  ") != NULL &&
+                strstr(result.listing, "5  push r2\n") != NULL, "listing shows the source line");
+    freeAsmResult(&result);
+}
+
+// a mix of every operand form, repeated so threads overlap in the parser
+static const char *threadLines =
+    "\tadd r1, r2, r3\n\tsub r4, r5, r6\n\taddi r7, 12\n\tshftli r8, 3\n"
+    "\tmov r9, (r10)(8)\n\tmov (r11)(16), r12\n\tmov r13, r14\n\tmov r15, 99\n\tld r16, :Word\n"
+    "\tvadd v1, v2, v3\n\tvsplat v4, r17\n\tvld v5, (r18)\n\tvst (r19), v6\n\tpriv r20, r21, r22, 3\n"
+    "\tbrgt r23, r24, r25\n\tpush r26\n\tpop r27\n\tld r28, :Top\n\tbr r28\n";
+
+typedef struct ThreadRun {
+    const char *src;
+    const AsmResult *expected;
+    int mismatches;
+} ThreadRun;
+
+static void *assembleRepeatedly(void *arg) {
+    ThreadRun *run = arg;
+    AsmOptions options = {0};
+    options.threads = 1;
+    for (int i = 0; i < 200; i++) {
+        AsmResult result;
+        if (assemble(run->src, strlen(run->src), &options, &result) != 0 || result.size != run->expected->size ||
+            memcmp(result.bytes, run->expected->bytes, result.size) != 0)
+            run->mismatches++;
+        freeAsmResult(&result);
+    }
+    return NULL;
+}
+
+TEST(assemble_threads) {
+    char *src = malloc(40 * strlen(threadLines) + 64);
+    strcpy(src, ".code\n:Top\n");
+    for (int i = 0; i < 40; i++) strcat(src, threadLines);
+    strcat(src, ".data\n:Word\n\t42\n");
+
+    AsmOptions options = {0};
+    AsmResult expected;
+    assert_equal_int(assemble(src, strlen(src), &options, &expected), 0, "assemble on one thread");
+
+    pthread_t threads[8];
+    ThreadRun runs[8];
+    for (int i = 0; i < 8; i++) {
+        runs[i] = (ThreadRun){src, &expected, 0};
+        pthread_create(&threads[i], NULL, assembleRepeatedly, &runs[i]);
+    }
+    int mismatches = 0;
+    for (int i = 0; i < 8; i++) {
+        pthread_join(threads[i], NULL);
+        mismatches += runs[i].mismatches;
+    }
+    assert_equal_int(mismatches, 0, "images built on 8 threads match the one built alone");
+    freeAsmResult(&expected);
+    free(src);
+}
+
 // ============ MACRO TESTS ============
 
 TEST(isMacro_clr) {
@@ -456,6 +700,59 @@ TEST(isMacro_non_macro) {
     assert_false(result, "reject ADD as non-macro");
 }
 
+TEST(isMacro_block) {
+    assert_true(isMacro(INN) && isMacro(OUTN) && isMacro(OUTS), "identify block I/O as macros");
+    assert_true(isMacro(MEMCPY) && isMacro(MEMSET), "identify bulk memory as macros");
+}
+
+TEST(expand_block_priv) {
+    const char *macros = ".code\n\tinn r1, r2\n\touts r3, r4\n\tmemset r5, r6, r7\n";
+    const char *privs = ".code\n\tpriv r1, r2, r0, 5\n\tpriv r3, r4, r0, 7\n\tpriv r5, r6, r7, 9\n";
+    AsmOptions options = {0};
+    AsmResult a, b;
+    assert_equal_int(assemble(macros, strlen(macros), &options, &a), 0, "assemble the macros");
+    assert_equal_int(assemble(privs, strlen(privs), &options, &b), 0, "assemble the privs");
+    assert_true(a.size == b.size && memcmp(a.bytes, b.bytes, a.size) == 0, "one priv per macro");
+    freeAsmResult(&a);
+    freeAsmResult(&b);
+
+    const char *missing = ".code\n\tmemcpy r1, r2\n";
+    assert_equal_int(assemble(missing, strlen(missing), &options, &a), -1, "memcpy needs three registers");
+    freeAsmResult(&a);
+}
+
+TEST(expand_heap_priv) {
+    assert_true(isMacro(MALLOC) && isMacro(FREE) && isMacro(REALLOC), "identify heap services as macros");
+    const char *macros = ".code\n\tmalloc r1, r2\n\tfree r3\n\trealloc r4, r5, r6\n";
+    const char *privs = ".code\n\tpriv r1, r2, r0, 10\n\tpriv r3, r0, r0, 11\n\tpriv r4, r5, r6, 12\n";
+    AsmOptions options = {0};
+    AsmResult a, b;
+    assert_equal_int(assemble(macros, strlen(macros), &options, &a), 0, "assemble the macros");
+    assert_equal_int(assemble(privs, strlen(privs), &options, &b), 0, "assemble the privs");
+    assert_true(a.size == b.size && memcmp(a.bytes, b.bytes, a.size) == 0, "one priv per macro");
+    freeAsmResult(&a);
+    freeAsmResult(&b);
+}
+
+TEST(expand_timing_priv) {
+    assert_true(isMacro(ICOUNT) && isMacro(CLOCK) && isMacro(REGION) && isMacro(ENDREGION),
+                "identify timing services as macros");
+    const char *macros = ".code\n\ticount r1\n\tclock r2\n\tregion r3\n\tendregion r3\n";
+    const char *privs = ".code\n\tpriv r1, r0, r0, 13\n\tpriv r2, r0, r0, 14\n\tpriv r3, r0, r0, 15\n"
+                        "\tpriv r3, r0, r0, 16\n";
+    AsmOptions options = {0};
+    AsmResult a, b;
+    assert_equal_int(assemble(macros, strlen(macros), &options, &a), 0, "assemble the macros");
+    assert_equal_int(assemble(privs, strlen(privs), &options, &b), 0, "assemble the privs");
+    assert_true(a.size == b.size && memcmp(a.bytes, b.bytes, a.size) == 0, "one priv per macro");
+    freeAsmResult(&a);
+    freeAsmResult(&b);
+
+    const char *missing = ".code\n\tclock\n";
+    assert_equal_int(assemble(missing, strlen(missing), &options, &a), -1, "clock needs a register");
+    freeAsmResult(&a);
+}
+
 TEST(isLabelReference_true) {
     char *str = malloc(20);
     strcpy(str, ":myLabel");
@@ -560,6 +857,7 @@ int main() {
     RUN_TEST(getintAddress_exists);
     RUN_TEST(insertLabel_name_preserved);
     RUN_TEST(insertLabel_address_preserved);
+    RUN_TEST(insertLabel_many);
     
     // Run encode tests
     printf(YELLOW "\nEncode Tests:\n" RESET);
@@ -572,6 +870,26 @@ int main() {
     RUN_TEST(isParArg_register);
     RUN_TEST(build_instruction_basic);
     RUN_TEST(build_instruction_opcode);
+    RUN_TEST(getInstruction_vector);
+    RUN_TEST(getInstruction_vector_store);
+    RUN_TEST(lzCompress_zero_run);
+    RUN_TEST(lzCompress_incompressible);
+    RUN_TEST(applyReloc_pcrel);
+    RUN_TEST(applyReloc_ld64);
+
+    // Run lexer tests
+    printf(YELLOW "\nLexer Tests:\n" RESET);
+    RUN_TEST(lookupMnemonic_all);
+    RUN_TEST(lexFindDelim_long_line);
+    RUN_TEST(lexLine_item);
+    RUN_TEST(lexRegister_bounds);
+
+    // Run library tests
+    printf(YELLOW "\nLibrary Tests:\n" RESET);
+    RUN_TEST(assemble_buffer);
+    RUN_TEST(assemble_diagnostics);
+    RUN_TEST(assemble_line_records);
+    RUN_TEST(assemble_threads);
     
     // Run macro tests
     printf(YELLOW "\nMacro Tests:\n" RESET);
@@ -580,6 +898,10 @@ int main() {
     RUN_TEST(isMacro_push);
     RUN_TEST(isMacro_pop);
     RUN_TEST(isMacro_non_macro);
+    RUN_TEST(isMacro_block);
+    RUN_TEST(expand_block_priv);
+    RUN_TEST(expand_heap_priv);
+    RUN_TEST(expand_timing_priv);
     RUN_TEST(isLabelReference_true);
     RUN_TEST(isLabelReference_false);
     RUN_TEST(isLabelReference_empty);
@@ -0,0 +1,105 @@
+#include "tko.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_MAX_DISTANCE 0xffff
+#define LZ_HASH_BITS 12
+
+static void putWord(FILE * file, uint64_t v) {
+	unsigned char b[8];
+	for (int i = 0; i < 8; i++)
+		b[i] = (v >> (8 * i)) & 0xFF;
+	fwrite(b, 1, 8, file);
+}
+
+size_t lzBound(size_t len) {
+	return len + len / LZ_MAX_LITERALS + 1;
+}
+
+static size_t flushLiterals(const unsigned char * in, size_t from, size_t to, unsigned char * out, size_t op) {
+	while (from < to) {
+		size_t run = to - from;
+		if (run > LZ_MAX_LITERALS) run = LZ_MAX_LITERALS;
+		out[op++] = run - 1;
+		memcpy(out + op, in + from, run);
+		op += run;
+		from += run;
+	}
+	return op;
+}
+
+size_t lzCompress(const unsigned char * in, size_t len, unsigned char * out) {
+	long table[1 << LZ_HASH_BITS];
+	for (int i = 0; i < (1 << LZ_HASH_BITS); i++)
+		table[i] = -1;
+
+	size_t ip = 0, op = 0, lit = 0;
+	while (ip + LZ_MIN_MATCH <= len) {
+		uint32_t seq;
+		memcpy(&seq, in + ip, 4);
+		uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+		long cand = table[h];
+		table[h] = ip;
+
+		if (cand < 0 || ip - cand > LZ_MAX_DISTANCE || memcmp(in + cand, in + ip, LZ_MIN_MATCH) != 0) {
+			ip++;
+			continue;
+		}
+
+		size_t m = LZ_MIN_MATCH;
+		while (ip + m < len && m < LZ_MAX_MATCH && in[cand + m] == in[ip + m])
+			m++;
+
+		op = flushLiterals(in, lit, ip, out, op);
+		size_t dist = ip - cand;
+		out[op++] = 0x80 | (m - LZ_MIN_MATCH);
+		out[op++] = dist & 0xFF;
+		out[op++] = dist >> 8;
+		ip += m;
+		lit = ip;
+	}
+	return flushLiterals(in, lit, len, out, op);
+}
+
+void writeTko(FILE * file, uint64_t entry, TkoSection * sections, int count, int compress) {
+	unsigned char ** payload = malloc(sizeof(unsigned char *) * count);
+	uint64_t * stored = malloc(sizeof(uint64_t) * count);
+	uint64_t * kind = malloc(sizeof(uint64_t) * count);
+
+	for (int i = 0; i < count; i++) {
+		kind[i] = sections[i].kind;
+		payload[i] = sections[i].bytes;
+		stored[i] = sections[i].bytes ? sections[i].size : 0;
+		if (!compress || !sections[i].bytes) continue;
+
+		unsigned char * packed = malloc(lzBound(sections[i].size));
+		size_t n = lzCompress(sections[i].bytes, sections[i].size, packed);
+		if (n < sections[i].size) {
+			kind[i] |= TKO_LZ;
+			payload[i] = packed;
+			stored[i] = n;
+		} else free(packed);
+	}
+
+	putWord(file, TKO_MAGIC);
+	putWord(file, TKO_VERSION);
+	putWord(file, entry);
+	putWord(file, count);
+	for (int i = 0; i < count; i++) {
+		putWord(file, kind[i]);
+		putWord(file, sections[i].address);
+		putWord(file, sections[i].size);
+		putWord(file, stored[i]);
+	}
+	for (int i = 0; i < count; i++) {
+		if (payload[i]) fwrite(payload[i], 1, stored[i], file);
+		if (kind[i] & TKO_LZ) free(payload[i]);
+	}
+
+	free(payload);
+	free(stored);
+	free(kind);
+}
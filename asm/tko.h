@@ -0,0 +1,42 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// .tko container, version 2. Every field is a little-endian 64-bit word.
+//
+//   magic, version, entry pc, section count
+//   section table: kind, address, size in memory, size in file
+//   section payloads, in table order (BSS and stack sections have none)
+//
+// Version 1 files start with a zero word followed by code address, code
+// size, data address and data size, then the raw code and data.
+#define TKO_MAGIC 0x4f4b5452454b4e54ULL // "TNKERTKO"
+#define TKO_VERSION 2
+
+#define TKO_CODE 1
+#define TKO_DATA 2
+#define TKO_BSS 3
+#define TKO_STACK 4 // no payload, the stack starts at its end (the memory size)
+#define TKO_KIND 0xff
+#define TKO_LZ 0x100 // payload is lz compressed
+
+typedef struct TkoSection {
+	uint64_t kind;
+	uint64_t address;
+	uint64_t size;
+	unsigned char * bytes; // null for BSS and stack
+} TkoSection;
+
+// Writes a version 2 image. With compress set, every section that shrinks
+// under lzCompress is stored compressed.
+void writeTko(FILE * file, uint64_t entry, TkoSection * sections, int count, int compress);
+
+// Worst case output size of lzCompress for len input bytes
+size_t lzBound(size_t len);
+
+// Byte oriented LZ77. Each token starts with a control byte c:
+//   c < 0x80  -> c + 1 literal bytes follow
+//   c >= 0x80 -> copy (c & 0x7f) + 4 bytes from a 16-bit little-endian
+//                distance back in the output, the copy may overlap itself
+size_t lzCompress(const unsigned char * in, size_t len, unsigned char * out);
@@ -0,0 +1,46 @@
+# times the scalar and vector versions of each kernel
+# usage: ./bench.sh [n] [reps] [lanes]   (n must be a multiple of 4)
+n=${1:-8192}
+reps=${2:-200}
+for k in dot saxpy; do
+	for v in scalar vector; do
+		../hw5-asm ${k}_$v.tk ${k}_$v.tko > /dev/null 2>&1 || exit 1
+		start=$(date +%s.%N)
+		out=$(printf "%d\n%d\n" $n $reps | ../hw5-sim ${k}_$v.tko)
+		end=$(date +%s.%N)
+		printf "%-14s %-22s %6.3fs\n" ${k}_$v "$out" $(awk "BEGIN { print $end - $start }")
+	done
+done
+
+# priv io on the interpreter thread and on reader and writer threads
+../hw5-asm stream.tk stream.tko > /dev/null 2>&1 || exit 1
+awk "BEGIN { print $n * 100; for (i = 0; i < $n * 100; i++) print i }" > stream_in
+for mode in sync async; do
+	start=$(date +%s.%N)
+	if [ $mode = async ]; then TINKER_ASYNC_IO=1 ../hw5-sim stream.tko < stream_in > /dev/null
+	else ../hw5-sim stream.tko < stream_in > /dev/null; fi
+	end=$(date +%s.%N)
+	printf "%-14s %-22s %6.3fs\n" stream_$mode "$((n * 100)) values" $(awk "BEGIN { print $end - $start }")
+done
+rm -f stream_in
+
+# lockstep lanes against one process per input, dot_scalar over lanes inputs
+lanes=${3:-64}
+../hw5-asm dot_scalar.tk dot_scalar.tko > /dev/null 2>&1 || exit 1
+mkdir -p lanes_in
+for i in $(seq 1 $lanes); do printf "%d\n%d\n" $((n + 4 * i)) 4 > lanes_in/$i; done
+start=$(date +%s.%N)
+for i in $(seq 1 $lanes); do ../hw5-sim dot_scalar.tko < lanes_in/$i > /dev/null; done
+end=$(date +%s.%N)
+printf "%-14s %-22s %6.3fs\n" processes "$lanes runs" $(awk "BEGIN { print $end - $start }")
+start=$(date +%s.%N)
+../hw5-sim --lanes dot_scalar.tko lanes_in/* 2> lanes.log
+end=$(date +%s.%N)
+printf "%-14s %-22s %6.3fs\n" lanes "$lanes lanes" $(awk "BEGIN { print $end - $start }")
+cat lanes.log
+rm -rf lanes_in lanes.log *.tko
+
+# assembler front end, lines per second
+gcc -O2 -I../asm -o lexbench lexbench.c ../asm/lexer.c || exit 1
+./lexbench
+rm -f lexbench
@@ -0,0 +1,98 @@
+// lexer microbenchmark: lines/second for the in-place lexer and perfect-hash
+// lookup against the old front end (copy each line, trim into a new string,
+// split off the mnemonic and strcmp down cmdTable)
+// usage: ./lexbench [lines]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "parse.h"
+#include "lexer.h"
+
+static const char * sample[] = {
+	"\tadd r1, r2, r3\n",
+	"\taddi r4, 12\n",
+	"\tmov r7, (r6)(8)\n",
+	"\tshftli r5, 4 ; scale\n",
+	"\tvfmaf v1, v2, v3\n",
+	"\tbrnz r9, r10\n",
+	"\tpush r3\n",
+	"\tld r2, :Table\n",
+};
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char * oldTrim(char * s) {
+	int l = 0;
+	while (s[l] && isspace((unsigned char)s[l])) l++;
+	int r = strlen(s) - 1;
+	while (r > l && isspace((unsigned char)s[r])) r--;
+	char * ret = malloc(r - l + 2);
+	strncpy(ret, s + l, r - l + 1);
+	ret[r - l + 1] = '\0';
+	return ret;
+}
+
+static int oldLookup(const char * cmd) {
+	for (size_t i = 0; i < sizeof(cmdTable) / sizeof(cmdTable[0]); i++)
+		if (strcmp(cmd, cmdTable[i].name) == 0) return cmdTable[i].type;
+	return -1;
+}
+
+static long oldPass(const char * src, const char * end) {
+	long sum = 0;
+	char line[256];
+	while (src < end) {
+		const char * nl = memchr(src, '\n', end - src);
+		size_t len = nl - src + 1;
+		memcpy(line, src, len);
+		line[len] = '\0';
+		char * text = oldTrim(line);
+		char * cmd = strdup(text);
+		char * space = strchr(cmd, ' ');
+		if (space) *space = '\0';
+		sum += oldLookup(cmd);
+		free(cmd);
+		free(text);
+		src += len;
+	}
+	return sum;
+}
+
+static long newPass(const char * src, const char * end) {
+	long sum = 0;
+	LexLine line;
+	while (src < end) {
+		src = lexLine(src, end, &line);
+		sum += lookupMnemonic(line.word, line.wordLen);
+	}
+	return sum;
+}
+
+int main(int argc, char ** argv) {
+	long lines = argc > 1 ? atol(argv[1]) : 2000000;
+	int n = sizeof(sample) / sizeof(sample[0]);
+	size_t size = 0;
+	for (long i = 0; i < lines; i++) size += strlen(sample[i % n]);
+	char * src = malloc(size + 1), * at = src;
+	for (long i = 0; i < lines; i++) at = stpcpy(at, sample[i % n]);
+
+	double start = now();
+	long a = oldPass(src, src + size);
+	double mid = now();
+	long b = newPass(src, src + size);
+	double end = now();
+	if (a != b) {
+		fprintf(stderr, "lexers disagree: %ld vs %ld\n", a, b);
+		return 1;
+	}
+	printf("%-14s %12.0f lines/s\n", "lex_old", lines / (mid - start));
+	printf("%-14s %12.0f lines/s\n", "lex_new", lines / (end - mid));
+	free(src);
+	return 0;
+}
@@ -7,4 +7,31 @@ cd ../sim/
 chmod u+x ./build.sh
 ./build.sh
 cp hw5-sim ./../
+
+cd ../link/
+chmod u+x ./build.sh
+./build.sh
+cp hw5-ld ./../
+cd ..
+
+cd trace/
+chmod u+x ./build.sh
+./build.sh
+cp hw5-trace ./../
+cd ..
+
+cd plugins/
+chmod u+x ./build.sh
+./build.sh
+cd ..
+
+cd run/
+chmod u+x ./build.sh
+./build.sh
+cp tinker ./../
+cd ..
+
+cd fuzz/
+chmod u+x ./build.sh
+./build.sh
 cd ..
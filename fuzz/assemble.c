@@ -0,0 +1,35 @@
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "asm.h"
+#include "fuzz.h"
+#include "sim.h"
+#include "../sim/main.h"
+
+// Source text in: the parser (getScript), macros, labels and encoding,
+// with compression, a symbol map and a listing on to reach their code
+// too. Failing without saying why is a bug, and so is an image that
+// assembles but does not load.
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+	AsmOptions options = {0};
+	options.compress = options.symbols = options.listing = 1;
+	options.threads = 1;
+	AsmResult result;
+	int failed = assemble((const char *)data, size, &options, &result) != 0;
+	if (failed != (result.numDiags > 0)) {
+		fprintf(stderr, "fuzz: assemble returned %d with %d errors\n", failed, result.numDiags);
+		abort();
+	}
+	if (!failed) {
+		jmp_buf trap;
+		simTrap = &trap;
+		if (setjmp(trap)) {
+			fprintf(stderr, "fuzz: the assembled image does not load\n");
+			abort();
+		}
+		simLoad(result.bytes, result.size);
+		simTrap = NULL;
+	}
+	freeAsmResult(&result);
+	return 0;
+}
@@ -0,0 +1,15 @@
+# Coverage instrumentation for the code under test only: the driver
+# provides the callbacks and must not call itself
+COVER="-O2 -g -fsanitize-coverage=trace-pc,trace-cmp"
+mkdir -p obj/asm obj/sim obj/run
+(cd obj/asm && gcc $COVER -c ../../../asm/asm.c ../../../asm/parse.c ../../../asm/lexer.c ../../../asm/argparse.c \
+	../../../asm/labletable.c ../../../asm/macro.c ../../../asm/encode.c ../../../asm/tko.c ../../../asm/layout.c \
+	../../../asm/object.c)
+(cd obj/sim && gcc $COVER -c ../../../sim/sim.c ../../../sim/check.c ../../../sim/guest.c ../../../sim/stream.c \
+	../../../sim/heap.c ../../../sim/profile.c ../../../sim/sample.c ../../../sim/symbols.c ../../../sim/plugins.c \
+	../../../sim/trace.c ../../../sim/timing.c ../../../sim/decode.c ../../../sim/vector.c ../../../sim/tko.c ../../../sim/stats.c ../../../sim/file.c)
+(cd obj/run && gcc $COVER -c ../../../run/gen.c)
+for target in assemble load roundtrip; do
+	gcc -O2 -g -I../asm -I../sim -I../run -o fuzz-$target driver.c $target.c obj/asm/*.o obj/sim/*.o obj/run/*.o \
+		-lm -pthread -ldl
+done
@@ -0,0 +1,458 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "fuzz.h"
+
+#define ull unsigned long long
+
+// Coverage-guided fuzz driver for the targets in this directory, a small
+// libFuzzer for gcc. The code under test is built with
+// -fsanitize-coverage=trace-pc,trace-cmp: every basic block it enters
+// calls __sanitizer_cov_trace_pc below, which counts the edge from the
+// block before it, and every comparison reports its operands. An input
+// that reaches a new edge, or a new bucket of hits on one (1, 2, 3, 4-7,
+// 8-15, 16-31, 32-127, 128+), joins the corpus. Every run mutates an
+// input from the corpus: bit flips, random bytes inserted and erased,
+// chunks copied within it or spliced in from another input, interesting
+// integers, and operands of recent comparisons written in binary or as
+// decimal text, which is how magic numbers and the assembler's limits
+// are found. Inputs start short and may grow once short ones stop finding
+// anything, since long ones cost more to run.
+//
+// usage: fuzz-<target> [-flag=value ...] [corpus directory ... | input file ...]
+//
+// The flags are libFuzzer's: -runs=n (no limit by default),
+// -max_total_time=seconds, -seed=n, -max_len=n (4096), -timeout=seconds
+// per input (10), -artifact_prefix=path (./) and -close_fd_mask=n (1
+// closes the target's stdout, 2 its stderr). Directories seed the corpus
+// and the first one gets every input that joins it. Given files instead,
+// it runs each once, to reproduce a crash. A crash or timeout writes the
+// input to crash-<hash> or timeout-<hash> under the artifact prefix and
+// exits with 77 or 70.
+
+#define MAP_SIZE 65536
+#define OPERANDS 256 // comparison operands kept for mutations
+#define MAX_MUTATIONS 5 // stacked on each input
+#define LEN_START 64     // longest input mutations make at first, or the longest seed
+#define LEN_PATIENCE 10000 // runs without anything new before that grows by a quarter
+
+static unsigned char map[MAP_SIZE];  // hits per edge in this run
+static unsigned char seen[MAP_SIZE]; // buckets of hits per edge in every run so far
+static uintptr_t previous;           // the block before, shifted
+static uintptr_t origin;             // a code address, so edges do not move with where the program loads
+
+void __sanitizer_cov_trace_pc() {
+	uintptr_t at = ((uintptr_t)__builtin_return_address(0) - origin) * 0x9e3779b97f4a7c15ULL >> 48;
+	map[(at ^ previous) & (MAP_SIZE - 1)]++;
+	previous = at >> 1;
+}
+
+typedef struct Operand {
+	ull value;
+	int size; // bytes, 0 for an empty slot
+} Operand;
+
+// slots picked by value, so one comparison run many times fills one slot
+static Operand operands[OPERANDS];
+
+static void compared(ull a, ull b, int size) {
+	if (a == b) return;
+	operands[a * 0x9e3779b97f4a7c15ULL >> 56] = (Operand){a, size};
+	operands[b * 0x9e3779b97f4a7c15ULL >> 56] = (Operand){b, size};
+}
+
+void __sanitizer_cov_trace_cmp1(uint8_t a, uint8_t b) { compared(a, b, 1); }
+void __sanitizer_cov_trace_cmp2(uint16_t a, uint16_t b) { compared(a, b, 2); }
+void __sanitizer_cov_trace_cmp4(uint32_t a, uint32_t b) { compared(a, b, 4); }
+void __sanitizer_cov_trace_cmp8(uint64_t a, uint64_t b) { compared(a, b, 8); }
+void __sanitizer_cov_trace_const_cmp1(uint8_t a, uint8_t b) { compared(a, b, 1); }
+void __sanitizer_cov_trace_const_cmp2(uint16_t a, uint16_t b) { compared(a, b, 2); }
+void __sanitizer_cov_trace_const_cmp4(uint32_t a, uint32_t b) { compared(a, b, 4); }
+void __sanitizer_cov_trace_const_cmp8(uint64_t a, uint64_t b) { compared(a, b, 8); }
+void __sanitizer_cov_trace_cmpf(float a, float b) {}
+void __sanitizer_cov_trace_cmpd(double a, double b) {}
+// the interpreter's switches run every instruction and their cases are
+// easy to hit by chance
+void __sanitizer_cov_trace_switch(uint64_t value, uint64_t * cases) {}
+
+#pragma weak LLVMFuzzerInitialize
+
+typedef struct Input {
+	unsigned char * data;
+	size_t size;
+} Input;
+
+static Input * corpus;
+static size_t numCorpus, corpusCap;
+static ull corpusBytes;
+static size_t edges, features; // edges seen, and buckets seen over all of them
+
+static ull runs;
+static double begun, started; // when fuzzing and the current run started
+static const unsigned char * current; // the input running, for the artifact
+static size_t currentSize;
+static int timeout = 10;
+static const char * artifactPrefix = "./";
+static FILE * report; // stderr, even when -close_fd_mask closes the target's
+
+static ull state;
+
+// splitmix64
+static ull rnd() {
+	ull z = (state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static size_t below(size_t n) {
+	return n ? rnd() % n : 0;
+}
+
+static double seconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// FNV-1a, names artifacts and corpus files
+static ull hash(const unsigned char * data, size_t size) {
+	ull h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++) h = (h ^ data[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+static int writeFile(const char * path, const unsigned char * data, size_t size) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return -1;
+	int ok = write(fd, data, size) == (ssize_t)size;
+	return close(fd) == 0 && ok ? 0 : -1;
+}
+
+static void writeArtifact(const char * kind) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s%s-%016llx", artifactPrefix, kind, hash(current, currentSize));
+	if (writeFile(path, current, currentSize) == 0)
+		fprintf(report, "artifact_prefix='%s'; Test unit written to %s\n", artifactPrefix, path);
+	else fprintf(report, "Error: cannot write %s\n", path);
+}
+
+static void onCrash(int sig) {
+	fprintf(report, "==%d== ERROR: deadly signal %d (%s)\n", (int)getpid(), sig, strsignal(sig));
+	if (current) writeArtifact("crash");
+	_exit(77);
+}
+
+static void onAlarm(int sig) {
+	if (!current || seconds() - started < timeout) return;
+	fprintf(report, "==%d== ERROR: timeout after %d seconds\n", (int)getpid(), timeout);
+	writeArtifact("timeout");
+	_exit(70);
+}
+
+static unsigned char bucket(unsigned char hits) {
+	if (hits < 4) return 1 << (hits - 1);
+	if (hits < 8) return 8;
+	if (hits < 16) return 16;
+	if (hits < 32) return 32;
+	return hits < 128 ? 64 : 128;
+}
+
+// bucket for each byte of a pair of counts, so map is classified two at a time
+static uint16_t buckets[65536];
+
+static void fillBuckets() {
+	for (int i = 0; i < 65536; i++)
+		buckets[i] = (i & 0xff ? bucket(i & 0xff) : 0) | (i >> 8 ? bucket(i >> 8) : 0) << 8;
+}
+
+// runs one input, returns nonzero when it reached something new
+static int run(const unsigned char * data, size_t size) {
+	memset(map, 0, sizeof(map));
+	previous = 0;
+	current = data;
+	currentSize = size;
+	started = seconds();
+	LLVMFuzzerTestOneInput(data, size);
+	current = NULL;
+	runs++;
+
+	int fresh = 0;
+	for (size_t at = 0; at < MAP_SIZE; at += 8) {
+		ull hits, had;
+		memcpy(&hits, map + at, 8);
+		if (!hits) continue;
+		hits = buckets[hits & 0xffff] | (ull)buckets[hits >> 16 & 0xffff] << 16 |
+			(ull)buckets[hits >> 32 & 0xffff] << 32 | (ull)buckets[hits >> 48] << 48;
+		memcpy(&had, seen + at, 8);
+		if (!(hits & ~had)) continue;
+		memcpy(map + at, &hits, 8);
+		for (size_t i = at; i < at + 8; i++) {
+			unsigned char b = map[i] & ~seen[i];
+			if (!b) continue;
+			if (!seen[i]) edges++;
+			features += __builtin_popcount(b);
+			seen[i] |= b;
+			fresh = 1;
+		}
+	}
+	return fresh;
+}
+
+static void add(const unsigned char * data, size_t size, const char * dir) {
+	if (numCorpus == corpusCap) {
+		corpusCap = corpusCap ? 2 * corpusCap : 256;
+		corpus = realloc(corpus, corpusCap * sizeof(Input));
+	}
+	Input * in = corpus ? &corpus[numCorpus] : NULL;
+	if (!in || !(in->data = malloc(size ? size : 1))) {
+		fprintf(report, "Error: not enough memory for the corpus\n");
+		exit(1);
+	}
+	memcpy(in->data, data, size);
+	in->size = size;
+	numCorpus++;
+	corpusBytes += size;
+	if (dir) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%016llx", dir, hash(data, size));
+		if (writeFile(path, data, size) != 0) fprintf(report, "Error: cannot write %s\n", path);
+	}
+}
+
+static void status(const char * what) {
+	double elapsed = seconds() - begun;
+	fprintf(report, "#%llu\t%s cov: %zu ft: %zu corp: %zu/%llub exec/s: %llu\n", runs, what, edges, features,
+		numCorpus, corpusBytes, elapsed > 0 ? (ull)(runs / elapsed) : 0);
+}
+
+static void put(unsigned char * at, ull v, int size) {
+	for (int i = 0; i < size; i++) at[i] = v >> (8 * i);
+}
+
+// makes room for n bytes at at
+static void makeRoom(unsigned char * d, size_t size, size_t at, size_t n) {
+	memmove(d + at + n, d + at, size - at);
+}
+
+// one mutation of the size bytes at d, in place, returns the new size
+static size_t mutate(unsigned char * d, size_t size, size_t max) {
+	static const ull interesting[] = {0, 1, 0x7f, 0x80, 0xff, 0x100, 0x7fff, 0x8000, 0xffff, 0x7fffffff,
+		0x80000000, 0xffffffff, ~0ULL, 1ULL << 63};
+	switch (below(10)) {
+		case 0: // flip a bit
+			if (size) d[below(size)] ^= 1 << below(8);
+			break;
+		case 1: // a random byte
+			if (size) d[below(size)] = rnd();
+			break;
+		case 2: { // insert random bytes
+			size_t n = 1 + below(4), at = below(size + 1);
+			if (n > max - size) break;
+			makeRoom(d, size, at, n);
+			for (size_t i = 0; i < n; i++) d[at + i] = rnd();
+			size += n;
+			break;
+		}
+		case 3: { // erase some
+			if (size < 2) break;
+			size_t n = 1 + below(size < 16 ? size - 1 : 16), at = below(size - n + 1);
+			memmove(d + at, d + at + n, size - at - n);
+			size -= n;
+			break;
+		}
+		case 4: { // copy a chunk over another part
+			if (size < 2) break;
+			size_t n = 1 + below(size / 2), from = below(size - n + 1), to = below(size - n + 1);
+			memmove(d + to, d + from, n);
+			break;
+		}
+		case 5: { // splice in a chunk of another input
+			const Input * other = &corpus[below(numCorpus)];
+			if (!other->size) break;
+			size_t n = 1 + below(other->size), at = below(size + 1);
+			if (n > max - size) n = max - size;
+			if (!n) break;
+			makeRoom(d, size, at, n);
+			memcpy(d + at, other->data + below(other->size - n + 1), n);
+			size += n;
+			break;
+		}
+		case 6: { // an interesting integer
+			int n = 1 << below(4);
+			if (size >= (size_t)n)
+				put(d + below(size - n + 1), interesting[below(sizeof(interesting) / sizeof(interesting[0]))], n);
+			break;
+		}
+		case 7: { // a comparison operand, in binary
+			Operand o = operands[below(OPERANDS)];
+			if (o.size && size >= (size_t)o.size) put(d + below(size - o.size + 1), o.value, o.size);
+			break;
+		}
+		case 8: { // a comparison operand, as decimal text
+			Operand o = operands[below(OPERANDS)];
+			char text[24];
+			size_t n = snprintf(text, sizeof(text), "%llu", o.value), at = below(size + 1);
+			if (!o.size || n > max - size) break;
+			makeRoom(d, size, at, n);
+			memcpy(d + at, text, n);
+			size += n;
+			break;
+		}
+		default: // another digit
+			for (size_t i = 0, at = below(size); i < size; i++)
+				if (d[(at + i) % size] >= '0' && d[(at + i) % size] <= '9') {
+					d[(at + i) % size] = '0' + below(10);
+					break;
+				}
+	}
+	return size;
+}
+
+static unsigned char * readFile(const char * path, size_t max, size_t * size) {
+	FILE * file = fopen(path, "rb");
+	if (!file) return NULL;
+	unsigned char * data = malloc(max ? max : 1);
+	*size = data ? fread(data, 1, max, file) : 0;
+	fclose(file);
+	return data;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: fuzz-<target> [-runs=n] [-max_total_time=seconds] [-seed=n] [-max_len=n] "
+		"[-timeout=seconds] [-artifact_prefix=path] [-close_fd_mask=n] [corpus directory ... | input file ...]\n");
+	exit(1);
+}
+
+static int flag(const char * arg, const char * name, ull * value) {
+	size_t len = strlen(name);
+	if (strncmp(arg, name, len) != 0 || arg[len] != '=') return 0;
+	char * end;
+	*value = strtoull(arg + len + 1, &end, 10);
+	if (end == arg + len + 1 || *end) usage();
+	return 1;
+}
+
+int main(int argc, char ** argv) {
+	ull maxRuns = ~0ULL, maxTime = 0, seed = 0, maxLen = 4096, fdMask = 0, value;
+	char ** paths = calloc(argc, sizeof(char *));
+	int numPaths = 0;
+	for (int i = 1; i < argc; i++) {
+		const char * arg = argv[i];
+		if (arg[0] != '-') paths[numPaths++] = argv[i];
+		else if (flag(arg, "-runs", &maxRuns)) continue;
+		else if (flag(arg, "-max_total_time", &maxTime)) continue;
+		else if (flag(arg, "-seed", &seed)) continue;
+		else if (flag(arg, "-max_len", &maxLen)) continue;
+		else if (flag(arg, "-close_fd_mask", &fdMask)) continue;
+		else if (flag(arg, "-timeout", &value)) timeout = value;
+		else if (strncmp(arg, "-artifact_prefix=", 17) == 0) artifactPrefix = arg + 17;
+		else usage();
+	}
+
+	report = stderr;
+	if (fdMask) {
+		int fd = dup(2), null = open("/dev/null", O_WRONLY);
+		if (fd >= 0) report = fdopen(fd, "w");
+		if (!report) report = stderr;
+		setvbuf(report, NULL, _IOLBF, 0);
+		if (null >= 0) {
+			if (fdMask & 1) dup2(null, 1);
+			if (fdMask & 2) dup2(null, 2);
+			close(null);
+		}
+	}
+	int crashes[] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL};
+	for (size_t i = 0; i < sizeof(crashes) / sizeof(crashes[0]); i++) signal(crashes[i], onCrash);
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onAlarm;
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGALRM, &action, NULL);
+	struct itimerval tick = {{1, 0}, {1, 0}};
+	setitimer(ITIMER_REAL, &tick, NULL);
+
+	fillBuckets();
+	origin = (uintptr_t)main;
+	if (LLVMFuzzerInitialize) LLVMFuzzerInitialize(&argc, &argv);
+
+	// files: run each once
+	struct stat st;
+	if (numPaths && stat(paths[0], &st) == 0 && !S_ISDIR(st.st_mode)) {
+		for (int i = 0; i < numPaths; i++) {
+			size_t size;
+			unsigned char * data = readFile(paths[i], 1 << 30, &size);
+			if (!data) {
+				fprintf(report, "Error: cannot read %s\n", paths[i]);
+				return 1;
+			}
+			fprintf(report, "Running: %s\n", paths[i]);
+			double start = seconds();
+			run(data, size);
+			fprintf(report, "Executed %s in %llu ms\n", paths[i], (ull)((seconds() - start) * 1000));
+			free(data);
+		}
+		return 0;
+	}
+
+	if (!seed) seed = (ull)time(NULL) ^ ((ull)getpid() << 32);
+	state = seed;
+	fprintf(report, "INFO: Seed: %llu\n", seed);
+	begun = seconds();
+	const char * out = numPaths ? paths[0] : NULL;
+	unsigned char * buffer = malloc(maxLen ? maxLen : 1);
+	size_t lenLimit = LEN_START < maxLen ? LEN_START : maxLen;
+	ull lastNew = 0;
+	run(buffer, 0);
+	add(buffer, 0, NULL);
+	for (int i = 0; i < numPaths; i++) {
+		struct dirent ** names;
+		int n = scandir(paths[i], &names, NULL, alphasort);
+		if (n < 0) {
+			fprintf(report, "Error: cannot read %s\n", paths[i]);
+			return 1;
+		}
+		for (int j = 0; j < n; j++) {
+			char path[4096];
+			snprintf(path, sizeof(path), "%s/%s", paths[i], names[j]->d_name);
+			size_t size;
+			unsigned char * data;
+			if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && (data = readFile(path, maxLen, &size))) {
+				if (size > lenLimit) lenLimit = size;
+				if (run(data, size)) add(data, size, i ? out : NULL);
+				free(data);
+			}
+			free(names[j]);
+		}
+		free(names);
+	}
+	status("INITED");
+
+	while (runs < maxRuns && (!maxTime || seconds() - begun < maxTime)) {
+		const Input * in = &corpus[below(numCorpus)];
+		size_t size = in->size;
+		memcpy(buffer, in->data, size);
+		for (size_t m = 1 + below(MAX_MUTATIONS); m--;) size = mutate(buffer, size, lenLimit);
+		if (run(buffer, size)) {
+			add(buffer, size, out);
+			lastNew = runs;
+			status("NEW   ");
+		} else if (!(runs & (runs - 1))) {
+			status("pulse ");
+		}
+		if (runs - lastNew > LEN_PATIENCE && lenLimit < maxLen) {
+			lenLimit += lenLimit / 4 < maxLen - lenLimit ? lenLimit / 4 : maxLen - lenLimit;
+			lastNew = runs;
+		}
+	}
+	status("DONE  ");
+	fprintf(report, "Done %llu runs in %llu second(s)\n", runs, (ull)(seconds() - begun));
+	return 0;
+}
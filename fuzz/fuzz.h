@@ -0,0 +1,13 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// In-process fuzz targets, in libFuzzer's interface. Each target file
+// defines LLVMFuzzerTestOneInput, which runs one input and returns 0,
+// and aborts when the input shows a bug. Targets build with
+// clang -fsanitize=fuzzer where there is one; build.sh links them with
+// driver.c instead, which needs only gcc (see driver.c).
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size);
+
+// Optional, called once before the first input
+int LLVMFuzzerInitialize(int * argc, char *** argv);
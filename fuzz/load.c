@@ -0,0 +1,39 @@
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "fuzz.h"
+#include "sim.h"
+#include "../sim/main.h"
+
+// A .tko image in: the loader, and whatever loads run on the predecoded
+// core for up to BUDGET instructions with a few numbers of input. A
+// malformed image or a simulation error ends the run; only a crash is a
+// bug.
+
+#define BUDGET 1000
+
+static const char input[] = "3\n7\n18446744073709551615\n";
+static FILE * in, * out;
+
+int LLVMFuzzerInitialize(int * argc, char *** argv) {
+	in = fmemopen((void *)input, sizeof(input) - 1, "r");
+	out = fopen("/dev/null", "w");
+	if (!in || !out) {
+		fprintf(stderr, "Error: cannot set up the guest's input and output\n");
+		exit(1);
+	}
+	simBudget(BUDGET);
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+	jmp_buf trap;
+	rewind(in);
+	simTrap = &trap;
+	if (setjmp(trap) == 0) {
+		simLoad(data, size);
+		simStart(in, out);
+	}
+	simTrap = NULL;
+	return 0;
+}
@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "asm.h"
+#include "fuzz.h"
+#include "gen.h"
+#include "sim.h"
+
+// Choice bytes in (see genProgramFrom): a random valid program, assembled
+// in memory and run on the reference and predecoded cores side by side by
+// the differential checker, for up to BUDGET instructions each. A program
+// that does not assemble or cores that disagree are bugs.
+
+#define BUDGET 100000
+
+static FILE * out;
+
+int LLVMFuzzerInitialize(int * argc, char *** argv) {
+	if (!(out = fopen("/dev/null", "w"))) {
+		fprintf(stderr, "Error: cannot open /dev/null\n");
+		exit(1);
+	}
+	simBudget(BUDGET);
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+	GenProgram program;
+	genProgramFrom(data, size, &program);
+	AsmOptions options = {0};
+	options.threads = 1;
+	AsmResult result;
+	if (assemble(program.source, program.sourceSize, &options, &result) != 0) {
+		fprintf(stderr, "fuzz: a generated program does not assemble, line %d: %s\n", result.diags[0].line,
+			result.diags[0].message);
+		abort();
+	}
+	FILE * in = fmemopen(program.input, program.inputSize, "r");
+	CheckStats stats;
+	if (!in || simCheck(result.bytes, result.size, 0, in, out, &stats) != 0) abort();
+	fclose(in);
+	freeAsmResult(&result);
+	freeGenProgram(&program);
+	return 0;
+}
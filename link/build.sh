@@ -0,0 +1 @@
+gcc -I../asm -o hw5-ld main.c ../asm/object.c ../asm/tko.c ../asm/layout.c
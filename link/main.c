@@ -0,0 +1,195 @@
+#include "object.h"
+#include "layout.h"
+#include "tko.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdarg.h>
+
+// hw5-ld: links relocatable objects written by hw5-asm --object into a .tko
+//
+// usage: hw5-ld [--layout=file] [--entry=label] [--compress] -o output.tko input...
+//
+// Code, data and BSS of the inputs are concatenated in command line order,
+// then placed by the layout like a single assembled program.
+
+char * output = NULL;
+Layout layout;
+
+void error() {
+	if (output) remove(output);
+	exit(1);
+}
+
+// layout.c reports through the assembler's error hook
+void asmError(const char * fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	fprintf(stderr, "Error: ");
+	vfprintf(stderr, fmt, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	error();
+}
+
+typedef struct Global {
+	char * name;
+	uint64_t address;
+	char * file;
+} Global;
+
+Global * globals;
+uint64_t globalCap;
+
+static uint64_t hashName(const char * name) {
+	uint64_t h = 14695981039346656037ULL;
+	for (; *name; name++)
+		h = (h ^ (unsigned char)*name) * 1099511628211ULL;
+	return h;
+}
+
+// Slot for name: either the existing entry or the empty slot to fill
+static Global * findGlobal(const char * name) {
+	uint64_t i = hashName(name) & (globalCap - 1);
+	while (globals[i].name && strcmp(globals[i].name, name) != 0)
+		i = (i + 1) & (globalCap - 1);
+	return &globals[i];
+}
+
+static uint64_t alignUp(uint64_t v, uint64_t align) {
+	return (v + align - 1) / align * align;
+}
+
+int main(int argc, char * argv[]) {
+	char * layoutFile = NULL;
+	char * entryName = NULL;
+	int compress = 0;
+	char ** inputs = malloc(sizeof(char *) * argc);
+	int n = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--layout=", 9) == 0) layoutFile = argv[i] + 9;
+		else if (strncmp(argv[i], "--entry=", 8) == 0) entryName = argv[i] + 8;
+		else if (strcmp(argv[i], "--compress") == 0) compress = 1;
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) output = argv[++i];
+		else inputs[n++] = argv[i];
+	}
+	if (!output || n == 0) {
+		fprintf(stderr, "usage: hw5-ld [--layout=file] [--entry=label] [--compress] -o output.tko input...\n");
+		exit(1);
+	}
+
+	Object ** objs = malloc(sizeof(Object *) * n);
+	uint64_t * codeBase = malloc(sizeof(uint64_t) * n);
+	uint64_t * dataBase = malloc(sizeof(uint64_t) * n);
+	uint64_t * bssBase = malloc(sizeof(uint64_t) * n);
+	uint64_t codeSize = 0, dataSize = 0, bssSize = 0, numGlobals = 0;
+
+	// offsets of each object within the merged sections
+	for (int i = 0; i < n; i++) {
+		objs[i] = readObject(inputs[i]);
+		if (!objs[i]) {
+			fprintf(stderr, "Error: %s is not a tinker object\n", inputs[i]);
+			error();
+		}
+		codeBase[i] = codeSize;
+		dataBase[i] = dataSize;
+		bssBase[i] = bssSize;
+		codeSize += objs[i]->codeSize;
+		dataSize += alignUp(objs[i]->dataSize, 8);
+		bssSize += alignUp(objs[i]->bssSize, 8);
+		numGlobals += objs[i]->numSymbols;
+	}
+
+	defaultLayout(&layout);
+	if (layoutFile) readLayout(layoutFile, &layout);
+	placeSegments(&layout, codeSize, dataSize, bssSize);
+
+	unsigned char * code = calloc(codeSize + 1, 1);
+	unsigned char * data = calloc(dataSize + 1, 1);
+	for (int i = 0; i < n; i++) {
+		memcpy(code + codeBase[i], objs[i]->code, objs[i]->codeSize);
+		memcpy(data + dataBase[i], objs[i]->data, objs[i]->dataSize);
+		codeBase[i] += layout.code;
+		dataBase[i] += layout.data;
+		bssBase[i] += layout.bss;
+	}
+
+	globalCap = 16;
+	while (globalCap < 2 * numGlobals) globalCap <<= 1;
+	globals = calloc(globalCap, sizeof(Global));
+
+	for (int i = 0; i < n; i++)
+		for (int j = 0; j < objs[i]->numSymbols; j++) {
+			ObjSymbol * sym = &objs[i]->symbols[j];
+			if (!sym->global || sym->section == OBJ_UNDEF) continue;
+			Global * g = findGlobal(sym->name);
+			if (g->name) {
+				fprintf(stderr, "Error: symbol '%s' defined in both %s and %s\n", sym->name, g->file, inputs[i]);
+				error();
+			}
+			g->name = sym->name;
+			g->file = inputs[i];
+			g->address = sym->offset + (sym->section == TKO_CODE ? codeBase[i]
+					: sym->section == TKO_DATA ? dataBase[i] : bssBase[i]);
+		}
+
+	for (int i = 0; i < n; i++)
+		for (int j = 0; j < objs[i]->numRelocs; j++) {
+			ObjReloc * rel = &objs[i]->relocs[j];
+			ObjSymbol * sym = &objs[i]->symbols[rel->symbol];
+
+			uint64_t value;
+			if (sym->section == OBJ_UNDEF) {
+				Global * g = findGlobal(sym->name);
+				if (!g->name) {
+					fprintf(stderr, "Error: undefined symbol '%s' referenced in %s\n", sym->name, inputs[i]);
+					error();
+				}
+				value = g->address;
+			} else value = sym->offset + (sym->section == TKO_CODE ? codeBase[i]
+					: sym->section == TKO_DATA ? dataBase[i] : bssBase[i]);
+
+			uint64_t width = rel->kind == RELOC_LD64 ? 48 : 4;
+			uint64_t size = rel->section == TKO_CODE ? objs[i]->codeSize : objs[i]->dataSize;
+			if (rel->offset > size || width > size - rel->offset) {
+				fprintf(stderr, "Error: bad relocation in %s\n", inputs[i]);
+				error();
+			}
+
+			unsigned char * bytes = rel->section == TKO_CODE
+				? code + (codeBase[i] - layout.code) : data + (dataBase[i] - layout.data);
+			uint64_t site = (rel->section == TKO_CODE ? codeBase[i] : dataBase[i]) + rel->offset;
+			if (applyReloc(bytes, rel->offset, rel->kind, site, value) != 0) {
+				fprintf(stderr, "Error: '%s' at 0x%" PRIx64 " is out of range for the reference in %s\n",
+						sym->name, value, inputs[i]);
+				error();
+			}
+		}
+
+	uint64_t entry = layout.code;
+	if (entryName) {
+		Global * g = findGlobal(entryName[0] == ':' ? entryName + 1 : entryName);
+		if (!g->name) {
+			fprintf(stderr, "Error: entry symbol '%s' is not defined\n", entryName);
+			error();
+		}
+		entry = g->address;
+	}
+
+	FILE * file = fopen(output, "wb");
+	if (!file) {
+		fprintf(stderr, "Error: cannot write %s\n", output);
+		exit(1);
+	}
+	TkoSection sections[4];
+	int count = 0;
+	sections[count++] = (TkoSection){TKO_CODE, layout.code, codeSize, code};
+	if (dataSize) sections[count++] = (TkoSection){TKO_DATA, layout.data, dataSize, data};
+	if (bssSize) sections[count++] = (TkoSection){TKO_BSS, layout.bss, bssSize, NULL};
+	sections[count++] = (TkoSection){TKO_STACK, stackBase(&layout), layout.stack, NULL};
+	writeTko(file, entry, sections, count, compress);
+	fclose(file);
+	return 0;
+}
@@ -0,0 +1,2 @@
+gcc -shared -fPIC -I../sim -o coverage.so coverage.c
+gcc -shared -fPIC -I../sim -o heatmap.so heatmap.c
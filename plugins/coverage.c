@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plugin.h"
+
+// Code coverage plugin: marks every instruction word the guest runs and,
+// when it halts, writes how much of the code segment ran and each range
+// that never did, named by label and source line when there is a symbol
+// map. The argument is the file to write, stderr without one.
+//
+//   TINKER_PLUGINS=plugins/coverage.so=fib.coverage hw5-sim fib.tko
+
+static const TinkerApi * tinker;
+static const char * outPath;
+static uint64_t base, words;
+static unsigned char * hit; // one byte per word of code, set once it runs
+
+static void onExecute(void * ctx, uint64_t pc, uint32_t word) {
+	if (!hit) {
+		uint64_t size;
+		tinker->code(&base, &size);
+		words = size / 4;
+		if (!(hit = calloc(words ? words : 1, 1))) {
+			fprintf(stderr, "coverage: not enough memory\n");
+			exit(1);
+		}
+	}
+	if (pc - base < words * 4) hit[(pc - base) / 4] = 1;
+}
+
+static void printRange(FILE * out, uint64_t from, uint64_t to) {
+	char start[128], end[128], line[64];
+	tinker->symbolize(base + 4 * from, start, sizeof(start));
+	tinker->symbolize(base + 4 * (to - 1), end, sizeof(end));
+	fprintf(out, "  %s", start);
+	if (to - from > 1) fprintf(out, " .. %s", end);
+	fprintf(out, "  %llu instructions", (unsigned long long)(to - from));
+	if (tinker->sourceLine(base + 4 * from, line, sizeof(line))) fprintf(out, ", %s", line);
+	fputc('\n', out);
+}
+
+static void onHalt(void * ctx, uint64_t instructions, int failed) {
+	FILE * out = outPath[0] ? fopen(outPath, "w") : stderr;
+	if (!out) {
+		fprintf(stderr, "coverage: cannot write %s\n", outPath);
+		return;
+	}
+	uint64_t covered = 0;
+	for (uint64_t i = 0; i < words; i++) covered += hit[i];
+	fprintf(out, "coverage: %llu of %llu instructions (%.1f%%)\n", (unsigned long long)covered,
+		(unsigned long long)words, words ? 100.0 * covered / words : 0.0);
+	for (uint64_t i = 0; i < words; i++) {
+		if (hit[i]) continue;
+		uint64_t from = i;
+		while (i < words && !hit[i]) i++;
+		printRange(out, from, i);
+	}
+	if (out != stderr) fclose(out);
+}
+
+int tinkerPlugin(const TinkerApi * api, const char * args) {
+	if (api->version != TINKER_PLUGIN_VERSION) return 1;
+	tinker = api;
+	outPath = args;
+	api->onExecute(onExecute, NULL);
+	api->onHalt(onHalt, NULL);
+	return 0;
+}
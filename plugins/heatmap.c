@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plugin.h"
+
+// Memory heatmap plugin: counts the guest's loads and stores per block of
+// memory and, when it halts, writes one line per block it touched, in
+// address order, with its counts and a bar scaled to the busiest block.
+// The argument is the file to write and optionally the block size in
+// bytes (64), as path[:block]; without a path it writes to stderr.
+//
+//   TINKER_PLUGINS=plugins/heatmap.so=dot.heat:256 hw5-sim dot.tko
+
+#define BAR 40 // width of the busiest block's bar
+
+static const TinkerApi * tinker;
+static char outPath[4096];
+static uint64_t block = 64, blocks;
+static uint64_t * reads, * writes; // per block
+static uint64_t totalReads, totalWrites;
+
+static void allocate() {
+	uint64_t memSize;
+	tinker->memory(&memSize);
+	blocks = (memSize + block - 1) / block;
+	reads = calloc(blocks, sizeof(uint64_t));
+	writes = calloc(blocks, sizeof(uint64_t));
+	if (!reads || !writes) {
+		fprintf(stderr, "heatmap: not enough memory\n");
+		exit(1);
+	}
+}
+
+static void count(uint64_t * counts, uint64_t address, uint64_t size) {
+	uint64_t first = address / block, last = (address + size - 1) / block;
+	for (uint64_t b = first; b <= last && b < blocks; b++) counts[b]++;
+}
+
+static void onRead(void * ctx, uint64_t pc, uint64_t address, uint64_t size) {
+	if (!reads) allocate();
+	totalReads++;
+	count(reads, address, size);
+}
+
+static void onWrite(void * ctx, uint64_t pc, uint64_t address, uint64_t size) {
+	if (!writes) allocate();
+	totalWrites++;
+	count(writes, address, size);
+}
+
+static void onHalt(void * ctx, uint64_t instructions, int failed) {
+	FILE * out = outPath[0] ? fopen(outPath, "w") : stderr;
+	if (!out) {
+		fprintf(stderr, "heatmap: cannot write %s\n", outPath);
+		return;
+	}
+	uint64_t busiest = 0;
+	for (uint64_t b = 0; b < blocks; b++)
+		if (reads[b] + writes[b] > busiest) busiest = reads[b] + writes[b];
+	fprintf(out, "heatmap: %llu loads, %llu stores, %llu byte blocks\n", (unsigned long long)totalReads,
+		(unsigned long long)totalWrites, (unsigned long long)block);
+	fprintf(out, "%-10s %10s %10s\n", "address", "loads", "stores");
+	for (uint64_t b = 0; b < blocks; b++) {
+		uint64_t n = reads[b] + writes[b];
+		if (!n) continue;
+		int width = (int)((n * BAR + busiest - 1) / busiest);
+		fprintf(out, "0x%08llx %10llu %10llu  %.*s\n", (unsigned long long)(b * block), (unsigned long long)reads[b],
+			(unsigned long long)writes[b], width, "########################################");
+	}
+	if (out != stderr) fclose(out);
+}
+
+int tinkerPlugin(const TinkerApi * api, const char * args) {
+	if (api->version != TINKER_PLUGIN_VERSION) return 1;
+	tinker = api;
+	snprintf(outPath, sizeof(outPath), "%s", args);
+	char * size = strchr(outPath, ':');
+	if (size) {
+		*size++ = '\0';
+		char * end;
+		block = strtoull(size, &end, 0);
+		if (*end || block == 0) {
+			fprintf(stderr, "heatmap: block size should be a positive number of bytes\n");
+			return 1;
+		}
+	}
+	api->onRead(onRead, NULL);
+	api->onWrite(onWrite, NULL);
+	api->onHalt(onHalt, NULL);
+	return 0;
+}
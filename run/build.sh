@@ -0,0 +1,4 @@
+gcc -I../asm -I../sim -o tinker main.c gen.c \
+	../asm/asm.c ../asm/parse.c ../asm/lexer.c ../asm/argparse.c ../asm/labletable.c ../asm/macro.c \
+	../asm/encode.c ../asm/tko.c ../asm/layout.c ../asm/object.c \
+	../sim/sim.c ../sim/check.c ../sim/guest.c ../sim/stream.c ../sim/heap.c ../sim/profile.c ../sim/sample.c ../sim/symbols.c ../sim/plugins.c ../sim/trace.c ../sim/timing.c ../sim/decode.c ../sim/vector.c ../sim/tko.c ../sim/stats.c ../sim/file.c -lm -pthread -ldl
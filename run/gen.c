@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gen.h"
+
+#define ull unsigned long long
+
+// Registers: r1-r12 hold the values random instructions work on and are
+// the only ones they write. r13 points to the middle of :Buf, r14 counts
+// loops, r16 holds a routine's address, r15 and r17-r19 are scratch for
+// targets, addresses and lengths, and r20 and r21 hold the output ports
+// 1 and 3. r31 is the stack pointer, moved only by balanced push and pop.
+
+#define HALF 256       // bytes of :Buf on each side of r13
+#define SEGMENTS 24    // at least this many, up to twice as many
+#define FAULT_EVERY 4  // one program in this many ends on a simulation error
+
+typedef struct Gen {
+	FILE * out;
+	FILE * routines; // leaf routines, placed after the halt
+	ull seed, state;
+	const unsigned char * choices; // genProgramFrom's bytes, one per call to next
+	size_t numChoices, used;
+	int labels;
+	int inputs, reads; // numbers in the input, numbers read so far
+} Gen;
+
+// splitmix64, with the next choice byte mixed in while there are any
+static ull next(Gen * g) {
+	ull z = (g->state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+	if (g->used < g->numChoices) z ^= g->choices[g->used++] * 0x9e3779b97f4a7c15ULL;
+	return z;
+}
+
+static int below(Gen * g, int n) {
+	return next(g) % n;
+}
+
+static int reg(Gen * g) {
+	return 1 + below(g, 12);
+}
+
+static int vreg(Gen * g) {
+	return 1 + below(g, 8);
+}
+
+static ull value(Gen * g) {
+	static const ull special[] = {
+		0, 1, 2, 63, 64, ~0ULL, 1ULL << 63, ~0ULL >> 1,
+		0x3ff8000000000000ULL, // 1.5
+		0xc002000000000000ULL, // -2.25
+		0x7ff0000000000000ULL, // infinity
+		0x7ff8000000000000ULL, // nan
+	};
+	switch (below(g, 4)) {
+		case 0: return special[below(g, sizeof(special) / sizeof(special[0]))];
+		case 1: return below(g, 4096);
+		default: return next(g);
+	}
+}
+
+static int label(Gen * g) {
+	return g->labels++;
+}
+
+// an offset from r13 that keeps an access of size bytes inside :Buf
+static int offset(Gen * g, int size) {
+	int at = 8 * below(g, (2 * HALF - size) / 8 + 1) - HALF;
+	if (size == 8 && !below(g, 4) && at < HALF - 15) at += 1 + below(g, 7); // unaligned
+	return at;
+}
+
+// r17 = r13 + offset for an access of size bytes
+static void address(Gen * g, int size) {
+	int at = offset(g, size);
+	fprintf(g->out, "\tmov r17, r13\n");
+	if (at > 0) fprintf(g->out, "\taddi r17, %d\n", at);
+	if (at < 0) fprintf(g->out, "\tsubi r17, %d\n", -at);
+}
+
+// one instruction of one word, so brr can skip it
+static void single(Gen * g, FILE * out) {
+	static const char * three[] = {"and", "or", "xor", "shftr", "shftl", "add", "sub", "mul", "addf", "subf", "mulf"};
+	static const char * literal[] = {"shftri", "shftli", "addi", "subi"};
+	switch (below(g, 5)) {
+		case 0:
+		case 1:
+			fprintf(out, "\t%s r%d, r%d, r%d\n", three[below(g, 11)], reg(g), reg(g), reg(g));
+			break;
+		case 2:
+			fprintf(out, "\t%s r%d, %d\n", literal[below(g, 4)], reg(g), below(g, 2) ? below(g, 64) : below(g, 4096));
+			break;
+		case 3: fprintf(out, "\tnot r%d, r%d\n", reg(g), reg(g)); break;
+		default:
+			if (below(g, 2)) fprintf(out, "\tmov r%d, r%d\n", reg(g), reg(g));
+			else fprintf(out, "\tmov r%d, %d\n", reg(g), below(g, 4096));
+	}
+}
+
+static void alu(Gen * g, FILE * out) {
+	switch (below(g, 6)) {
+		case 0: // divisors made odd, so never zero
+			fprintf(out, "\tld r15, 1\n\tor r15, r15, r%d\n\t%s r%d, r%d, r15\n", reg(g), below(g, 2) ? "div" : "divf",
+				reg(g), reg(g));
+			break;
+		case 1: fprintf(out, "\tld r%d, %llu\n", reg(g), value(g)); break;
+		case 2: fprintf(out, "\tclr r%d\n", reg(g)); break;
+		default: single(g, out);
+	}
+}
+
+static void memory(Gen * g, FILE * out) {
+	if (below(g, 2)) fprintf(out, "\tmov r%d, (r13)(%d)\n", reg(g), offset(g, 8));
+	else fprintf(out, "\tmov (r13)(%d), r%d\n", offset(g, 8), reg(g));
+}
+
+static void vector(Gen * g) {
+	static const char * three[] = {"vadd", "vsub", "vmul", "vaddf", "vsubf", "vmulf", "vfma", "vfmaf"};
+	switch (below(g, 6)) {
+		case 0: fprintf(g->out, "\tvsplat v%d, r%d\n", vreg(g), reg(g)); break;
+		case 1:
+			address(g, 32);
+			fprintf(g->out, "\tvld v%d, (r17)\n", vreg(g));
+			break;
+		case 2:
+			address(g, 32);
+			fprintf(g->out, "\tvst (r17), v%d\n", vreg(g));
+			break;
+		case 3: fprintf(g->out, "\t%s v%d, v%d, v%d\n", three[below(g, 8)], vreg(g), vreg(g), vreg(g)); break;
+		case 4: // divisor lanes made odd
+			fprintf(g->out, "\tld r15, 1\n\tor r15, r15, r%d\n\tvsplat v9, r15\n\t%s v%d, v%d, v9\n", reg(g),
+				below(g, 2) ? "vdiv" : "vdivf", vreg(g), vreg(g));
+			break;
+		default: fprintf(g->out, "\t%s r%d, v%d\n", below(g, 2) ? "vsum" : "vsumf", reg(g), vreg(g));
+	}
+}
+
+// what a loop or a skipped stretch holds
+static void body(Gen * g, int count) {
+	for (int i = 0; i < count; i++) {
+		switch (below(g, 4)) {
+			case 0: memory(g, g->out); break;
+			case 1: vector(g); break;
+			default: alu(g, g->out);
+		}
+	}
+}
+
+static void loop(Gen * g) {
+	int top = label(g);
+	fprintf(g->out, "\tld r14, %d\n:L%d\n", 1 + below(g, 6), top);
+	body(g, 1 + below(g, 4));
+	fprintf(g->out, "\tsubi r14, 1\n\tld r15, :L%d\n\tbrnz r15, r14\n", top);
+}
+
+static void branch(Gen * g) {
+	int past = label(g);
+	switch (below(g, 6)) {
+		case 0:
+			fprintf(g->out, "\tld r15, :L%d\n\tbrnz r15, r%d\n", past, reg(g));
+			body(g, 1 + below(g, 3));
+			break;
+		case 1:
+			fprintf(g->out, "\tld r15, :L%d\n\tbrgt r15, r%d, r%d\n", past, reg(g), reg(g));
+			body(g, 1 + below(g, 3));
+			break;
+		case 2:
+			fprintf(g->out, "\tld r15, :L%d\n\tbr r15\n", past);
+			body(g, 1 + below(g, 3));
+			break;
+		case 3:
+			fprintf(g->out, "\tbrr :L%d\n", past);
+			body(g, 1 + below(g, 3));
+			break;
+		case 4:
+			fprintf(g->out, "\tbrr 8\n");
+			single(g, g->out);
+			break;
+		default:
+			fprintf(g->out, "\tld r15, 8\n\tbrr r15\n");
+			single(g, g->out);
+	}
+	fprintf(g->out, ":L%d\n", past);
+}
+
+static void call(Gen * g) {
+	int routine = label(g);
+	fprintf(g->out, "\tld r16, :F%d\n\tcall r16\n", routine);
+	fprintf(g->routines, ":F%d\n", routine);
+	for (int i = below(g, 4); i >= 0; i--) {
+		if (below(g, 3)) alu(g, g->routines);
+		else memory(g, g->routines);
+	}
+	fprintf(g->routines, "\treturn\n");
+}
+
+static void stack(Gen * g) {
+	fprintf(g->out, "\tpush r%d\n", reg(g));
+	body(g, below(g, 3));
+	fprintf(g->out, "\tpop r%d\n", reg(g));
+}
+
+static void output(Gen * g) {
+	switch (below(g, 4)) {
+		case 0: fprintf(g->out, "\tout r%d, r%d\n", below(g, 2) ? 20 : 21, reg(g)); break;
+		case 1:
+			address(g, 32);
+			fprintf(g->out, "\tld r19, %d\n\toutn r17, r19\n", below(g, 5));
+			break;
+		case 2:
+			address(g, 32);
+			fprintf(g->out, "\tld r19, %d\n\touts r17, r19\n", below(g, 33));
+			break;
+		default:
+			if (g->reads < g->inputs) {
+				g->reads++;
+				fprintf(g->out, "\tclr r15\n\tin r%d, r15\n", reg(g));
+			} else {
+				fprintf(g->out, "\tout r20, r%d\n", reg(g));
+			}
+	}
+}
+
+static void block(Gen * g) {
+	switch (below(g, 3)) {
+		case 0: {
+			int count = below(g, 4);
+			if (count > g->inputs - g->reads) count = g->inputs - g->reads;
+			g->reads += count;
+			address(g, 32);
+			fprintf(g->out, "\tld r19, %d\n\tinn r17, r19\n", count);
+			break;
+		}
+		case 1: {
+			int from = offset(g, 64);
+			address(g, 64);
+			fprintf(g->out, "\tmov r18, r13\n");
+			if (from > 0) fprintf(g->out, "\taddi r18, %d\n", from);
+			if (from < 0) fprintf(g->out, "\tsubi r18, %d\n", -from);
+			fprintf(g->out, "\tld r19, %d\n\tmemcpy r17, r18, r19\n", below(g, 65));
+			break;
+		}
+		default:
+			address(g, 64);
+			fprintf(g->out, "\tld r19, %d\n\tmemset r17, r%d, r19\n", below(g, 65), reg(g));
+	}
+}
+
+static void heapCalls(Gen * g) {
+	fprintf(g->out, "\tld r15, %d\n\tmalloc r17, r15\n", 8 + below(g, 120));
+	fprintf(g->out, "\tmov (r17)(0), r%d\n", reg(g));
+	if (below(g, 2)) fprintf(g->out, "\tld r19, %d\n\trealloc r17, r17, r19\n", 8 + below(g, 300));
+	fprintf(g->out, "\tmov r%d, (r17)(0)\n\tfree r17\n", reg(g));
+}
+
+// copies two words over the two words that follow, which then run instead
+static void selfModify(Gen * g) {
+	int past = label(g), from = label(g), to = label(g);
+	fprintf(g->out, "\tld r15, :L%d\n\tbr r15\n:L%d\n", past, from);
+	single(g, g->out);
+	single(g, g->out);
+	fprintf(g->out, ":L%d\n\tld r17, :L%d\n\tmov r18, (r17)(0)\n\tld r17, :L%d\n\tmov (r17)(0), r18\n:L%d\n", past,
+		from, to, to);
+	single(g, g->out);
+	single(g, g->out);
+}
+
+static void fault(Gen * g) {
+	switch (below(g, 14)) {
+		case 0: fprintf(g->out, "\tclr r15\n\tdiv r%d, r%d, r15\n", reg(g), reg(g)); break;
+		case 1: fprintf(g->out, "\tclr r15\n\tdivf r%d, r%d, r15\n", reg(g), reg(g)); break;
+		case 2: fprintf(g->out, "\tclr r15\n\tvsplat v9, r15\n\tvdiv v1, v2, v9\n"); break;
+		case 3: fprintf(g->out, "\tmov r15, r31\n\tmov r%d, (r15)(%d)\n", reg(g), below(g, 2) ? 0 : -4); break;
+		case 4:
+			fprintf(g->out, "\tld r15, %llu\n\tmov (r15)(0), r%d\n", below(g, 2) ? next(g) | (1ULL << 40) : 0xfffff000ULL,
+				reg(g));
+			break;
+		case 5: fprintf(g->out, "\tld r15, %llu\n\tbr r15\n", 0x80000000ULL + below(g, 4096)); break;
+		case 6: fprintf(g->out, "\tld r15, :Bad\n\tbr r15\n"); break;
+		case 7: fprintf(g->out, "\tpriv r0, r0, r0, %d\n", 13 + below(g, 4083)); break;
+		case 8: fprintf(g->out, "\tld r15, 2\n\tout r15, r%d\n", reg(g)); break;
+		case 9:
+			fprintf(g->out, "\tclr r15\n");
+			for (; g->reads <= g->inputs; g->reads++) fprintf(g->out, "\tin r%d, r15\n", reg(g));
+			break;
+		case 10: fprintf(g->out, "\tmov r17, r31\n\tsubi r17, 8\n\tld r19, 16\n\tmemset r17, r0, r19\n"); break;
+		case 11: fprintf(g->out, "\tld r15, 24\n\tmalloc r17, r15\n\tfree r17\n\tfree r17\n"); break;
+		case 12: fprintf(g->out, "\tclr r31\n\tpush r%d\n", reg(g)); break;
+		default: // pc is 32 bits wide, so past memory but below 2 GiB
+			fprintf(g->out, "\tld r15, %d\n\tmov (r31)(-8), r15\n\treturn\n", 0x7ff00000 + 4 * below(g, 1024));
+	}
+}
+
+static void generate(Gen * g, GenProgram * program) {
+	memset(program, 0, sizeof(*program));
+	g->out = open_memstream(&program->source, &program->sourceSize);
+	char * routines = NULL;
+	size_t routinesSize = 0;
+	g->routines = open_memstream(&routines, &routinesSize);
+	FILE * input = open_memstream(&program->input, &program->inputSize);
+	if (!g->out || !g->routines || !input) {
+		fprintf(stderr, "Error: not enough memory for a program\n");
+		exit(1);
+	}
+
+	g->inputs = 2 + below(g, 8);
+	for (int i = 0; i < g->inputs; i++) fprintf(input, "%llu\n", value(g));
+	fclose(input);
+
+	if (g->choices) fprintf(g->out, "; generated from %zu choice bytes\n.code\n", g->numChoices);
+	else fprintf(g->out, "; generated by tinker gen --seed=%llu\n.code\n", g->seed);
+	fprintf(g->out, "\tld r13, :Mid\n\tld r20, 1\n\tld r21, 3\n");
+	for (int i = 1; i <= 12; i++) fprintf(g->out, "\tld r%d, %llu\n", i, value(g));
+
+	int segments = SEGMENTS + below(g, SEGMENTS + 1);
+	int faultAt = below(g, FAULT_EVERY) ? -1 : below(g, segments);
+	for (int i = 0; i < segments; i++) {
+		if (i == faultAt) {
+			fault(g);
+			break;
+		}
+		switch (below(g, 16)) {
+			case 0: case 1: case 2: body(g, 1 + below(g, 4)); break;
+			case 3: loop(g); break;
+			case 4: case 5: branch(g); break;
+			case 6: call(g); break;
+			case 7: stack(g); break;
+			case 8: case 9: vector(g); break;
+			case 10: case 11: output(g); break;
+			case 12: block(g); break;
+			case 13: heapCalls(g); break;
+			case 14: if (!below(g, 3)) selfModify(g); break;
+			default: memory(g, g->out);
+		}
+	}
+	for (int i = 1; i <= 12; i++) fprintf(g->out, "\tout r20, r%d\n", i);
+	fprintf(g->out, "\thalt\n");
+
+	fclose(g->routines);
+	fwrite(routines, 1, routinesSize, g->out);
+	free(routines);
+	fprintf(g->out, ".data\n:Buf\n");
+	for (int i = 0; i < 2 * HALF / 8; i++) {
+		if (i == HALF / 8) fprintf(g->out, ":Mid\n");
+		fprintf(g->out, "\t%llu\n", value(g));
+	}
+	fprintf(g->out, ":Bad\n\t%llu\n", 0x1fULL << 27); // opcode 31, no instruction
+	fclose(g->out);
+}
+
+void genProgram(unsigned long long seed, GenProgram * program) {
+	Gen gen = {0};
+	gen.seed = gen.state = seed;
+	generate(&gen, program);
+}
+
+void genProgramFrom(const unsigned char * choices, size_t len, GenProgram * program) {
+	Gen gen = {0};
+	gen.choices = choices;
+	gen.numChoices = len;
+	generate(&gen, program);
+}
+
+void freeGenProgram(GenProgram * program) {
+	free(program->source);
+	free(program->input);
+	memset(program, 0, sizeof(*program));
+}
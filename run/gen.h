@@ -0,0 +1,31 @@
+#pragma once
+#include <stddef.h>
+
+// Random Tinker programs for the differential checker (tinker check).
+// A program is a seeded mix of every instruction, vector operation, priv
+// service and macro: alu runs, loads and stores around a data buffer,
+// counted loops, forward branches and jumps of every form, calls to leaf
+// routines, pushes and pops, block transfers, heap calls and code that
+// overwrites the instructions ahead of it. Loops count down and every
+// other jump goes forward, so programs end. About one in four stops
+// early on a simulation error instead: a zero divisor, an access or jump
+// outside memory, an invalid opcode, a bad priv, input running out, a
+// double free or a broken stack.
+
+typedef struct GenProgram {
+	char * source;
+	size_t sourceSize;
+	char * input; // the numbers it reads, one per line
+	size_t inputSize;
+} GenProgram;
+
+// The program for seed, the same one every time
+void genProgram(unsigned long long seed, GenProgram * program);
+
+// The program steered by len bytes, each deciding one of the generator's
+// choices, so that changing a byte changes one part of the program (for
+// the round trip fuzz target). Past the last byte it carries on as for
+// seed 0.
+void genProgramFrom(const unsigned char * choices, size_t len, GenProgram * program);
+
+void freeGenProgram(GenProgram * program);
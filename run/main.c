@@ -0,0 +1,242 @@
+#include "asm.h"
+#include "gen.h"
+#include "layout.h"
+#include "sim.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// tinker: assembles a program in memory and runs it in the same process
+//
+// usage: tinker run [--no-cache] [--layout=file] program.tk
+//        tinker check [--seed=n] [--count=n] [--every=n]
+//        tinker gen [--seed=n] program.tk input
+//
+// Assembled images are cached on disk, named by a hash of the assembler
+// version, the layout and the source bytes, so running an unchanged
+// program again skips the assembler. Predecoded code is cached next to
+// them and skips the simulator's decode. The cache lives in $TINKER_CACHE,
+// else $XDG_CACHE_HOME/tinker, else ~/.cache/tinker.
+//
+// check generates count random programs (see gen.h) from seed on, runs
+// each on the reference interpreter and the predecoded core side by side
+// (simCheck in sim.h) and stops at the first program they disagree on.
+// gen writes the program for one seed and its input, to look at or to
+// run by hand.
+
+#define TKO_MAGIC "TNKERTKO"
+
+static void usage() {
+	fprintf(stderr, "usage: tinker run [--no-cache] [--layout=file] program.tk\n"
+		"       tinker check [--seed=n] [--count=n] [--every=n]\n"
+		"       tinker gen [--seed=n] program.tk input\n");
+	exit(1);
+}
+
+static uint64_t fnv1a(uint64_t h, const void * bytes, size_t len) {
+	const unsigned char * p = bytes;
+	for (size_t i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+// creates the cache directory if needed, returns null when there is none
+static char * cacheDir() {
+	static char dir[4096];
+	const char * env = getenv("TINKER_CACHE");
+	if (env && *env) snprintf(dir, sizeof(dir), "%s", env);
+	else if ((env = getenv("XDG_CACHE_HOME")) && *env) snprintf(dir, sizeof(dir), "%s/tinker", env);
+	else if ((env = getenv("HOME")) && *env) {
+		snprintf(dir, sizeof(dir), "%s/.cache", env);
+		mkdir(dir, 0755);
+		snprintf(dir, sizeof(dir), "%s/.cache/tinker", env);
+	} else return NULL;
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) return NULL;
+	return dir;
+}
+
+static unsigned char * readCached(const char * path, size_t * len) {
+	FILE * file = fopen(path, "rb");
+	if (!file) return NULL;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+	unsigned char * image = size > 8 ? malloc(size) : NULL;
+	if (image && fread(image, 1, size, file) == (size_t)size && memcmp(image, TKO_MAGIC, 8) == 0) {
+		fclose(file);
+		*len = size;
+		return image;
+	}
+	fclose(file);
+	free(image);
+	return NULL;
+}
+
+static int writeImage(FILE * file, const void * arg) {
+	const AsmResult * result = arg;
+	return fwrite(result->bytes, 1, result->size, file) == result->size ? 0 : -1;
+}
+
+static int run(int argc, char * argv[]) {
+	char * program = NULL;
+	char * layoutFile = NULL;
+	int useCache = 1;
+	for (int i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "--no-cache") == 0) useCache = 0;
+		else if (strncmp(argv[i], "--layout=", 9) == 0) layoutFile = argv[i] + 9;
+		else if (!program) program = argv[i];
+		else usage();
+	}
+	if (!program) usage();
+
+	Layout layout;
+	memset(&layout, 0, sizeof(layout));
+	defaultLayout(&layout);
+	if (layoutFile) readLayout(layoutFile, &layout);
+
+	int fd = open(program, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "Error: cannot open %s\n", program);
+		exit(1);
+	}
+	size_t size = st.st_size;
+	const char * src = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+	if (src == MAP_FAILED) {
+		fprintf(stderr, "Error: cannot read %s\n", program);
+		exit(1);
+	}
+
+	char path[4200];
+	char * dir = useCache ? cacheDir() : NULL;
+	if (dir) {
+		simDecodeCache(dir);
+		uint64_t h = 0xcbf29ce484222325ULL;
+		h = fnv1a(h, ASM_VERSION, sizeof(ASM_VERSION));
+		h = fnv1a(h, &layout, sizeof(layout));
+		h = fnv1a(h, src, size);
+		snprintf(path, sizeof(path), "%s/%016" PRIx64 "-%zx.tko", dir, h, size);
+
+		size_t len;
+		unsigned char * image = readCached(path, &len);
+		if (image) {
+			if (size) munmap((void *)src, size);
+			close(fd);
+			simRun(image, len);
+			free(image);
+			return 0;
+		}
+	}
+
+	AsmOptions options = {0};
+	options.layout = &layout;
+	AsmResult result;
+	int failed = assemble(src, size, &options, &result);
+	if (size) munmap((void *)src, size);
+	close(fd);
+	if (failed) {
+		for (int i = 0; i < result.numDiags; i++) {
+			AsmDiag * diag = &result.diags[i];
+			if (diag->line) fprintf(stderr, "%s:%d:%d: error: %s\n", program, diag->line, diag->column, diag->message);
+			else fprintf(stderr, "%s: error: %s\n", program, diag->message);
+		}
+		exit(1);
+	}
+
+	if (dir) simReplaceFile(path, writeImage, &result);
+	simRun(result.bytes, result.size);
+	freeAsmResult(&result);
+	return 0;
+}
+
+static void writeFile(const char * path, const char * bytes, size_t len) {
+	FILE * file = fopen(path, "wb");
+	int ok = file && fwrite(bytes, 1, len, file) == len;
+	if (file && fclose(file) != 0) ok = 0;
+	if (!ok) {
+		fprintf(stderr, "Error: cannot write %s\n", path);
+		exit(1);
+	}
+}
+
+static int gen(int argc, char * argv[]) {
+	unsigned long long seed = 1;
+	char * paths[2];
+	int numPaths = 0;
+	for (int i = 0; i < argc; i++) {
+		if (strncmp(argv[i], "--seed=", 7) == 0) seed = strtoull(argv[i] + 7, NULL, 0);
+		else if (numPaths < 2) paths[numPaths++] = argv[i];
+		else usage();
+	}
+	if (numPaths != 2) usage();
+	GenProgram program;
+	genProgram(seed, &program);
+	writeFile(paths[0], program.source, program.sourceSize);
+	writeFile(paths[1], program.input, program.inputSize);
+	freeGenProgram(&program);
+	return 0;
+}
+
+static int check(int argc, char * argv[]) {
+	unsigned long long seed = 1, count = 100, every = 0;
+	for (int i = 0; i < argc; i++) {
+		if (strncmp(argv[i], "--seed=", 7) == 0) seed = strtoull(argv[i] + 7, NULL, 0);
+		else if (strncmp(argv[i], "--count=", 8) == 0) count = strtoull(argv[i] + 8, NULL, 0);
+		else if (strncmp(argv[i], "--every=", 8) == 0) every = strtoull(argv[i] + 8, NULL, 0);
+		else usage();
+	}
+	FILE * sink = fopen("/dev/null", "w");
+	if (!sink) {
+		fprintf(stderr, "Error: cannot open /dev/null\n");
+		exit(1);
+	}
+
+	unsigned long long instructions = 0, failed = 0;
+	for (unsigned long long n = seed; n < seed + count; n++) {
+		GenProgram program;
+		genProgram(n, &program);
+		AsmOptions options = {0};
+		AsmResult result;
+		if (assemble(program.source, program.sourceSize, &options, &result) != 0) {
+			AsmDiag * diag = &result.diags[0];
+			fprintf(stderr, "seed %llu: line %d: %s\n", n, diag->line, diag->message);
+			exit(1);
+		}
+		FILE * in = fmemopen(program.input, program.inputSize, "r");
+		CheckStats stats;
+		if (!in) {
+			fprintf(stderr, "Error: not enough memory for the input\n");
+			exit(1);
+		}
+		int differ = simCheck(result.bytes, result.size, every, in, sink, &stats);
+		fclose(in);
+		freeAsmResult(&result);
+		freeGenProgram(&program);
+		if (differ) {
+			fprintf(stderr, "seed %llu: the cores differ, tinker gen --seed=%llu writes the program\n", n, n);
+			return 1;
+		}
+		instructions += stats.instructions;
+		failed += stats.failed;
+	}
+	fclose(sink);
+	fprintf(stderr, "check: the cores agree on %llu programs, %llu instructions, %llu stopped on a simulation error\n",
+		count, instructions, failed);
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+	if (argc < 2) usage();
+	if (strcmp(argv[1], "run") == 0) return run(argc - 2, argv + 2);
+	if (strcmp(argv[1], "check") == 0) return check(argc - 2, argv + 2);
+	if (strcmp(argv[1], "gen") == 0) return gen(argc - 2, argv + 2);
+	usage();
+}
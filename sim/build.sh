@@ -1 +1 @@
-gcc main.c -o hw5-sim
+gcc main.c sim.c lanes.c check.c serve.c guest.c stream.c heap.c profile.c sample.c symbols.c plugins.c trace.c timing.c decode.c vector.c tko.c stats.c file.c -o hw5-sim -lm -pthread -ldl
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "sim.h"
+#include "decode.h"
+#include "heap.h"
+#include "symbols.h"
+#include "vector.h"
+
+#define ull unsigned long long
+#define MAX_STORES 256 // ranges remembered between checks, past that all of memory is compared
+#define MAX_LINES 16   // differences shown for memory
+
+// Differential checker. The reference core (stepReference) and an
+// alternative core each get their own registers, memory, heap, input and
+// output, set up from one load, and take turns in the globals like lanes
+// do. The alternative runs ahead a step (a predecoded block) at a time
+// until N instructions have passed since the last check, N being the
+// interval every from --check=N (0 checks after each step). The reference
+// then catches up to the same instruction count and the two are compared:
+// pc, registers, vector registers, output so far, and the memory the
+// reference stored to since the last check (all of it after a heap priv
+// and at the end).
+//
+// A simulation error stops a core where it happened, with the instruction
+// that failed not counted, so the reference runs until it fails too or
+// passes the alternative's count, and failing at the same pc is agreement. A budget
+// (simBudget) ends the check at the first check past it. The clock priv
+// reads the instruction count while checking, as the two cores would
+// otherwise read different times, and only the reference's regions count.
+
+typedef struct Core {
+	const char * name;
+	void (*step)();
+	unsigned char * mem;
+	ull r[32];
+	ull vr[32][VLANES];
+	Heap * heap;
+	int pc, halt, failed;
+	ull retired;
+	FILE * in, * out;
+	char * output;
+	size_t outputLen;
+} Core;
+
+static Core ref, alt;
+static ull stores[MAX_STORES][2]; // address and length of the reference's stores
+static int numStores, allMemory;
+static int differences;
+static ull agreed; // instructions at the last check that passed
+static int agreedPc;
+
+static void enter(Core * c) {
+	mem = c->mem;
+	memcpy(r, c->r, sizeof(r));
+	memcpy(vr, c->vr, sizeof(vr));
+	heap = c->heap;
+	pc = c->pc;
+	halt = c->halt;
+	retired = c->retired;
+	simIn = c->in;
+	simOut = c->out;
+}
+
+static void leave(Core * c) {
+	memcpy(c->r, r, sizeof(r));
+	memcpy(c->vr, vr, sizeof(vr));
+	c->pc = pc;
+	c->halt = halt;
+	c->retired = retired;
+}
+
+static void stored(ull add, ull len) {
+	if (numStores == MAX_STORES) allMemory = 1;
+	else if (len) {
+		stores[numStores][0] = add;
+		stores[numStores++][1] = len;
+	}
+}
+
+// what the instruction at pc is about to store, from the registers before it runs
+static void noteStores() {
+	int opcode, rd, rs, rt, imm;
+	parse(readMem(pc, 4), &opcode, &rd, &rs, &rt, &imm);
+	int offset = imm & 0x800 ? imm - 0x1000 : imm;
+	switch (getCmd(opcode)) {
+		case MOV3: stored(r[rd] + offset, 8); break;
+		case CALL: stored(r[31] - 8, 8); break;
+		case VEC: if (imm == VST) stored(r[rd], 8 * VLANES); break;
+		case PRIV:
+			if (imm == 0x5) stored(r[rd], 8 * r[rs]);
+			else if (imm == 0x8 || imm == 0x9) stored(r[rd], r[rt]);
+			else if (imm >= 0xa && imm <= 0xc) allMemory = 1; // headers and canaries
+			break;
+		default: break;
+	}
+}
+
+static void stepCore(Core * c) {
+	jmp_buf trap;
+	enter(c);
+	checking = c == &ref ? 1 : 2;
+	simTrap = &trap;
+	if (setjmp(trap) == 0) {
+		if (c == &ref) noteStores();
+		c->step();
+	} else {
+		c->failed = 1;
+	}
+	simTrap = NULL;
+	checking = 0;
+	leave(c);
+}
+
+static void header() {
+	if (differences++) return;
+	char label[128], line[64];
+	fprintf(stderr, "check: %s and %s differ after %llu instructions, at %s", ref.name, alt.name, ref.retired,
+		symbolize((ull)ref.pc, label, sizeof(label)));
+	if (sourceLine((ull)ref.pc, line, sizeof(line))) fprintf(stderr, " (%s)", line);
+	fprintf(stderr, "\n  last agreed after %llu instructions, at %s\n", agreed,
+		symbolize((ull)agreedPc, label, sizeof(label)));
+	fprintf(stderr, "  %-14s %-18s %s\n", "", ref.name, alt.name);
+}
+
+static void differ(const char * what, ull a, ull b) {
+	header();
+	fprintf(stderr, "  %-14s 0x%016llx 0x%016llx\n", what, a, b);
+}
+
+static ull word(const unsigned char * p, ull add) {
+	ull v = 0;
+	for (int i = 7; i >= 0; i--) v = (v << 8) | (add + i < memSize ? p[add + i] : 0);
+	return v;
+}
+
+// compares the 8-byte words covering [add, add + len), returns the lines shown
+static int compareMemory(ull add, ull len, int shown) {
+	if (add >= memSize) return shown;
+	if (len > memSize - add) len = memSize - add;
+	for (ull at = add & ~7ULL; at < add + len; at += 8) {
+		ull a = word(ref.mem, at), b = word(alt.mem, at);
+		if (a == b) continue;
+		if (shown == MAX_LINES) fprintf(stderr, "  ...\n");
+		if (shown++ >= MAX_LINES) return shown;
+		char what[32];
+		snprintf(what, sizeof(what), "mem 0x%llx", at);
+		differ(what, a, b);
+	}
+	return shown;
+}
+
+static void compareOutput() {
+	fflush(ref.out);
+	fflush(alt.out);
+	size_t n = ref.outputLen < alt.outputLen ? ref.outputLen : alt.outputLen;
+	size_t at = 0;
+	while (at < n && ref.output[at] == alt.output[at]) at++;
+	if (at == n && ref.outputLen == alt.outputLen) return;
+	char a[32], b[32];
+	snprintf(a, sizeof(a), "%zu bytes", ref.outputLen);
+	snprintf(b, sizeof(b), "%zu bytes", alt.outputLen);
+	header();
+	fprintf(stderr, "  %-14s %-18s %s, first difference at byte %zu\n", "output", a, b, at);
+}
+
+// compares the two cores, returns nonzero when they differ
+static int compare(int end) {
+	if (ref.failed != alt.failed) differ("failed", ref.failed, alt.failed);
+	if (ref.halt != alt.halt) differ("halted", ref.halt, alt.halt);
+	if (ref.pc != alt.pc) differ("pc", (ull)ref.pc, (ull)alt.pc);
+	if (!ref.failed && !alt.failed && ref.retired != alt.retired)
+		differ("instructions", ref.retired, alt.retired);
+	for (int i = 0; i < 32; i++)
+		if (ref.r[i] != alt.r[i]) {
+			char what[8];
+			snprintf(what, sizeof(what), "r%d", i);
+			differ(what, ref.r[i], alt.r[i]);
+		}
+	for (int i = 0; i < 32; i++)
+		for (int j = 0; j < VLANES; j++)
+			if (ref.vr[i][j] != alt.vr[i][j]) {
+				char what[16];
+				snprintf(what, sizeof(what), "v%d[%d]", i, j);
+				differ(what, ref.vr[i][j], alt.vr[i][j]);
+			}
+	compareOutput();
+	if (allMemory || end) {
+		if (memcmp(ref.mem, alt.mem, memSize) != 0) compareMemory(0, memSize, 0);
+	} else {
+		int shown = 0;
+		for (int i = 0; i < numStores; i++) shown = compareMemory(stores[i][0], stores[i][1], shown);
+	}
+	numStores = allMemory = 0;
+	return differences;
+}
+
+// The cores' memories are kept from one check to the next while the size
+// and guarding stay the same, as the loader keeps mem, and are given a
+// copy of the loaded image each time, so a run of checks (the round trip
+// fuzz target) maps nothing and writes no snapshot file
+static unsigned char * kept[2];
+static ull keptSize;
+static int keptGuarded;
+
+static void keepMemories() {
+	if (kept[0] && keptSize == memSize && keptGuarded == guarded) return;
+	ull size = memSize;
+	int on = guarded;
+	if (kept[0]) { // guestFree works from the size they were made for
+		memSize = keptSize;
+		guarded = keptGuarded;
+		guestFree(kept[0]);
+		guestFree(kept[1]);
+		memSize = size;
+		guarded = on;
+	}
+	kept[0] = guestAlloc();
+	kept[1] = guestAlloc();
+	keptSize = memSize;
+	keptGuarded = guarded;
+	if (!kept[0] || !kept[1] || guarded != on) {
+		fprintf(stderr, "Error: not enough memory for the checker\n");
+		exit(1);
+	}
+}
+
+static void setUp(Core * c, const char * name, void (*step)(), unsigned char * memory, const char * input,
+		size_t inputLen) {
+	memset(c, 0, sizeof(*c));
+	c->name = name;
+	c->step = step;
+	c->mem = memory;
+	memcpy(c->mem, mem, memSize);
+	c->heap = heapCreate();
+	c->in = fmemopen((void *)input, inputLen, "r");
+	c->out = open_memstream(&c->output, &c->outputLen);
+	if (!c->heap || !c->in || !c->out) {
+		fprintf(stderr, "Error: not enough memory for the checker\n");
+		exit(1);
+	}
+	c->r[31] = memSize;
+	c->pc = pc;
+}
+
+static void tearDown(Core * c) {
+	heapDestroy(c->heap);
+	fclose(c->in);
+	fclose(c->out);
+	free(c->output);
+}
+
+int simCheck(const unsigned char * image, size_t len, unsigned long long every, FILE * in, FILE * out,
+		CheckStats * stats) {
+	char * input = NULL;
+	size_t inputLen = 0;
+	FILE * copy = open_memstream(&input, &inputLen);
+	char buf[4096];
+	size_t n;
+	while (copy && (n = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, n, copy);
+	if (!copy || fclose(copy) != 0) {
+		fprintf(stderr, "Error: cannot read the checker's input\n");
+		exit(1);
+	}
+
+	simLoad(image, len);
+	keepMemories();
+	unsigned char * base = mem;
+	Heap * baseHeap = heap;
+	setUp(&ref, "reference", stepReference, kept[0], input, inputLen);
+	setUp(&alt, "decoded", stepDecoded, kept[1], input, inputLen);
+
+	ull checks = 0, limit = budget ? budget : ~0ULL;
+	memset(stats, 0, sizeof(*stats));
+	numStores = allMemory = differences = 0;
+	agreed = 0;
+	agreedPc = ref.pc;
+	for (;;) {
+		do stepCore(&alt);
+		while (!alt.halt && !alt.failed && alt.retired - agreed < every && alt.retired < limit);
+		// one past a failed alternative, to run the instruction that failed
+		while (!ref.halt && !ref.failed && ref.retired < alt.retired + alt.failed) stepCore(&ref);
+		int end = alt.halt || alt.failed || ref.halt || ref.failed || alt.retired >= limit;
+		checks++;
+		if (compare(end) || end) break;
+		agreed = ref.retired;
+		agreedPc = ref.pc;
+	}
+
+	fwrite(ref.output, 1, ref.outputLen, out);
+	fflush(out);
+	stats->instructions = ref.retired;
+	stats->checks = checks;
+	stats->failed = ref.failed && alt.failed;
+	stats->exhausted = !ref.halt && !ref.failed && alt.retired >= limit;
+	stats->pc = ref.pc;
+	tearDown(&ref);
+	tearDown(&alt);
+	free(input);
+	mem = base;
+	heap = baseHeap;
+	return differences != 0;
+}
@@ -0,0 +1,210 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "main.h"
+#include "decode.h"
+#include "sim.h"
+
+#define ull unsigned long long
+#define DECODE_MAGIC "TNKERDEC"
+
+const Decoded * decoded;
+ull codeBase, codeLen;
+ull * blockRuns;
+static const char * cacheDir;
+static const Decoded * built; // decoded, kept past dropDecoded for the counts
+static ull builtLen;
+
+// what the last predecode allocated or mapped, kept past dropDecoded (a
+// block may still be running from it) and released by the next predecode
+static void * owned;
+static size_t ownedSize; // of the mapping, 0 when owned came from malloc
+
+// header of a cached table, the entries follow it
+typedef struct DecodeHeader {
+	char magic[8];
+	uint64_t version;
+	uint64_t codeBase;
+	uint64_t codeLen;
+	uint64_t hash;
+} DecodeHeader;
+
+void simDecodeCache(const char * dir) {
+	cacheDir = dir;
+}
+
+void dropDecoded() {
+	decoded = NULL;
+}
+
+ull fusedValue(const Decoded * d) {
+	ull v = 0;
+	for (int k = 1; k < d->rt; k++)
+		if (d[k].cmd == ADDI) v += d[k].imm;
+		else v <<= d[k].imm;
+	return v;
+}
+
+// a fused entry is counted as the clear that heads its chain, the chain's
+// other entries as themselves
+static void countEntries(const Decoded * d, const Decoded * end, ull times, ull * counts) {
+	for (; d < end; d++)
+		if (d->cmd == DECODE_FUSED_LD) counts[XOR] += times;
+		else if (d->cmd != DECODE_INVALID) counts[d->cmd] += times;
+}
+
+void blockCounts(ull * counts) {
+	for (ull i = 0; i < builtLen; i++)
+		if (blockRuns[i]) countEntries(built + i, built + i + built[i].blockLen, blockRuns[i], counts);
+}
+
+void blockCut(const Decoded * start, const Decoded * last) {
+	blockRuns[start - built]--;
+	countEntries(start, last + 1, 1, commandRuns);
+}
+
+static uint64_t hashCode() {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	uint64_t seed[3] = {DECODE_VERSION, codeBase, codeLen};
+	const unsigned char * p = (const unsigned char *)seed;
+	for (size_t i = 0; i < sizeof(seed); i++) h = (h ^ p[i]) * 0x100000001b3ULL;
+	for (ull i = 0; i < codeLen; i++) h = (h ^ mem[codeBase + i]) * 0x100000001b3ULL;
+	return h;
+}
+
+static int isBlockEnd(int cmd) {
+	switch (cmd) {
+		case BR: case BRR: case BRR2: case BRNZ: case CALL: case RETURN: case BRGT: case PRIV:
+		case DECODE_INVALID:
+			return 1;
+	}
+	return 0;
+}
+
+static void build(Decoded * table, ull n) {
+	int opcodeCmd[32];
+	for (int i = 0; i < 32; i++) opcodeCmd[i] = DECODE_INVALID;
+	for (int i = 0; i < 31; i++) opcodeCmd[cmdTable[i].opcode] = cmdTable[i].type;
+
+	// the loader only places code inside guest memory, so no readMem checks
+	const unsigned char * code = mem + codeBase;
+	for (ull i = 0; i < n; i++) {
+		const unsigned char * at = code + 4 * i;
+		uint32_t word = at[0] | at[1] << 8 | at[2] << 16 | (uint32_t)at[3] << 24;
+		Decoded * d = &table[i];
+		d->imm = word & 0xfff;
+		d->rt = (word >> 12) & 0x1f;
+		d->rs = (word >> 17) & 0x1f;
+		d->rd = (word >> 22) & 0x1f;
+		d->cmd = opcodeCmd[(word >> 27) & 0x1f];
+	}
+
+	// ld chains, fused at their head only
+	for (ull i = 0; i < n; i++) {
+		Decoded * d = &table[i];
+		if (d->cmd != XOR || d->rs != d->rd || d->rt != d->rd) continue;
+		ull len = 1;
+		while (i + len < n && len < 255 && table[i + len].rd == d->rd &&
+				(table[i + len].cmd == ADDI || table[i + len].cmd == SHFTLI))
+			len++;
+		if (len < 3) continue;
+		d->cmd = DECODE_FUSED_LD;
+		d->rt = len;
+	}
+
+	// walking backwards, each entry is one more than the entry after it
+	for (ull i = n; i-- > 0;) {
+		int next = i + 1 < n && !isBlockEnd(table[i].cmd) ? table[i + 1].blockLen : 0;
+		table[i].blockLen = next < 0xffff ? next + 1 : 0xffff;
+	}
+}
+
+// A mapped table is only trusted as far as the dispatch loop relies on it:
+// every field in range and every fused chain and block inside the table,
+// so a corrupt file, or another segment with the same hash, is decoded
+// again instead of indexing past r[] or commandRuns[]
+static int validTable(const Decoded * table, ull n) {
+	for (ull i = 0; i < n; i++) {
+		const Decoded * d = &table[i];
+		if (d->rd > 31 || d->rs > 31 || d->imm > 0xfff || !d->blockLen || d->blockLen > n - i) return 0;
+		if (d->cmd == DECODE_FUSED_LD) {
+			if (d->rt < 3 || d->rt > n - i) return 0;
+		} else if ((d->cmd > VEC && d->cmd != DECODE_INVALID) || d->rt > 31) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static const Decoded * mapCached(const char * path, uint64_t hash, ull n) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	size_t size = sizeof(DecodeHeader) + n * sizeof(Decoded);
+	void * map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size == size)
+		map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return NULL;
+
+	const DecodeHeader * header = map;
+	if (memcmp(header->magic, DECODE_MAGIC, 8) != 0 || header->version != DECODE_VERSION ||
+			header->codeBase != codeBase || header->codeLen != codeLen || header->hash != hash ||
+			!validTable((const Decoded *)(header + 1), n)) {
+		munmap(map, size);
+		return NULL;
+	}
+	owned = map;
+	ownedSize = size;
+	return (const Decoded *)(header + 1);
+}
+
+typedef struct CacheFile {
+	uint64_t hash;
+	const Decoded * table;
+	ull n;
+} CacheFile;
+
+static int writeTable(FILE * file, const void * arg) {
+	const CacheFile * c = arg;
+	DecodeHeader header = {DECODE_MAGIC, DECODE_VERSION, codeBase, codeLen, c->hash};
+	return fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(c->table, sizeof(Decoded), c->n, file) == c->n
+		? 0 : -1;
+}
+
+static const Decoded * buildOrMap(ull n) {
+	char path[4200];
+	uint64_t hash = 0;
+	const Decoded * cached;
+	if (cacheDir) {
+		hash = hashCode();
+		snprintf(path, sizeof(path), "%s/%016llx.dec", cacheDir, (ull)hash);
+		if ((cached = mapCached(path, hash, n)) != NULL) return cached;
+	}
+
+	Decoded * table = malloc(n * sizeof(Decoded));
+	if (!table) return NULL;
+	build(table, n);
+	if (cacheDir) simReplaceFile(path, writeTable, &(CacheFile){hash, table, n});
+	return owned = table;
+}
+
+void predecode() {
+	decoded = built = NULL;
+	builtLen = 0;
+	if (ownedSize) munmap(owned, ownedSize);
+	else free(owned);
+	free(blockRuns);
+	owned = NULL;
+	ownedSize = 0;
+	blockRuns = NULL;
+	codeLen &= ~3ULL;
+	ull n = codeLen / 4;
+	if (!n || !(blockRuns = calloc(n, sizeof(ull)))) return;
+	decoded = built = buildOrMap(n);
+	if (built) builtLen = n;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+
+// Predecoded code segment: one entry per instruction word, so the
+// dispatch loop skips the fetch, parse() and getCmd() of every step.
+//
+// blockLen counts the entries up to and including the next branch, call,
+// return or priv, so a straight run of instructions is dispatched without
+// looking at pc in between. A fused entry stands for a chain the assembler
+// emits for ld (xor rd, rd, rd then addi/shftli rd, ...): it sets rd to the
+// final value in one step, and the chain's own entries stay in place for
+// code that branches into its middle.
+//
+// Tables can be cached on disk (simDecodeCache in sim.h), named by a hash
+// of the code segment, and are mapped straight back in on later runs.
+
+#define DECODE_VERSION 1
+#define DECODE_INVALID 0xff // opcode with no instruction, simErr when reached
+#define DECODE_FUSED_LD 0xfe // rt holds the length of the chain
+
+typedef struct Decoded {
+	uint8_t cmd; // CommandType, DECODE_INVALID or DECODE_FUSED_LD
+	uint8_t rd, rs, rt;
+	uint16_t imm;
+	uint16_t blockLen;
+} Decoded;
+
+// the table for [codeBase, codeBase + codeLen), null once guest code is overwritten
+extern const Decoded * decoded;
+extern unsigned long long codeBase, codeLen;
+
+// Builds or maps the table for the code segment loadTko placed
+void predecode();
+
+// Called on a store into the code segment: drops the table for good
+void dropDecoded();
+
+// Times the block starting at each entry was entered, by table index.
+// Counting blocks instead of instructions keeps the run statistics (see
+// stats.h) off the dispatch loop; the mix is worked out from the table
+// when they are read.
+extern unsigned long long * blockRuns;
+
+// Adds the instructions the entered blocks ran to counts, by CommandType
+void blockCounts(unsigned long long * counts);
+
+// A block the guest's store into code cut short at last: counted as the
+// instructions that ran, to commandRuns, instead of as a whole block
+void blockCut(const Decoded * start, const Decoded * last);
+
+// The value a DECODE_FUSED_LD entry leaves in rd
+unsigned long long fusedValue(const Decoded * d);
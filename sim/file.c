@@ -0,0 +1,19 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sim.h"
+
+int simReplaceFile(const char * path, int (*write)(FILE * file, const void * arg), const void * arg) {
+	size_t size = strlen(path) + 32; // room for ".<pid>.tmp"
+	char * tmp = malloc(size);
+	if (!tmp) return -1;
+	snprintf(tmp, size, "%s.%d.tmp", path, (int)getpid());
+	FILE * file = fopen(tmp, "wb");
+	int ok = file && write(file, arg) == 0;
+	if (file && fclose(file) != 0) ok = 0;
+	if (ok && rename(tmp, path) != 0) ok = 0;
+	if (!ok && file) remove(tmp);
+	free(tmp);
+	return ok ? 0 : -1;
+}
@@ -0,0 +1,112 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "main.h"
+#include "sim.h"
+
+#define ull unsigned long long
+
+// Guarded guest memory. Guest memory is placed at the end of its pages,
+// so mem + memSize is a page boundary, and is followed by a PROT_NONE
+// reservation of 4 GiB and a bit. readMem and loadMem then only check that
+// the address is below 4 GiB: an access that runs past memSize lands in
+// the reservation and the fault handler turns it into simErr().
+#define GUARD_SPAN ((1ULL << 32) + 65536)
+
+int guarded = 1;
+
+void simGuardMemory(int on) {
+	guarded = on;
+}
+
+static ull pageRound(ull size) {
+	ull page = sysconf(_SC_PAGESIZE);
+	return (size + page - 1) & ~(page - 1);
+}
+
+// bytes in front of mem on its first page
+static ull padding() {
+	return guarded ? pageRound(memSize) - memSize : 0;
+}
+
+// the whole mapping behind a guest memory
+static ull span() {
+	ull mapped = pageRound(memSize);
+	if (guarded) return mapped + GUARD_SPAN;
+	return mapped ? mapped : pageRound(1);
+}
+
+static struct sigaction before[2]; // the SIGSEGV and SIGBUS handlers onFault replaced
+
+// SA_NODEFER keeps SIGSEGV deliverable when simErr longjmps out of here
+static void onFault(int sig, siginfo_t * info, void * context) {
+	unsigned char * at = info->si_addr;
+	if (guarded && mem && at >= mem && at < mem + GUARD_SPAN) simErr();
+	// not the guest's, fault again under the handler from before (the default crashes)
+	sigaction(sig, &before[sig == SIGBUS], NULL);
+}
+
+// reserves the span and maps size usable bytes at its start, from fd or zeroed
+static unsigned char * reserve(int fd) {
+	ull mapped = pageRound(memSize);
+	int prot = guarded ? PROT_NONE : PROT_READ | PROT_WRITE;
+	unsigned char * base = mmap(NULL, span(), prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) return NULL;
+	if (mapped && (guarded || fd >= 0)) {
+		void * at = fd < 0
+			? mmap(base, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)
+			: mmap(base, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+		if (at == MAP_FAILED) {
+			munmap(base, span());
+			return NULL;
+		}
+	}
+	return base + padding();
+}
+
+unsigned char * guestAlloc() {
+	static int installed;
+	unsigned char * p = reserve(-1);
+	if (!p && guarded) { // no room for the reservation, check every access instead
+		guarded = 0;
+		p = reserve(-1);
+	}
+	if (p && guarded && !installed) {
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_sigaction = onFault;
+		action.sa_flags = SA_SIGINFO | SA_NODEFER;
+		sigaction(SIGSEGV, &action, &before[0]);
+		sigaction(SIGBUS, &action, &before[1]);
+		installed = 1;
+	}
+	return p;
+}
+
+int guestSnapshot() {
+	FILE * file = tmpfile();
+	if (!file) return -1;
+	int fd = dup(fileno(file));
+	ull mapped = pageRound(memSize);
+	int ok = fd >= 0 && fwrite(mem - padding(), 1, guarded ? mapped : memSize, file) == (guarded ? mapped : memSize);
+	if (fclose(file) != 0 || !ok) {
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+unsigned char * guestClone(int fd) {
+	return reserve(fd);
+}
+
+int guestZero(unsigned char * p) {
+	return madvise(p - padding(), pageRound(memSize), MADV_DONTNEED);
+}
+
+void guestFree(unsigned char * p) {
+	munmap(p - padding(), span());
+}
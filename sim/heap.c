@@ -0,0 +1,227 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "sim.h"
+#include "decode.h"
+#include "heap.h"
+#include "tko.h"
+
+#define ull unsigned long long
+
+#define CLASSES 128
+#define HEADER 16
+#define CANARY 0xfdfdfdfdfdfdfdfdULL
+#define HEAP_MAGIC 0x5a17c0de2b9e4f61ULL
+
+// what the byte for each 16 bytes of the region says about a chunk there
+#define CHUNK_NONE 0
+#define CHUNK_LIVE 1
+#define CHUNK_FREED 2
+
+struct Heap {
+	ull top; // chunks are carved from here up
+	ull * lists[CLASSES]; // freed chunks of each class
+	size_t counts[CLASSES], caps[CLASSES];
+	unsigned char * chunks; // CHUNK_* per 16 bytes, only set at chunk starts
+	HeapStats stats;
+};
+
+Heap * heap;
+static ull heapBase, heapEnd;
+static ull wantBase, wantSize;
+
+void simHeapRegion(ull base, ull size) {
+	wantBase = base;
+	wantSize = size;
+}
+
+void simHeapStats(HeapStats * stats) {
+	memset(stats, 0, sizeof(*stats));
+	if (heap) *stats = heap->stats;
+	stats->size = heapEnd - heapBase;
+}
+
+static void heapError(const char * fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	fprintf(stderr, "Heap error: ");
+	vfprintf(stderr, fmt, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	simErr();
+}
+
+// 16-byte steps up to 256, then four classes per power of two
+static int classOf(ull need) {
+	if (need <= 256) return (need + 15) / 16 - 1;
+	int b = 63 - __builtin_clzll(need - 1);
+	return 16 + (b - 8) * 4 + (int)((need - 1 - (1ULL << b)) >> (b - 2));
+}
+
+static ull classSize(int cls) {
+	if (cls < 16) return (ull)(cls + 1) * 16;
+	int b = 8 + (cls - 16) / 4;
+	return (1ULL << b) + (ull)((cls - 16) % 4 + 1) * (1ULL << (b - 2));
+}
+
+static ull check(ull chunk, ull size, int cls) {
+	return (ull)cls << 56 | ((size ^ chunk ^ HEAP_MAGIC) * 0x9e3779b97f4a7c15ULL) >> 8;
+}
+
+Heap * heapCreate() {
+	Heap * h = calloc(1, sizeof(Heap));
+	if (!h) return NULL;
+	h->top = heapBase;
+	h->chunks = calloc((heapEnd - heapBase) / 16 + 1, 1);
+	if (!h->chunks) {
+		free(h);
+		return NULL;
+	}
+	return h;
+}
+
+void heapDestroy(Heap * h) {
+	if (!h) return;
+	for (int i = 0; i < CLASSES; i++) free(h->lists[i]);
+	free(h->chunks);
+	free(h);
+}
+
+void heapReset() {
+	ull base = (imageEnd + 15) & ~15ULL, end = stackStart & ~15ULL;
+	if (wantSize) {
+		base = (wantBase + 15) & ~15ULL;
+		end = (wantBase + wantSize) & ~15ULL;
+		if (wantBase > memSize || wantSize > memSize - wantBase ||
+				(wantBase < codeBase + codeLen && wantBase + wantSize > codeBase)) {
+			fprintf(stderr, "Error: heap outside of guest memory or over the code\n");
+			exit(1);
+		}
+	}
+	heapBase = base;
+	heapEnd = end > base ? end : base;
+	heapDestroy(heap);
+	if (!(heap = heapCreate())) {
+		fprintf(stderr, "Error: not enough memory for the heap\n");
+		exit(1);
+	}
+}
+
+static void place(ull chunk, ull size, int cls) {
+	loadMem(chunk, size, 8);
+	loadMem(chunk + 8, check(chunk, size, cls), 8);
+	loadMem(chunk + HEADER + size, CANARY, 8);
+	heap->chunks[(chunk - heapBase) / 16] = CHUNK_LIVE;
+	heap->stats.inUse += size;
+	if (heap->stats.inUse > heap->stats.peakInUse) heap->stats.peakInUse = heap->stats.inUse;
+}
+
+// the chunk behind a pointer the guest passes back, after checking it
+static ull chunkOf(ull add, const char * op, ull * size, int * cls) {
+	ull chunk = add - HEADER;
+	if (add < heapBase + HEADER || chunk >= heap->top || (add - heapBase) % 16)
+		heapError("%s of %#llx, which is not a heap pointer", op, add);
+	int state = heap->chunks[(chunk - heapBase) / 16];
+	if (state == CHUNK_FREED) heapError("%s of %#llx, which was already freed", op, add);
+	if (state != CHUNK_LIVE) heapError("%s of %#llx, which malloc did not return", op, add);
+
+	*size = readMem(chunk, 8);
+	ull word = readMem(chunk + 8, 8);
+	*cls = word >> 56;
+	if (*cls == 0 || *cls >= CLASSES || word != check(chunk, *size, *cls) ||
+			*size > classSize(*cls) - HEADER - 8 || chunk + classSize(*cls) > heap->top)
+		heapError("corrupt header before %#llx", add);
+	if ((ull)readMem(add + *size, 8) != CANARY)
+		heapError("write past the end of the %llu bytes at %#llx", *size, add);
+	return chunk;
+}
+
+int stackInHeap(ull sp) {
+	return heap && sp >= heapBase && sp < heap->top;
+}
+
+void stackLowered() {
+	if (stackInHeap(r[31]))
+		heapError("the stack at %#llx has grown into the heap, which is carved up to %#llx", r[31], heap->top);
+	stackLow = r[31];
+}
+
+static ull allocate(ull size) {
+	if (size > heapEnd - heapBase) return 0;
+	int cls = classOf(size + HEADER + 8);
+	// fresh space stops at the stack, wherever it has grown to
+	ull end = heapEnd;
+	if (r[31] >= heap->top && r[31] < end) end = r[31] & ~15ULL;
+	ull chunk;
+	if (heap->counts[cls]) {
+		chunk = heap->lists[cls][--heap->counts[cls]];
+	} else if (classSize(cls) <= end - heap->top) {
+		chunk = heap->top;
+		heap->top += classSize(cls);
+		heap->stats.extent = heap->top - heapBase;
+	} else {
+		// out of fresh space, settle for a freed chunk of a larger class
+		do {
+			if (++cls == CLASSES) return 0;
+		} while (!heap->counts[cls]);
+		chunk = heap->lists[cls][--heap->counts[cls]];
+	}
+	place(chunk, size, cls);
+	return chunk + HEADER;
+}
+
+static void release(ull chunk, ull size, int cls) {
+	if (heap->counts[cls] == heap->caps[cls]) {
+		size_t cap = heap->caps[cls] ? 2 * heap->caps[cls] : 16;
+		ull * list = realloc(heap->lists[cls], cap * sizeof(ull));
+		if (!list) simErr();
+		heap->lists[cls] = list;
+		heap->caps[cls] = cap;
+	}
+	heap->lists[cls][heap->counts[cls]++] = chunk;
+	heap->chunks[(chunk - heapBase) / 16] = CHUNK_FREED;
+	heap->stats.inUse -= size;
+}
+
+ull heapMalloc(ull size) {
+	heap->stats.mallocs++;
+	ull add = allocate(size);
+	if (!add) heap->stats.failed++;
+	return add;
+}
+
+void heapFree(ull add) {
+	if (!add) return;
+	heap->stats.frees++;
+	ull size;
+	int cls;
+	ull chunk = chunkOf(add, "free", &size, &cls);
+	release(chunk, size, cls);
+}
+
+ull heapRealloc(ull add, ull size) {
+	heap->stats.reallocs++;
+	if (!add) {
+		ull to = allocate(size);
+		if (!to) heap->stats.failed++;
+		return to;
+	}
+	ull old;
+	int cls;
+	ull chunk = chunkOf(add, "realloc", &old, &cls);
+	if (size <= classSize(cls) - HEADER - 8) { // still fits its chunk
+		heap->stats.inUse -= old;
+		place(chunk, size, cls);
+		return add;
+	}
+	ull to = allocate(size);
+	if (!to) { // the old block stays as it was
+		heap->stats.failed++;
+		return 0;
+	}
+	memcpy(mem + to, mem + add, old);
+	release(chunk, old, cls);
+	return to;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// Native guest heap behind priv 10-12 (malloc, free, realloc). The heap
+// is a region of guest memory, by default from the end of the loaded
+// image to the stack, carved into chunks of a few size classes:
+//
+//   chunk + 0    requested size
+//   chunk + 8    class << 56 | check of the size and address
+//   chunk + 16   the guest's bytes, 16-byte aligned
+//   after them   8 canary bytes, then slack up to the class size
+//
+// The bookkeeping (free lists and a bit per chunk start) lives outside
+// guest memory, so a stray guest write can only damage headers and
+// canaries, and free and realloc check both before trusting a chunk.
+//
+// The default region ends at the stack the image reserves (4 KiB unless its
+// layout says otherwise), but a deeper stack can still reach it. Fresh
+// chunks are never carved past r[31], and r[31] reaching below the carved
+// top stops the run with a heap error, checked where the simulator tracks
+// the lowest stack pointer.
+
+typedef struct Heap Heap;
+
+// the running guest's heap; lanes switch it like mem
+extern Heap * heap;
+
+Heap * heapCreate();
+void heapDestroy(Heap * h);
+
+// Places the region for the loaded image and starts the global heap empty
+void heapReset();
+
+// whether a stack pointer is inside the chunks carved so far
+int stackInHeap(unsigned long long sp);
+// records r[31] as the lowest stack pointer, with the check above
+void stackLowered();
+
+unsigned long long heapMalloc(unsigned long long size); // 0 when it does not fit
+void heapFree(unsigned long long add);
+unsigned long long heapRealloc(unsigned long long add, unsigned long long size);
@@ -0,0 +1,396 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "main.h"
+#include "sim.h"
+#include "decode.h"
+#include "heap.h"
+#include "vector.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#define ull unsigned long long
+#define NONE (~0ULL)
+
+// Lanes share one instruction stream while their pcs agree. Registers are
+// kept structure-of-arrays, row reg holding that register for every lane,
+// so an alu instruction is one pass over a row with a mask of the lanes
+// that are at the running pc. Memory, branches and priv run lane by lane
+// through execute() with the lane's state swapped into the globals, so
+// each lane's memory is guarded the same way as the single run's. Each
+// lane counts its own instructions, which the icount and region privs read
+// through retired while it runs them.
+
+typedef struct Lane {
+	unsigned char * mem;
+	ull (*vr)[VLANES]; // vector registers, allocated on first use
+	Heap * heap;       // also allocated on first use, by a priv
+	FILE * in, * out;
+	ull pc;            // stale while the lane is in the running group
+	ull retired;       // behind by ran while the lane is in the running group
+	int live;
+} Lane;
+
+typedef void (*laneKernel)(int cmd, ull * d, const ull * a, const ull * b, ull imm, const ull * mask, int n);
+
+static Lane * lanes;
+static int numLanes, stride; // stride is numLanes rounded up to the vector width
+static ull * regs;           // 32 rows of stride lanes
+static ull * mask;           // all ones for the lanes in the running group
+static ull cur, next;        // pc of the running group, lowest pc of the other lanes
+static int width;            // lanes in the running group
+static ull ran;              // instructions each lane of the running group ran since schedule()
+static LaneStats * stats;
+static laneKernel kernel;
+
+#define ROW(reg) (regs + (reg) * stride)
+
+static double toDouble(ull v) {
+	double db;
+	memcpy(&db, &v, sizeof(double));
+	return db;
+}
+
+static ull fromDouble(double db) {
+	ull v;
+	memcpy(&v, &db, sizeof(double));
+	return v;
+}
+
+static int isAlu(int cmd) {
+	switch (cmd) {
+		case AND: case OR: case XOR: case NOT: case SHFTR: case SHFTRI: case SHFTL: case SHFTLI:
+		case MOV1: case MOV2: case ADDF: case SUBF: case MULF:
+		case ADD: case ADDI: case SUB: case SUBI: case MUL:
+		case DECODE_FUSED_LD:
+			return 1;
+	}
+	return 0;
+}
+
+// shift counts are taken mod 64 like the host does for the scalar simulator
+
+static void stepS(int cmd, ull * d, const ull * a, const ull * b, ull imm, const ull * mask, int n) {
+	for (int l = 0; l < n; l++) {
+		if (!mask[l]) continue;
+		ull v = d[l];
+		switch (cmd) {
+			case AND   : v = a[l] & b[l]; break;
+			case OR    : v = a[l] | b[l]; break;
+			case XOR   : v = a[l] ^ b[l]; break;
+			case NOT   : v = ~a[l]; break;
+			case SHFTR : v = a[l] >> (b[l] & 63); break;
+			case SHFTRI: v = d[l] >> (imm & 63); break;
+			case SHFTL : v = a[l] << (b[l] & 63); break;
+			case SHFTLI: v = d[l] << (imm & 63); break;
+			case MOV1  : v = a[l]; break;
+			case MOV2  : v = (d[l] & ~0xfffULL) | (imm & 0xfff); break;
+			case ADDF  : v = fromDouble(toDouble(a[l]) + toDouble(b[l])); break;
+			case SUBF  : v = fromDouble(toDouble(a[l]) - toDouble(b[l])); break;
+			case MULF  : v = fromDouble(toDouble(a[l]) * toDouble(b[l])); break;
+			case ADD   : v = a[l] + b[l]; break;
+			case ADDI  : v = d[l] + imm; break;
+			case SUB   : v = a[l] - b[l]; break;
+			case SUBI  : v = d[l] - imm; break;
+			case MUL   : v = a[l] * b[l]; break;
+			case DECODE_FUSED_LD: v = imm; break;
+		}
+		d[l] = v;
+	}
+}
+
+#ifdef HAVE_X86
+// AVX2, four lanes per register, blended into rd under the mask
+// there is no 64-bit multiply below AVX-512, so mul is built from 32-bit halves
+
+__attribute__((target("avx2")))
+static void stepAVX(int cmd, ull * d, const ull * a, const ull * b, ull imm, const ull * mask, int n) {
+	const __m256i ones = _mm256_set1_epi64x(-1);
+	const __m256i count = _mm256_set1_epi64x(imm & 63);
+	const __m256i k = _mm256_set1_epi64x(imm);
+	for (int l = 0; l < n; l += 4) {
+		__m256i m = _mm256_load_si256((const __m256i *)(mask + l));
+		if (_mm256_testz_si256(m, m)) continue;
+		__m256i x = _mm256_load_si256((const __m256i *)(a + l));
+		__m256i y = _mm256_load_si256((const __m256i *)(b + l));
+		__m256i old = _mm256_load_si256((const __m256i *)(d + l));
+		__m256i v = old;
+		switch (cmd) {
+			case AND   : v = _mm256_and_si256(x, y); break;
+			case OR    : v = _mm256_or_si256(x, y); break;
+			case XOR   : v = _mm256_xor_si256(x, y); break;
+			case NOT   : v = _mm256_xor_si256(x, ones); break;
+			case SHFTR : v = _mm256_srlv_epi64(x, _mm256_and_si256(y, _mm256_set1_epi64x(63))); break;
+			case SHFTRI: v = _mm256_srlv_epi64(old, count); break;
+			case SHFTL : v = _mm256_sllv_epi64(x, _mm256_and_si256(y, _mm256_set1_epi64x(63))); break;
+			case SHFTLI: v = _mm256_sllv_epi64(old, count); break;
+			case MOV1  : v = x; break;
+			case MOV2  : v = _mm256_or_si256(_mm256_andnot_si256(_mm256_set1_epi64x(0xfff), old),
+					_mm256_set1_epi64x(imm & 0xfff)); break;
+			case ADDF  : v = _mm256_castpd_si256(_mm256_add_pd(_mm256_castsi256_pd(x), _mm256_castsi256_pd(y))); break;
+			case SUBF  : v = _mm256_castpd_si256(_mm256_sub_pd(_mm256_castsi256_pd(x), _mm256_castsi256_pd(y))); break;
+			case MULF  : v = _mm256_castpd_si256(_mm256_mul_pd(_mm256_castsi256_pd(x), _mm256_castsi256_pd(y))); break;
+			case ADD   : v = _mm256_add_epi64(x, y); break;
+			case ADDI  : v = _mm256_add_epi64(old, k); break;
+			case SUB   : v = _mm256_sub_epi64(x, y); break;
+			case SUBI  : v = _mm256_sub_epi64(old, k); break;
+			case MUL   : {
+				__m256i cross = _mm256_add_epi64(
+					_mm256_mul_epu32(_mm256_srli_epi64(x, 32), y),
+					_mm256_mul_epu32(x, _mm256_srli_epi64(y, 32)));
+				v = _mm256_add_epi64(_mm256_mul_epu32(x, y), _mm256_slli_epi64(cross, 32));
+				break;
+			}
+			case DECODE_FUSED_LD: v = k; break;
+		}
+		_mm256_store_si256((__m256i *)(d + l), _mm256_blendv_epi8(old, v, m));
+	}
+}
+#endif
+
+static void fail(int l) {
+	fprintf(stderr, "lane %d: Simulation error\n", l);
+	lanes[l].live = 0;
+	stats->failed++;
+}
+
+// Picks the lowest pc among the live lanes to run next. Lanes that took
+// the other side of a branch wait at their higher pc until the running
+// group reaches it, which is where paths through an if or a loop join.
+static void schedule() {
+	cur = NONE;
+	next = NONE;
+	width = 0;
+	for (int l = 0; l < numLanes; l++)
+		if (lanes[l].live && lanes[l].pc < cur) cur = lanes[l].pc;
+	for (int l = 0; l < numLanes; l++) {
+		if (mask[l]) lanes[l].retired += ran;
+		mask[l] = 0;
+		if (!lanes[l].live) continue;
+		if (lanes[l].pc == cur) {
+			mask[l] = NONE;
+			width++;
+		} else if (lanes[l].pc < next) next = lanes[l].pc;
+	}
+	ran = 0;
+}
+
+// brnz and brgt, where lanes split, decided per lane without execute()
+static void branch(const Decoded * d) {
+	const ull * target = ROW(d->rd), * a = ROW(d->rs), * b = ROW(d->rt);
+	for (int l = 0; l < numLanes; l++) {
+		if (!mask[l]) continue;
+		int taken = d->cmd == BRNZ ? a[l] != 0 : a[l] > b[l];
+		lanes[l].pc = taken ? target[l] : cur + 4;
+		lanes[l].retired++;
+		stats->instructions++;
+		if (taken && target[l] >= memSize) fail(l);
+	}
+}
+
+// mov loads and stores, per lane without execute(). Returns 0 when a lane
+// faulted, with the pcs of the group written back for schedule().
+static int memoryStep(const Decoded * d) {
+	ull imm = d->imm & 0x800 ? d->imm | ~0xfffULL : d->imm;
+	const ull * base = ROW(d->cmd == MOV ? d->rs : d->rd);
+	ull * reg = ROW(d->cmd == MOV ? d->rd : d->rs);
+	int ok = 1;
+	for (int l = 0; l < numLanes; l++) {
+		if (!mask[l]) continue;
+		ull add = base[l] + imm;
+		lanes[l].pc = cur + 4;
+		lanes[l].retired++;
+		stats->instructions++;
+		if (add >= memSize || add + 7 >= memSize) {
+			fail(l);
+			ok = 0;
+			continue;
+		}
+		unsigned char * p = lanes[l].mem + add;
+		if (d->cmd == MOV) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			memcpy(&reg[l], p, 8);
+#else
+			ull v = 0;
+			for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+			reg[l] = v;
+#endif
+		} else {
+			if (decoded && add < codeBase + codeLen && add + 8 > codeBase) dropDecoded();
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			memcpy(p, &reg[l], 8);
+#else
+			for (int i = 0; i < 8; i++) p[i] = reg[l] >> (8 * i);
+#endif
+		}
+	}
+	return ok;
+}
+
+// Runs one instruction on each lane of the group in turn. d is null when
+// pc is outside the predecoded table and each lane fetches its own word.
+static void scalarStep(const Decoded * d) {
+	jmp_buf trap;
+	volatile int l = 0;
+	simTrap = &trap;
+	if (setjmp(trap)) {
+		stepping = 0;
+		runningLane = -1;
+		fail(l++);
+	}
+	for (; l < numLanes; l++) {
+		if (!mask[l]) continue;
+		Lane * lane = &lanes[l];
+		mem = lane->mem;
+		pc = cur;
+		simIn = lane->in;
+		simOut = lane->out;
+
+		int cmd, rd, rs, rt, imm;
+		if (d) {
+			cmd = d->cmd; rd = d->rd; rs = d->rs; rt = d->rt; imm = d->imm;
+		} else {
+			int opcode;
+			parse(readMem(pc, 4), &opcode, &rd, &rs, &rt, &imm);
+			cmd = getCmd(opcode);
+		}
+
+		// nothing reads registers beyond its operands and the stack pointer
+		r[rs] = ROW(rs)[l];
+		r[rt] = ROW(rt)[l];
+		r[31] = ROW(31)[l];
+		r[rd] = ROW(rd)[l];
+		if (cmd == VEC) {
+			if (!lane->vr && !(lane->vr = calloc(32, sizeof(vr[0])))) simErr();
+			memcpy(vr, lane->vr, sizeof(vr));
+		}
+		if (cmd == PRIV) {
+			if (!lane->heap && !(lane->heap = heapCreate())) simErr();
+			heap = lane->heap;
+		}
+		retired = lane->retired + ran;
+		runningLane = l;
+		stepping = 1;
+		execute(cmd, rd, rs, rt, imm);
+		stepping = 0;
+		runningLane = -1;
+		if (cmd == VEC) memcpy(lane->vr, vr, sizeof(vr));
+		ROW(rd)[l] = r[rd];
+		lane->pc = (ull)pc;
+		lane->retired++;
+		stats->instructions++;
+		if (halt) {
+			halt = 0;
+			lane->live = 0;
+		}
+	}
+	simTrap = NULL;
+}
+
+static void run() {
+	schedule();
+	while (width) {
+		stats->steps++;
+		stats->groupLanes += width;
+		if (next == NONE && width > 1) stats->converged++;
+
+		ull off = cur - codeBase;
+		const Decoded * d = decoded && off < codeLen && !(off & 3) ? decoded + (off >> 2) : NULL;
+		if (d && isAlu(d->cmd)) {
+			if (d->cmd == DECODE_FUSED_LD) {
+				kernel(d->cmd, ROW(d->rd), ROW(0), ROW(0), fusedValue(d), mask, stride);
+				stats->instructions += (ull)width * d->rt;
+				ran += d->rt;
+				cur += 4 * d->rt;
+			} else {
+				kernel(d->cmd, ROW(d->rd), ROW(d->rs), ROW(d->rt), d->imm, mask, stride);
+				stats->instructions += width;
+				ran++;
+				cur += 4;
+			}
+		} else if (d && (d->cmd == MOV || d->cmd == MOV3)) {
+			if (!memoryStep(d)) {
+				schedule();
+				continue;
+			}
+			cur += 4;
+		} else {
+			if (d && (d->cmd == BRNZ || d->cmd == BRGT)) branch(d);
+			else scalarStep(d);
+			schedule();
+			continue;
+		}
+		if (cur < next) continue;
+		// caught up with a waiting lane, merge it into the group
+		for (int l = 0; l < numLanes; l++)
+			if (mask[l]) lanes[l].pc = cur;
+		schedule();
+	}
+}
+
+void simRunLanes(const unsigned char * image, size_t len, int count, FILE ** in, FILE ** out, LaneStats * laneStats) {
+	memset(laneStats, 0, sizeof(*laneStats));
+	if (count <= 0) return;
+	simLoad(image, len);
+	kernel = stepS;
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) kernel = stepAVX;
+#endif
+
+	// every lane maps the loaded image copy-on-write, so pages a lane
+	// never writes stay shared
+	int image0 = guestSnapshot();
+	if (image0 < 0) {
+		fprintf(stderr, "Error: cannot set up lane memory\n");
+		exit(1);
+	}
+
+	unsigned char * base = mem;
+	Heap * baseHeap = heap;
+	ull baseRetired = retired;
+	numLanes = count;
+	stride = (count + 3) & ~3;
+	stats = laneStats;
+	lanes = calloc(count, sizeof(Lane));
+	regs = aligned_alloc(32, 32 * stride * sizeof(ull));
+	mask = aligned_alloc(32, stride * sizeof(ull));
+	if (!lanes || !regs || !mask) {
+		fprintf(stderr, "Error: not enough memory for %d lanes\n", count);
+		exit(1);
+	}
+	memset(regs, 0, 32 * stride * sizeof(ull));
+	memset(mask, 0, stride * sizeof(ull));
+	for (int l = 0; l < count; l++) {
+		lanes[l].mem = guestClone(image0);
+		if (!lanes[l].mem) {
+			fprintf(stderr, "Error: not enough memory for %d lanes\n", count);
+			exit(1);
+		}
+		lanes[l].in = in[l];
+		lanes[l].out = out[l];
+		lanes[l].pc = pc;
+		lanes[l].retired = retired;
+		lanes[l].live = 1;
+		ROW(31)[l] = memSize;
+	}
+	close(image0);
+
+	run();
+
+	for (int l = 0; l < count; l++) {
+		guestFree(lanes[l].mem);
+		free(lanes[l].vr);
+		heapDestroy(lanes[l].heap);
+	}
+	free(lanes);
+	free(regs);
+	free(mask);
+	mem = base;
+	heap = baseHeap;
+	retired = baseRetired;
+}
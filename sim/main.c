@@ -1,335 +1,222 @@
-#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "main.h"
-#define MEM_SIZE 524288
-#define ull unsigned long long
-#define ll long long
-
-unsigned char mem[MEM_SIZE];
-ull r[32] = {0};
-int pc = 0x2000;
-int halt = 0;
-
-void simErr() {
-	fprintf(stderr, "Simulation error\n");
-	exit(1);
-}
-
-int verifyAddress(ull add) {
-	if (add < 0 || add >= MEM_SIZE) simErr();
-	return add;
-}
-
-int verifyRegister(int r) {
-	if (r < 0 || r > 31) simErr();
-	return r;
-}
-
-void sign(int *imm) {
-    if (*imm & 0x800) {  // Check if bit 11 is set
-        *imm |= 0xFFFFF000;  // Sign-extend to 32 bits
-    }
-}
-
-long long readMem(ull add, int size) { 
-    verifyAddress(add);
-    verifyAddress(add + size - 1);
-    long long ret = 0;
-    for (int i = 0; i < size; i++) {
-		ret <<= 8;
-        ret += (((long long)(mem[add+size-1-i])));
-    }
-    return ret;
-}
-
-void loadMem(ull add, long long v, int size) { 
-    verifyAddress(add);
-    verifyAddress(add + size - 1);
-    for (int i = 0; i < size; i++) {
-		//printf("%d 0x%x\n", i, (v >> (8 * i)) & 0xFF);
-        mem[add + i] = (v >> (8 * i)) & 0xFF;
-    }
-}
-
-double fcast(ull* l) {
-	double db;
-	memcpy(&db, l, sizeof(double));
-	return db;
-}
-
-ull dcast(double *db) {
-	ull l;
-	memcpy(&l, db, sizeof(ull));
-	return l;
-}
-
-void doAND(int rd, int rs, int rt, int imm) {
-	r[rd] = r[rs] & r[rt];
-}
-void doOR(int rd, int rs, int rt, int imm) {
-	r[rd] = r[rs] | r[rt];
-}
-void doXOR(int rd, int rs, int rt, int imm) {
-	r[rd] = r[rs] ^ r[rt];
-}
-
-void doNOT(int rd, int rs, int rt, int imm) {
-	r[rd] = ~r[rs];
-}
-
-void doSHFTR(int rd, int rs, int rt, int imm) {
-	r[rd] = r[rs] >> r[rt];
-}
-
-void doSHFTRI(int rd, int rs, int rt, int imm) {
-	r[rd] >>= imm;
-}
-
-void doSHFTL(int rd, int rs, int rt, int imm) {
-	r[rd] = r[rs] << r[rt];
-}
-
-void doSHFTLI(int rd, int rs, int rt, int imm) {
-	r[rd] <<= imm;
-}
-
-void doBR(int rd, int rs, int rt, int imm) {
-	pc = verifyAddress(r[rd]);
-}
-
-void doBRR(int rd, int rs, int rt, int imm) {
-	pc += r[rd];
-}
-
-void doBRR2(int rd, int rs, int rt, int imm) {
-	sign(&imm);
-	pc += imm;
-}
-
-void doBRNZ(int rd, int rs, int rt, int imm) {
-	if (r[rs] != 0) pc = verifyAddress(r[rd]);
-	else pc += 4;
-}
-
-void doCALL(int rd, int rs, int rt, int imm) {
-	loadMem(r[31]-8, pc + 4, 8);
-	pc = verifyAddress(r[rd]);
-}
-
-void doRETURN(int rd, int rs, int rt, int imm) {
-	pc = readMem(r[31]-8, 8);
-}
-
-void doBRGT(int rd, int rs, int rt, int imm) {
-	if (r[rs] > r[rt]) pc = verifyAddress(r[rd]);
-	else pc += 4;
-}
-
-void doPRIV(int rd, int rs, int rt, int imm) {
-	if (imm == 0x0) { // halt
-		halt = 1;
-	} else if (imm == 0x3 && r[rs] == 0) { // input
-										   //
-		char buf[100];
-		if (!fgets(buf, sizeof(buf), stdin)) 
-			simErr();
-
-		char *endptr;
-		errno = 0;
-		ull value = strtoull(buf, &endptr, 10);
-
-		// 1. Check for valid range
-		if (buf[0] == '-' || errno == ERANGE) {
-			simErr();
-		}
-
-		// 2. Check that entire string was valid number
-		if (*endptr != '\n' && *endptr != '\0') {
-			simErr();
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sim.h"
+#include "symbols.h"
+
+// hw5-sim: runs a .tko file with the simulator in sim.c
+//
+// usage: hw5-sim program.tko
+//        hw5-sim --lanes program.tko input...
+//        hw5-sim --serve socket program.tko
+//        hw5-sim --connect socket [--stats]
+//        hw5-sim --check[=n] program.tko
+//
+// --lanes runs one copy of the program per input file in lockstep (see
+// lanes.c), writes each copy's output to input.out and reports the
+// aggregate instruction rate on stderr.
+// --serve loads the program once and runs a fork server on a unix socket
+// (see serve.c); --connect runs one job on it with this process's stdin
+// and stdout, exits with the job's status and with --stats prints the
+// job's times and memory on stderr.
+// --check runs the program on the reference interpreter and the
+// predecoded core side by side and compares them every n instructions, or
+// at every predecoded block without n (see check.c). It exits with 1 at
+// the first difference, after describing it on stderr.
+// TINKER_DECODE_CACHE names a directory to cache predecoded code in, and
+// TINKER_CHECKED_MEMORY=1 checks every memory access in software instead
+// of relying on guard pages, TINKER_ASYNC_IO=1 moves input parsing and
+// output formatting onto their own threads (see stream.c).
+// TINKER_HEAP=base:size places the guest heap (see heap.h) and
+// TINKER_HEAP_STATS=1 prints its usage on stderr after a run.
+// TINKER_PROFILE=path profiles the run's calls into path.folded and
+// path.calls (see profile.h). Profiles and simulation errors name pcs by
+// label and source line from the symbol map in TINKER_SYMBOLS, or
+// program.map next to program.tko.
+// TINKER_SAMPLE=path samples the pc into a histogram in path.samples
+// instead (see sample.h), TINKER_SAMPLE_HZ times a second (997).
+// TINKER_TRACE=path writes every instruction run to a binary trace for
+// hw5-trace (see trace.h). TINKER_TIMING=1, or a configuration (see
+// timing.h), estimates the run's cycles on a cache and pipeline model
+// and prints them on stderr. TINKER_PLUGINS=a.so,b.so=args loads
+// instrumentation plugins (see plugin.h). TINKER_STATS=path writes the
+// run's statistics when it halts or fails, as JSON or, for a path ending
+// in .prom, in Prometheus text format (see stats.h).
+
+static int runLanes(const unsigned char * image, size_t len, int count, char ** inputs) {
+	FILE ** in = calloc(count, sizeof(FILE *));
+	FILE ** out = calloc(count, sizeof(FILE *));
+	if (!in || !out) {
+		fprintf(stderr, "Error: not enough memory for %d lanes\n", count);
+		exit(1);
+	}
+	for (int i = 0; i < count; i++) {
+		char path[4200];
+		snprintf(path, sizeof(path), "%s.out", inputs[i]);
+		if (!(in[i] = fopen(inputs[i], "r")) || !(out[i] = fopen(path, "w"))) {
+			fprintf(stderr, "Error: cannot open %s\n", in[i] ? path : inputs[i]);
+			exit(1);
 		}
-
-		r[rd] = value;
-	} else if (imm == 0x4 && r[rd] == 1) {
-		printf("%llu\n", r[rs]);
-	} else if (imm == 0x4 && r[rd] == 3) {
-		printf("%c", (char)r[rs]);
-	} else {
-		simErr();
 	}
-}
-
-void doMOV(int rd, int rs, int rt, int imm) {
-	sign(&imm);
-	r[rd] = readMem(r[rs]+imm, 8);
-}
-
-void doMOV1(int rd, int rs, int rt, int imm) {
-	sign(&imm);
-	r[rd] = r[rs];
-}
-
-void doMOV2(int rd, int rs, int rt, int imm) {
-	r[rd] >>= 12; r[rd] <<= 12;
-	r[rd] += (0xFFF & imm);
-}
 
-void doMOV3(int rd, int rs, int rt, int imm) {
-	sign(&imm);
-	loadMem(r[rd]+imm, r[rs], 8);
-}
-
-void doADDF(int rd, int rs, int rt, int imm) {
-	double sum = fcast(&r[rs]) + fcast(&r[rt]);
-	r[rd] = dcast(&sum);
-}
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	LaneStats stats;
+	simRunLanes(image, len, count, in, out, &stats);
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-void doSUBF(int rd, int rs, int rt, int imm) {
-	double diff = fcast(&r[rs]) - fcast(&r[rt]);
-	r[rd] = dcast(&diff);
-}
-
-void doMULF(int rd, int rs, int rt, int imm) {
-	double prod = fcast(&r[rs]) * fcast(&r[rt]);
-	r[rd] = dcast(&prod);
-
-}
-
-void doDIVF(int rd, int rs, int rt, int imm) {
-	double div = fcast(&r[rt]);
-	if (div == 0.0) 
-		simErr();
-
-	double quo = fcast(&r[rs]) / div;
-	r[rd] = dcast(&quo);
-
-}
-
-void doADD(int rd, int rs, int rt, int imm) {
-	r[rd] = r[rs] + r[rt];
-}
-
-void doADDI(int rd, int rs, int rt, int imm) {
-	r[rd] += imm;
-}
-
-void doSUB(int rd, int rs, int rt, int imm) {
-	r[rd] = r[rs] - r[rt];
-}
-
-void doSUBI(int rd, int rs, int rt, int imm) {
-	r[rd] -= imm;
+	for (int i = 0; i < count; i++) {
+		fclose(in[i]);
+		fclose(out[i]);
+	}
+	free(in);
+	free(out);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	double steps = stats.steps ? stats.steps : 1;
+	fprintf(stderr, "%d lanes: %llu instructions in %.3fs, %.1fM/s, %.0f%% of steps converged, %.1f lanes per step\n",
+		count, stats.instructions, seconds, stats.instructions / (seconds > 0 ? seconds : 1e-9) / 1e6,
+		100.0 * stats.converged / steps, stats.groupLanes / steps);
+	return stats.failed ? 1 : 0;
+}
+
+static void heapRegion(const char * spec) {
+	if (!spec) return;
+	char * end;
+	unsigned long long base = strtoull(spec, &end, 0), size = 0;
+	if (*end == ':') size = strtoull(end + 1, &end, 0);
+	if (*end || !size) {
+		fprintf(stderr, "Error: TINKER_HEAP should be base:size\n");
+		exit(1);
+	}
+	simHeapRegion(base, size);
 }
 
-void doMUL(int rd, int rs, int rt, int imm) {
-	r[rd] = r[rs] * r[rt];
+// TINKER_SYMBOLS, or the map hw5-asm --map would put next to the image
+static void symbols(const char * image) {
+	const char * path = getenv("TINKER_SYMBOLS");
+	char sibling[4200];
+	size_t len = strlen(image);
+	if (!path && len > 4 && len < sizeof(sibling) && strcmp(image + len - 4, ".tko") == 0) {
+		snprintf(sibling, sizeof(sibling), "%.*s.map", (int)(len - 4), image);
+		path = sibling;
+	}
+	simSymbols(path);
 }
 
-void doDIV(int rd, int rs, int rt, int imm) {
-	if (r[rt] == 0) 	
-		simErr();
-
-	r[rd] = r[rs] / r[rt];
+static void printHeapStats() {
+	HeapStats s;
+	simHeapStats(&s);
+	fflush(stdout);
+	fprintf(stderr, "heap: %llu mallocs, %llu frees, %llu reallocs, %llu failed, %llu bytes in use, "
+		"peak %llu, %llu of %llu bytes carved\n", s.mallocs, s.frees, s.reallocs, s.failed, s.inUse,
+		s.peakInUse, s.extent, s.size);
 }
 
-void parse(int i, int *opcode, int *rd, int *rs, int *rt, int *imm) {
-	int j= i;
-	*imm = i & 0xFFF; i >>= 12;
-
-
-	*rt = i & 0x1F; i >>= 5;
-	*rs = i & 0x1F; i >>= 5;
-	*rd = i & 0x1F; i >>= 5;
-	*opcode = i & 0x1F; i >>= 5;
-
-	verifyRegister(*rt);
-	verifyRegister(*rs);
-	verifyRegister(*rd);
-	//if (*rd == 0) printf("waa 0x%x\n", j), simErr();
+static void timingModel(const char * spec) {
+	if (simTiming(spec) != 0) {
+		fprintf(stderr, "Error: TINKER_TIMING should be 1 or key=value,... (see sim/timing.h)\n");
+		exit(1);
+	}
 }
 
-CommandType getCmd(int opcode) {
-	for (int i = 0; i < 30; i++)
-		if (cmdTable[i].opcode == opcode) 
-			return cmdTable[i].type;
-	simErr();
-	return -1;
+static void printCache(const char * name, const CacheStats * c) {
+	fprintf(stderr, "  %-4s %llu accesses, %llu misses (%.2f%%), %llu writebacks\n", name, c->accesses, c->misses,
+		c->accesses ? 100.0 * c->misses / c->accesses : 0.0, c->writebacks);
+}
+
+static void printTiming() {
+	TimingStats s;
+	simTimingStats(&s);
+	fflush(stdout);
+	fprintf(stderr, "timing: %llu instructions, %llu cycles, CPI %.3f\n", s.instructions, s.cycles,
+		s.instructions ? (double)s.cycles / s.instructions : 0.0);
+	printCache("l1i", &s.l1i);
+	printCache("l1d", &s.l1d);
+	printCache("l2", &s.l2);
+	fprintf(stderr, "  branches %llu, %llu mispredicted (%.2f%%), returns %llu, %llu mispredicted\n", s.branches,
+		s.mispredicts, s.branches ? 100.0 * s.mispredicts / s.branches : 0.0, s.returns, s.returnMispredicts);
+	fprintf(stderr, "  stalls %llu fetch, %llu operand, %llu branch cycles\n", s.fetchStalls, s.operandStalls,
+		s.branchStalls);
+}
+
+static int checkCores(const unsigned char * image, size_t len, unsigned long long every) {
+	CheckStats s;
+	if (simCheck(image, len, every, stdin, stdout, &s) != 0) return 1;
+	char label[128];
+	fprintf(stderr, "check: the cores agree over %llu instructions, %llu checks", s.instructions, s.checks);
+	if (s.failed) fprintf(stderr, ", both stopped on a simulation error at %s", symbolize(s.pc, label, sizeof(label)));
+	fprintf(stderr, "\n");
+	return 0;
+}
+
+static int connectJob(const char * path, int stats) {
+	ServeReply reply;
+	if (simConnect(path, &reply) != 0) {
+		fprintf(stderr, "Error: no server on %s\n", path);
+		return 1;
+	}
+	if (stats)
+		fprintf(stderr, "status %d, %.3fms wall, %.3fms user, %.3fms sys, %llu KiB\n", reply.status,
+			reply.wallMicros / 1e3, reply.userMicros / 1e3, reply.sysMicros / 1e3,
+			(unsigned long long)reply.maxRssKb);
+	return reply.status;
 }
 
-
-
 int main(int argc, char * argv[]) {
+	if (argc > 2 && strcmp(argv[1], "--connect") == 0)
+		return connectJob(argv[2], argc > 3 && strcmp(argv[3], "--stats") == 0);
+
+	int lanes = argc > 1 && strcmp(argv[1], "--lanes") == 0;
+	int serve = argc > 2 && strcmp(argv[1], "--serve") == 0;
+	int check = argc > 1 && strncmp(argv[1], "--check", 7) == 0 && (argv[1][7] == '\0' || argv[1][7] == '=');
+	int at = 1 + lanes + 2 * serve + check;
 	FILE * file;
-	if (argc < 2 || (file = fopen(argv[1], "rb")) == NULL) {
+	if (argc <= at || (file = fopen(argv[at], "rb")) == NULL) {
 		fprintf(stderr, "Invalid tinker filepath\n");
 		exit(1);
 	}
 
-	ll header[5];
-	int c = fread(header, sizeof(ull), 5, file);
-
-	pc = header[1];
-	int cnt = fread(mem+pc, 1, header[2], file); // read code
-	cnt = fread(mem+header[3], 1, header[4], file); // read mem
-													
+	struct stat st;
+	if (fstat(fileno(file), &st) != 0 || st.st_size == 0) {
+		fprintf(stderr, "Invalid tinker filepath\n");
+		exit(1);
+	}
+	unsigned char * image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (image == MAP_FAILED) {
+		fprintf(stderr, "Invalid tinker filepath\n");
+		exit(1);
+	}
+	simDecodeCache(getenv("TINKER_DECODE_CACHE"));
+	simGuardMemory(!getenv("TINKER_CHECKED_MEMORY"));
+	simAsyncIo(getenv("TINKER_ASYNC_IO") != NULL);
+	heapRegion(getenv("TINKER_HEAP"));
+	int status = 0;
+	if (serve) status = simServe(argv[2], image, st.st_size) != 0;
+	else if (lanes) {
+		symbols(argv[at]);
+		status = runLanes(image, st.st_size, argc - 3, argv + 3);
+	}
+	else if (check) {
+		symbols(argv[at]);
+		status = checkCores(image, st.st_size, argv[1][7] ? strtoull(argv[1] + 8, NULL, 0) : 0);
+	} else {
+		symbols(argv[at]);
+		simProfile(getenv("TINKER_PROFILE"));
+		simSample(getenv("TINKER_SAMPLE"), getenv("TINKER_SAMPLE_HZ") ? atoi(getenv("TINKER_SAMPLE_HZ")) : 0);
+		simTrace(getenv("TINKER_TRACE"));
+		timingModel(getenv("TINKER_TIMING"));
+		if (simPlugins(getenv("TINKER_PLUGINS")) != 0) exit(1);
+		simStats(getenv("TINKER_STATS"));
+		// at exit, last in first out, so a run that stops on a simulation error reports them too
+		if (getenv("TINKER_TIMING")) atexit(printTiming);
+		if (getenv("TINKER_HEAP_STATS")) atexit(printHeapStats);
+		simRun(image, st.st_size);
+	}
+	munmap(image, st.st_size);
 	fclose(file);
-
-	r[31] = MEM_SIZE;
-	
-	int i = 0;
-	while (!halt) {
-		// 1: extract bits for next command
-		// 2: extract opcode, operands, and literals
-		// 3: process command and update register values
-		// 4: continue until halt
-	
-		// 1
-		int read = readMem(pc, 4);
-		int opcode, rd, rs, rt, imm;
-		parse(read, &opcode, &rd, &rs, &rt, &imm);
-		CommandType cmd = getCmd(opcode);
-		//printf("%s 0x%x\n", cmdTable[cmd].name, read);
-
-		//loadMem(0, 0x123456, 8);
-		//int x = readMem(0, 8);
-		//printf("0x%x\n", x);
-
-		switch (cmd) {
-			case AND   : doAND   (rd, rs, rt, imm); pc += 4; break;
-			case OR    : doOR    (rd, rs, rt, imm); pc += 4; break;
-			case XOR   : doXOR   (rd, rs, rt, imm); pc += 4; break;
-			case NOT   : doNOT   (rd, rs, rt, imm); pc += 4; break;
-			case SHFTR : doSHFTR (rd, rs, rt, imm); pc += 4; break;
-			case SHFTRI: doSHFTRI(rd, rs, rt, imm); pc += 4; break;
-			case SHFTL : doSHFTL (rd, rs, rt, imm); pc += 4; break;
-			case SHFTLI: doSHFTLI(rd, rs, rt, imm); pc += 4; break;
-			case BR    : doBR    (rd, rs, rt, imm); pc += 0; break;
-			case BRR   : doBRR   (rd, rs, rt, imm); pc += 0; break;
-			case BRR2  : doBRR2  (rd, rs, rt, imm); pc += 0; break;
-			case BRNZ  : doBRNZ  (rd, rs, rt, imm); pc += 0; break;
-			case CALL  : doCALL  (rd, rs, rt, imm); pc += 0; break;
-			case RETURN: doRETURN(rd, rs, rt, imm); pc += 0; break;
-			case BRGT  : doBRGT  (rd, rs, rt, imm); pc += 0; break;
-			case PRIV  : doPRIV  (rd, rs, rt, imm); pc += 4; break;
-			case MOV   : doMOV   (rd, rs, rt, imm); pc += 4; break;
-			case MOV1  : doMOV1  (rd, rs, rt, imm); pc += 4; break;
-			case MOV2  : doMOV2  (rd, rs, rt, imm); pc += 4; break;
-			case MOV3  : doMOV3  (rd, rs, rt, imm); pc += 4; break;
-			case ADDF  : doADDF  (rd, rs, rt, imm); pc += 4; break;
-			case SUBF  : doSUBF  (rd, rs, rt, imm); pc += 4; break;
-			case MULF  : doMULF  (rd, rs, rt, imm); pc += 4; break;
-			case DIVF  : doDIVF  (rd, rs, rt, imm); pc += 4; break;
-			case ADD   : doADD   (rd, rs, rt, imm); pc += 4; break;
-			case ADDI  : doADDI  (rd, rs, rt, imm); pc += 4; break;
-			case SUB   : doSUB   (rd, rs, rt, imm); pc += 4; break;
-			case SUBI  : doSUBI  (rd, rs, rt, imm); pc += 4; break;
-			case MUL   : doMUL   (rd, rs, rt, imm); pc += 4; break;
-			case DIV   : doDIV   (rd, rs, rt, imm); pc += 4; break;
-			default: 
-			   simErr();
-			   break;
-		}
-
-	}	
+	return status;
 }
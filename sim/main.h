@@ -1,3 +1,6 @@
+#pragma once
+#include <setjmp.h>
+#include <stdio.h>
 typedef enum CommandType {
 	AND    ,
 	OR     ,
@@ -29,6 +32,7 @@ typedef enum CommandType {
 	SUBI     ,
 	MUL     ,
 	DIV     ,
+	VEC     ,
 // MACROS
 	IN,
 	OUT,
@@ -79,6 +83,7 @@ static CmdMap cmdTable[] = {
 	{"subi", SUBI, 1, 0x1b},
     {"mul", MUL, 1, 0x1c}, 
 	{"div", DIV, 1, 0x1d},
+    {"vec", VEC, 1, 0x1e},
 
     {"in", IN, 1, -1},
 	{"out", OUT, 1, -1},
@@ -90,3 +95,72 @@ static CmdMap cmdTable[] = {
 	{"halt", HALT, 1, -1}
 };
 
+#define MEM_SIZE 524288       // default guest memory size
+#define MAX_MEM_SIZE (1 << 30) // largest memory an image may ask for
+#define DEFAULT_STACK 0x1000   // stack the assembler reserves by default
+
+// simulator state and helpers shared with the other source files
+extern unsigned char * mem;
+extern unsigned long long memSize;
+extern unsigned long long r[32];
+extern unsigned long long retired; // instructions simStart has run
+extern unsigned long long budget;  // simBudget's, 0 for none
+extern unsigned long long retiredLimit; // simStart stops with simErr when retired reaches it
+extern int pc;
+extern int halt;
+extern FILE * simIn, * simOut; // priv input and output
+extern jmp_buf * simTrap;       // when set, simErr jumps here instead of exiting
+
+// run statistics (stats.h), kept on every run
+extern unsigned long long commandRuns[VEC + 1]; // instructions run one at a time, by CommandType
+extern unsigned long long vectorLoads, vectorStores;
+extern unsigned long long stackLow;   // lowest r[31] an instruction started with or wrote
+extern unsigned long long touchedEnd; // one past the highest address loaded or stored
+extern unsigned long long inputPrivs, inputValues, inputBytes, outputPrivs, outputBytes;
+extern int stepping;    // the running instruction is not in retired yet, as outside a predecoded block
+// set by simCheck to the core it steps, 1 for the reference and 2 for the
+// other: the clock priv reads the instruction count so the cores agree,
+// and only the reference's regions are kept
+extern int checking;
+extern int runningLane; // set by simRunLanes to the lane running a priv, -1 otherwise
+static inline void touched(unsigned long long end) {
+	if (end > touchedEnd) touchedEnd = end;
+}
+
+// guest memory (guest.c), all of memSize bytes
+extern int guarded;                // accesses past memSize fault instead of being checked
+unsigned char * guestAlloc();      // zeroed, null when out of memory
+int guestSnapshot();               // file holding a copy of mem, for guestClone
+unsigned char * guestClone(int fd); // copy-on-write mapping of a snapshot
+int guestZero(unsigned char * p);    // zeroes a guestAlloc memory in place, -1 when it cannot
+void guestFree(unsigned char * p);
+
+void simErr();
+int verifyAddress(unsigned long long add);
+long long readMem(unsigned long long add, int size);
+void loadMem(unsigned long long add, long long v, int size);
+int fetch(unsigned long long add); // the instruction word at add, not counted as a load
+// Reads one line of decimal priv input, returns the bytes it took and -1
+// at the end of input or on anything that is not a number in range
+int readInput(FILE * in, unsigned long long * value);
+
+// priv input and output through the reader and writer threads of
+// stream.c, when streaming is set by streamStart
+#define STREAM_NUMBER 0
+#define STREAM_CHAR 1
+extern int streaming;
+void streamStart();
+void streamStop();
+int streamIn(unsigned long long * value); // readInput's result for the next line
+void streamOut(int kind, unsigned long long v);
+
+void parse(int i, int *opcode, int *rd, int *rs, int *rt, int *imm);
+CommandType getCmd(int opcode);
+void execute(int cmd, int rd, int rs, int rt, int imm);
+
+// The two cores, each run on the state in the globals: stepReference
+// fetches, parses and executes one instruction, stepDecoded (what
+// simStart runs) a block from the predecoded table. Both add what they
+// ran to retired.
+void stepReference();
+void stepDecoded();
@@ -0,0 +1,62 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Plugin interface. A plugin is a shared object hw5-sim loads with dlopen
+// (TINKER_PLUGINS=a.so,b.so=args). It exports
+//
+//   int tinkerPlugin(const TinkerApi * api, const char * args);
+//
+// which subscribes callbacks to the events it wants and returns 0, or
+// nonzero to stop the run before it starts. args is what followed '=' in
+// its TINKER_PLUGINS entry, "" without one. Each callback gets back the
+// ctx pointer it was subscribed with.
+//
+// While anything subscribes to a per-instruction event, the guest runs one
+// instruction at a time through a copy of the loop built for exactly the
+// events that have subscribers; with none, it runs on the usual
+// predecoded core and plugins cost nothing. Build plugins with
+// -shared -fPIC -I sim (see plugins/).
+
+#define TINKER_PLUGIN_VERSION 1
+
+// before an instruction runs: its pc and its word
+typedef void (*TinkerExecute)(void * ctx, uint64_t pc, uint32_t word);
+
+// after a load or store: the instruction's pc and the bytes it touched;
+// block privs (inn, outn, outs, memcpy, memset) report their whole range
+typedef void (*TinkerMemory)(void * ctx, uint64_t pc, uint64_t address, uint64_t size);
+
+// after a branch, call or return: where it went when taken is set, else
+// where it would have gone
+typedef void (*TinkerBranch)(void * ctx, uint64_t pc, uint64_t target, int taken);
+
+// before a priv runs: its literal and register operands
+typedef void (*TinkerPriv)(void * ctx, uint64_t pc, int imm, int rd, int rs, int rt);
+
+// once, when the guest halts or stops on a simulation error, with the
+// number of instructions it ran
+typedef void (*TinkerHalt)(void * ctx, uint64_t instructions, int failed);
+
+typedef struct TinkerApi {
+	int version; // TINKER_PLUGIN_VERSION
+
+	void (*onExecute)(TinkerExecute fn, void * ctx);
+	void (*onRead)(TinkerMemory fn, void * ctx);
+	void (*onWrite)(TinkerMemory fn, void * ctx);
+	void (*onBranch)(TinkerBranch fn, void * ctx);
+	void (*onPriv)(TinkerPriv fn, void * ctx);
+	void (*onHalt)(TinkerHalt fn, void * ctx);
+
+	// guest state, valid from the first event on
+	uint64_t (*reg)(int n);
+	const unsigned char * (*memory)(uint64_t * size);
+	void (*code)(uint64_t * base, uint64_t * size); // the code segment
+
+	// names pcs from the symbol map, as in profiles; sourceLine returns
+	// null when the map has no line for pc
+	const char * (*symbolize)(uint64_t pc, char * buf, size_t len);
+	const char * (*sourceLine)(uint64_t pc, char * buf, size_t len);
+} TinkerApi;
+
+typedef int (*TinkerPluginInit)(const TinkerApi * api, const char * args);
@@ -0,0 +1,147 @@
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "sim.h"
+#include "decode.h"
+#include "plugin.h"
+#include "plugins.h"
+#include "symbols.h"
+
+#define ull unsigned long long
+#define MAX_HOOKS 16 // callbacks per event
+
+int pluginEvents;
+static int running;
+static ull started; // retired at pluginStart
+
+// one array of callbacks per event, and the function the api hands out to
+// subscribe to it
+#define HOOKS(name, type, bit) \
+	static struct { type fn; void * ctx; } name[MAX_HOOKS]; \
+	static int name##Count; \
+	static void name##Subscribe(type fn, void * ctx) { \
+		if (name##Count == MAX_HOOKS) { \
+			fprintf(stderr, "Error: more than %d plugin callbacks for one event\n", MAX_HOOKS); \
+			exit(1); \
+		} \
+		name[name##Count].fn = fn; \
+		name[name##Count++].ctx = ctx; \
+		pluginEvents |= bit; \
+	}
+
+HOOKS(executes, TinkerExecute, PLUGIN_EXECUTE)
+HOOKS(reads, TinkerMemory, PLUGIN_READ)
+HOOKS(writes, TinkerMemory, PLUGIN_WRITE)
+HOOKS(branches, TinkerBranch, PLUGIN_BRANCH)
+HOOKS(privs, TinkerPriv, PLUGIN_PRIV)
+HOOKS(halts, TinkerHalt, 0)
+
+static uint64_t guestReg(int n) {
+	return r[n & 31];
+}
+
+static const unsigned char * guestMemory(uint64_t * size) {
+	*size = memSize;
+	return mem;
+}
+
+static void guestCode(uint64_t * base, uint64_t * size) {
+	*base = codeBase;
+	*size = codeLen;
+}
+
+static const char * pcName(uint64_t pc, char * buf, size_t len) {
+	return symbolize(pc, buf, len);
+}
+
+static const char * pcLine(uint64_t pc, char * buf, size_t len) {
+	return sourceLine(pc, buf, len);
+}
+
+static const TinkerApi api = {
+	TINKER_PLUGIN_VERSION,
+	executesSubscribe, readsSubscribe, writesSubscribe, branchesSubscribe, privsSubscribe, haltsSubscribe,
+	guestReg, guestMemory, guestCode, pcName, pcLine,
+};
+
+static int loadPlugin(const char * path, const char * args) {
+	char local[4200];
+	if (!strchr(path, '/')) { // dlopen would search the library path instead
+		snprintf(local, sizeof(local), "./%s", path);
+		path = local;
+	}
+	void * handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		fprintf(stderr, "Error: cannot load plugin %s: %s\n", path, dlerror());
+		return -1;
+	}
+	TinkerPluginInit init = (TinkerPluginInit)dlsym(handle, "tinkerPlugin");
+	if (!init) {
+		fprintf(stderr, "Error: %s has no tinkerPlugin\n", path);
+		return -1;
+	}
+	if (init(&api, args) != 0) {
+		fprintf(stderr, "Error: plugin %s did not start\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+int simPlugins(const char * list) {
+	if (!list) return 0;
+	char * copy = strdup(list);
+	if (!copy) return -1;
+	int status = 0;
+	for (char * save, * entry = strtok_r(copy, ",", &save); entry && !status; entry = strtok_r(NULL, ",", &save)) {
+		char * args = strchr(entry, '=');
+		if (args) *args++ = '\0';
+		status = loadPlugin(entry, args ? args : "");
+	}
+	free(copy);
+	return status;
+}
+
+static void stop(int failed) {
+	if (!running) return;
+	running = 0;
+	for (int i = 0; i < haltsCount; i++) halts[i].fn(halts[i].ctx, retired - started, failed);
+}
+
+static void stopFailed() {
+	stop(1);
+}
+
+void pluginStart() {
+	static int registered;
+	if (!haltsCount && !pluginEvents) return;
+	if (!registered) atexit(stopFailed);
+	registered = 1;
+	running = 1;
+	started = retired;
+}
+
+void pluginStop() {
+	stop(0);
+}
+
+void pluginExecute(ull pc, unsigned int word) {
+	for (int i = 0; i < executesCount; i++) executes[i].fn(executes[i].ctx, pc, word);
+}
+
+void pluginRead(ull pc, ull address, ull size) {
+	for (int i = 0; i < readsCount; i++) reads[i].fn(reads[i].ctx, pc, address, size);
+}
+
+void pluginWrite(ull pc, ull address, ull size) {
+	for (int i = 0; i < writesCount; i++) writes[i].fn(writes[i].ctx, pc, address, size);
+}
+
+void pluginBranch(ull pc, ull target, int taken) {
+	for (int i = 0; i < branchesCount; i++) branches[i].fn(branches[i].ctx, pc, target, taken);
+}
+
+void pluginPriv(ull pc, int imm, int rd, int rs, int rt) {
+	for (int i = 0; i < privsCount; i++) privs[i].fn(privs[i].ctx, pc, imm, rd, rs, rt);
+}
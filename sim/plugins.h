@@ -0,0 +1,26 @@
+#pragma once
+
+// Loads plugins (see plugin.h) and passes events to the callbacks they
+// subscribe. pluginEvents holds a PLUGIN_* bit for every per-instruction
+// event with at least one subscriber; simStart runs the guest through
+// traceRun (trace.c) while it is nonzero, on a loop specialized for
+// exactly those bits.
+
+#define PLUGIN_EXECUTE 0x1
+#define PLUGIN_READ    0x2
+#define PLUGIN_WRITE   0x4
+#define PLUGIN_BRANCH  0x8
+#define PLUGIN_PRIV    0x10
+
+extern int pluginEvents;
+
+void pluginStart();
+void pluginExecute(unsigned long long pc, unsigned int word);
+void pluginRead(unsigned long long pc, unsigned long long address, unsigned long long size);
+void pluginWrite(unsigned long long pc, unsigned long long address, unsigned long long size);
+void pluginBranch(unsigned long long pc, unsigned long long target, int taken);
+void pluginPriv(unsigned long long pc, int imm, int rd, int rs, int rt);
+
+// Fires the halt callbacks; also run at exit after a simulation error,
+// which they see as failed
+void pluginStop();
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "sim.h"
+#include "profile.h"
+#include "symbols.h"
+
+#define ull unsigned long long
+
+// One counter record, found by a two-word key:
+//   call tree nodes  (parent node, routine), self counts for the folded stacks
+//   routines         (entry pc, 0)
+//   call sites       (call pc, routine)
+typedef struct Stat {
+	ull a, b;
+	ull calls, self, incl;
+	int active; // frames of it on the shadow stack, inclusive counts only close the outermost
+} Stat;
+
+typedef struct Table {
+	Stat * stats;
+	int count, max;
+	int * slots; // open addressing over stats, -1 when empty
+	int numSlots;
+} Table;
+
+typedef struct Frame {
+	int node, routine, site;
+	ull ret;   // where its return goes
+	ull start; // retired when it was entered
+} Frame;
+
+int profiling;
+volatile int profileTop = -1;
+static const char * outputPath;
+static Table nodes, routines, sites;
+static Frame * frames;
+static int depth, maxDepth;
+static ull mark;    // retired when the top frame was last charged
+static ull started; // retired at profileStart
+
+void simProfile(const char * path) {
+	outputPath = path;
+}
+
+static void outOfMemory() {
+	fprintf(stderr, "Error: not enough memory for the profile\n");
+	exit(1);
+}
+
+static unsigned hashKey(ull a, ull b) {
+	ull h = (a * 0x9e3779b97f4a7c15ULL) ^ (b * 0xc2b2ae3d27d4eb4fULL);
+	return (unsigned)(h ^ (h >> 29));
+}
+
+static void rehash(Table * t) {
+	int numSlots = t->numSlots ? 2 * t->numSlots : 1024;
+	int * slots = malloc(numSlots * sizeof(int));
+	if (!slots) outOfMemory();
+	memset(slots, -1, numSlots * sizeof(int));
+	for (int i = 0; i < t->count; i++) {
+		unsigned at = hashKey(t->stats[i].a, t->stats[i].b) & (numSlots - 1);
+		while (slots[at] >= 0) at = (at + 1) & (numSlots - 1);
+		slots[at] = i;
+	}
+	free(t->slots);
+	t->slots = slots;
+	t->numSlots = numSlots;
+}
+
+// index of the record for (a, b), added zeroed when it is new
+static int find(Table * t, ull a, ull b) {
+	if (2 * (t->count + 1) > t->numSlots) rehash(t);
+	unsigned at = hashKey(a, b) & (t->numSlots - 1);
+	for (; t->slots[at] >= 0; at = (at + 1) & (t->numSlots - 1)) {
+		Stat * s = &t->stats[t->slots[at]];
+		if (s->a == a && s->b == b) return t->slots[at];
+	}
+	if (t->count == t->max) {
+		t->max = t->max ? 2 * t->max : 1024;
+		if (!(t->stats = realloc(t->stats, t->max * sizeof(Stat)))) outOfMemory();
+	}
+	t->stats[t->count] = (Stat){a, b, 0, 0, 0, 0};
+	t->slots[at] = t->count;
+	return t->count++;
+}
+
+static void clear(Table * t) {
+	free(t->stats);
+	free(t->slots);
+	memset(t, 0, sizeof(*t));
+}
+
+static void push(int node, int routine, int site, ull ret) {
+	if (depth == maxDepth) {
+		maxDepth = maxDepth ? 2 * maxDepth : 256;
+		if (!(frames = realloc(frames, maxDepth * sizeof(Frame)))) outOfMemory();
+	}
+	frames[depth++] = (Frame){node, routine, site, ret, retired};
+	routines.stats[routine].active++;
+	if (site >= 0) sites.stats[site].active++;
+	profileTop = node;
+}
+
+static void pop() {
+	Frame * f = &frames[--depth];
+	profileTop = depth ? frames[depth - 1].node : -1;
+	ull incl = retired - f->start;
+	if (--routines.stats[f->routine].active == 0) routines.stats[f->routine].incl += incl;
+	if (f->site >= 0 && --sites.stats[f->site].active == 0) sites.stats[f->site].incl += incl;
+}
+
+// charges what ran since the last call or return to the top frame
+static void charge() {
+	Frame * f = &frames[depth - 1];
+	nodes.stats[f->node].self += retired - mark;
+	routines.stats[f->routine].self += retired - mark;
+	mark = retired;
+}
+
+void profileStart() {
+	static int registered;
+	if (!outputPath || profiling) return;
+	clear(&nodes);
+	clear(&routines);
+	clear(&sites);
+	depth = 0;
+	mark = started = retired;
+	int root = find(&routines, (ull)pc, 0);
+	routines.stats[root].calls = 1;
+	push(find(&nodes, ~0ULL, (ull)pc), root, -1, ~0ULL);
+	if (!registered) atexit(profileStop);
+	registered = 1;
+	profiling = 1;
+}
+
+void profileCall(ull site, ull target) {
+	charge();
+	int routine = find(&routines, target, 0);
+	int at = find(&sites, site, target);
+	routines.stats[routine].calls++;
+	sites.stats[at].calls++;
+	push(find(&nodes, frames[depth - 1].node, target), routine, at, site + 4);
+}
+
+void profileReturn(ull to) {
+	int at = depth - 1;
+	while (at > 0 && frames[at].ret != to) at--;
+	if (at == 0) return; // not to any caller on the stack
+	charge();
+	while (depth > at) pop();
+}
+
+static const char * name(ull pc, char * buf) {
+	return symbolize(pc, buf, 128);
+}
+
+// the call path down to a node, root first
+static void printPath(FILE * file, int node, int * path) {
+	int n = 0;
+	for (; node >= 0; node = nodes.stats[node].a == ~0ULL ? -1 : (int)nodes.stats[node].a)
+		path[n++] = node;
+	char buf[128];
+	while (n--) {
+		fputs(name(nodes.stats[path[n]].b, buf), file);
+		if (n) fputc(';', file);
+	}
+}
+
+void profilePath(FILE * file, int node) {
+	int * path = malloc((nodes.count + 1) * sizeof(int));
+	if (!path) outOfMemory();
+	printPath(file, node, path);
+	free(path);
+}
+
+static int byInclusive(const void * x, const void * y) {
+	const Stat * a = &routines.stats[*(const int *)x], * b = &routines.stats[*(const int *)y];
+	if (a->incl != b->incl) return a->incl > b->incl ? -1 : 1;
+	return a->a < b->a ? -1 : a->a > b->a;
+}
+
+static int bySiteInclusive(const void * x, const void * y) {
+	const Stat * a = &sites.stats[*(const int *)x], * b = &sites.stats[*(const int *)y];
+	if (a->b != b->b) return a->b < b->b ? -1 : 1;
+	if (a->incl != b->incl) return a->incl > b->incl ? -1 : 1;
+	return a->a < b->a ? -1 : a->a > b->a;
+}
+
+static FILE * openOutput(const char * suffix) {
+	char path[4200];
+	snprintf(path, sizeof(path), "%s.%s", outputPath, suffix);
+	FILE * file = fopen(path, "w");
+	if (!file) fprintf(stderr, "Error: cannot write %s\n", path);
+	return file;
+}
+
+static void writeFolded() {
+	FILE * file = openOutput("folded");
+	if (!file) return;
+	int * path = malloc((nodes.count + 1) * sizeof(int)); // a path has each node at most once
+	if (!path) outOfMemory();
+	for (int i = 0; i < nodes.count; i++) {
+		if (!nodes.stats[i].self) continue;
+		printPath(file, i, path);
+		fprintf(file, " %llu\n", nodes.stats[i].self);
+	}
+	free(path);
+	fclose(file);
+}
+
+// routines by inclusive count, each followed by the sites that call it
+static void writeCalls() {
+	FILE * file = openOutput("calls");
+	if (!file) return;
+	int * order = malloc((routines.count + sites.count + 1) * sizeof(int));
+	if (!order) outOfMemory();
+	int * siteOrder = order + routines.count;
+	for (int i = 0; i < routines.count; i++) order[i] = i;
+	for (int i = 0; i < sites.count; i++) siteOrder[i] = i;
+	qsort(order, routines.count, sizeof(int), byInclusive);
+	qsort(siteOrder, sites.count, sizeof(int), bySiteInclusive);
+
+	ull total = retired - started;
+	double scale = total ? 100.0 / total : 0;
+	fprintf(file, "%llu instructions\n\n", total);
+	fprintf(file, "%-32s %12s %14s %7s %14s %7s\n", "routine", "calls", "self", "self%", "inclusive", "incl%");
+	char buf[128], site[128];
+	for (int i = 0; i < routines.count; i++) {
+		Stat * routine = &routines.stats[order[i]];
+		fprintf(file, "%-32s %12llu %14llu %6.2f%% %14llu %6.2f%%\n", name(routine->a, buf), routine->calls,
+			routine->self, routine->self * scale, routine->incl, routine->incl * scale);
+		// sites are sorted by routine, so its callers are one run
+		int lo = 0, hi = sites.count;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (sites.stats[siteOrder[mid]].b < routine->a) lo = mid + 1;
+			else hi = mid;
+		}
+		for (int j = lo; j < sites.count && sites.stats[siteOrder[j]].b == routine->a; j++) {
+			Stat * s = &sites.stats[siteOrder[j]];
+			snprintf(site, sizeof(site), "  from %s", name(s->a, buf));
+			fprintf(file, "%-32s %12llu %14s %7s %14llu %6.2f%%", site, s->calls, "", "", s->incl, s->incl * scale);
+			if (sourceLine(s->a, buf, sizeof(buf))) fprintf(file, "  %s", buf);
+			fputc('\n', file);
+		}
+	}
+	fclose(file);
+	free(order);
+}
+
+void profileStop() {
+	if (!profiling) return;
+	profiling = 0;
+	charge();
+	while (depth > 0) pop();
+	writeFolded();
+	writeCalls();
+}
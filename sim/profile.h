@@ -0,0 +1,31 @@
+#pragma once
+#include <stdio.h>
+
+// Call-graph profiler. simStart counts retired instructions a block at a
+// time; with profiling set, doCALL and doRETURN also keep a shadow call
+// stack, and the instructions retired between two calls or returns are
+// charged to the routine on top of it. At the end of the run the profile
+// is written as folded stacks (path.folded, one "a;b;c count" line per
+// call path, the input flamegraph.pl expects) and as a table of every
+// routine's self and inclusive counts with its call sites (path.calls).
+//
+// A routine is named by its entry pc, through the symbol map when there
+// is one. Returns are matched to the innermost frame whose return address
+// they go to, so code that unwinds several frames at once stays balanced
+// and a return that matches no frame is not counted as one.
+
+extern int profiling;
+
+// call tree node on top of the shadow stack, -1 when not profiling; set
+// only once a call or return is complete, so a signal handler can read it
+extern volatile int profileTop;
+
+void profileStart();
+void profileCall(unsigned long long site, unsigned long long target);
+void profileReturn(unsigned long long to);
+
+// Writes the profile files; also run at exit after a simulation error
+void profileStop();
+
+// Writes the call path to a profileTop node, root first and ';' separated
+void profilePath(FILE * file, int node);
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include "main.h"
+#include "sim.h"
+#include "profile.h"
+#include "sample.h"
+#include "symbols.h"
+
+#define ull unsigned long long
+
+#define SAMPLE_MAX (1 << 20)
+
+typedef struct Sample {
+	uint32_t pc;
+	int32_t node; // profileTop, -1 without the call-graph profiler
+} Sample;
+
+typedef struct Count {
+	char name[128];
+	char line[64]; // source line, pcs only
+	ull pc;
+	ull samples;
+} Count;
+
+static const char * samplePath;
+static int sampleHz = 997; // prime, so it does not beat with loops in the guest
+static int sampling;
+
+// written by the handler only, read once the timer is gone
+static Sample * samples;
+static size_t numSamples;
+static unsigned stride, skip; // keep one tick in stride
+
+#ifdef SIGEV_THREAD_ID
+static timer_t timer;
+#endif
+
+void simSample(const char * path, int hz) {
+	samplePath = path;
+	if (hz > 0) sampleHz = hz;
+}
+
+static void onTick(int sig) {
+	if (++skip < stride) return;
+	skip = 0;
+	if (numSamples == SAMPLE_MAX) {
+		for (size_t i = 0; i < SAMPLE_MAX / 2; i++) samples[i] = samples[2 * i + 1];
+		numSamples = SAMPLE_MAX / 2;
+		stride *= 2;
+	}
+	samples[numSamples++] = (Sample){(uint32_t)*(volatile int *)&pc, profileTop};
+}
+
+// cpu time of this thread only, so the I/O threads of stream.c neither
+// take samples nor make them
+static int arm(long interval) {
+	struct itimerspec spec = {{interval / 1000000000, interval % 1000000000},
+		{interval / 1000000000, interval % 1000000000}};
+#ifdef SIGEV_THREAD_ID
+	struct sigevent event;
+	memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGPROF;
+	event._sigev_un._tid = syscall(SYS_gettid);
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0) return -1;
+	if (timer_settime(timer, 0, &spec, NULL) != 0) {
+		timer_delete(timer);
+		return -1;
+	}
+	return 0;
+#else
+	struct itimerval value = {{spec.it_interval.tv_sec, spec.it_interval.tv_nsec / 1000},
+		{spec.it_value.tv_sec, spec.it_value.tv_nsec / 1000}};
+	return setitimer(ITIMER_PROF, &value, NULL);
+#endif
+}
+
+static void disarm() {
+#ifdef SIGEV_THREAD_ID
+	timer_delete(timer);
+#else
+	struct itimerval off;
+	memset(&off, 0, sizeof(off));
+	setitimer(ITIMER_PROF, &off, NULL);
+#endif
+	signal(SIGPROF, SIG_IGN);
+}
+
+void sampleStart() {
+	static int registered;
+	if (!samplePath || sampling) return;
+	if (!samples && !(samples = malloc(SAMPLE_MAX * sizeof(Sample)))) {
+		fprintf(stderr, "Error: not enough memory for samples\n");
+		return;
+	}
+	numSamples = 0;
+	stride = 1;
+	skip = 0;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onTick;
+	action.sa_flags = SA_RESTART; // a tick during a read of input must not fail it
+	sigaction(SIGPROF, &action, NULL);
+	if (arm(1000000000L / sampleHz) != 0) {
+		fprintf(stderr, "Error: cannot start the sampling timer\n");
+		signal(SIGPROF, SIG_IGN);
+		return;
+	}
+	if (!registered) atexit(sampleStop);
+	registered = 1;
+	sampling = 1;
+}
+
+static int byPc(const void * a, const void * b) {
+	const Sample * x = a, * y = b;
+	if (x->pc != y->pc) return x->pc < y->pc ? -1 : 1;
+	return (x->node > y->node) - (x->node < y->node);
+}
+
+static int byNode(const void * a, const void * b) {
+	const Sample * x = a, * y = b;
+	if (x->node != y->node) return x->node < y->node ? -1 : 1;
+	return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+static int byCount(const void * a, const void * b) {
+	const Count * x = a, * y = b;
+	if (x->samples != y->samples) return x->samples > y->samples ? -1 : 1;
+	return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+static void printCounts(FILE * file, const char * title, Count * counts, size_t n, int withPc) {
+	qsort(counts, n, sizeof(Count), byCount);
+	double scale = numSamples ? 100.0 / numSamples : 0;
+	if (withPc) fprintf(file, "%-12s ", "pc");
+	fprintf(file, "%-32s %10s %7s%s\n", title, "samples", "%", withPc ? "  source" : "");
+	for (size_t i = 0; i < n; i++) {
+		if (withPc) fprintf(file, "%#-12llx ", counts[i].pc);
+		fprintf(file, "%-32s %10llu %6.2f%%", counts[i].name, counts[i].samples, counts[i].samples * scale);
+		if (withPc && counts[i].line[0]) fprintf(file, "  %s", counts[i].line);
+		fputc('\n', file);
+	}
+}
+
+// histograms by label, then by pc; samples end up sorted by pc
+static void writeHistogram() {
+	char path[4200];
+	snprintf(path, sizeof(path), "%s.samples", samplePath);
+	FILE * file = fopen(path, "w");
+	Count * labels = calloc(numSamples + 1, sizeof(Count));
+	Count * pcs = calloc(numSamples + 1, sizeof(Count));
+	if (!file || !labels || !pcs) {
+		fprintf(stderr, "Error: cannot write %s\n", path);
+		if (file) fclose(file);
+		free(labels);
+		free(pcs);
+		return;
+	}
+
+	qsort(samples, numSamples, sizeof(Sample), byPc);
+	size_t numLabels = 0, numPcs = 0;
+	for (size_t i = 0; i < numSamples; i++) {
+		if (!numPcs || pcs[numPcs - 1].pc != samples[i].pc) {
+			Count * c = &pcs[numPcs++];
+			c->pc = samples[i].pc;
+			symbolize(c->pc, c->name, sizeof(c->name));
+			sourceLine(c->pc, c->line, sizeof(c->line));
+			// consecutive pcs under the same label are one label
+			char label[128];
+			snprintf(label, sizeof(label), "%s", c->name);
+			label[strcspn(label, "+")] = '\0';
+			if (!numLabels || strcmp(labels[numLabels - 1].name, label) != 0) {
+				strcpy(labels[numLabels].name, label);
+				labels[numLabels++].pc = c->pc;
+			}
+		}
+		pcs[numPcs - 1].samples++;
+		labels[numLabels - 1].samples++;
+	}
+
+	fprintf(file, "%zu samples at %d Hz, one per %u ticks, %.3fs of cpu\n\n", numSamples, sampleHz, stride,
+		(double)numSamples * stride / sampleHz);
+	printCounts(file, "label", labels, numLabels, 0);
+	fputc('\n', file);
+	printCounts(file, "label", pcs, numPcs, 1);
+	fclose(file);
+	free(labels);
+	free(pcs);
+}
+
+static void writeFolded() {
+	size_t first = 0;
+	qsort(samples, numSamples, sizeof(Sample), byNode);
+	while (first < numSamples && samples[first].node < 0) first++;
+	if (first == numSamples) return;
+
+	char path[4200];
+	snprintf(path, sizeof(path), "%s.sampled.folded", samplePath);
+	FILE * file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "Error: cannot write %s\n", path);
+		return;
+	}
+	for (size_t i = first; i < numSamples;) {
+		size_t j = i;
+		while (j < numSamples && samples[j].node == samples[i].node) j++;
+		profilePath(file, samples[i].node);
+		fprintf(file, " %llu\n", (ull)(j - i) * stride);
+		i = j;
+	}
+	fclose(file);
+}
+
+void sampleStop() {
+	if (!sampling) return;
+	sampling = 0;
+	disarm();
+	writeHistogram();
+	writeFolded();
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// Sampling profiler. A cpu-time timer on the interpreter thread raises
+// SIGPROF sampleHz times a second and the handler appends the guest pc,
+// and the shadow call stack node when the call-graph profiler runs too,
+// to a buffer nothing else writes while the guest runs. When the buffer
+// fills, every other sample is dropped and from then on only every other
+// tick is kept, so a run of any length fits and each kept sample stands
+// for the same number of ticks. At the end of the run the samples become
+// a histogram by label and by pc (path.samples), plus folded stacks
+// (path.sampled.folded) when there was a call stack to sample.
+
+void sampleStart();
+
+// Writes the histogram; also run at exit after a simulation error
+void sampleStop();
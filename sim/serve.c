@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "sim.h"
+
+// Fork server: the image is loaded, predecoded and given its stack once,
+// and each job is a fork of that state, so a job costs about one fork
+// plus the pages it writes instead of a process start, a file read and
+// zeroing guest memory.
+
+typedef struct Job {
+	pid_t pid;
+	int conn;
+	struct timespec start;
+} Job;
+
+static const char * socketPath;
+static Job * jobs;
+static int numJobs, maxJobs;
+static int * pending; // accepted, non-blocking, waiting for their request
+static int numPending, maxPending;
+
+static void stop(int sig) {
+	unlink(socketPath);
+	_exit(0);
+}
+
+// only there to interrupt ppoll
+static void onChild(int sig) {
+}
+
+static int setAddress(struct sockaddr_un * addr, const char * path) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) return -1;
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+// the request is one byte carrying exactly two descriptors. Returns 0 with
+// them, 1 when it has not come yet or -1 for anything else.
+static int receiveFds(int conn, int fds[2]) {
+	char byte;
+	struct iovec iov = {&byte, 1};
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	ssize_t n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 1;
+	if (n != 1) return -1;
+
+	struct cmsghdr * c = CMSG_FIRSTHDR(&msg);
+	if (!c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) return -1;
+	int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	int got[2] = {-1, -1};
+	memcpy(got, CMSG_DATA(c), (count < 2 ? count : 2) * sizeof(int));
+	if (count != 2 || (msg.msg_flags & MSG_CTRUNC)) {
+		for (int i = 0; i < count && i < 2; i++) close(got[i]);
+		return -1;
+	}
+	fds[0] = got[0];
+	fds[1] = got[1];
+	return 0;
+}
+
+static uint64_t micros(struct timeval t) {
+	return (uint64_t)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+static void finish(pid_t pid, int status, const struct rusage * usage) {
+	for (int i = 0; i < numJobs; i++) {
+		if (jobs[i].pid != pid) continue;
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ServeReply reply;
+		memset(&reply, 0, sizeof(reply));
+		reply.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		reply.wallMicros = (now.tv_sec - jobs[i].start.tv_sec) * 1000000 + (now.tv_nsec - jobs[i].start.tv_nsec) / 1000;
+		reply.userMicros = micros(usage->ru_utime);
+		reply.sysMicros = micros(usage->ru_stime);
+		reply.maxRssKb = usage->ru_maxrss;
+		if (write(jobs[i].conn, &reply, sizeof(reply)) != sizeof(reply)) {
+			// the client went away, nobody to tell
+		}
+		close(jobs[i].conn);
+		jobs[i] = jobs[--numJobs];
+		return;
+	}
+}
+
+static void reap() {
+	int status;
+	struct rusage usage;
+	pid_t pid;
+	while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0)
+		finish(pid, status, &usage);
+}
+
+static void startJob(int listener, int conn, int fds[2]) {
+	if (numJobs == maxJobs) {
+		int max = maxJobs ? 2 * maxJobs : 16;
+		Job * grown = realloc(jobs, max * sizeof(Job));
+		if (!grown) {
+			close(fds[0]);
+			close(fds[1]);
+			close(conn);
+			return;
+		}
+		jobs = grown;
+		maxJobs = max;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(listener);
+		close(conn);
+		for (int i = 0; i < numPending; i++) close(pending[i]);
+		for (int i = 0; i < numJobs; i++) close(jobs[i].conn);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGPIPE, SIG_DFL);
+		signal(SIGCHLD, SIG_DFL);
+		sigset_t none;
+		sigemptyset(&none);
+		sigprocmask(SIG_SETMASK, &none, NULL);
+		FILE * in = fdopen(fds[0], "r");
+		FILE * out = fdopen(fds[1], "w");
+		if (!in || !out) exit(1);
+		simStart(in, out);
+		exit(0);
+	}
+	close(fds[0]);
+	close(fds[1]);
+	if (pid < 0) {
+		close(conn);
+		return;
+	}
+	jobs[numJobs].pid = pid;
+	jobs[numJobs].conn = conn;
+	jobs[numJobs].start = start;
+	numJobs++;
+}
+
+// reads the request on pending[i] if it has come, starting its job
+static void takeRequest(int listener, int i) {
+	int conn = pending[i];
+	int fds[2];
+	int got = receiveFds(conn, fds);
+	if (got > 0) return;
+	pending[i] = pending[--numPending];
+	if (got < 0) close(conn);
+	else startJob(listener, conn, fds);
+}
+
+static void addPending(int conn) {
+	if (numPending == maxPending) {
+		int max = maxPending ? 2 * maxPending : 16;
+		int * grown = realloc(pending, max * sizeof(int));
+		if (!grown) {
+			close(conn);
+			return;
+		}
+		pending = grown;
+		maxPending = max;
+	}
+	pending[numPending++] = conn;
+}
+
+int simServe(const char * path, const unsigned char * image, size_t len) {
+	simLoad(image, len);
+
+	// bound under a temporary name and renamed once listening, so a
+	// client that sees the socket can connect to it
+	char tmp[sizeof(((struct sockaddr_un *)0)->sun_path) + 32];
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	struct sockaddr_un addr;
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0 || setAddress(&addr, tmp) != 0) {
+		fprintf(stderr, "Error: cannot listen on %s\n", path);
+		return -1;
+	}
+	unlink(tmp);
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 128) != 0 ||
+			rename(tmp, path) != 0) {
+		fprintf(stderr, "Error: cannot listen on %s\n", path);
+		unlink(tmp);
+		return -1;
+	}
+	socketPath = path;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	action.sa_handler = onChild;
+	sigaction(SIGCHLD, &action, NULL);
+	action.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &action, NULL);
+
+	// SIGCHLD is only let through while waiting in ppoll, so an exit is
+	// never missed between reap() and the wait
+	sigset_t block, waiting;
+	sigemptyset(&block);
+	sigaddset(&block, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &block, &waiting);
+	sigdelset(&waiting, SIGCHLD);
+
+	// connections are polled along with the listener until their request
+	// comes, so a client that connects and sends nothing holds up no one
+	struct pollfd * polls = NULL;
+	int maxPolls = 0;
+	for (;;) {
+		if (numPending + 1 > maxPolls) {
+			int max = 2 * (numPending + 1);
+			struct pollfd * grown = realloc(polls, max * sizeof(struct pollfd));
+			if (grown) polls = grown, maxPolls = max;
+			else if (!polls) {
+				fprintf(stderr, "Error: not enough memory to serve\n");
+				return -1;
+			}
+		}
+		int n = numPending + 1 < maxPolls ? numPending + 1 : maxPolls;
+		polls[0] = (struct pollfd){listener, POLLIN, 0};
+		for (int i = 1; i < n; i++) polls[i] = (struct pollfd){pending[i - 1], POLLIN, 0};
+		int ready = ppoll(polls, n, NULL, &waiting);
+		reap();
+		if (ready <= 0) continue;
+		// from the end, as taking one moves the last into its place
+		for (int i = n - 1; i >= 1; i--)
+			if (polls[i].revents) takeRequest(listener, i - 1);
+		if (polls[0].revents & POLLIN) {
+			int conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (conn >= 0) addPending(conn);
+		}
+	}
+}
+
+int simConnect(const char * path, ServeReply * reply) {
+	struct sockaddr_un addr;
+	int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (conn < 0) return -1;
+	if (setAddress(&addr, path) != 0 || connect(conn, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(conn);
+		return -1;
+	}
+
+	int fds[2] = {STDIN_FILENO, STDOUT_FILENO};
+	char byte = 0;
+	struct iovec iov = {&byte, 1};
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(fds))];
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	struct cmsghdr * c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(c), fds, sizeof(fds));
+	if (sendmsg(conn, &msg, 0) != 1) {
+		close(conn);
+		return -1;
+	}
+
+	size_t got = 0;
+	while (got < sizeof(*reply)) {
+		ssize_t n = read(conn, (char *)reply + got, sizeof(*reply) - got);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) {
+			close(conn);
+			return -1;
+		}
+		got += n;
+	}
+	close(conn);
+	return 0;
+}
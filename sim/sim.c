@@ -0,0 +1,567 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "sim.h"
+#include "decode.h"
+#include "heap.h"
+#include "plugins.h"
+#include "profile.h"
+#include "sample.h"
+#include "stats.h"
+#include "symbols.h"
+#include "timing.h"
+#include "tko.h"
+#include "trace.h"
+#include "vector.h"
+#define ull unsigned long long
+#define ll long long
+
+unsigned char * mem;
+ull memSize = MEM_SIZE;
+ull r[32] = {0};
+ull retired;
+ull budget, retiredLimit = ~0ULL;
+int pc = 0x2000;
+int halt = 0;
+FILE * simIn, * simOut;
+jmp_buf * simTrap;
+static const Decoded * block; // the block runBlock is in, and the pc it starts at
+static int blockPc;
+
+static void blockFailed();
+
+void simErr() {
+	if (block) blockFailed();
+	if (simTrap) longjmp(*simTrap, 1);
+	char label[128], line[64];
+	if (sourceLine((ull)pc, line, sizeof(line)))
+		fprintf(stderr, "Simulation error at %s (%s)\n", symbolize((ull)pc, label, sizeof(label)), line);
+	else fprintf(stderr, "Simulation error\n");
+	exit(1);
+}
+
+int verifyAddress(ull add) {
+	if (add < 0 || add >= memSize) simErr();
+	return add;
+}
+
+int verifyRegister(int r) {
+	if (r < 0 || r > 31) simErr();
+	return r;
+}
+
+void sign(int *imm) {
+    if (*imm & 0x800) {  // Check if bit 11 is set
+        *imm |= 0xFFFFF000;  // Sign-extend to 32 bits
+    }
+}
+
+// With guarded memory only addresses the guard pages cannot cover are
+// checked here, the rest fault into simErr (see guest.c)
+static void checkAccess(ull add, int size) {
+	if (guarded) {
+		if (add >> 32) simErr();
+	} else {
+		verifyAddress(add);
+		verifyAddress(add + size - 1);
+	}
+}
+
+long long readMem(ull add, int size) { 
+    checkAccess(add, size);
+    long long ret = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&ret, mem + add, size);
+#else
+    for (int i = 0; i < size; i++) {
+		ret <<= 8;
+        ret += (((long long)(mem[add+size-1-i])));
+    }
+#endif
+    if (add + size > touchedEnd) touchedEnd = add + size;
+    return ret;
+}
+
+int fetch(ull add) {
+    checkAccess(add, 4);
+    return mem[add] | mem[add + 1] << 8 | mem[add + 2] << 16 | (unsigned)mem[add + 3] << 24;
+}
+
+void loadMem(ull add, long long v, int size) { 
+    checkAccess(add, size);
+    if (decoded && add < codeBase + codeLen && add + size > codeBase) dropDecoded();
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(mem + add, &v, size);
+#else
+    for (int i = 0; i < size; i++) {
+        mem[add + i] = (v >> (8 * i)) & 0xFF;
+    }
+#endif
+    if (add + size > touchedEnd) touchedEnd = add + size;
+}
+
+double fcast(ull* l) {
+	double db;
+	memcpy(&db, l, sizeof(double));
+	return db;
+}
+
+ull dcast(double *db) {
+	ull l;
+	memcpy(&l, db, sizeof(ull));
+	return l;
+}
+
+void doAND(int rd, int rs, int rt, int imm) {
+	r[rd] = r[rs] & r[rt];
+}
+void doOR(int rd, int rs, int rt, int imm) {
+	r[rd] = r[rs] | r[rt];
+}
+void doXOR(int rd, int rs, int rt, int imm) {
+	r[rd] = r[rs] ^ r[rt];
+}
+
+void doNOT(int rd, int rs, int rt, int imm) {
+	r[rd] = ~r[rs];
+}
+
+void doSHFTR(int rd, int rs, int rt, int imm) {
+	r[rd] = r[rs] >> r[rt];
+}
+
+void doSHFTRI(int rd, int rs, int rt, int imm) {
+	r[rd] >>= imm;
+}
+
+void doSHFTL(int rd, int rs, int rt, int imm) {
+	r[rd] = r[rs] << r[rt];
+}
+
+void doSHFTLI(int rd, int rs, int rt, int imm) {
+	r[rd] <<= imm;
+}
+
+void doBR(int rd, int rs, int rt, int imm) {
+	pc = verifyAddress(r[rd]);
+}
+
+void doBRR(int rd, int rs, int rt, int imm) {
+	pc += r[rd];
+}
+
+void doBRR2(int rd, int rs, int rt, int imm) {
+	sign(&imm);
+	pc += imm;
+}
+
+void doBRNZ(int rd, int rs, int rt, int imm) {
+	if (r[rs] != 0) pc = verifyAddress(r[rd]);
+	else pc += 4;
+}
+
+void doCALL(int rd, int rs, int rt, int imm) {
+	loadMem(r[31]-8, pc + 4, 8);
+	int site = pc;
+	pc = verifyAddress(r[rd]);
+	if (profiling) profileCall(site, pc);
+}
+
+void doRETURN(int rd, int rs, int rt, int imm) {
+	pc = readMem(r[31]-8, 8);
+	if (profiling) profileReturn((ull)pc);
+}
+
+void doBRGT(int rd, int rs, int rt, int imm) {
+	if (r[rs] > r[rt]) pc = verifyAddress(r[rd]);
+	else pc += 4;
+}
+
+int readInput(FILE * in, ull * value) {
+	char buf[100];
+	if (!fgets(buf, sizeof(buf), in)) 
+		return -1;
+
+	char *endptr;
+	errno = 0;
+	ull v = strtoull(buf, &endptr, 10);
+
+	// 1. Check for valid range
+	if (buf[0] == '-' || errno == ERANGE) {
+		return -1;
+	}
+
+	// 2. Check that entire string was valid number
+	if (*endptr != '\n' && *endptr != '\0') {
+		return -1;
+	}
+
+	*value = v;
+	return strlen(buf);
+}
+
+// Block priv operands: the whole range is checked before any of it is
+// touched, so a bad length never leaves a partial copy behind
+static void verifyRange(ull add, ull len) {
+	if (add > memSize || len > memSize - add) simErr();
+	if (len) touched(add + len);
+}
+
+// priv input and output a value at a time, counted for the run statistics
+static ull input() {
+	ull value;
+	int bytes = streaming ? streamIn(&value) : readInput(simIn, &value);
+	if (bytes < 0) simErr();
+	inputValues++;
+	inputBytes += bytes;
+	return value;
+}
+
+static void output(int kind, ull v) {
+	if (streaming) streamOut(kind, v);
+	else if (kind == STREAM_CHAR) fputc((char)v, simOut);
+	else fprintf(simOut, "%llu\n", v);
+	int digits = 1;
+	while (kind == STREAM_NUMBER && v >= 10) v /= 10, digits++;
+	outputBytes += kind == STREAM_CHAR ? 1 : digits + 1;
+}
+
+// a block write over code invalidates the predecoded table like a store
+static void touchRange(ull add, ull len) {
+	if (decoded && len && add < codeBase + codeLen && add + len > codeBase) dropDecoded();
+}
+
+void doPRIV(int rd, int rs, int rt, int imm) {
+	if (imm == 0x0) { // halt
+		halt = 1;
+	} else if (imm == 0x3 && r[rs] == 0) { // input
+		inputPrivs++;
+		r[rd] = input();
+	} else if (imm == 0x4 && (r[rd] == 1 || r[rd] == 3)) {
+		outputPrivs++;
+		output(r[rd] == 1 ? STREAM_NUMBER : STREAM_CHAR, r[rs]);
+	} else if (imm == 0x5) { // read r[rs] integers into words at r[rd]
+		ull add = r[rd], count = r[rs];
+		if (count > memSize / 8) simErr();
+		verifyRange(add, count * 8);
+		inputPrivs++;
+		for (ull i = 0; i < count; i++) loadMem(add + 8 * i, input(), 8);
+	} else if (imm == 0x6) { // print r[rs] words from r[rd]
+		ull add = r[rd], count = r[rs];
+		if (count > memSize / 8) simErr();
+		verifyRange(add, count * 8);
+		outputPrivs++;
+		for (ull i = 0; i < count; i++) output(STREAM_NUMBER, readMem(add + 8 * i, 8));
+	} else if (imm == 0x7) { // write r[rs] bytes from r[rd]
+		ull add = r[rd], len = r[rs];
+		verifyRange(add, len);
+		outputPrivs++;
+		outputBytes += len;
+		if (streaming) {
+			for (ull i = 0; i < len; i++) streamOut(STREAM_CHAR, mem[add + i]);
+		} else {
+			fwrite(mem + add, 1, len, simOut);
+		}
+	} else if (imm == 0x8) { // copy r[rt] bytes from r[rs] to r[rd]
+		ull to = r[rd], from = r[rs], len = r[rt];
+		verifyRange(to, len);
+		verifyRange(from, len);
+		touchRange(to, len);
+		memmove(mem + to, mem + from, len);
+	} else if (imm == 0x9) { // set r[rt] bytes at r[rd] to the low byte of r[rs]
+		ull add = r[rd], len = r[rt];
+		verifyRange(add, len);
+		touchRange(add, len);
+		memset(mem + add, (unsigned char)r[rs], len);
+	} else if (imm == 0xa) { // malloc
+		r[rd] = heapMalloc(r[rs]);
+	} else if (imm == 0xb) { // free
+		heapFree(r[rd]);
+	} else if (imm == 0xc) { // realloc
+		r[rd] = heapRealloc(r[rs], r[rt]);
+	} else if (imm == 0xd) { // instruction count
+		r[rd] = guestInstructions();
+	} else if (imm == 0xe) { // clock
+		r[rd] = guestClock();
+	} else if (imm == 0xf) {
+		regionStart(r[rd]);
+	} else if (imm == 0x10) {
+		regionStop(r[rd]);
+	} else {
+		simErr();
+	}
+}
+
+void doMOV(int rd, int rs, int rt, int imm) {
+	sign(&imm);
+	r[rd] = readMem(r[rs]+imm, 8);
+}
+
+void doMOV1(int rd, int rs, int rt, int imm) {
+	sign(&imm);
+	r[rd] = r[rs];
+}
+
+void doMOV2(int rd, int rs, int rt, int imm) {
+	r[rd] >>= 12; r[rd] <<= 12;
+	r[rd] += (0xFFF & imm);
+}
+
+void doMOV3(int rd, int rs, int rt, int imm) {
+	sign(&imm);
+	loadMem(r[rd]+imm, r[rs], 8);
+}
+
+void doADDF(int rd, int rs, int rt, int imm) {
+	double sum = fcast(&r[rs]) + fcast(&r[rt]);
+	r[rd] = dcast(&sum);
+}
+
+void doSUBF(int rd, int rs, int rt, int imm) {
+	double diff = fcast(&r[rs]) - fcast(&r[rt]);
+	r[rd] = dcast(&diff);
+}
+
+void doMULF(int rd, int rs, int rt, int imm) {
+	double prod = fcast(&r[rs]) * fcast(&r[rt]);
+	r[rd] = dcast(&prod);
+
+}
+
+void doDIVF(int rd, int rs, int rt, int imm) {
+	double div = fcast(&r[rt]);
+	if (div == 0.0) 
+		simErr();
+
+	double quo = fcast(&r[rs]) / div;
+	r[rd] = dcast(&quo);
+
+}
+
+void doADD(int rd, int rs, int rt, int imm) {
+	r[rd] = r[rs] + r[rt];
+}
+
+void doADDI(int rd, int rs, int rt, int imm) {
+	r[rd] += imm;
+}
+
+void doSUB(int rd, int rs, int rt, int imm) {
+	r[rd] = r[rs] - r[rt];
+}
+
+void doSUBI(int rd, int rs, int rt, int imm) {
+	r[rd] -= imm;
+}
+
+void doMUL(int rd, int rs, int rt, int imm) {
+	r[rd] = r[rs] * r[rt];
+}
+
+void doDIV(int rd, int rs, int rt, int imm) {
+	if (r[rt] == 0) 	
+		simErr();
+
+	r[rd] = r[rs] / r[rt];
+}
+
+void parse(int i, int *opcode, int *rd, int *rs, int *rt, int *imm) {
+	*imm = i & 0xFFF; i >>= 12;
+
+
+	*rt = i & 0x1F; i >>= 5;
+	*rs = i & 0x1F; i >>= 5;
+	*rd = i & 0x1F; i >>= 5;
+	*opcode = i & 0x1F; i >>= 5;
+
+	verifyRegister(*rt);
+	verifyRegister(*rs);
+	verifyRegister(*rd);
+}
+
+CommandType getCmd(int opcode) {
+	for (int i = 0; i < 31; i++)
+		if (cmdTable[i].opcode == opcode) 
+			return cmdTable[i].type;
+	simErr();
+	return -1;
+}
+
+
+
+// Executes one decoded instruction and moves pc past it
+void execute(int cmd, int rd, int rs, int rt, int imm) {
+	switch (cmd) {
+		case AND   : doAND   (rd, rs, rt, imm); pc += 4; break;
+		case OR    : doOR    (rd, rs, rt, imm); pc += 4; break;
+		case XOR   : doXOR   (rd, rs, rt, imm); pc += 4; break;
+		case NOT   : doNOT   (rd, rs, rt, imm); pc += 4; break;
+		case SHFTR : doSHFTR (rd, rs, rt, imm); pc += 4; break;
+		case SHFTRI: doSHFTRI(rd, rs, rt, imm); pc += 4; break;
+		case SHFTL : doSHFTL (rd, rs, rt, imm); pc += 4; break;
+		case SHFTLI: doSHFTLI(rd, rs, rt, imm); pc += 4; break;
+		case BR    : doBR    (rd, rs, rt, imm); pc += 0; break;
+		case BRR   : doBRR   (rd, rs, rt, imm); pc += 0; break;
+		case BRR2  : doBRR2  (rd, rs, rt, imm); pc += 0; break;
+		case BRNZ  : doBRNZ  (rd, rs, rt, imm); pc += 0; break;
+		case CALL  : doCALL  (rd, rs, rt, imm); pc += 0; break;
+		case RETURN: doRETURN(rd, rs, rt, imm); pc += 0; break;
+		case BRGT  : doBRGT  (rd, rs, rt, imm); pc += 0; break;
+		case PRIV  : doPRIV  (rd, rs, rt, imm); pc += 4; break;
+		case MOV   : doMOV   (rd, rs, rt, imm); pc += 4; break;
+		case MOV1  : doMOV1  (rd, rs, rt, imm); pc += 4; break;
+		case MOV2  : doMOV2  (rd, rs, rt, imm); pc += 4; break;
+		case MOV3  : doMOV3  (rd, rs, rt, imm); pc += 4; break;
+		case ADDF  : doADDF  (rd, rs, rt, imm); pc += 4; break;
+		case SUBF  : doSUBF  (rd, rs, rt, imm); pc += 4; break;
+		case MULF  : doMULF  (rd, rs, rt, imm); pc += 4; break;
+		case DIVF  : doDIVF  (rd, rs, rt, imm); pc += 4; break;
+		case ADD   : doADD   (rd, rs, rt, imm); pc += 4; break;
+		case ADDI  : doADDI  (rd, rs, rt, imm); pc += 4; break;
+		case SUB   : doSUB   (rd, rs, rt, imm); pc += 4; break;
+		case SUBI  : doSUBI  (rd, rs, rt, imm); pc += 4; break;
+		case MUL   : doMUL   (rd, rs, rt, imm); pc += 4; break;
+		case DIV   : doDIV   (rd, rs, rt, imm); pc += 4; break;
+		case VEC   : doVEC   (rd, rs, rt, imm); pc += 4; break;
+		default: 
+		   simErr();
+		   break;
+	}
+}
+
+// A block is counted when it starts; when an instruction in it fails, the
+// rest of it, from that instruction on, never ran. The failed instruction
+// stays in the mix, as stepReference counts it before running it.
+static void blockFailed() {
+	const Decoded * end = block + block->blockLen;
+	const Decoded * d = block + (((ull)pc - (ull)blockPc) >> 2);
+	if (d < block || d >= end) d = end - 1; // a branch that moved pc, it ends the block
+	retired -= end - d;
+	blockCut(block, d);
+	block = NULL;
+}
+
+// A new low for r[31] in a block: recorded, unless the stack has grown into
+// the heap, which fails at the next instruction, where the other cores see it
+static int intoHeap() {
+	if (stackInHeap(r[31])) return 1;
+	stackLow = r[31];
+	return 0;
+}
+
+// Runs the block starting at d from the predecoded table
+static void runBlock(const Decoded * d) {
+	const Decoded * start = d, * end = d + d->blockLen;
+	block = start;
+	blockPc = pc;
+	while (d < end) {
+		if (d->cmd == DECODE_FUSED_LD) {
+			int rd = d->rd;
+			r[rd] = fusedValue(d);
+			pc += 4 * d->rt;
+			d += d->rt;
+			if (rd == 31 && r[31] < stackLow && intoHeap()) {
+				retired -= end - d;
+				blockCut(start, d - 1);
+				break;
+			}
+			continue;
+		}
+		execute(d->cmd, d->rd, d->rs, d->rt, d->imm);
+		// the guest wrote over its code, or grew the stack into the heap
+		if (!decoded || (d->rd == 31 && r[31] < stackLow && intoHeap())) {
+			retired -= end - d - 1;
+			blockCut(start, d);
+			break;
+		}
+		d++;
+	}
+	block = NULL;
+}
+
+void stepReference() {
+	int read = fetch(pc);
+	int opcode, rd, rs, rt, imm;
+	parse(read, &opcode, &rd, &rs, &rt, &imm);
+	CommandType cmd = getCmd(opcode);
+	if (r[31] < stackLow) stackLowered();
+	commandRuns[cmd]++;
+	stepping = 1;
+	execute(cmd, rd, rs, rt, imm);
+	stepping = 0;
+	retired++;
+}
+
+void stepDecoded() {
+	ull off = (ull)pc - codeBase;
+	if (decoded && off < codeLen && !(off & 3)) {
+		const Decoded * d = decoded + (off >> 2);
+		if (r[31] < stackLow) stackLowered();
+		retired += d->blockLen;
+		blockRuns[off >> 2]++;
+		runBlock(d);
+	} else {
+		stepReference(); // outside the table
+	}
+}
+
+void simBudget(ull instructions) {
+	budget = instructions;
+}
+
+// a fresh machine each time, for callers that load more than one image
+void simLoad(const unsigned char * image, size_t len) {
+	ull begun = statsClock();
+	loadTko(image, len);
+	predecode();
+	heapReset();
+	memset(r, 0, sizeof(r));
+	r[31] = memSize;
+	halt = 0;
+	vecInit();
+	statsReset(statsClock() - begun);
+}
+
+void simStart(FILE * in, FILE * out) {
+	simIn = in;
+	simOut = out;
+	streamStart();
+	profileStart();
+	sampleStart();
+	traceStart();
+	timingStart();
+	pluginStart();
+	statsStart();
+	stepping = 0;
+	retiredLimit = budget ? retired + budget : ~0ULL;
+	if (tracing || timing || pluginEvents) traceRun();
+	// stepDecoded, kept in line
+	while (!halt) {
+		if (retired >= retiredLimit) simErr();
+		ull off = (ull)pc - codeBase;
+		if (decoded && off < codeLen && !(off & 3)) {
+			const Decoded * d = decoded + (off >> 2);
+			if (r[31] < stackLow) stackLowered();
+			retired += d->blockLen;
+			blockRuns[off >> 2]++;
+			runBlock(d);
+			continue;
+		}
+		stepReference(); // outside the table
+	}
+	statsStop();
+	pluginStop();
+	timingStop();
+	traceStop();
+	sampleStop();
+	profileStop();
+	streamStop();
+}
+
+// Loads a .tko image and runs it until it halts
+void simRun(const unsigned char * image, size_t len) {
+	simLoad(image, len);
+	simStart(stdin, stdout);
+}
@@ -0,0 +1,177 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Loads a version 1 or 2 .tko image into guest memory and runs it until
+// it halts, reading stdin and writing stdout. Exits on a simulation error.
+void simRun(const unsigned char * image, size_t len);
+
+// simRun in two halves, for callers that set up once and run the loaded
+// image later (the fork server runs it once in each child)
+void simLoad(const unsigned char * image, size_t len);
+void simStart(FILE * in, FILE * out);
+
+// On (the default), guest memory is followed by guard pages and loads and
+// stores are not bounds checked in software; off checks every access.
+// Either way an access outside guest memory is a simulation error. Takes
+// effect at the next load.
+void simGuardMemory(int on);
+
+// On, simStart parses input on a reader thread and formats output on a
+// writer thread, overlapping both with the guest. Off by default.
+void simAsyncIo(int on);
+
+// Cuts every later run off with a simulation error once it has run
+// instructions (counted from the start of simStart, per core in simCheck),
+// for programs that may not halt; 0 (the default) for no limit. The
+// limit is checked between predecoded blocks, so a run can go up to a
+// block past it.
+void simBudget(unsigned long long instructions);
+
+// Writes path through write(file, arg) under a temporary name next to it
+// and renames it into place, so readers never see half a file, even with
+// runs writing it at the same time. 0 when written, -1 when write failed
+// or the file could not be written, with nothing left behind.
+int simReplaceFile(const char * path, int (*write)(FILE * file, const void * arg), const void * arg);
+
+// Directory to keep predecoded code segments in across runs (see
+// decode.h), null (the default) to decode on every run
+void simDecodeCache(const char * dir);
+
+// Places the guest heap (priv 10-12, see heap.h) at [base, base + size)
+// instead of between the loaded image and its stack. Size 0 (the default)
+// keeps that. Takes effect at the next load.
+void simHeapRegion(unsigned long long base, unsigned long long size);
+
+typedef struct HeapStats {
+	unsigned long long mallocs, frees, reallocs;
+	unsigned long long failed;    // mallocs and reallocs that did not fit
+	unsigned long long inUse;     // bytes the guest holds now
+	unsigned long long peakInUse; // high-water mark of inUse
+	unsigned long long extent;    // bytes of the region carved into chunks
+	unsigned long long size;      // bytes in the region
+} HeapStats;
+
+// The heap usage of the last run (of simRun or simStart)
+void simHeapStats(HeapStats * stats);
+
+typedef struct RunStats {
+	int halted;                      // 0 when the run stopped on a simulation error
+	unsigned long long pc;           // where it stopped
+	unsigned long long instructions;
+	unsigned long long commands[31]; // by CommandType (main.h) from AND to VEC, macros as what they assemble to
+	unsigned long long loads, stores; // instructions that load or store, vector ones included
+	unsigned long long inputPrivs, inputValues, inputBytes;
+	unsigned long long outputPrivs, outputBytes;
+	unsigned long long stackBytes;   // how far r[31] went below the top of memory
+	unsigned long long highestAddress; // loaded or stored, 0 for none
+	unsigned long long memoryBytes;
+	double loadSeconds, runSeconds;
+	unsigned long long peakRssBytes;
+} RunStats;
+
+// The statistics of the last load and run (see stats.h), kept on every
+// run; called during a run, what it has done so far
+void simRunStats(RunStats * stats);
+
+// Writes the statistics of every later simStart to path when it halts or
+// stops on a simulation error: JSON, or Prometheus text format for a path
+// that ends in .prom. Null (the default) writes none.
+void simStats(const char * path);
+
+// Symbol map written by hw5-asm --map, to name pcs in profiles and
+// errors. A map that cannot be read leaves them as addresses.
+void simSymbols(const char * path);
+
+// Profiles the calls of the next simStart and writes path.folded and
+// path.calls when it ends (see profile.h); null (the default) turns it off
+void simProfile(const char * path);
+
+// Samples the guest pc hz times a second of cpu time during the next
+// simStart and writes a histogram to path.samples when it ends (see
+// sample.h); hz 0 keeps the default, null path turns it off
+void simSample(const char * path, int hz);
+
+// Records every instruction the next simStart runs, with its branch
+// target and memory address, into the binary trace at path (see trace.h);
+// null (the default) turns it off
+void simTrace(const char * path);
+
+// Loads the plugins in list, comma separated paths of shared objects each
+// optionally followed by =args (see plugin.h), for every later simStart.
+// Returns -1, having said why on stderr, when one cannot be loaded or
+// does not start.
+int simPlugins(const char * list);
+
+typedef struct CheckStats {
+	unsigned long long instructions; // the reference ran
+	unsigned long long checks;
+	int failed;                      // both cores stopped on a simulation error
+	int exhausted;                   // both ran out of budget (see simBudget)
+	unsigned long long pc;           // where the reference stopped
+} CheckStats;
+
+// Differential check: runs the image on the reference interpreter and on
+// the predecoded core side by side, each on its own copy of the guest
+// state and of in, and compares them every instructions (0 for every
+// predecoded block) until both halt or fail, or run out of budget. The first difference is
+// described on stderr. Writes the reference's output to out and returns
+// 0 when the cores agree, 1 when they do not.
+int simCheck(const unsigned char * image, size_t len, unsigned long long every, FILE * in, FILE * out,
+	CheckStats * stats);
+
+typedef struct CacheStats {
+	unsigned long long accesses, misses, writebacks;
+} CacheStats;
+
+typedef struct TimingStats {
+	unsigned long long instructions, cycles;
+	CacheStats l1i, l1d, l2;
+	unsigned long long branches, mispredicts; // conditional branches
+	unsigned long long returns, returnMispredicts;
+	unsigned long long fetchStalls, operandStalls, branchStalls; // cycles lost to each
+} TimingStats;
+
+// Runs the next simStart through the cache and pipeline timing model,
+// configured by spec (see timing.h), "1" for the defaults and null (the
+// default) for none. Returns -1 for a spec it cannot read.
+int simTiming(const char * spec);
+
+// What the model estimated for the last run
+void simTimingStats(TimingStats * stats);
+
+typedef struct LaneStats {
+	unsigned long long instructions; // summed over every lane
+	unsigned long long steps;        // instructions dispatched, one per group of lanes
+	unsigned long long converged;    // steps that ran every live lane at once, with more than one live
+	unsigned long long groupLanes;   // lanes in the running group, summed over the steps
+	int failed;                      // lanes that ended in a simulation error
+} LaneStats;
+
+// Runs lanes copies of one image in lockstep, lane i reading in[i] and
+// writing out[i], each with its own registers and memory. Lanes that
+// branch apart run separately until their pcs meet again. A lane that
+// hits a simulation error stops and the others carry on.
+void simRunLanes(const unsigned char * image, size_t len, int lanes, FILE ** in, FILE ** out, LaneStats * stats);
+
+// Fork server. simServe loads the image once, then listens on a unix
+// socket at path and runs every job in a forked copy of the loaded state.
+// A client connects and sends one byte carrying its stdin and stdout as
+// SCM_RIGHTS; when the job exits the server replies with a ServeReply and
+// closes the connection. simServe returns only on a setup error.
+typedef struct ServeReply {
+	int32_t status;      // exit status, 128 + signal when the job was killed
+	int32_t reserved;
+	uint64_t wallMicros; // fork to exit
+	uint64_t userMicros;
+	uint64_t sysMicros;
+	uint64_t maxRssKb;
+} ServeReply;
+
+int simServe(const char * path, const unsigned char * image, size_t len);
+
+// Runs one job on the server at path with this process's stdin and
+// stdout. Returns 0 with the reply filled in, or -1 when the server
+// cannot be reached.
+int simConnect(const char * path, ServeReply * reply);
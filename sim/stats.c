@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "main.h"
+#include "sim.h"
+#include "decode.h"
+#include "stats.h"
+#include "symbols.h"
+
+#define ull unsigned long long
+
+ull commandRuns[VEC + 1];
+ull vectorLoads, vectorStores;
+ull stackLow, touchedEnd;
+ull inputPrivs, inputValues, inputBytes, outputPrivs, outputBytes;
+int stepping, checking;
+int runningLane = -1;
+
+static const char * outputPath;
+static int running;  // between statsStart and statsStop
+static ull loaded;   // retired when the image was loaded
+static ull loadNanos, runStarted, runNanos;
+
+typedef struct Region {
+	ull id, site; // site is where it was first started
+	int lane;     // runningLane that started it, each lane's regions are its own
+	ull runs, instructions, nanos;
+	int depth;    // starts not stopped yet, only the outermost is timed
+	ull startedAt, startedNanos;
+} Region;
+
+static Region * regions;
+static int numRegions, maxRegions;
+
+// one name per CommandType, with the forms the assembler writes under one
+// mnemonic (brr, mov) told apart
+static const char * names[VEC + 1] = {
+	[AND] = "and", [OR] = "or", [XOR] = "xor", [NOT] = "not",
+	[SHFTR] = "shftr", [SHFTRI] = "shftri", [SHFTL] = "shftl", [SHFTLI] = "shftli",
+	[BR] = "br", [BRR] = "brr_reg", [BRR2] = "brr_imm", [BRNZ] = "brnz",
+	[CALL] = "call", [RETURN] = "return", [BRGT] = "brgt", [PRIV] = "priv",
+	[MOV] = "mov_load", [MOV1] = "mov_reg", [MOV2] = "mov_imm", [MOV3] = "mov_store",
+	[ADDF] = "addf", [SUBF] = "subf", [MULF] = "mulf", [DIVF] = "divf",
+	[ADD] = "add", [ADDI] = "addi", [SUB] = "sub", [SUBI] = "subi",
+	[MUL] = "mul", [DIV] = "div", [VEC] = "vec",
+};
+
+void simStats(const char * path) {
+	outputPath = path;
+}
+
+ull statsClock() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+void statsReset(ull nanos) {
+	memset(commandRuns, 0, sizeof(commandRuns));
+	vectorLoads = vectorStores = 0;
+	inputPrivs = inputValues = inputBytes = outputPrivs = outputBytes = 0;
+	stackLow = r[31];
+	touchedEnd = 0;
+	loaded = retired;
+	loadNanos = nanos;
+	runNanos = 0;
+	running = 0;
+	numRegions = 0;
+}
+
+void statsStart() {
+	static int registered;
+	runStarted = statsClock();
+	running = 1;
+	if (outputPath && !registered) {
+		atexit(statsStop);
+		registered = 1;
+	}
+}
+
+ull guestInstructions() {
+	return retired - loaded - !stepping;
+}
+
+ull guestClock() {
+	return checking ? guestInstructions() : statsClock();
+}
+
+static void printRegions() {
+	if (!numRegions) return;
+	fflush(stdout);
+	for (int i = 0; i < numRegions; i++) {
+		Region * g = &regions[i];
+		char label[128], line[64];
+		fprintf(stderr, "region %llu at %s", g->id, symbolize(g->site, label, sizeof(label)));
+		if (sourceLine(g->site, line, sizeof(line))) fprintf(stderr, " (%s)", line);
+		if (g->lane >= 0) fprintf(stderr, " in lane %d", g->lane);
+		double runs = g->runs ? g->runs : 1;
+		fprintf(stderr, ": %llu runs, %llu instructions (%.1f each), %.3fms (%.3fus each)%s\n", g->runs,
+			g->instructions, g->instructions / runs, g->nanos / 1e6, g->nanos / runs / 1e3,
+			g->depth ? ", still open" : "");
+	}
+}
+
+static Region * findRegion(ull id) {
+	for (int i = 0; i < numRegions; i++)
+		if (regions[i].id == id && regions[i].lane == runningLane) return &regions[i];
+	return NULL;
+}
+
+void regionStart(ull id) {
+	static int registered;
+	if (checking == 2) return;
+	Region * g = findRegion(id);
+	if (!g) {
+		if (numRegions == maxRegions) {
+			maxRegions = maxRegions ? 2 * maxRegions : 16;
+			if (!(regions = realloc(regions, maxRegions * sizeof(Region)))) {
+				fprintf(stderr, "Error: not enough memory for the regions\n");
+				exit(1);
+			}
+		}
+		g = &regions[numRegions++];
+		*g = (Region){.id = id, .site = (ull)pc, .lane = runningLane};
+	}
+	if (g->depth++) return;
+	if (!registered) atexit(printRegions);
+	registered = 1;
+	g->startedAt = guestInstructions();
+	g->startedNanos = statsClock();
+}
+
+void regionStop(ull id) {
+	ull now = statsClock();
+	Region * g = findRegion(id);
+	if (checking == 2 || !g || !g->depth || --g->depth) return;
+	g->runs++;
+	g->instructions += guestInstructions() - g->startedAt - 1;
+	g->nanos += now - g->startedNanos;
+}
+
+void simRunStats(RunStats * s) {
+	memset(s, 0, sizeof(*s));
+	s->halted = halt;
+	s->pc = (ull)pc;
+	s->instructions = retired - loaded;
+	memcpy(s->commands, commandRuns, sizeof(commandRuns));
+	if (blockRuns) blockCounts(s->commands);
+	s->loads = s->commands[MOV] + s->commands[RETURN] + vectorLoads;
+	s->stores = s->commands[MOV3] + s->commands[CALL] + vectorStores;
+	s->inputPrivs = inputPrivs;
+	s->inputValues = inputValues;
+	s->inputBytes = inputBytes;
+	s->outputPrivs = outputPrivs;
+	s->outputBytes = outputBytes;
+	s->stackBytes = stackLow < memSize ? memSize - stackLow : 0;
+	s->highestAddress = touchedEnd ? touchedEnd - 1 : 0;
+	s->memoryBytes = memSize;
+	s->loadSeconds = loadNanos / 1e9;
+	s->runSeconds = (running ? statsClock() - runStarted : runNanos) / 1e9;
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) s->peakRssBytes = (ull)usage.ru_maxrss * 1024;
+}
+
+static void writeJson(FILE * file, const RunStats * s) {
+	fprintf(file, "{\"halted\": %s, \"pc\": %llu, \"instructions\": %llu,\n", s->halted ? "true" : "false", s->pc,
+		s->instructions);
+	fprintf(file, " \"commands\": {");
+	for (int i = 0; i <= VEC; i++) fprintf(file, "%s\"%s\": %llu", i ? ", " : "", names[i], s->commands[i]);
+	fprintf(file, "},\n \"loads\": %llu, \"stores\": %llu,\n", s->loads, s->stores);
+	fprintf(file, " \"input\": {\"privs\": %llu, \"values\": %llu, \"bytes\": %llu},\n", s->inputPrivs,
+		s->inputValues, s->inputBytes);
+	fprintf(file, " \"output\": {\"privs\": %llu, \"bytes\": %llu},\n", s->outputPrivs, s->outputBytes);
+	fprintf(file, " \"stack_bytes\": %llu, \"highest_address\": %llu, \"memory_bytes\": %llu,\n", s->stackBytes,
+		s->highestAddress, s->memoryBytes);
+	fprintf(file, " \"load_seconds\": %.6f, \"run_seconds\": %.6f, \"peak_rss_bytes\": %llu,\n", s->loadSeconds,
+		s->runSeconds, s->peakRssBytes);
+	fprintf(file, " \"regions\": [");
+	for (int i = 0; i < numRegions; i++)
+		fprintf(file, "%s{\"id\": %llu, \"runs\": %llu, \"instructions\": %llu, \"seconds\": %.6f}",
+			i ? ", " : "", regions[i].id, regions[i].runs, regions[i].instructions, regions[i].nanos / 1e9);
+	fprintf(file, "]}\n");
+}
+
+static void metric(FILE * file, const char * name, const char * type, ull value) {
+	fprintf(file, "# TYPE tinker_%s %s\ntinker_%s %llu\n", name, type, name, value);
+}
+
+static void writePrometheus(FILE * file, const RunStats * s) {
+	metric(file, "halted", "gauge", s->halted);
+	metric(file, "pc", "gauge", s->pc);
+	metric(file, "instructions_total", "counter", s->instructions);
+	fprintf(file, "# TYPE tinker_commands_total counter\n");
+	for (int i = 0; i <= VEC; i++)
+		fprintf(file, "tinker_commands_total{command=\"%s\"} %llu\n", names[i], s->commands[i]);
+	metric(file, "loads_total", "counter", s->loads);
+	metric(file, "stores_total", "counter", s->stores);
+	metric(file, "input_privs_total", "counter", s->inputPrivs);
+	metric(file, "input_values_total", "counter", s->inputValues);
+	metric(file, "input_bytes_total", "counter", s->inputBytes);
+	metric(file, "output_privs_total", "counter", s->outputPrivs);
+	metric(file, "output_bytes_total", "counter", s->outputBytes);
+	metric(file, "stack_bytes", "gauge", s->stackBytes);
+	metric(file, "highest_address", "gauge", s->highestAddress);
+	metric(file, "memory_bytes", "gauge", s->memoryBytes);
+	fprintf(file, "# TYPE tinker_load_seconds gauge\ntinker_load_seconds %.6f\n", s->loadSeconds);
+	fprintf(file, "# TYPE tinker_run_seconds gauge\ntinker_run_seconds %.6f\n", s->runSeconds);
+	metric(file, "peak_rss_bytes", "gauge", s->peakRssBytes);
+	if (!numRegions) return;
+	fprintf(file, "# TYPE tinker_region_runs_total counter\n");
+	for (int i = 0; i < numRegions; i++)
+		fprintf(file, "tinker_region_runs_total{region=\"%llu\"} %llu\n", regions[i].id, regions[i].runs);
+	fprintf(file, "# TYPE tinker_region_instructions_total counter\n");
+	for (int i = 0; i < numRegions; i++)
+		fprintf(file, "tinker_region_instructions_total{region=\"%llu\"} %llu\n", regions[i].id,
+			regions[i].instructions);
+	fprintf(file, "# TYPE tinker_region_seconds_total counter\n");
+	for (int i = 0; i < numRegions; i++)
+		fprintf(file, "tinker_region_seconds_total{region=\"%llu\"} %.6f\n", regions[i].id, regions[i].nanos / 1e9);
+}
+
+static int writeStats(FILE * file, const void * arg) {
+	size_t len = strlen(outputPath);
+	if (len > 5 && strcmp(outputPath + len - 5, ".prom") == 0) writePrometheus(file, arg);
+	else writeJson(file, arg);
+	return 0;
+}
+
+void statsStop() {
+	if (!running) return;
+	running = 0;
+	runNanos = statsClock() - runStarted;
+	if (!outputPath) return;
+
+	RunStats s;
+	simRunStats(&s);
+	if (simReplaceFile(outputPath, writeStats, &s) != 0) fprintf(stderr, "Error: cannot write %s\n", outputPath);
+}
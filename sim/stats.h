@@ -0,0 +1,36 @@
+#pragma once
+
+// Run statistics (simRunStats and simStats in sim.h), kept on every run
+// because keeping them costs next to nothing. The predecoded loop counts
+// the blocks it enters (blockRuns in decode.h), and the instruction mix
+// is worked out from the table only when the statistics are read;
+// instructions run one at a time count themselves in commandRuns. Loads
+// and stores follow from the mix, priv I/O is counted in doPRIV, memory
+// accesses move touchedEnd up, and r[31] is sampled where each block
+// starts, so a push popped again within one block can go unseen.
+//
+// With a path set, the statistics are written when the run halts, or at
+// exit after a simulation error, to a temporary file that is then renamed
+// over path, so a collector never reads half of one.
+
+unsigned long long statsClock(); // monotonic nanoseconds
+
+// Zeroes the counters for a newly loaded image that took loadNanos
+void statsReset(unsigned long long loadNanos);
+
+void statsStart();
+
+// Writes the statistics; also run at exit after a simulation error
+void statsStop();
+
+// Timing services for the guest (priv 13-16). The instruction count is
+// what ran since the load before the priv that reads it, and the clock
+// is host monotonic time in nanoseconds. A region adds the instructions
+// and time between its start and stop markers, not counting them, to a
+// total kept for its id; starting a region that is open already only
+// nests it, and stopping one that is not open does nothing. Regions are
+// reported on stderr at exit, and in the statistics file.
+unsigned long long guestInstructions();
+unsigned long long guestClock();
+void regionStart(unsigned long long id);
+void regionStop(unsigned long long id);
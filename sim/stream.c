@@ -0,0 +1,163 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include "main.h"
+#include "sim.h"
+
+#define ull unsigned long long
+
+// Asynchronous priv I/O. A reader thread runs readInput ahead of the guest
+// and a writer thread formats what it outputs, each talking to the
+// interpreter through a single-producer single-consumer ring. Parse errors
+// travel through the ring as entries, so they still stop the guest at the
+// priv that reads the bad line. The rings and threads belong to one run:
+// streamStop cancels the reader, which may be waiting for input nobody
+// will ask for, joins both threads and frees the rings, so a later run in
+// the same process starts with fresh ones.
+
+#define RING_SIZE 4096 // a power of two
+
+#define STREAM_VALUE 2 // input entries
+#define STREAM_ERROR 3
+#define STREAM_END 4   // tells the writer to finish
+
+typedef struct Entry {
+	ull value;
+	int kind;
+	int bytes; // of an input line
+} Entry;
+
+// Each side owns a cache line: the index it advances and its last look at
+// the other side's index, so the shared lines only move when a side runs
+// out of entries or room.
+typedef struct Ring {
+	_Atomic size_t head; // next entry the consumer takes
+	size_t seenTail;     // consumer's copy of tail
+	char pad[64 - 2 * sizeof(size_t)];
+	_Atomic size_t tail; // next entry the producer fills
+	size_t seenHead;     // producer's copy of head
+	char pad2[64 - 2 * sizeof(size_t)];
+	Entry entries[RING_SIZE];
+} Ring;
+
+int streaming;
+static int requested;
+static Ring * input, * output;
+static pthread_t reader, writer;
+
+void simAsyncIo(int on) {
+	requested = on;
+}
+
+// spins briefly, then yields, then sleeps, so an idle side costs little
+static void backoff(int * spins) {
+	if (++*spins < 64) return;
+	if (*spins < 128) sched_yield();
+	else nanosleep(&(struct timespec){0, 20000}, NULL);
+}
+
+static void push(Ring * ring, Entry entry) {
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	int spins = 0;
+	while (tail - ring->seenHead == RING_SIZE) {
+		ring->seenHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+		if (tail - ring->seenHead < RING_SIZE) break;
+		backoff(&spins);
+	}
+	ring->entries[tail & (RING_SIZE - 1)] = entry;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static Entry pop(Ring * ring) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	int spins = 0;
+	while (ring->seenTail == head) {
+		ring->seenTail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+		if (ring->seenTail != head) break;
+		backoff(&spins);
+	}
+	Entry entry = ring->entries[head & (RING_SIZE - 1)];
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return entry;
+}
+
+// stops after the first error, which is as far as the guest can read
+static void * readLines(void * arg) {
+	Ring * ring = arg;
+	for (;;) {
+		ull value = 0;
+		int bytes = readInput(simIn, &value);
+		push(ring, (Entry){value, bytes >= 0 ? STREAM_VALUE : STREAM_ERROR, bytes});
+		if (bytes < 0) return NULL;
+	}
+}
+
+static void * writeValues(void * arg) {
+	Ring * ring = arg;
+	for (;;) {
+		Entry entry = pop(ring);
+		if (entry.kind == STREAM_END) return NULL;
+		if (entry.kind == STREAM_NUMBER) fprintf(simOut, "%llu\n", entry.value);
+		else fputc((char)entry.value, simOut);
+	}
+}
+
+int streamIn(ull * value) {
+	Entry entry = pop(input);
+	*value = entry.value;
+	return entry.kind == STREAM_VALUE ? entry.bytes : -1;
+}
+
+void streamOut(int kind, ull v) {
+	push(output, (Entry){v, kind});
+}
+
+static void freeRings() {
+	free(input);
+	free(output);
+	input = output = NULL;
+}
+
+void streamStart() {
+	static int registered;
+	if (!requested || streaming) return;
+	input = aligned_alloc(64, sizeof(Ring));
+	output = aligned_alloc(64, sizeof(Ring));
+	if (!input || !output) {
+		freeRings();
+		return;
+	}
+	atomic_init(&input->head, 0);
+	atomic_init(&input->tail, 0);
+	atomic_init(&output->head, 0);
+	atomic_init(&output->tail, 0);
+	input->seenTail = input->seenHead = output->seenTail = output->seenHead = 0;
+	if (pthread_create(&writer, NULL, writeValues, output) != 0) {
+		freeRings();
+		return;
+	}
+	if (pthread_create(&reader, NULL, readLines, input) != 0) {
+		push(output, (Entry){0, STREAM_END});
+		pthread_join(writer, NULL);
+		freeRings();
+		return;
+	}
+	// simErr exits from the guest's thread, what it wrote must still come out
+	if (!registered) atexit(streamStop);
+	registered = 1;
+	streaming = 1;
+}
+
+// drains the output ring, so everything the guest wrote reaches simOut,
+// and ends the reader wherever it is, blocked on input or on a full ring
+void streamStop() {
+	if (!streaming) return;
+	streaming = 0;
+	push(output, (Entry){0, STREAM_END});
+	pthread_join(writer, NULL);
+	pthread_cancel(reader);
+	pthread_join(reader, NULL);
+	freeRings();
+}
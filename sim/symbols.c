@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "symbols.h"
+
+#define ull unsigned long long
+
+typedef struct Symbol {
+	ull address;
+	int order; // position in the map, the first of equal labels names them
+	char * name;
+} Symbol;
+
+// an instruction as written and the count it expanded to
+typedef struct Line {
+	ull address;
+	int line, count;
+	char name[12];
+} Line;
+
+static Symbol * symbols;
+static int numSymbols, maxSymbols;
+static Line * lines;
+static int numLines, maxLines;
+
+static int byAddress(const void * a, const void * b) {
+	const Symbol * x = a, * y = b;
+	if (x->address != y->address) return x->address < y->address ? -1 : 1;
+	return x->order - y->order;
+}
+
+static int byLineAddress(const void * a, const void * b) {
+	const Line * x = a, * y = b;
+	return (x->address > y->address) - (x->address < y->address);
+}
+
+static int addLine(const char * text) {
+	Line line;
+	if (sscanf(text, "line %llx %d %11s %d", &line.address, &line.line, line.name, &line.count) != 4) return 0;
+	if (numLines == maxLines) {
+		int max = maxLines ? 2 * maxLines : 256;
+		Line * grown = realloc(lines, max * sizeof(Line));
+		if (!grown) return -1;
+		lines = grown;
+		maxLines = max;
+	}
+	lines[numLines++] = line;
+	return 0;
+}
+
+void simSymbols(const char * path) {
+	loadSymbols(path);
+}
+
+int loadSymbols(const char * path) {
+	FILE * file = path ? fopen(path, "r") : NULL;
+	if (!file) return -1;
+	char line[256], segment[16], name[128];
+	ull address;
+	while (fgets(line, sizeof(line), file)) {
+		if (strncmp(line, "line ", 5) == 0) {
+			if (addLine(line) != 0) break;
+			continue;
+		}
+		if (sscanf(line, "%15s %llx %127s", segment, &address, name) != 3 || strcmp(segment, "code") != 0)
+			continue;
+		if (numSymbols == maxSymbols) {
+			int max = maxSymbols ? 2 * maxSymbols : 64;
+			Symbol * grown = realloc(symbols, max * sizeof(Symbol));
+			if (!grown) break;
+			symbols = grown;
+			maxSymbols = max;
+		}
+		symbols[numSymbols].address = address;
+		symbols[numSymbols].order = numSymbols;
+		symbols[numSymbols++].name = strdup(name);
+	}
+	fclose(file);
+	qsort(symbols, numSymbols, sizeof(Symbol), byAddress);
+	qsort(lines, numLines, sizeof(Line), byLineAddress);
+	return 0;
+}
+
+const char * symbolize(ull pc, char * buf, size_t len) {
+	int lo = 0, hi = numSymbols; // first symbol above pc
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (symbols[mid].address <= pc) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) {
+		snprintf(buf, len, "%#llx", pc);
+		return buf;
+	}
+	// back to the first label at that address
+	int at = lo - 1;
+	while (at > 0 && symbols[at - 1].address == symbols[at].address) at--;
+	if (pc == symbols[at].address) snprintf(buf, len, "%s", symbols[at].name);
+	else snprintf(buf, len, "%s+%#llx", symbols[at].name, pc - symbols[at].address);
+	return buf;
+}
+
+const char * sourceLine(ull pc, char * buf, size_t len) {
+	int lo = 0, hi = numLines; // first line above pc
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (lines[mid].address <= pc) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) return NULL;
+	Line * line = &lines[lo - 1];
+	ull at = (pc - line->address) / 4;
+	if (at >= (ull)line->count) return NULL;
+	if (line->count == 1) snprintf(buf, len, "line %d", line->line);
+	else snprintf(buf, len, "line %d, %s %llu/%d", line->line, line->name, at + 1, line->count);
+	return buf;
+}
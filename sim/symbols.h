@@ -0,0 +1,18 @@
+#pragma once
+#include <stddef.h>
+
+// Code labels and source lines from a symbol map written by hw5-asm --map
+// (see asm/asm.h), used to name pcs in profiles and errors
+
+// Reads the map at path. Returns 0, or -1 when it cannot be read, which
+// leaves pcs unnamed.
+int loadSymbols(const char * path);
+
+// Writes pc into buf as "Label" or "Label+0x10", from the closest code
+// label at or below it, or as a bare address when there is none. Returns buf.
+const char * symbolize(unsigned long long pc, char * buf, size_t len);
+
+// Writes the source line pc was assembled from into buf as "line 14", or
+// as "line 14, ld 3/12" for the third of the twelve instructions an ld
+// expanded to. Returns buf, or null when the map has no line for pc.
+const char * sourceLine(unsigned long long pc, char * buf, size_t len);
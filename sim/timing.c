@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "sim.h"
+#include "timing.h"
+#include "trace.h"
+#include "vector.h"
+
+#define ull unsigned long long
+
+#define RAS_DEPTH 16
+
+typedef struct CacheConfig {
+	ull size;
+	int ways, line;
+} CacheConfig;
+
+typedef struct Cache {
+	int sets, ways, lineBits;
+	ull * tags; // sets * ways line numbers plus one, 0 when empty
+	ull * used; // when each way was last used
+	unsigned char * dirty;
+	ull clock;
+	CacheStats * stats;
+} Cache;
+
+enum { STATIC, BIMODAL, GSHARE };
+
+int timing;
+static int configured;
+static CacheConfig l1iConfig = {16 << 10, 4, 64}, l1dConfig = {16 << 10, 4, 64}, l2Config = {256 << 10, 8, 64};
+static int l1Time = 2, l2Time = 12, memTime = 100;
+static int mulTime = 3, divTime = 20, fpTime = 4, fdivTime = 15;
+static int predictor = GSHARE, historyBits = 12, mispredictTime = 3;
+
+static TimingStats stats;
+static Cache l1i, l1d, l2;
+static unsigned char * counters; // two-bit, taken from 2 up
+static unsigned history;
+static ull ras[RAS_DEPTH];
+static int rasTop;
+
+static ull next;       // earliest cycle the next instruction can issue
+static ull ready[64];  // when each register's value is ready, vector registers from 32
+static ull last;       // latest cycle anything finishes
+
+static ull number(const char * s, char ** end) {
+	ull v = strtoull(s, end, 0);
+	if (**end == 'k') v <<= 10, (*end)++;
+	else if (**end == 'm') v <<= 20, (*end)++;
+	return v;
+}
+
+static int cacheConfig(const char * s, CacheConfig * c) {
+	char * end;
+	c->size = number(s, &end);
+	if (*end != '/') return -1;
+	c->ways = strtol(end + 1, &end, 0);
+	if (*end != '/') return -1;
+	c->line = strtol(end + 1, &end, 0);
+	if (*end || c->ways < 1 || c->line < 8 || (c->line & (c->line - 1))) return -1;
+	ull sets = c->size / ((ull)c->ways * c->line);
+	if (!sets || sets * c->ways * c->line != c->size || (sets & (sets - 1))) return -1;
+	return 0;
+}
+
+int simTiming(const char * spec) {
+	configured = spec != NULL;
+	if (!spec || strcmp(spec, "1") == 0) return 0;
+	char * copy = strdup(spec);
+	int ok = copy != NULL;
+	for (char * save, * item = strtok_r(copy, ",", &save); ok && item; item = strtok_r(NULL, ",", &save)) {
+		char * value = strchr(item, '=');
+		if (!value) {
+			ok = 0;
+			break;
+		}
+		*value++ = '\0';
+		char * end = "";
+		long v = 0;
+		if (strcmp(item, "l1i") == 0) ok = cacheConfig(value, &l1iConfig) == 0;
+		else if (strcmp(item, "l1d") == 0) ok = cacheConfig(value, &l1dConfig) == 0;
+		else if (strcmp(item, "l2") == 0) ok = cacheConfig(value, &l2Config) == 0;
+		else if (strcmp(item, "predictor") == 0) {
+			if (strcmp(value, "static") == 0) predictor = STATIC;
+			else if (strcmp(value, "bimodal") == 0) predictor = BIMODAL;
+			else if (strcmp(value, "gshare") == 0) predictor = GSHARE;
+			else ok = 0;
+		} else {
+			v = strtol(value, &end, 0);
+			int * field = NULL;
+			if (strcmp(item, "l1time") == 0) field = &l1Time;
+			else if (strcmp(item, "l2time") == 0) field = &l2Time;
+			else if (strcmp(item, "memtime") == 0) field = &memTime;
+			else if (strcmp(item, "mul") == 0) field = &mulTime;
+			else if (strcmp(item, "div") == 0) field = &divTime;
+			else if (strcmp(item, "fp") == 0) field = &fpTime;
+			else if (strcmp(item, "fdiv") == 0) field = &fdivTime;
+			else if (strcmp(item, "mispredict") == 0) field = &mispredictTime;
+			else if (strcmp(item, "history") == 0 && v <= 24) field = &historyBits;
+			if (!field || *end || *value == '\0' || v < 0) ok = 0;
+			else *field = v;
+		}
+	}
+	free(copy);
+	if (!ok) configured = 0;
+	return ok ? 0 : -1;
+}
+
+void simTimingStats(TimingStats * out) {
+	*out = stats;
+}
+
+static int cacheInit(Cache * c, CacheConfig * config, CacheStats * s) {
+	free(c->tags);
+	free(c->used);
+	free(c->dirty);
+	c->ways = config->ways;
+	c->sets = config->size / ((ull)config->ways * config->line);
+	c->lineBits = __builtin_ctz(config->line);
+	c->tags = calloc((size_t)c->sets * c->ways, sizeof(ull));
+	c->used = calloc((size_t)c->sets * c->ways, sizeof(ull));
+	c->dirty = calloc((size_t)c->sets * c->ways, 1);
+	c->clock = 0;
+	c->stats = s;
+	return c->tags && c->used && c->dirty ? 0 : -1;
+}
+
+// Returns 1 on a hit. A miss fills the line over the least recently used
+// way and returns 0, with the address of what it pushed out in *evicted
+// when that was dirty (else ~0).
+static int lookup(Cache * c, ull address, int write, ull * evicted) {
+	ull line = address >> c->lineBits;
+	size_t set = (line & (c->sets - 1)) * c->ways;
+	c->stats->accesses++;
+	c->clock++;
+	*evicted = ~0ULL;
+	int victim = 0;
+	for (int w = 0; w < c->ways; w++) {
+		if (c->tags[set + w] == line + 1) {
+			c->used[set + w] = c->clock;
+			c->dirty[set + w] |= write;
+			return 1;
+		}
+		if (c->used[set + w] < c->used[set + victim]) victim = w;
+	}
+	c->stats->misses++;
+	if (c->tags[set + victim] && c->dirty[set + victim]) {
+		c->stats->writebacks++;
+		*evicted = (c->tags[set + victim] - 1) << c->lineBits;
+	}
+	c->tags[set + victim] = line + 1;
+	c->used[set + victim] = c->clock;
+	c->dirty[set + victim] = write;
+	return 0;
+}
+
+// cycles until an access through l1 has its data
+static int access(Cache * l1, ull address, int write) {
+	ull evicted, dropped;
+	if (lookup(l1, address, write, &evicted)) return l1Time;
+	if (evicted != ~0ULL) lookup(&l2, evicted, 1, &dropped);
+	return lookup(&l2, address, 0, &dropped) ? l2Time : memTime;
+}
+
+// the slowest line of a range, or with serial set the lines one after another
+static int accessRange(ull address, ull len, int write, int serial) {
+	int total = 0;
+	if (!len) return 0;
+	ull line = 1ULL << l1d.lineBits;
+	for (ull at = address & ~(line - 1); at < address + len; at += line) {
+		int t = access(&l1d, at, write);
+		if (serial) total += t;
+		else if (t > total) total = t;
+	}
+	return total;
+}
+
+void timingStart() {
+	static int registered;
+	if (!configured || timing) return;
+	memset(&stats, 0, sizeof(stats));
+	if (cacheInit(&l1i, &l1iConfig, &stats.l1i) != 0 || cacheInit(&l1d, &l1dConfig, &stats.l1d) != 0 ||
+		cacheInit(&l2, &l2Config, &stats.l2) != 0 ||
+		!(counters = realloc(counters, 1 << historyBits))) {
+		fprintf(stderr, "Error: not enough memory for the timing model\n");
+		return;
+	}
+	memset(counters, 1, 1 << historyBits);
+	history = 0;
+	rasTop = 0;
+	next = last = 0;
+	memset(ready, 0, sizeof(ready));
+	timing = 1;
+	if (!registered) atexit(timingStop); // the cycles, after a simulation error
+	registered = 1;
+}
+
+static int predict(ull at, ull target) {
+	unsigned mask = (1u << historyBits) - 1;
+	if (predictor == STATIC) return target <= at;
+	if (predictor == BIMODAL) return counters[(at >> 2) & mask] >= 2;
+	return counters[((at >> 2) ^ history) & mask] >= 2;
+}
+
+static void train(ull at, int taken) {
+	unsigned mask = (1u << historyBits) - 1;
+	if (predictor == STATIC) return;
+	unsigned char * c = &counters[((at >> 2) ^ (predictor == GSHARE ? history : 0)) & mask];
+	if (taken && *c < 3) (*c)++;
+	else if (!taken && *c > 0) (*c)--;
+	history = ((history << 1) | taken) & mask;
+}
+
+static int latency(int cmd, int imm) {
+	switch (cmd) {
+		case MUL: return mulTime;
+		case DIV: return divTime;
+		case ADDF: case SUBF: case MULF: return fpTime;
+		case DIVF: return fdivTime;
+		case VEC:
+			switch (imm) {
+				case VMUL: case VFMA: return mulTime;
+				case VDIV: return divTime;
+				case VADDF: case VSUBF: case VMULF: case VFMAF: case VSUMF: return fpTime;
+				case VDIVF: return fdivTime;
+			}
+	}
+	return 1;
+}
+
+void timingStep(int cmd, int rd, int rs, int rt, int imm, ull at, int flags, ull address) {
+	// registers read, registers written (vector ones from 32), -1 for none
+	int src[3] = {-1, -1, -1}, dst = -1;
+	switch (cmd) {
+		case NOT: case MOV1: src[0] = rs, dst = rd; break;
+		case SHFTRI: case SHFTLI: case ADDI: case SUBI: case MOV2: src[0] = rd, dst = rd; break;
+		case MOV: src[0] = rs, dst = rd; break;
+		case MOV3: src[0] = rd, src[1] = rs; break;
+		case BR: case BRR: src[0] = rd; break;
+		case BRR2: break;
+		case BRNZ: src[0] = rd, src[1] = rs; break;
+		case BRGT: src[0] = rd, src[1] = rs, src[2] = rt; break;
+		case CALL: src[0] = rd, src[1] = 31; break;
+		case RETURN: src[0] = 31; break;
+		case PRIV: src[0] = rd, src[1] = rs, src[2] = rt, dst = rd; break;
+		case VEC:
+			switch (imm) {
+				case VSPLAT: src[0] = rs, dst = 32 + rd; break;
+				case VSUM: case VSUMF: src[0] = 32 + rs, dst = rd; break;
+				case VLD: src[0] = rs, dst = 32 + rd; break;
+				case VST: src[0] = rd, src[1] = 32 + rs; break;
+				case VFMA: case VFMAF: src[2] = 32 + rd; // falls through
+				default: src[0] = 32 + rs, src[1] = 32 + rt, dst = 32 + rd; break;
+			}
+			break;
+		default: src[0] = rs, src[1] = rt, dst = rd; break;
+	}
+
+	// an instruction that misses in the l1 waits for its fetch
+	int fetch = access(&l1i, at, 0);
+	ull issue = next;
+	if (fetch > l1Time) {
+		issue += fetch - l1Time;
+		stats.fetchStalls += fetch - l1Time;
+	}
+	ull operands = 0;
+	for (int i = 0; i < 3; i++)
+		if (src[i] >= 0 && ready[src[i]] > operands) operands = ready[src[i]];
+	if (operands > issue) {
+		stats.operandStalls += operands - issue;
+		issue = operands;
+	}
+
+	int result = latency(cmd, imm), busy = 1;
+	if (flags & TRACE_MEMORY) {
+		int t = accessRange(address, cmd == VEC ? 8 * VLANES : 8, (flags & TRACE_STORE) != 0, 0);
+		if (!(flags & TRACE_STORE)) result = t; // stores retire into a store buffer
+	} else if (cmd == PRIV) {
+		// block privs move their whole range before the next instruction
+		if (imm == 0x5) busy += accessRange(r[rd], 8 * r[rs], 1, 1);
+		else if (imm == 0x6) busy += accessRange(r[rd], 8 * r[rs], 0, 1);
+		else if (imm == 0x7) busy += accessRange(r[rd], r[rs], 0, 1);
+		else if (imm == 0x8) busy += accessRange(r[rs], r[rt], 0, 1) + accessRange(r[rd], r[rt], 1, 1);
+		else if (imm == 0x9) busy += accessRange(r[rd], r[rt], 1, 1);
+	}
+	if (dst >= 0) ready[dst] = issue + result;
+	next = issue + busy;
+
+	if (cmd == BRNZ || cmd == BRGT) {
+		int taken = (flags & TRACE_JUMP) != 0;
+		stats.branches++;
+		if (predict(at, r[rd]) != taken) {
+			stats.mispredicts++;
+			stats.branchStalls += mispredictTime;
+			next += mispredictTime;
+		}
+		train(at, taken);
+	} else if (cmd == CALL) {
+		ras[rasTop++ % RAS_DEPTH] = at + 4;
+	} else if (cmd == RETURN) {
+		stats.returns++;
+		// a return the stack gets wrong waits for its load
+		if (!rasTop || ras[--rasTop % RAS_DEPTH] != (ull)pc) {
+			stats.returnMispredicts++;
+			ull resolved = issue + (result > mispredictTime ? result : mispredictTime);
+			stats.branchStalls += resolved - issue;
+			next = resolved;
+		}
+	}
+
+	stats.instructions++;
+	if (next > last) last = next;
+	if (dst >= 0 && ready[dst] > last) last = ready[dst];
+}
+
+void timingStop() {
+	if (!timing) return;
+	timing = 0;
+	stats.cycles = last;
+}
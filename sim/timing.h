@@ -0,0 +1,33 @@
+#pragma once
+
+// Timing model. With a model configured, simStart runs one instruction at
+// a time (traceRun in trace.c) and hands each retired instruction here;
+// the plain dispatch loop never calls into it.
+//
+// The model is a scalar in-order pipeline. An instruction issues a cycle
+// after the one before it, later when it waits on an operand a long
+// latency instruction or a load has not produced yet, on an instruction
+// fetch that missed, or behind a mispredicted branch. Fetches go through
+// an L1 instruction cache and loads and stores through an L1 data cache,
+// both backed by a shared L2 and then memory; caches are set associative,
+// LRU, write-back and write-allocate. Conditional branches (brnz, brgt)
+// are predicted by gshare, bimodal or static backward-taken, returns by a
+// return address stack; other jumps are taken for free.
+//
+// simTiming takes the configuration as comma separated key=value pairs,
+// anything left out keeping its default:
+//
+//   l1i=16k/4/64  l1d=16k/4/64  l2=256k/8/64   size/ways/line bytes
+//   l1time=2  l2time=12  memtime=100           cycles to a loaded value
+//   mul=3  div=20  fp=4  fdiv=15               result latencies, others 1
+//   predictor=gshare  history=12  mispredict=3 (or bimodal, static)
+
+extern int timing;
+
+void timingStart();
+
+// One retired instruction that started at pc at: its TRACE_* flags and
+// the address of its load or store (see trace.h)
+void timingStep(int cmd, int rd, int rs, int rt, int imm, unsigned long long at, int flags, unsigned long long address);
+
+void timingStop();
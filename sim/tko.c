@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "tko.h"
+#include "decode.h"
+
+#define ull unsigned long long
+
+static void badImage(const char * why) {
+	if (simTrap) longjmp(*simTrap, 1);
+	fprintf(stderr, "Invalid tinker file: %s\n", why);
+	exit(1);
+}
+
+static ull getWord(const unsigned char * image, size_t len, size_t at) {
+	if (at + 8 > len) badImage("truncated header");
+	ull v = 0;
+	for (int i = 7; i >= 0; i--)
+		v = (v << 8) | image[at + i];
+	return v;
+}
+
+// true when [address, address + size) fits in guest memory
+static int fits(ull address, ull size) {
+	return address <= memSize && size <= memSize - address;
+}
+
+int lzDecompress(const unsigned char * in, size_t inLen, unsigned char * out, size_t outLen) {
+	size_t ip = 0, op = 0;
+	while (ip < inLen) {
+		unsigned char c = in[ip++];
+		if (c < 0x80) {
+			size_t run = c + 1;
+			if (run > inLen - ip || run > outLen - op) return -1;
+			memcpy(out + op, in + ip, run);
+			ip += run;
+			op += run;
+		} else {
+			size_t m = (c & 0x7f) + 4;
+			if (inLen - ip < 2) return -1;
+			size_t dist = in[ip] | (in[ip + 1] << 8);
+			ip += 2;
+			if (dist == 0 || dist > op || m > outLen - op) return -1;
+			// byte by byte, the copy may overlap what it is writing
+			for (size_t i = 0; i < m; i++, op++)
+				out[op] = out[op - dist];
+		}
+	}
+	return op == outLen ? 0 : -1;
+}
+
+ull imageEnd, stackStart;
+
+static unsigned char * allocated; // mem as allocMem left it
+static int allocatedGuarded;
+
+static void allocMem(ull size) {
+	// a second load, as in tinker check and the fuzz targets: dropping the
+	// pages is cheaper than a new reservation when the size is the same
+	if (mem && mem == allocated && size == memSize && guarded == allocatedGuarded && guestZero(mem) == 0) return;
+	if (mem) guestFree(mem);
+	memSize = size;
+	mem = allocated = guestAlloc();
+	allocatedGuarded = guarded;
+	if (!mem) badImage("not enough memory for the guest");
+}
+
+static void loadLegacy(const unsigned char * image, size_t len) {
+	allocMem(MEM_SIZE);
+	ull codeAddress = getWord(image, len, 8);
+	ull codeSize = getWord(image, len, 16);
+	ull dataAddress = getWord(image, len, 24);
+	ull dataSize = getWord(image, len, 32);
+
+	if (!fits(codeAddress, codeSize) || !fits(dataAddress, dataSize))
+		badImage("segment outside of memory");
+
+	// short files load what is there, like the original fread loader
+	size_t at = 40;
+	size_t n = codeSize < len - at ? codeSize : len - at;
+	memcpy(mem + codeAddress, image + at, n);
+	at += n;
+	n = dataSize < len - at ? dataSize : len - at;
+	memcpy(mem + dataAddress, image + at, n);
+
+	pc = codeAddress;
+	codeBase = codeAddress;
+	codeLen = codeSize;
+	imageEnd = codeAddress + codeSize > dataAddress + dataSize ? codeAddress + codeSize : dataAddress + dataSize;
+	stackStart = memSize > DEFAULT_STACK ? memSize - DEFAULT_STACK : 0;
+}
+
+void loadTko(const unsigned char * image, size_t len) {
+	if (getWord(image, len, 0) == 0) {
+		loadLegacy(image, len);
+		return;
+	}
+	if (getWord(image, len, 0) != TKO_MAGIC) badImage("bad magic");
+	if (getWord(image, len, 8) != TKO_VERSION) badImage("unsupported version");
+
+	ull entry = getWord(image, len, 16);
+	ull count = getWord(image, len, 24);
+	if (count > (len - 32) / 32) badImage("truncated section table");
+
+	// the stack section sits at the top of memory and sets its size
+	ull memory = MEM_SIZE;
+	for (ull i = 0; i < count; i++)
+		if ((getWord(image, len, 32 + 32 * i) & TKO_KIND) == TKO_STACK) {
+			ull base = getWord(image, len, 32 + 32 * i + 8);
+			ull size = getWord(image, len, 32 + 32 * i + 16);
+			if (base > MAX_MEM_SIZE || size > MAX_MEM_SIZE - base) badImage("memory too large");
+			memory = base + size;
+		}
+	allocMem(memory);
+	codeBase = codeLen = 0;
+	imageEnd = 0;
+	stackStart = memSize > DEFAULT_STACK ? memSize - DEFAULT_STACK : 0;
+
+	size_t payload = 32 + 32 * count;
+	for (ull i = 0; i < count; i++) {
+		size_t at = 32 + 32 * i;
+		ull kind = getWord(image, len, at);
+		ull address = getWord(image, len, at + 8);
+		ull size = getWord(image, len, at + 16);
+		ull stored = getWord(image, len, at + 24);
+
+		if (!fits(address, size)) badImage("section outside of memory");
+		for (ull j = 0; j < i && size; j++) {
+			ull otherAddress = getWord(image, len, 32 + 32 * j + 8);
+			ull otherSize = getWord(image, len, 32 + 32 * j + 16);
+			if (otherSize && address < otherAddress + otherSize && otherAddress < address + size)
+				badImage("sections overlap");
+		}
+		if (stored > len - payload) badImage("truncated section");
+		if ((kind & TKO_KIND) != TKO_STACK && size && address + size > imageEnd) imageEnd = address + size;
+
+		switch (kind & TKO_KIND) {
+			case TKO_CODE:
+				if (!codeLen) codeBase = address, codeLen = size;
+				// fall through
+			case TKO_DATA:
+				if (kind & TKO_LZ) {
+					if (lzDecompress(image + payload, stored, mem + address, size) != 0)
+						badImage("corrupt compressed section");
+				} else {
+					if (stored != size) badImage("section size mismatch");
+					memcpy(mem + address, image + payload, size);
+				}
+				break;
+			case TKO_BSS: // guest memory starts zeroed and sections do not overlap
+				break;
+			case TKO_STACK:
+				stackStart = address;
+				break;
+			default:
+				badImage("unknown section kind");
+		}
+		payload += stored;
+	}
+
+	pc = entry;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stddef.h>
+
+// .tko container, see asm/tko.h for the layout
+#define TKO_MAGIC 0x4f4b5452454b4e54ULL // "TNKERTKO"
+#define TKO_VERSION 2
+
+#define TKO_CODE 1
+#define TKO_DATA 2
+#define TKO_BSS 3
+#define TKO_STACK 4
+#define TKO_KIND 0xff
+#define TKO_LZ 0x100
+
+// Allocates guest memory, copies (and decompresses) a version 1 or 2 image
+// into it and sets pc. A stack section sets the memory size to its end.
+// Exits with a message when the image is malformed, or jumps to simTrap
+// without one when that is set.
+void loadTko(const unsigned char * image, size_t len);
+
+// Set by loadTko: the end of the highest section the image loads, and the
+// base of its stack section (4 KiB below the top of memory without one)
+extern unsigned long long imageEnd, stackStart;
+
+// Decodes lz tokens from in into exactly outLen bytes of out.
+// Returns 0 on success, -1 when the stream is corrupt or the wrong size.
+int lzDecompress(const unsigned char * in, size_t inLen, unsigned char * out, size_t outLen);
@@ -0,0 +1,242 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "heap.h"
+#include "plugins.h"
+#include "sim.h"
+#include "timing.h"
+#include "trace.h"
+#include "vector.h"
+
+#define ull unsigned long long
+
+#define TRACE_BUFFER (1 << 20)
+#define TRACE_RECORD 22 // longest record: two bytes and two 10 byte varints
+
+int tracing;
+static const char * tracePath;
+static FILE * file;
+static pthread_t writer;
+
+// The interpreter fills buffers[filling]; a full one goes to the writer,
+// which takes one buffer at a time. pending is its length, 0 while the
+// writer has nothing to do.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static unsigned char * buffers[2];
+static int filling;
+static size_t used, pending;
+static int finished;
+static int failed; // a write failed, what follows is dropped
+
+static ull lastAddress;
+static ull started; // retired at traceStart
+static int commands[32]; // CommandType by opcode, -1 for the one with none
+static int decodes;      // commands is filled in
+
+void simTrace(const char * path) {
+	tracePath = path;
+}
+
+static void * writeBuffers(void * unused) {
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (!pending && !finished) pthread_cond_wait(&changed, &lock);
+		if (!pending) break;
+		unsigned char * bytes = buffers[!filling];
+		size_t len = pending;
+		pthread_mutex_unlock(&lock);
+		int ok = fwrite(bytes, 1, len, file) == len;
+		pthread_mutex_lock(&lock);
+		if (!ok) failed = 1;
+		pending = 0;
+		pthread_cond_broadcast(&changed);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+// hands the full buffer to the writer once it is done with the other one
+static void flush() {
+	pthread_mutex_lock(&lock);
+	while (pending) pthread_cond_wait(&changed, &lock);
+	pending = used;
+	filling = !filling;
+	used = 0;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+}
+
+static void putWord(unsigned char * at, ull v, int size) {
+	for (int i = 0; i < size; i++) at[i] = v >> (8 * i);
+}
+
+void traceStart() {
+	static int registered;
+	if (!tracePath || tracing) return;
+	if (!(file = fopen(tracePath, "wb"))) {
+		fprintf(stderr, "Error: cannot write %s\n", tracePath);
+		return;
+	}
+	for (int i = 0; i < 2; i++)
+		if (!buffers[i] && !(buffers[i] = malloc(TRACE_BUFFER))) {
+			fprintf(stderr, "Error: not enough memory for the trace\n");
+			fclose(file);
+			return;
+		}
+	filling = 0;
+	pending = finished = failed = 0;
+	lastAddress = 0;
+	started = retired;
+
+	unsigned char * header = buffers[0];
+	memcpy(header, TRACE_MAGIC, 8);
+	putWord(header + 8, TRACE_VERSION, 4);
+	putWord(header + 12, 0, 4);
+	putWord(header + 16, (ull)pc, 8);
+	putWord(header + 24, memSize, 8);
+	used = TRACE_HEADER;
+
+	if (pthread_create(&writer, NULL, writeBuffers, NULL) != 0) {
+		fprintf(stderr, "Error: cannot start the trace writer\n");
+		fclose(file);
+		return;
+	}
+	if (!registered) atexit(traceStop);
+	registered = 1;
+	tracing = 1;
+}
+
+static unsigned char * putVarint(unsigned char * at, ull v) {
+	while (v >= 0x80) {
+		*at++ = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	*at++ = v;
+	return at;
+}
+
+// the bytes a block priv reads or writes, from the registers before it runs
+static void privRange(int imm, int rd, int rs, int rt, ull * from, ull * fromLen, ull * to, ull * toLen) {
+	*fromLen = *toLen = 0;
+	switch (imm) {
+		case 0x5: *to = r[rd], *toLen = 8 * r[rs]; break;
+		case 0x6: *from = r[rd], *fromLen = 8 * r[rs]; break;
+		case 0x7: *from = r[rd], *fromLen = r[rs]; break;
+		case 0x8: *from = r[rs], *fromLen = *toLen = r[rt], *to = r[rd]; break;
+		case 0x9: *to = r[rd], *toLen = r[rt]; break;
+		default: break;
+	}
+}
+
+// One copy of the loop per set of plugin events (see plugins.h), each
+// with the hooks for the others compiled out
+static inline __attribute__((always_inline)) void run(const int events) {
+	while (!halt) {
+		if (retired >= retiredLimit) simErr();
+		int word = fetch(pc);
+		int opcode, rd, rs, rt, imm;
+		parse(word, &opcode, &rd, &rs, &rt, &imm);
+		int cmd = commands[opcode];
+		if (cmd < 0) simErr();
+		int at = pc;
+		if (r[31] < stackLow) stackLowered();
+		commandRuns[cmd]++;
+
+		// the access, from the registers before the instruction changes them
+		int flags = 0;
+		ull address = 0;
+		int offset = imm & 0x800 ? imm - 0x1000 : imm;
+		switch (cmd) {
+			case MOV: flags = TRACE_MEMORY, address = r[rs] + offset; break;
+			case MOV3: flags = TRACE_MEMORY | TRACE_STORE, address = r[rd] + offset; break;
+			case CALL: flags = TRACE_MEMORY | TRACE_STORE, address = r[31] - 8; break;
+			case RETURN: flags = TRACE_MEMORY, address = r[31] - 8; break;
+			case VEC:
+				if (imm == VLD) flags = TRACE_MEMORY, address = r[rs];
+				else if (imm == VST) flags = TRACE_MEMORY | TRACE_STORE, address = r[rd];
+				break;
+			default: break;
+		}
+
+		ull from, fromLen, to, toLen;
+		if ((events & (PLUGIN_READ | PLUGIN_WRITE)) && cmd == PRIV)
+			privRange(imm, rd, rs, rt, &from, &fromLen, &to, &toLen);
+		ull target = 0;
+		int taken = 1;
+		if (events & PLUGIN_BRANCH) {
+			if (cmd == BRNZ) target = r[rd], taken = r[rs] != 0;
+			else if (cmd == BRGT) target = r[rd], taken = r[rs] > r[rt];
+		}
+		if (events & PLUGIN_EXECUTE) pluginExecute((ull)at, (unsigned int)word);
+		if ((events & PLUGIN_PRIV) && cmd == PRIV) pluginPriv((ull)at, imm, rd, rs, rt);
+
+		stepping = 1;
+		execute(cmd, rd, rs, rt, imm);
+		stepping = 0;
+		retired++;
+		if (pc != at + 4) flags |= TRACE_JUMP;
+
+		if (events & (PLUGIN_READ | PLUGIN_WRITE)) {
+			ull size = cmd == VEC ? VLANES * 8 : 8;
+			if ((events & PLUGIN_READ) && (flags & (TRACE_MEMORY | TRACE_STORE)) == TRACE_MEMORY)
+				pluginRead((ull)at, address, size);
+			if ((events & PLUGIN_WRITE) && (flags & TRACE_STORE)) pluginWrite((ull)at, address, size);
+			if (cmd == PRIV) {
+				if ((events & PLUGIN_READ) && fromLen) pluginRead((ull)at, from, fromLen);
+				if ((events & PLUGIN_WRITE) && toLen) pluginWrite((ull)at, to, toLen);
+			}
+		}
+		if ((events & PLUGIN_BRANCH) && cmd >= BR && cmd <= BRGT)
+			pluginBranch((ull)at, taken ? (ull)pc : target, taken);
+
+		if (timing) timingStep(cmd, rd, rs, rt, imm, (ull)at, flags, address);
+		if (!tracing) continue;
+
+		if (used > TRACE_BUFFER - TRACE_RECORD) flush();
+		unsigned char * out = buffers[filling] + used;
+		*out++ = cmd | flags;
+		if (cmd == PRIV || cmd == VEC) *out++ = imm;
+		if (flags & TRACE_JUMP) out = putVarint(out, traceZigzag((long long)pc - at));
+		if (flags & TRACE_MEMORY) {
+			out = putVarint(out, traceZigzag(address - lastAddress));
+			lastAddress = address;
+		}
+		used = out - buffers[filling];
+	}
+}
+
+#define RUN(events) case events: run(events); break;
+#define RUN4(events) RUN(events) RUN(events + 1) RUN(events + 2) RUN(events + 3)
+#define RUN16(events) RUN4(events) RUN4(events + 4) RUN4(events + 8) RUN4(events + 12)
+
+void traceRun() {
+	if (!decodes) {
+		for (int i = 0; i < 31; i++) commands[i] = getCmd(i);
+		commands[31] = -1;
+		decodes = 1;
+	}
+	switch (pluginEvents) {
+		RUN16(0)
+		RUN16(16)
+	}
+}
+
+void traceStop() {
+	if (!tracing) return;
+	tracing = 0;
+	if (used > TRACE_BUFFER - 9) flush();
+	buffers[filling][used] = TRACE_END;
+	putWord(buffers[filling] + used + 1, retired - started, 8);
+	used += 9;
+	flush();
+	pthread_mutex_lock(&lock);
+	finished = 1;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+	pthread_join(writer, NULL);
+	if (fclose(file) != 0) failed = 1;
+	if (failed) fprintf(stderr, "Error: cannot write %s\n", tracePath);
+}
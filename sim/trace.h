@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+
+// Execution trace. With a trace path set, simStart runs one instruction
+// at a time from guest memory and records each one it retires (the
+// timing model of timing.h takes its instructions from the same loop); the
+// records fill one buffer while a writer thread puts the other on disk,
+// so the interpreter only waits when the disk falls a whole buffer
+// behind. hw5-trace (trace/) decodes and analyzes the file.
+//
+// The file starts with a header:
+//
+//   "TNKTRACE", then little-endian u32 version, u32 0, u64 entry pc,
+//   u64 memory size
+//
+// then one record per instruction, pcs following from the entry pc:
+//
+//   byte     CommandType in the low 5 bits, TRACE_* flags above
+//   byte     the literal, for PRIV and VEC only (which priv or vector op)
+//   varint   TRACE_JUMP: next pc minus this pc, zigzag encoded; without
+//            it the next pc is this one plus 4, so a conditional branch
+//            was taken exactly when the flag is set
+//   varint   TRACE_MEMORY: address minus the last address recorded,
+//            zigzag encoded, 8 bytes at it (32 for vector loads and stores)
+//
+// and ends with TRACE_END and the instruction count as a u64. A run that
+// stops on a simulation error ends there too; the instruction that
+// failed is not recorded.
+
+#define TRACE_MAGIC "TNKTRACE"
+#define TRACE_VERSION 1
+#define TRACE_HEADER 32
+
+#define TRACE_CMD 0x1f
+#define TRACE_JUMP 0x20
+#define TRACE_MEMORY 0x40
+#define TRACE_STORE 0x80   // with TRACE_MEMORY, the access writes
+#define TRACE_END 0x1f     // a CommandType no instruction has
+
+static inline uint64_t traceZigzag(int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t traceUnzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+extern int tracing;
+
+void traceStart();
+
+// Runs the guest until it halts, recording every instruction in the
+// trace and the timing model, whichever are on, and passing it to the
+// plugins that subscribe to it
+void traceRun();
+
+// Ends the file and waits for it to be written; also run at exit after a
+// simulation error
+void traceStop();
@@ -0,0 +1,224 @@
+#include <math.h>
+#include <string.h>
+#include "main.h"
+#include "vector.h"
+#include "decode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#define ull unsigned long long
+
+ull vr[32][VLANES] __attribute__((aligned(32)));
+
+typedef void (*vecKernel)(ull * d, const ull * a, const ull * b);
+
+static vecKernel kernels[VFMAF + 1];
+
+static double lane(const ull * v, int i) {
+	double db;
+	memcpy(&db, &v[i], sizeof(double));
+	return db;
+}
+
+static void setLane(ull * v, int i, double db) {
+	memcpy(&v[i], &db, sizeof(double));
+}
+
+// scalar kernels, used when the host has no usable vector unit
+
+static void addS(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i++) d[i] = a[i] + b[i];
+}
+static void subS(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i++) d[i] = a[i] - b[i];
+}
+static void mulS(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i++) d[i] = a[i] * b[i];
+}
+static void divS(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i++) d[i] = a[i] / b[i];
+}
+static void fmaS(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i++) d[i] += a[i] * b[i];
+}
+static void addfS(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i++) setLane(d, i, lane(a, i) + lane(b, i));
+}
+static void subfS(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i++) setLane(d, i, lane(a, i) - lane(b, i));
+}
+static void mulfS(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i++) setLane(d, i, lane(a, i) * lane(b, i));
+}
+static void divfS(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i++) setLane(d, i, lane(a, i) / lane(b, i));
+}
+static void fmafS(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i++) setLane(d, i, fma(lane(a, i), lane(b, i), lane(d, i)));
+}
+
+#ifdef HAVE_X86
+// SSE2 kernels, two lanes per register
+// there is no 64-bit integer multiply below AVX-512, so vmul/vdiv/vfma stay scalar
+
+static void addSSE(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i += 2)
+		_mm_storeu_si128((__m128i *)(d + i), _mm_add_epi64(
+			_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i))));
+}
+static void subSSE(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i += 2)
+		_mm_storeu_si128((__m128i *)(d + i), _mm_sub_epi64(
+			_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i))));
+}
+static void addfSSE(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i += 2)
+		_mm_storeu_pd((double *)(d + i), _mm_add_pd(
+			_mm_loadu_pd((const double *)(a + i)), _mm_loadu_pd((const double *)(b + i))));
+}
+static void subfSSE(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i += 2)
+		_mm_storeu_pd((double *)(d + i), _mm_sub_pd(
+			_mm_loadu_pd((const double *)(a + i)), _mm_loadu_pd((const double *)(b + i))));
+}
+static void mulfSSE(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i += 2)
+		_mm_storeu_pd((double *)(d + i), _mm_mul_pd(
+			_mm_loadu_pd((const double *)(a + i)), _mm_loadu_pd((const double *)(b + i))));
+}
+static void divfSSE(ull * d, const ull * a, const ull * b) {
+	for (int i = 0; i < VLANES; i += 2)
+		_mm_storeu_pd((double *)(d + i), _mm_div_pd(
+			_mm_loadu_pd((const double *)(a + i)), _mm_loadu_pd((const double *)(b + i))));
+}
+
+// AVX2 kernels, all four lanes at once
+
+__attribute__((target("avx2")))
+static void addAVX(ull * d, const ull * a, const ull * b) {
+	_mm256_storeu_si256((__m256i *)d, _mm256_add_epi64(
+		_mm256_loadu_si256((const __m256i *)a), _mm256_loadu_si256((const __m256i *)b)));
+}
+__attribute__((target("avx2")))
+static void subAVX(ull * d, const ull * a, const ull * b) {
+	_mm256_storeu_si256((__m256i *)d, _mm256_sub_epi64(
+		_mm256_loadu_si256((const __m256i *)a), _mm256_loadu_si256((const __m256i *)b)));
+}
+__attribute__((target("avx2")))
+static void addfAVX(ull * d, const ull * a, const ull * b) {
+	_mm256_storeu_pd((double *)d, _mm256_add_pd(
+		_mm256_loadu_pd((const double *)a), _mm256_loadu_pd((const double *)b)));
+}
+__attribute__((target("avx2")))
+static void subfAVX(ull * d, const ull * a, const ull * b) {
+	_mm256_storeu_pd((double *)d, _mm256_sub_pd(
+		_mm256_loadu_pd((const double *)a), _mm256_loadu_pd((const double *)b)));
+}
+__attribute__((target("avx2")))
+static void mulfAVX(ull * d, const ull * a, const ull * b) {
+	_mm256_storeu_pd((double *)d, _mm256_mul_pd(
+		_mm256_loadu_pd((const double *)a), _mm256_loadu_pd((const double *)b)));
+}
+__attribute__((target("avx2")))
+static void divfAVX(ull * d, const ull * a, const ull * b) {
+	_mm256_storeu_pd((double *)d, _mm256_div_pd(
+		_mm256_loadu_pd((const double *)a), _mm256_loadu_pd((const double *)b)));
+}
+__attribute__((target("avx2,fma")))
+static void fmafAVX(ull * d, const ull * a, const ull * b) {
+	_mm256_storeu_pd((double *)d, _mm256_fmadd_pd(
+		_mm256_loadu_pd((const double *)a), _mm256_loadu_pd((const double *)b),
+		_mm256_loadu_pd((const double *)d)));
+}
+#endif
+
+void vecInit() {
+	memset(vr, 0, sizeof(vr));
+	kernels[VADD]  = addS;
+	kernels[VSUB]  = subS;
+	kernels[VMUL]  = mulS;
+	kernels[VDIV]  = divS;
+	kernels[VADDF] = addfS;
+	kernels[VSUBF] = subfS;
+	kernels[VMULF] = mulfS;
+	kernels[VDIVF] = divfS;
+	kernels[VFMA]  = fmaS;
+	kernels[VFMAF] = fmafS;
+
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		kernels[VADD]  = addAVX;
+		kernels[VSUB]  = subAVX;
+		kernels[VADDF] = addfAVX;
+		kernels[VSUBF] = subfAVX;
+		kernels[VMULF] = mulfAVX;
+		kernels[VDIVF] = divfAVX;
+		if (__builtin_cpu_supports("fma"))
+			kernels[VFMAF] = fmafAVX;
+	} else if (__builtin_cpu_supports("sse2")) {
+		kernels[VADD]  = addSSE;
+		kernels[VSUB]  = subSSE;
+		kernels[VADDF] = addfSSE;
+		kernels[VSUBF] = subfSSE;
+		kernels[VMULF] = mulfSSE;
+		kernels[VDIVF] = divfSSE;
+	}
+#endif
+}
+
+void doVEC(int rd, int rs, int rt, int imm) {
+	switch (imm) {
+		case VDIV:
+			for (int i = 0; i < VLANES; i++)
+				if (vr[rt][i] == 0) simErr();
+			break;
+		case VDIVF:
+			for (int i = 0; i < VLANES; i++)
+				if (lane(vr[rt], i) == 0.0) simErr();
+			break;
+		case VSPLAT:
+			for (int i = 0; i < VLANES; i++) vr[rd][i] = r[rs];
+			return;
+		case VSUM: {
+			ull sum = 0;
+			for (int i = 0; i < VLANES; i++) sum += vr[rs][i];
+			r[rd] = sum;
+			return;
+		}
+		case VSUMF: {
+			double sum = 0.0;
+			for (int i = 0; i < VLANES; i++) sum += lane(vr[rs], i);
+			memcpy(&r[rd], &sum, sizeof(double));
+			return;
+		}
+		case VLD:
+			verifyAddress(r[rs]);
+			verifyAddress(r[rs] + 8 * VLANES - 1);
+			vectorLoads++;
+			touched(r[rs] + 8 * VLANES);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			memcpy(vr[rd], mem + r[rs], 8 * VLANES);
+#else
+			for (int i = 0; i < VLANES; i++) vr[rd][i] = readMem(r[rs] + 8 * i, 8);
+#endif
+			return;
+		case VST:
+			verifyAddress(r[rd]);
+			verifyAddress(r[rd] + 8 * VLANES - 1);
+			vectorStores++;
+			touched(r[rd] + 8 * VLANES);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			if (decoded && r[rd] < codeBase + codeLen && r[rd] + 8 * VLANES > codeBase) dropDecoded();
+			memcpy(mem + r[rd], vr[rs], 8 * VLANES);
+#else
+			for (int i = 0; i < VLANES; i++) loadMem(r[rd] + 8 * i, vr[rs][i], 8);
+#endif
+			return;
+	}
+	if (imm > VFMAF) simErr();
+	kernels[imm](vr[rd], vr[rs], vr[rt]);
+}
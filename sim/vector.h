@@ -0,0 +1,30 @@
+#pragma once
+
+// Vector extension: 32 registers v0-v31 of 4 x 64-bit lanes.
+// Every vector instruction uses opcode 0x1e; the literal selects the operation.
+#define VLANES 4
+
+typedef enum VecOp {
+	VADD   , // vd = vs + vt            (integer)
+	VSUB   , // vd = vs - vt
+	VMUL   , // vd = vs * vt
+	VDIV   , // vd = vs / vt
+	VADDF  , // vd = vs + vt            (double)
+	VSUBF  , // vd = vs - vt
+	VMULF  , // vd = vs * vt
+	VDIVF  , // vd = vs / vt
+	VFMA   , // vd = vd + vs * vt       (integer)
+	VFMAF  , // vd = vd + vs * vt       (double, single rounding)
+	VSPLAT , // vd = {rs, rs, rs, rs}
+	VSUM   , // rd = sum of vs lanes    (integer)
+	VSUMF  , // rd = sum of vs lanes    (double)
+	VLD    , // vd = mem[rs .. rs+31]
+	VST    , // mem[rd .. rd+31] = vs
+} VecOp;
+
+extern unsigned long long vr[32][VLANES];
+
+// Clears the vector registers and picks AVX2, SSE2 or scalar kernels for
+// the host cpu
+void vecInit();
+void doVEC(int rd, int rs, int rt, int imm);
@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #define PASS "PASS"
 #define FAIL "FAIL"
@@ -63,6 +66,26 @@ static int assemble(const char *src, const char *out)
     return ret;
 }
 
+static int assemble_flags(const char *flags, const char *src, const char *out)
+{
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "./hw5-asm %s %s %s >/dev/null 2>&1", flags, src, out);
+    int ret = system(cmd);
+    if (ret != 0)
+        fprintf(stderr, "Assembly of %s %s failed (exit %d)\n", flags, src, ret);
+    return ret;
+}
+
+static long file_size(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fclose(f);
+    return n;
+}
+
 static void test_fibonacci(void)
 {
     puts("\n--- fibonacci tests ---");
@@ -150,12 +173,746 @@ static void test_binary_search(void)
     bs_check("all same, search absent",    a6, 5, 3, 0);
 }
 
+static void test_vector(void)
+{
+    puts("\n--- vector extension tests ---");
+
+    const char *kernels[] = {"dot", "saxpy"};
+    const char *expected[] = {"84", "4627448617123184640"};
+
+    for (int k = 0; k < 2; k++) {
+        char src[64], out[64], sim[96], name[64];
+        for (int v = 0; v < 2; v++) {
+            const char *kind = v ? "vector" : "scalar";
+            snprintf(src, sizeof(src), "bench/%s_%s.tk", kernels[k], kind);
+            snprintf(out, sizeof(out), "/tmp/%s_%s.tko", kernels[k], kind);
+            if (assemble(src, out) != 0) {
+                printf("Skipping %s: assembly failed.\n", src);
+                continue;
+            }
+            snprintf(sim, sizeof(sim), "./hw5-sim %s", out);
+            snprintf(name, sizeof(name), "%s %s n=8 reps=2", kernels[k], kind);
+            check(name, run_with_input(sim, "8\n2\n"), expected[k]);
+        }
+    }
+}
+
+static void test_sections(void)
+{
+    puts("\n--- .tko format tests ---");
+
+    const char *flags[] = {"", "--legacy", "--compress"};
+    const char *outs[] = {"/tmp/sec.tko", "/tmp/sec_v1.tko", "/tmp/sec_lz.tko"};
+
+    for (int i = 0; i < 3; i++) {
+        char sim[64], name[64];
+        if (assemble_flags(flags[i], "tests/sections.tk", outs[i]) != 0)
+            continue;
+        snprintf(sim, sizeof(sim), "./hw5-sim %s", outs[i]);
+        snprintf(name, sizeof(name), "data and .space %s", i ? flags[i] : "(version 2)");
+        check(name, run_with_input(sim, ""), "204\n204\n0");
+    }
+
+    tests_run++;
+    long v1 = file_size(outs[1]), v2 = file_size(outs[0]), lz = file_size(outs[2]);
+    int ok = v2 > 0 && v2 < v1 && lz > 0 && lz < v2;
+    if (ok) tests_pass++;
+    printf("[%s] bss and compression shrink the file (%ld, %ld, %ld bytes)\n", ok ? PASS : FAIL, v1, v2, lz);
+}
+
+static void test_layout(void)
+{
+    puts("\n--- segment layout tests ---");
+
+    if (assemble_flags("--layout=tests/layout.ld", "tests/layout.tk", "/tmp/layout.tko") == 0)
+        check("layout file bases and memory size",
+              run_with_input("./hw5-sim /tmp/layout.tko", ""), "262144\n42\n1048576\n42");
+
+    if (assemble("tests/layout.tk", "/tmp/layout_default.tko") == 0)
+        check("default layout",
+              run_with_input("./hw5-sim /tmp/layout_default.tko", ""), "65536\n42\n524288\n42");
+
+    tests_run++;
+    int ok = assemble_flags("--layout=tests/overlap.ld", "tests/layout.tk", "/tmp/overlap.tko") != 0;
+    if (ok) tests_pass++;
+    printf("[%s] overlapping segments are rejected\n", ok ? PASS : FAIL);
+
+    // 16000 instructions (64000 bytes) of code run past the default data base
+    FILE *big = fopen("/tmp/big.tk", "w");
+    if (!big) return;
+    fputs(".code\n\tld r1, 1\n\tclr r2\n", big);
+    for (int i = 0; i < 16000; i++)
+        fputs("\taddi r2, 1\n", big);
+    fputs("\tout r1, r2\n\tld r3, :Last\n\tmov r4, (r3)(0)\n\tout r1, r4\n\thalt\n", big);
+    fputs(".data\n:Last\n\t7\n", big);
+    fclose(big);
+    if (assemble("/tmp/big.tk", "/tmp/big.tko") == 0)
+        check("large code pushes data past it",
+              run_with_input("./hw5-sim /tmp/big.tko", ""), "16000\n7");
+}
+
+static void test_link(void)
+{
+    puts("\n--- object and linker tests ---");
+
+    if (assemble_flags("--object", "tests/link_main.tk", "/tmp/link_main.o") != 0 ||
+        assemble_flags("--object", "tests/link_lib.tk", "/tmp/link_lib.o") != 0)
+        return;
+
+    if (system("./hw5-ld -o /tmp/linked.tko /tmp/link_main.o /tmp/link_lib.o 2>/dev/null") == 0)
+        check("linked program (ld, call, brr and data across objects)",
+              run_with_input("./hw5-sim /tmp/linked.tko", "7\n"), "49\n1\n7");
+
+    // the same two files assembled as one program behave the same
+    if (system("cat tests/link_main.tk tests/link_lib.tk > /tmp/link_mono.tk") == 0 &&
+        assemble("/tmp/link_mono.tk", "/tmp/link_mono.tko") == 0)
+        check("same modules assembled together",
+              run_with_input("./hw5-sim /tmp/link_mono.tko", "7\n"), "49\n1\n7");
+
+    tests_run++;
+    int ok = system("./hw5-ld -o /tmp/unresolved.tko /tmp/link_main.o 2>/dev/null") != 0;
+    if (ok) tests_pass++;
+    printf("[%s] undefined symbols are rejected\n", ok ? PASS : FAIL);
+
+    tests_run++;
+    ok = system("./hw5-ld -o /tmp/dup.tko /tmp/link_lib.o /tmp/link_lib.o 2>/dev/null") != 0;
+    if (ok) tests_pass++;
+    printf("[%s] duplicate globals are rejected\n", ok ? PASS : FAIL);
+}
+
+static int count_files(const char *pattern)
+{
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "ls %s 2>/dev/null | wc -l", pattern);
+    FILE *fp = popen(cmd, "r");
+    int n = -1;
+    if (fp) {
+        if (fscanf(fp, "%d", &n) != 1) n = -1;
+        pclose(fp);
+    }
+    return n;
+}
+
+static void test_run(void)
+{
+    puts("\n--- tinker run tests ---");
+
+    system("rm -rf /tmp/tinker_cache_test && cp fibonacci.tk /tmp/run_fib.tk");
+    const char *run = "TINKER_CACHE=/tmp/tinker_cache_test ./tinker run /tmp/run_fib.tk";
+
+    check("tinker run assembles and runs", run_with_input(run, "10"), "34");
+    tests_run++;
+    int ok = count_files("/tmp/tinker_cache_test/*.tko") == 1;
+    if (ok) tests_pass++;
+    printf("[%s] image is cached\n", ok ? PASS : FAIL);
+    tests_run++;
+    ok = count_files("/tmp/tinker_cache_test/*.dec") == 1;
+    if (ok) tests_pass++;
+    printf("[%s] predecoded code is cached\n", ok ? PASS : FAIL);
+
+    check("cached image runs on new input", run_with_input(run, "9"), "21");
+    tests_run++;
+    ok = count_files("/tmp/tinker_cache_test/*.tko") == 1;
+    if (ok) tests_pass++;
+    printf("[%s] unchanged source reuses the image\n", ok ? PASS : FAIL);
+
+    system("echo '; edited' >> /tmp/run_fib.tk");
+    check("edited source runs", run_with_input(run, "10"), "34");
+    tests_run++;
+    ok = count_files("/tmp/tinker_cache_test/*.tko") == 2;
+    if (ok) tests_pass++;
+    printf("[%s] edited source is assembled again\n", ok ? PASS : FAIL);
+}
+
+static void test_predecode(void)
+{
+    puts("\n--- predecode tests ---");
+
+    if (assemble("tests/selfmod.tk", "/tmp/selfmod.tko") == 0)
+        check("stores into the running block are seen",
+              run_with_input("./hw5-sim /tmp/selfmod.tko", ""), "10");
+
+    if (assemble("fibonacci.tk", "/tmp/fib_dec.tko") != 0)
+        return;
+    system("rm -rf /tmp/decode_cache_test && mkdir -p /tmp/decode_cache_test");
+    const char *sim = "TINKER_DECODE_CACHE=/tmp/decode_cache_test ./hw5-sim /tmp/fib_dec.tko";
+    check("cold run writes the table", run_with_input(sim, "10"), "34");
+    check("warm run maps the table", run_with_input(sim, "9"), "21");
+    tests_run++;
+    int ok = count_files("/tmp/decode_cache_test/*.dec") == 1;
+    if (ok) tests_pass++;
+    printf("[%s] one table per code segment\n", ok ? PASS : FAIL);
+    // out of range fields, under a header that still matches
+    system("for f in /tmp/decode_cache_test/*.dec; do head -c 40 $f > $f.new; "
+           "head -c $(($(stat -c %s $f) - 40)) /dev/zero | tr \\\\0 \\\\377 >> $f.new; mv $f.new $f; done");
+    check("corrupt table is decoded again", run_with_input(sim, "9"), "21");
+}
+
+static char *read_file(const char *path)
+{
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "cat %s", path);
+    return run_with_input(cmd, "");
+}
+
+static void test_lanes(void)
+{
+    puts("\n--- lockstep lanes tests ---");
+
+    if (assemble("fibonacci.tk", "/tmp/fib_lanes.tko") != 0)
+        return;
+    system("rm -rf /tmp/lanes_test && mkdir -p /tmp/lanes_test && "
+           "echo 10 > /tmp/lanes_test/a && echo 9 > /tmp/lanes_test/b && "
+           "echo 20 > /tmp/lanes_test/c && echo -1 > /tmp/lanes_test/d");
+    int ret = system("./hw5-sim --lanes /tmp/fib_lanes.tko /tmp/lanes_test/a /tmp/lanes_test/b "
+                     "/tmp/lanes_test/c /tmp/lanes_test/d 2>/dev/null");
+    check("lane 0 output", read_file("/tmp/lanes_test/a.out"), "34");
+    check("lane 1 output", read_file("/tmp/lanes_test/b.out"), "21");
+    check("lane 2 output", read_file("/tmp/lanes_test/c.out"), "4181");
+    tests_run++;
+    int ok = ret != 0;
+    if (ok) tests_pass++;
+    printf("[%s] failing lane is reported\n", ok ? PASS : FAIL);
+
+    // a step converges only when it runs every live lane and there are two or more
+    check("lanes that never split converge",
+          run_with_input("sh -c './hw5-sim --lanes /tmp/fib_lanes.tko /tmp/lanes_test/a /tmp/lanes_test/a 2>&1 | "
+                         "sed \"s/.*M\\/s, //\"'", ""),
+          "100% of steps converged, 2.0 lanes per step");
+    check("lanes that split do not",
+          run_with_input("sh -c './hw5-sim --lanes /tmp/fib_lanes.tko /tmp/lanes_test/a /tmp/lanes_test/c 2>&1 | "
+                         "grep -c \" 100% of steps\"'", ""),
+          "0");
+
+    if (assemble("bench/dot_vector.tk", "/tmp/dot_lanes.tko") != 0)
+        return;
+    system("printf '16\\n2\\n' > /tmp/lanes_test/e && printf '32\\n1\\n' > /tmp/lanes_test/f");
+    system("./hw5-sim --lanes /tmp/dot_lanes.tko /tmp/lanes_test/e /tmp/lanes_test/f 2>/dev/null");
+    char *want = run_with_input("./hw5-sim /tmp/dot_lanes.tko", "16\n2\n");
+    check("vector lane 0 matches a single run", read_file("/tmp/lanes_test/e.out"), want);
+    free(want);
+    want = run_with_input("./hw5-sim /tmp/dot_lanes.tko", "32\n1\n");
+    check("vector lane 1 matches a single run", read_file("/tmp/lanes_test/f.out"), want);
+    free(want);
+}
+
+static void test_serve(void)
+{
+    puts("\n--- fork server tests ---");
+
+    if (assemble("fibonacci.tk", "/tmp/fib_serve.tko") != 0)
+        return;
+    system("rm -f /tmp/sim_serve.sock; ./hw5-sim --serve /tmp/sim_serve.sock /tmp/fib_serve.tko "
+           "& echo $! > /tmp/sim_serve.pid; "
+           "for i in $(seq 1 200); do [ -S /tmp/sim_serve.sock ] && break; sleep 0.01; done");
+
+    const char *job = "./hw5-sim --connect /tmp/sim_serve.sock";
+    check("job runs in a forked copy", run_with_input(job, "10"), "34");
+    check("next job starts from the loaded image", run_with_input(job, "9"), "21");
+    tests_run++;
+    int ok = system("echo -1 | ./hw5-sim --connect /tmp/sim_serve.sock 2>/dev/null") != 0;
+    if (ok) tests_pass++;
+    printf("[%s] failing job's status is returned\n", ok ? PASS : FAIL);
+
+    // a client that connects and sends nothing holds up no one
+    int idle = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {AF_UNIX, "/tmp/sim_serve.sock"};
+    connect(idle, (struct sockaddr *)&addr, sizeof(addr));
+    // into a file, as a pipe passed to a stuck server would keep this waiting on it
+    system("echo 10 | timeout 5 ./hw5-sim --connect /tmp/sim_serve.sock > /tmp/sim_serve_idle.out 2>/dev/null");
+    check("job runs past an idle connection", read_file("/tmp/sim_serve_idle.out"), "34");
+    close(idle);
+
+    system("kill $(cat /tmp/sim_serve.pid); sleep 0.1");
+    tests_run++;
+    ok = system("echo 10 | ./hw5-sim --connect /tmp/sim_serve.sock 2>/dev/null >/dev/null") != 0;
+    if (ok) tests_pass++;
+    printf("[%s] stopped server removes its socket\n", ok ? PASS : FAIL);
+}
+
+// runs an out-of-bounds probe with guard pages and with checked memory,
+// both must give the expected output and exit status
+static void oob_check(const char *prog, const char *addr, const char *expected, int fails)
+{
+    const char *modes[2] = {"", "TINKER_CHECKED_MEMORY=1 "};
+    for (int m = 0; m < 2; m++) {
+        char cmd[256], name[128];
+        snprintf(cmd, sizeof(cmd), "%s./hw5-sim /tmp/oob_%s.tko", modes[m], prog);
+        snprintf(name, sizeof(name), "%s %s (%s)", prog, addr, m ? "checked" : "guarded");
+        check(name, run_with_input(cmd, addr), expected);
+
+        snprintf(cmd, sizeof(cmd), "echo %s | %s./hw5-sim /tmp/oob_%s.tko >/dev/null 2>&1",
+                 addr, modes[m], prog);
+        tests_run++;
+        int ok = (system(cmd) != 0) == fails;
+        if (ok) tests_pass++;
+        printf("[%s] %s exit status\n", ok ? PASS : FAIL, name);
+    }
+}
+
+static void test_out_of_bounds(void)
+{
+    puts("\n--- out of bounds tests ---");
+
+    const char *progs[4] = {"load", "store", "fetch", "stack"};
+    for (int i = 0; i < 4; i++) {
+        char src[64], out[64];
+        snprintf(src, sizeof(src), "tests/oob_%s.tk", progs[i]);
+        snprintf(out, sizeof(out), "/tmp/oob_%s.tko", progs[i]);
+        if (assemble(src, out) != 0)
+            return;
+    }
+
+    // default memory is 524288 bytes
+    oob_check("load", "524280", "1\n0", 0);
+    oob_check("load", "524281", "1", 1);
+    oob_check("load", "524288", "1", 1);
+    oob_check("load", "4294967295", "1", 1);
+    oob_check("load", "18446744073709551608", "1", 1);
+    oob_check("store", "524280", "1\n77", 0);
+    oob_check("store", "524284", "1", 1);
+    oob_check("store", "4294967296", "1", 1);
+    oob_check("fetch", "524286", "1", 1);
+    oob_check("fetch", "524288", "1", 1);
+    oob_check("stack", "524288", "1", 0);
+    oob_check("stack", "7", "1", 1);
+    oob_check("stack", "4294967288", "1", 1);
+}
+
+static void test_async_io(void)
+{
+    puts("\n--- async io tests ---");
+
+    if (assemble("bench/stream.tk", "/tmp/stream.tko") != 0)
+        return;
+    const char *sim = "TINKER_ASYNC_IO=1 ./hw5-sim /tmp/stream.tko";
+    check("values stream through both rings", run_with_input(sim, "3\n1\n2\n3\n"), "3\n6\n9\n!");
+    check("output before a bad line is kept", run_with_input(sim, "3\n1\nx\n3\n"), "3");
+    check("short input stops at the read", run_with_input(sim, "3\n5\n"), "15");
+    tests_run++;
+    int ok = system("printf '3\\n1\\n-2\\n3\\n' | TINKER_ASYNC_IO=1 ./hw5-sim /tmp/stream.tko "
+                    ">/dev/null 2>&1") != 0;
+    if (ok) tests_pass++;
+    printf("[%s] parse error fails the run\n", ok ? PASS : FAIL);
+}
+
+static void test_block_priv(void)
+{
+    puts("\n--- block priv tests ---");
+
+    if (assemble("tests/blockio.tk", "/tmp/blockio.tko") != 0 ||
+        assemble("tests/selfmod_block.tk", "/tmp/selfmod_block.tko") != 0)
+        return;
+    const char *sim = "./hw5-sim /tmp/blockio.tko";
+    check("inn, memcpy, outn, memset, outs", run_with_input(sim, "100000\n3\n1\n2\n3\n"), "1\n2\n3\nxxxdone");
+    check("block ending at the top of memory", run_with_input(sim, "524264\n2\n7\n8\n"), "7\n8\nxxxdone");
+    check("memcpy past the top of memory", run_with_input(sim, "524272\n2\n7\n8\n"), "");
+    check("count that overflows the length", run_with_input(sim, "0\n2305843009213693953\n"), "");
+    check("async io reads the block too",
+          run_with_input("TINKER_ASYNC_IO=1 ./hw5-sim /tmp/blockio.tko", "100000\n2\n4\n5\n"), "4\n5\nxxxdone");
+    check("memcpy and memset into code", run_with_input("./hw5-sim /tmp/selfmod_block.tko", ""), "5");
+
+    tests_run++;
+    int ok = system("printf '524272\\n2\\n7\\n8\\n' | ./hw5-sim /tmp/blockio.tko >/dev/null 2>&1") != 0;
+    if (ok) tests_pass++;
+    printf("[%s] out of bounds block fails the run\n", ok ? PASS : FAIL);
+}
+
+static void test_heap(void)
+{
+    puts("\n--- heap tests ---");
+
+    if (assemble("tests/heap.tk", "/tmp/heap.tko") != 0)
+        return;
+    const char *sim = "./hw5-sim /tmp/heap.tko";
+    check("malloc, realloc, free", run_with_input(sim, "0\n3\n7\n8\n9\n"), "7\n8\n9\n0");
+    check("double free stops the run", run_with_input(sim, "1\n2\n4\n5\n"), "4\n5");
+    check("overrun caught at free", run_with_input(sim, "2\n1\n6\n"), "6");
+    check("heap stats",
+          run_with_input("sh -c 'TINKER_HEAP_STATS=1 TINKER_HEAP=0x40000:0x1000 ./hw5-sim /tmp/heap.tko 2>&1 >/dev/null'",
+                         "0\n3\n7\n8\n9\n"),
+          "heap: 2 mallocs, 1 frees, 1 reallocs, 1 failed, 0 bytes in use, peak 72, 128 of 4096 bytes carved");
+    check("heap error message",
+          run_with_input("sh -c './hw5-sim /tmp/heap.tko 2>&1 >/dev/null'", "1\n1\n4\n"),
+          "Heap error: free of 0x21b0, which was already freed\nSimulation error");
+
+    // the heap fills up to the stack's 4 KiB, then the stack grows into it
+    if (assemble("tests/stack_heap.tk", "/tmp/stack_heap.tko") == 0) {
+        check("stack grown into the heap",
+              run_with_input("sh -c 'TINKER_HEAP_STATS=1 ./hw5-sim /tmp/stack_heap.tko 2>&1'", ""),
+              "Heap error: the stack at 0x7dce8 has grown into the heap, which is carved up to 0x7dcf0\n"
+              "Simulation error\n"
+              "99\n"
+              "heap: 100 mallocs, 0 frees, 0 reallocs, 1 failed, 405504 bytes in use, peak 405504, "
+              "506880 of 511760 bytes carved");
+        check("cores agree on the stack in the heap",
+              run_with_input("sh -c './hw5-sim --check /tmp/stack_heap.tko 2>&1 >/dev/null | tail -1'", ""),
+              "check: the cores agree over 3719 instructions, 1325 checks, both stopped on a simulation error at 0x20e0");
+        check("timing report after a simulation error",
+              run_with_input("sh -c 'TINKER_TIMING=1 ./hw5-sim /tmp/stack_heap.tko 2>&1 >/dev/null | grep ^timing:'", ""),
+              "timing: 3719 instructions, 4153 cycles, CPI 1.117");
+    }
+
+    // every lane gets a heap of its own
+    FILE *f = fopen("/tmp/heap_lane0", "w");
+    if (f) { fputs("0\n2\n5\n6\n", f); fclose(f); }
+    f = fopen("/tmp/heap_lane1", "w");
+    if (f) { fputs("1\n1\n4\n", f); fclose(f); }
+    tests_run++;
+    int ok = system("./hw5-sim --lanes /tmp/heap.tko /tmp/heap_lane0 /tmp/heap_lane1 2>/dev/null") != 0;
+    char *out = read_file("/tmp/heap_lane0.out");
+    ok = ok && out && strcmp(out, "5\n6\n0") == 0;
+    free(out);
+    if (ok) tests_pass++;
+    printf("[%s] lane heaps are separate\n", ok ? PASS : FAIL);
+}
+
+static void test_profile(void)
+{
+    puts("\n--- profile tests ---");
+
+    if (assemble_flags("--map=/tmp/fib.map --listing=/tmp/fib.lst", "tests/fib.tk", "/tmp/fib.tko") != 0)
+        return;
+    check("symbol map", run_with_input("awk '$1 != \"line\"' /tmp/fib.map", ""),
+          "code 0x2000 Main\ncode 0x20a0 Fib\ncode 0x2114 Recurse");
+    check("line records",
+          run_with_input("awk '$1 == \"line\" && NR <= 8' /tmp/fib.map", ""),
+          "line 0x2000 6 ld 12\nline 0x2030 7 in 1\nline 0x2034 8 ld 12\nline 0x2064 9 call 1\nline 0x2068 10 ld 12");
+    check("listing",
+          run_with_input("sed -n '1,2p;14p' /tmp/fib.lst", ""),
+          "                            :Main\n00002000  10421000       6  ld r1, 0\n00002030  78420003       7  in r1, r1");
+    check("profiling leaves output alone",
+          run_with_input("TINKER_PROFILE=/tmp/fib_prof ./hw5-sim /tmp/fib.tko", "10\n"), "55");
+    check("folded stacks",
+          run_with_input("head -n 3 /tmp/fib_prof.folded", ""), "Main 40\nMain;Fib 41\nMain;Fib;Fib 82");
+    char *total = run_with_input("awk 'NR == 1 { print $1 }' /tmp/fib_prof.calls", "");
+    check("folded counts add up to the total",
+          run_with_input("awk '{ n += $2 } END { print n }' /tmp/fib_prof.folded", ""), total ? total : "");
+    free(total);
+    check("routine calls and inclusive counts",
+          run_with_input("awk '$1 == \"Fib\" || $1 == \"Main\" { print $1, $2, $6 }' /tmp/fib_prof.calls", ""),
+          "Main 1 100.00%\nFib 177 99.36%");
+    check("call sites",
+          run_with_input("awk '$1 == \"from\" { print $2, $3, $(NF - 1), $NF }' /tmp/fib_prof.calls", ""),
+          "Main+0x64 1 line 9\nRecurse+0xc 88 line 25\nRecurse+0x24 88 line 29");
+
+    check("sampling leaves output alone",
+          run_with_input("TINKER_PROFILE=/tmp/fib_prof TINKER_SAMPLE=/tmp/fib_prof TINKER_SAMPLE_HZ=10000 "
+                         "./hw5-sim /tmp/fib.tko", "25\n"), "75025");
+    char *taken = run_with_input("awk 'NR == 1 { print $1 }' /tmp/fib_prof.samples", "");
+    check("label histogram covers every sample",
+          run_with_input("awk 'NR == 3, NF == 0 { if ($1 != \"label\") n += $2 } END { print n + 0 }' "
+                         "/tmp/fib_prof.samples", ""), taken ? taken : "");
+    free(taken);
+    check("samples fall in fib's labels",
+          run_with_input("awk 'NR > 3 && NF == 3 && $1 !~ /^(Main|Fib|Recurse)$/' /tmp/fib_prof.samples", ""), "");
+    check("sampled stacks start at the entry",
+          run_with_input("awk '$1 !~ /^Main(;Fib)*$/' /tmp/fib_prof.sampled.folded; "
+                         "test -s /tmp/fib_prof.sampled.folded && echo stacks", ""), "stacks");
+
+    FILE *src = fopen("/tmp/wild.tk", "w");
+    if (!src) return;
+    fputs(".code\n:Main\n\tld r1, 1\n\tsubi r1, 2\n\tbr r1\n", src);
+    fclose(src);
+    if (assemble_flags("--map=/tmp/wild.map", "/tmp/wild.tk", "/tmp/wild.tko") == 0)
+        check("errors name the pc's source line",
+              run_with_input("sh -c './hw5-sim /tmp/wild.tko 2>&1'", ""), "Simulation error at Main+0x34 (line 5)");
+}
+
+static void test_trace(void)
+{
+    puts("\n--- trace tests ---");
+
+    check("tracing leaves output alone",
+          run_with_input("TINKER_TRACE=/tmp/fib.trace ./hw5-sim /tmp/fib.tko", "10\n"), "55");
+    if (system("./hw5-trace /tmp/fib.trace > /tmp/fib.report 2>&1") != 0)
+        fprintf(stderr, "hw5-trace /tmp/fib.trace failed\n");
+    check("trace totals", run_with_input("sed -n 1,2p /tmp/fib.report", ""),
+          "6229 instructions, 353 loads, 353 stores\n177 conditional branches, 88 taken (49.72%)");
+    check("instruction mix",
+          run_with_input("awk '$1 == \"call\" || $1 == \"return\" || $1 == \"halt\" { print $1, $2 }' /tmp/fib.report", ""),
+          "call 177\nreturn 177\nhalt 1");
+
+    if (assemble_flags("--map=/tmp/dot_vector.map", "bench/dot_vector.tk", "/tmp/dot_vector.tko") != 0)
+        return;
+    check("traced vector run",
+          run_with_input("TINKER_TRACE=/tmp/dot.trace ./hw5-sim /tmp/dot_vector.tko", "16\n3\n"), "360");
+    if (system("./hw5-trace --map=/tmp/dot_vector.map /tmp/dot.trace > /tmp/dot.report 2>&1") != 0)
+        fprintf(stderr, "hw5-trace /tmp/dot.trace failed\n");
+    check("hot loops",
+          run_with_input("awk '/^loop/ { on = 1; next } on && NF == 0 { exit } on { print $1, $2, $3, $4 }' "
+                         "/tmp/dot.report", ""),
+          "Dot+0x24 Rep 2 108\nFill+0x14 Fill 15 96\nDot+0x18 Dot 9 84");
+    // every rep reads the same 32 words of x and y
+    check("reuse distances",
+          run_with_input("awk '$1 == \"16-31\" || $1 == \"first\" { print $1, $2, $3 }' /tmp/dot.report", ""),
+          "16-31 96 75.00%\nfirst touch 32");
+    check("truncated trace",
+          run_with_input("head -c 200 /tmp/dot.trace > /tmp/cut.trace && ./hw5-trace /tmp/cut.trace > /tmp/cut.report; "
+                         "sed -n 2p /tmp/cut.report", ""),
+          "the trace ends early, the run did not finish");
+}
+
+static void test_timing(void)
+{
+    puts("\n--- timing model tests ---");
+
+    check("timing leaves output alone",
+          run_with_input("TINKER_TIMING=1 ./hw5-sim /tmp/fib.tko", "10\n"), "55");
+    // as many instructions as the trace has
+    check("cycles and CPI",
+          run_with_input("sh -c 'TINKER_TIMING=1 ./hw5-sim /tmp/fib.tko 2>&1 >/dev/null | sed -n 1p'", "10\n"),
+          "timing: 6229 instructions, 6922 cycles, CPI 1.111");
+    check("return address stack",
+          run_with_input("sh -c 'TINKER_TIMING=1 ./hw5-sim /tmp/fib.tko 2>&1 >/dev/null | sed -n 5p'", "10\n"),
+          "  branches 177, 35 mispredicted (19.77%), returns 177, 0 mispredicted");
+    // one line of l1d, so x and y take turns evicting each other
+    check("configured caches",
+          run_with_input("sh -c 'TINKER_TIMING=l1d=64/1/64,predictor=static ./hw5-sim /tmp/dot_vector.tko "
+                         "2>&1 >/dev/null | sed -n 3,5p'", "16\n3\n"),
+          "  l1d  56 accesses, 56 misses (100.00%), 32 writebacks\n"
+          "  l2   96 accesses, 12 misses (12.50%), 0 writebacks\n"
+          "  branches 31, 5 mispredicted (16.13%), returns 0, 0 mispredicted");
+    check("bad timing configuration",
+          run_with_input("sh -c 'TINKER_TIMING=l1d=3k ./hw5-sim /tmp/fib.tko 2>&1'", ""),
+          "Error: TINKER_TIMING should be 1 or key=value,... (see sim/timing.h)");
+}
+
+static void test_plugins(void)
+{
+    puts("\n--- plugin tests ---");
+
+    // fib(1) never takes the Recurse branch
+    check("plugins leave output alone",
+          run_with_input("TINKER_PLUGINS=plugins/coverage.so=/tmp/fib.coverage ./hw5-sim /tmp/fib.tko", "1\n"), "1");
+    check("coverage", run_with_input("cat /tmp/fib.coverage", ""),
+          "coverage: 69 of 84 instructions (82.1%)\n"
+          "  Recurse .. Recurse+0x38  15 instructions, line 23, push 1/2");
+    // the vector loads and stores touch 32 bytes of x and y at a time
+    check("memory heatmap",
+          run_with_input("TINKER_PLUGINS=plugins/heatmap.so=/tmp/dot.heat:128,plugins/coverage.so=/tmp/dot.coverage "
+                         "./hw5-sim /tmp/dot_vector.tko", "16\n3\n"), "360");
+    check("heatmap blocks", run_with_input("cat /tmp/dot.heat", ""),
+          "heatmap: 24 loads, 32 stores, 128 byte blocks\n"
+          "address         loads     stores\n"
+          "0x00020000         12         16  ########################################\n"
+          "0x00030000         12         16  ########################################");
+    check("two plugins at once", run_with_input("sed -n 1p /tmp/dot.coverage", ""),
+          "coverage: 124 of 124 instructions (100.0%)");
+    check("missing plugin",
+          run_with_input("sh -c 'TINKER_PLUGINS=/tmp/none.so ./hw5-sim /tmp/fib.tko 2>&1 | cut -d: -f1-2'", ""),
+          "Error: cannot load plugin /tmp/none.so");
+}
+
+static void test_check(void)
+{
+    puts("\n--- differential check tests ---");
+
+    check("checked run",
+          run_with_input("sh -c './hw5-sim --check /tmp/fib.tko 2>&1'", "10\n"),
+          "55\ncheck: the cores agree over 6229 instructions, 534 checks");
+    check("checked every 1000 instructions",
+          run_with_input("sh -c './hw5-sim --check=1000 /tmp/fib.tko 2>&1 >/dev/null'", "10\n"),
+          "check: the cores agree over 6229 instructions, 7 checks");
+    // the predecoded core drops its table at the store into code
+    check("checked self-modifying code",
+          run_with_input("sh -c './hw5-sim --check /tmp/selfmod.tko 2>&1'", ""),
+          "10\ncheck: the cores agree over 43 instructions, 5 checks");
+    check("checked simulation error",
+          run_with_input("sh -c './hw5-sim --check /tmp/wild.tko 2>&1'", ""),
+          "check: the cores agree over 13 instructions, 1 checks, both stopped on a simulation error at Main+0x34");
+    check("random programs",
+          run_with_input("sh -c './tinker check --count=100 2>&1 | tail -1'", ""),
+          "check: the cores agree on 100 programs, 68248 instructions, 23 stopped on a simulation error");
+    check("generated programs are reproducible",
+          run_with_input("./tinker gen --seed=42 /tmp/gen1.tk /tmp/gen1.in && ./tinker gen --seed=42 /tmp/gen2.tk /tmp/gen2.in "
+                         "&& cmp -s /tmp/gen1.tk /tmp/gen2.tk && cmp -s /tmp/gen1.in /tmp/gen2.in && echo same", ""),
+          "same");
+    if (assemble("/tmp/gen1.tk", "/tmp/gen1.tko") == 0)
+        check("generated program runs",
+              run_with_input("sh -c './hw5-sim --check /tmp/gen1.tko < /tmp/gen1.in 2>&1 >/dev/null | cut -c1-26'", ""),
+              "check: the cores agree ove");
+}
+
+static void test_stats(void)
+{
+    puts("\n--- run statistics tests ---");
+
+    check("statistics leave output alone",
+          run_with_input("TINKER_STATS=/tmp/fib.stats.json ./hw5-sim /tmp/fib.tko", "10\n"), "55");
+    check("statistics",
+          run_with_input("sed -n '1p;3,6p' /tmp/fib.stats.json", ""),
+          "{\"halted\": true, \"pc\": 8352, \"instructions\": 6229,\n"
+          " \"loads\": 353, \"stores\": 353,\n"
+          " \"input\": {\"privs\": 1, \"values\": 1, \"bytes\": 3},\n"
+          " \"output\": {\"privs\": 1, \"bytes\": 3},\n"
+          " \"stack_bytes\": 152, \"highest_address\": 524287, \"memory_bytes\": 524288,");
+    // counted a block at a time here, one at a time under the timing model
+    check("instruction mix",
+          run_with_input("sh -c 'TINKER_TIMING=1 TINKER_STATS=/tmp/fib.timed.json ./hw5-sim /tmp/fib.tko >/dev/null 2>&1; "
+                         "sed -n 2p /tmp/fib.stats.json > /tmp/fib.mix; "
+                         "sed -n 2p /tmp/fib.timed.json | cmp -s - /tmp/fib.mix && echo same'", "10\n"),
+          "same");
+    check("statistics after a simulation error",
+          run_with_input("sh -c 'TINKER_STATS=/tmp/wild.prom ./hw5-sim /tmp/wild.tko 2>/dev/null; "
+                         "grep -E \"^tinker_(halted|instructions_total|commands_total.*mov_load.*) \" /tmp/wild.prom'", ""),
+          "tinker_halted 0\n"
+          "tinker_instructions_total 13\n"
+          "tinker_commands_total{command=\"mov_load\"} 0");
+    // a load fails in the middle of a block, after three pushes and pops
+    if (assemble("tests/stack_fault.tk", "/tmp/stack_fault.tko") != 0)
+        return;
+    check("statistics after a failure in a block",
+          run_with_input("sh -c 'TINKER_STATS=/tmp/stack_fault.json ./hw5-sim /tmp/stack_fault.tko >/dev/null 2>&1; "
+                         "sed -n \"1p;6s/, \\\"highest.*//p\" /tmp/stack_fault.json'", "99999999\n"),
+          "{\"halted\": false, \"pc\": 8292, \"instructions\": 25,\n"
+          " \"stack_bytes\": 24");
+    check("one instruction at a time gives the same statistics",
+          run_with_input("sh -c 'TINKER_TIMING=1 TINKER_STATS=/tmp/stack_fault.timed.json ./hw5-sim /tmp/stack_fault.tko "
+                         ">/dev/null 2>&1; sed -n 1,6p /tmp/stack_fault.json > /tmp/stack_fault.run; "
+                         "sed -n 1,6p /tmp/stack_fault.timed.json | cmp -s - /tmp/stack_fault.run && echo same'",
+                         "99999999\n"),
+          "same");
+}
+
+static void test_regions(void)
+{
+    puts("\n--- timing service tests ---");
+
+    if (assemble_flags("--map=/tmp/regions.map", "tests/regions.tk", "/tmp/regions.tko") != 0)
+        return;
+    // icount to icount is the loop's 2n instructions, the region and endregion and the first icount
+    check("instruction counter and clock",
+          run_with_input("./hw5-sim /tmp/regions.tko 2>/dev/null", "10\n"), "23\n1");
+    check("one instruction at a time counts the same",
+          run_with_input("sh -c 'TINKER_TIMING=1 ./hw5-sim /tmp/regions.tko 2>/dev/null'", "10\n"), "23\n1");
+    check("region report",
+          run_with_input("sh -c './hw5-sim /tmp/regions.tko 2>&1 >/dev/null | sed \"s/, [0-9.]*ms.*//\"'", "1000\n"),
+          "region 1 at 0x209c (line 11): 1 runs, 2000 instructions (2000.0 each)");
+    check("regions in the statistics",
+          run_with_input("sh -c 'TINKER_STATS=/tmp/regions.prom ./hw5-sim /tmp/regions.tko >/dev/null 2>&1; "
+                         "grep -E \"^tinker_region_(runs|instructions)\" /tmp/regions.prom'", "10\n"),
+          "tinker_region_runs_total{region=\"1\"} 1\n"
+          "tinker_region_instructions_total{region=\"1\"} 20");
+    // the clock reads the instruction count on both cores
+    check("checked clock",
+          run_with_input("sh -c './hw5-sim --check /tmp/regions.tko 2>&1 | sed -n 3p'", "10\n"),
+          "check: the cores agree over 94 instructions, 21 checks");
+    // each lane counts its own instructions and keeps its own regions
+    check("instruction counter in lanes",
+          run_with_input("sh -c 'echo 10 > /tmp/regions_lane0; echo 100 > /tmp/regions_lane1; "
+                         "./hw5-sim --lanes /tmp/regions.tko /tmp/regions_lane0 /tmp/regions_lane1 >/dev/null 2>&1; "
+                         "cat /tmp/regions_lane0.out /tmp/regions_lane1.out'", ""),
+          "23\n1\n203\n1");
+    check("region report in lanes",
+          run_with_input("sh -c './hw5-sim --lanes /tmp/regions.tko /tmp/regions_lane0 /tmp/regions_lane1 2>&1 | "
+                         "sed -n \"s/, [0-9.]*ms.*//p\"'", ""),
+          "region 1 at 0x209c (line 11) in lane 0: 1 runs, 20 instructions (20.0 each)\n"
+          "region 1 at 0x209c (line 11) in lane 1: 1 runs, 200 instructions (200.0 each)");
+}
+
+static void test_fuzz(void)
+{
+    puts("\n--- fuzz target tests ---");
+
+    // short fixed-seed runs: the targets abort on a crash, a diagnostic
+    // without a failure, an image the simulator rejects or a divergence
+    check("fuzz the assembler",
+          run_with_input("sh -c './fuzz/fuzz-assemble -runs=2000 -seed=1 -close_fd_mask=3 2>&1 | tail -1 | cut -d\\  -f1-3'", ""),
+          "Done 2000 runs");
+    check("fuzz the loader",
+          run_with_input("sh -c './fuzz/fuzz-load -runs=2000 -seed=1 -close_fd_mask=3 2>&1 | tail -1 | cut -d\\  -f1-3'", ""),
+          "Done 2000 runs");
+    check("fuzz the round trip",
+          run_with_input("sh -c './fuzz/fuzz-roundtrip -runs=200 -seed=1 -close_fd_mask=3 2>&1 | tail -1 | cut -d\\  -f1-3'", ""),
+          "Done 200 runs");
+    // the mov that once crashed the encoder, rerun as a saved input
+    FILE *input = fopen("/tmp/fuzz-mov.tk", "w");
+    if (!input) return;
+    fputs(".code\n\tmov (r8)(0ts\n", input);
+    fclose(input);
+    check("fuzz input reproduced",
+          run_with_input("sh -c './fuzz/fuzz-assemble /tmp/fuzz-mov.tk 2>&1 | cut -d\\  -f1-2'", ""),
+          "Running: /tmp/fuzz-mov.tk\nExecuted /tmp/fuzz-mov.tk");
+}
+
+static void test_large_source(void)
+{
+    puts("\n--- large source tests ---");
+
+    // well past the old 50000 line limit, and big enough to be split
+    // across parser threads with chunks that start inside .data
+    FILE *src = fopen("/tmp/large.tk", "w");
+    if (!src) return;
+    fputs(".code\n\tld r1, 1\n\tld r2, :Last\n\tmov r3, (r2)(0)\n\tout r1, r3\n\tclr r4\n", src);
+    for (int i = 0; i < 60000; i++)
+        fputs("\taddi r4, 1\n", src);
+    fputs("\tout r1, r4\n\thalt\n.data\n", src);
+    for (int i = 0; i < 20000; i++)
+        fputs("\t1\n", src);
+    fputs(":Last\n\t99\n", src);
+    fclose(src);
+
+    if (assemble("/tmp/large.tk", "/tmp/large.tko") == 0)
+        check("80000 line source", run_with_input("./hw5-sim /tmp/large.tko", ""), "99\n60000");
+
+    // force more parser threads than this machine may have cores
+    if (system("HW5_ASM_THREADS=7 ./hw5-asm /tmp/large.tk /tmp/large7.tko >/dev/null 2>&1") == 0)
+        check("80000 line source, 7 parser threads",
+              run_with_input("./hw5-sim /tmp/large7.tko", ""), "99\n60000");
+    check("7 parser threads give the same image",
+          run_with_input("cmp -s /tmp/large.tko /tmp/large7.tko && echo same", ""), "same");
+
+    // bad lines in chunks that start without a directive are parsed once the
+    // chunks before them are, and still reported one per line, in order
+    src = fopen("/tmp/large_bad.tk", "w");
+    if (!src) return;
+    fputs(".code\n", src);
+    for (int i = 0; i < 8000; i++)
+        fputs(i == 4000 ? "\tfoo r1\n" : "\taddi r4, 1\n", src);
+    fputs("\thalt\n.data\n", src);
+    for (int i = 0; i < 20000; i++)
+        fputs(i == 16000 ? "\tbad1\n\tbad2\n" : "\t1\n", src);
+    fclose(src);
+    check("errors in a large source",
+          run_with_input("sh -c 'HW5_ASM_THREADS=1 ./hw5-asm /tmp/large_bad.tk /tmp/large_bad.tko 2>&1'", ""),
+          "/tmp/large_bad.tk:4002:2: error: unknown command foo\n"
+          "/tmp/large_bad.tk:24004:2: error: invalid data\n"
+          "/tmp/large_bad.tk:24005:2: error: invalid data");
+    check("4 parser threads give the same errors",
+          run_with_input("sh -c 'HW5_ASM_THREADS=1 ./hw5-asm /tmp/large_bad.tk /tmp/large_bad.tko > /tmp/large_bad.1 2>&1; "
+                         "HW5_ASM_THREADS=4 ./hw5-asm /tmp/large_bad.tk /tmp/large_bad.tko 2>&1 | "
+                         "cmp -s - /tmp/large_bad.1 && echo same'", ""),
+          "same");
+}
+
 int main(void)
 {
     puts("hw5 test");
 
     test_fibonacci();
     test_binary_search();
+    test_vector();
+    test_sections();
+    test_layout();
+    test_link();
+    test_run();
+    test_predecode();
+    test_lanes();
+    test_serve();
+    test_out_of_bounds();
+    test_async_io();
+    test_block_priv();
+    test_heap();
+    test_profile();
+    test_trace();
+    test_timing();
+    test_plugins();
+    test_check();
+    test_stats();
+    test_regions();
+    test_fuzz();
+    test_large_source();
 
     printf("\nResults: %d / %d passed\n", tests_pass, tests_run);
     return (tests_pass == tests_run) ? 0 : 1;
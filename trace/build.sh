@@ -0,0 +1 @@
+gcc -I../sim -o hw5-trace main.c ../sim/symbols.c
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "symbols.h"
+#include "trace.h"
+#include "vector.h"
+
+#define ull unsigned long long
+
+// hw5-trace: decodes a trace hw5-sim wrote with TINKER_TRACE (see
+// sim/trace.h) and reports the instruction mix, branches, the hottest
+// loops, the reuse distances of memory words and the working set over time
+//
+// usage: hw5-trace [--map=file] [--window=n] trace
+//   --map=file  name pcs with the symbol map hw5-asm --map wrote
+//   --window=n  instructions per working set sample, by default a
+//               twentieth of the run
+
+static const char * names[32] = {
+	[AND] = "and", [OR] = "or", [XOR] = "xor", [NOT] = "not",
+	[SHFTR] = "shftr", [SHFTRI] = "shftri", [SHFTL] = "shftl", [SHFTLI] = "shftli",
+	[BR] = "br", [BRR] = "brr rd", [BRR2] = "brr L", [BRNZ] = "brnz",
+	[CALL] = "call", [RETURN] = "return", [BRGT] = "brgt", [PRIV] = "priv",
+	[MOV] = "mov load", [MOV1] = "mov rd, rs", [MOV2] = "mov rd, L", [MOV3] = "mov store",
+	[ADDF] = "addf", [SUBF] = "subf", [MULF] = "mulf", [DIVF] = "divf",
+	[ADD] = "add", [ADDI] = "addi", [SUB] = "sub", [SUBI] = "subi",
+	[MUL] = "mul", [DIV] = "div", [VEC] = "vec",
+};
+
+static const char * privNames[17] = {
+	"halt", "priv 1", "priv 2", "in", "out", "inn", "outn", "outs", "memcpy", "memset", "malloc", "free", "realloc",
+	"icount", "clock", "region", "endregion",
+};
+
+static const char * vecNames[16] = {
+	[VADD] = "vadd", [VSUB] = "vsub", [VMUL] = "vmul", [VDIV] = "vdiv",
+	[VADDF] = "vaddf", [VSUBF] = "vsubf", [VMULF] = "vmulf", [VDIVF] = "vdivf",
+	[VFMA] = "vfma", [VFMAF] = "vfmaf", [VSPLAT] = "vsplat", [VSUM] = "vsum",
+	[VSUMF] = "vsumf", [VLD] = "vld", [VST] = "vst",
+};
+
+static void fail(const char * message, const char * path) {
+	fprintf(stderr, "Error: %s %s\n", message, path);
+	exit(1);
+}
+
+static void * grow(void * p, size_t size) {
+	if (!(p = realloc(p, size))) {
+		fprintf(stderr, "Error: not enough memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+// Open addressing from a 64-bit key to a counter, keys stored plus one so
+// that 0 marks an empty slot
+typedef struct Map {
+	ull * keys, * values;
+	size_t count, size;
+} Map;
+
+static ull * slot(Map * map, ull key) {
+	if (2 * (map->count + 1) > map->size) {
+		Map old = *map;
+		map->size = old.size ? 2 * old.size : 1024;
+		map->keys = calloc(map->size, sizeof(ull));
+		map->values = calloc(map->size, sizeof(ull));
+		if (!map->keys || !map->values) grow(NULL, 0);
+		map->count = 0;
+		for (size_t i = 0; i < old.size; i++)
+			if (old.keys[i]) *slot(map, old.keys[i] - 1) = old.values[i];
+		free(old.keys);
+		free(old.values);
+	}
+	size_t at = (key * 0x9e3779b97f4a7c15ULL >> 20) & (map->size - 1);
+	while (map->keys[at] && map->keys[at] != key + 1) at = (at + 1) & (map->size - 1);
+	if (!map->keys[at]) {
+		map->keys[at] = key + 1;
+		map->values[at] = 0;
+		map->count++;
+	}
+	return &map->values[at];
+}
+
+// Reuse distance: the number of distinct words touched since the last
+// touch of this one. Every word's last touch is a marked position in a
+// Fenwick tree over time, so the distance is the count of marks after it.
+// Positions are renumbered from 1 when they run out.
+static Map lastTouch;
+static int * tree;
+static size_t treeSize, now;
+static ull reuse[66]; // [0] first touches, [1] distance 0, [b + 1] distances 2^(b-1) to 2^b - 1
+
+static void mark(size_t at, int delta) {
+	for (; at <= treeSize; at += at & -at) tree[at] += delta;
+}
+
+static ull marksUpTo(size_t at) {
+	ull n = 0;
+	for (; at; at -= at & -at) n += tree[at];
+	return n;
+}
+
+typedef struct Touch {
+	ull position;
+	size_t slot;
+} Touch;
+
+static int byPosition(const void * a, const void * b) {
+	const Touch * x = a, * y = b;
+	return (x->position > y->position) - (x->position < y->position);
+}
+
+static void renumber() {
+	Touch * touches = grow(NULL, (lastTouch.count + 1) * sizeof(Touch));
+	size_t n = 0;
+	for (size_t i = 0; i < lastTouch.size; i++)
+		if (lastTouch.keys[i]) touches[n++] = (Touch){lastTouch.values[i], i};
+	qsort(touches, n, sizeof(Touch), byPosition);
+	if (treeSize < 4 * n) treeSize = 4 * n;
+	if (treeSize < (1 << 20)) treeSize = 1 << 20;
+	free(tree);
+	tree = calloc(treeSize + 1, sizeof(int));
+	if (!tree) grow(NULL, 0);
+	for (size_t i = 0; i < n; i++) {
+		lastTouch.values[touches[i].slot] = i + 1;
+		mark(i + 1, 1);
+	}
+	now = n;
+	free(touches);
+}
+
+static void touchWord(ull word) {
+	if (now == treeSize) renumber();
+	ull * last = slot(&lastTouch, word);
+	size_t at = ++now;
+	if (!*last) reuse[0]++;
+	else {
+		ull distance = marksUpTo(at - 1) - marksUpTo(*last);
+		int bucket = 1;
+		while (distance) bucket++, distance >>= 1;
+		reuse[bucket]++;
+		mark(*last, -1);
+	}
+	*last = at;
+	mark(at, 1);
+}
+
+// working set: distinct 64-byte lines in each window of instructions
+typedef struct Window {
+	ull start, instructions, lines;
+} Window;
+
+static Map lineWindow;
+static ull window, windowLines, windowStart;
+static Window * windows;
+static size_t numWindows, maxWindows;
+
+static void endWindow(ull instructions) {
+	if (instructions == windowStart) return;
+	if (numWindows == maxWindows) {
+		maxWindows = maxWindows ? 2 * maxWindows : 64;
+		windows = grow(windows, maxWindows * sizeof(Window));
+	}
+	windows[numWindows++] = (Window){windowStart, instructions - windowStart, windowLines};
+	windowStart = instructions;
+	windowLines = 0;
+}
+
+static void touchLine(ull line, ull windowId) {
+	ull * seen = slot(&lineWindow, line);
+	if (*seen != windowId + 1) {
+		*seen = windowId + 1;
+		windowLines++;
+	}
+}
+
+typedef struct Row {
+	const char * name;
+	ull count;
+} Row;
+
+static int byCount(const void * a, const void * b) {
+	const Row * x = a, * y = b;
+	if (x->count != y->count) return x->count > y->count ? -1 : 1;
+	return strcmp(x->name, y->name);
+}
+
+typedef struct Loop {
+	ull from, to; // the backward jump and its target
+	ull iterations, instructions;
+} Loop;
+
+static int byWeight(const void * a, const void * b) {
+	const Loop * x = a, * y = b;
+	if (x->instructions != y->instructions) return x->instructions > y->instructions ? -1 : 1;
+	return (x->to > y->to) - (x->to < y->to);
+}
+
+static int getVarint(FILE * file, ull * v) {
+	*v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = getc_unlocked(file);
+		if (c == EOF) return -1;
+		*v |= (ull)(c & 0x7f) << shift;
+		if (!(c & 0x80)) return 0;
+	}
+	return -1;
+}
+
+static ull getWord(const unsigned char * at, int size) {
+	ull v = 0;
+	for (int i = 0; i < size; i++) v |= (ull)at[i] << (8 * i);
+	return v;
+}
+
+static const char * where(ull pc, char * buf) {
+	return symbolize(pc, buf, 128);
+}
+
+typedef struct PcCount {
+	ull pc, count;
+} PcCount;
+
+static int byPc(const void * a, const void * b) {
+	const PcCount * x = a, * y = b;
+	return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+int main(int argc, char * argv[]) {
+	const char * path = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--map=", 6) == 0) loadSymbols(argv[i] + 6);
+		else if (strncmp(argv[i], "--window=", 9) == 0) window = strtoull(argv[i] + 9, NULL, 0);
+		else path = argv[i];
+	}
+	if (!path) {
+		fprintf(stderr, "usage: hw5-trace [--map=file] [--window=n] trace\n");
+		exit(1);
+	}
+	FILE * file = fopen(path, "rb");
+	if (!file) fail("cannot open", path);
+	unsigned char header[TRACE_HEADER];
+	if (fread(header, 1, TRACE_HEADER, file) != TRACE_HEADER || memcmp(header, TRACE_MAGIC, 8) != 0)
+		fail("not a trace:", path);
+	if (getWord(header + 8, 4) != TRACE_VERSION) fail("unknown trace version in", path);
+	ull pc = getWord(header + 16, 8);
+
+	// the count at the end sizes the working set windows
+	unsigned char end[9];
+	ull expected = 0;
+	if (fseek(file, -9, SEEK_END) == 0 && fread(end, 1, 9, file) == 9 && end[0] == TRACE_END)
+		expected = getWord(end + 1, 8);
+	fseek(file, TRACE_HEADER, SEEK_SET);
+	if (!window) window = expected >= 20 ? (expected + 19) / 20 : 100000;
+
+	ull counts[32] = {0}, privCounts[256] = {0}, vecCounts[256] = {0};
+	ull conditional = 0, taken = 0, loads = 0, stores = 0, instructions = 0, address = 0;
+	Map pcs = {0}, loops = {0};
+	int complete = 0;
+	for (;;) {
+		int c = getc_unlocked(file);
+		if (c == EOF) break;
+		int cmd = c & TRACE_CMD;
+		if (cmd == TRACE_END) {
+			unsigned char count[8];
+			complete = fread(count, 1, 8, file) == 8 && getWord(count, 8) == instructions;
+			break;
+		}
+		if (cmd > VEC) fail("bad record in", path);
+		int imm = 0;
+		if (cmd == PRIV || cmd == VEC) {
+			if ((imm = getc_unlocked(file)) == EOF) break;
+		}
+		ull next = pc + 4, v;
+		if (c & TRACE_JUMP) {
+			if (getVarint(file, &v) != 0) break;
+			next = pc + traceUnzigzag(v);
+		}
+		if (c & TRACE_MEMORY) {
+			if (getVarint(file, &v) != 0) break;
+			address += traceUnzigzag(v);
+		}
+
+		counts[cmd]++;
+		if (cmd == PRIV) privCounts[imm]++;
+		if (cmd == VEC) vecCounts[imm]++;
+		(*slot(&pcs, pc))++;
+		if (cmd == BRNZ || cmd == BRGT) {
+			conditional++;
+			if (c & TRACE_JUMP) taken++;
+		}
+		if ((c & TRACE_JUMP) && next <= pc && cmd != CALL && cmd != RETURN)
+			(*slot(&loops, pc << 32 | next))++;
+		if (instructions - windowStart >= window) endWindow(instructions);
+		if (c & TRACE_MEMORY) {
+			int words = cmd == VEC ? VLANES : 1;
+			if (c & TRACE_STORE) stores++;
+			else loads++;
+			for (int i = 0; i < words; i++) touchWord((address >> 3) + i);
+			touchLine(address >> 6, instructions / window);
+			touchLine((address + 8 * words - 1) >> 6, instructions / window);
+		}
+		instructions++;
+		pc = next;
+	}
+	endWindow(instructions);
+	fclose(file);
+
+	printf("%llu instructions, %llu loads, %llu stores\n", instructions, loads, stores);
+	if (!complete) printf("the trace ends early, the run did not finish\n");
+	printf("%llu conditional branches, %llu taken (%.2f%%)\n", conditional, taken,
+		conditional ? 100.0 * taken / conditional : 0.0);
+	double scale = instructions ? 100.0 / instructions : 0;
+
+	Row * rows = grow(NULL, (32 + 2 * 256) * sizeof(Row));
+	int n = 0;
+	char privName[256][16], vecName[256][16];
+	for (int i = 0; i < 32; i++)
+		if (counts[i] && i != PRIV && i != VEC) rows[n++] = (Row){names[i], counts[i]};
+	for (int i = 0; i < 256; i++) {
+		if (privCounts[i]) {
+			if (i < 17) snprintf(privName[i], 16, "%s", privNames[i]);
+			else snprintf(privName[i], 16, "priv %d", i);
+			rows[n++] = (Row){privName[i], privCounts[i]};
+		}
+		if (vecCounts[i]) {
+			if (i < 16 && vecNames[i]) snprintf(vecName[i], 16, "%s", vecNames[i]);
+			else snprintf(vecName[i], 16, "vec %d", i);
+			rows[n++] = (Row){vecName[i], vecCounts[i]};
+		}
+	}
+	qsort(rows, n, sizeof(Row), byCount);
+	printf("\n%-16s %14s %8s\n", "instruction", "count", "%");
+	for (int i = 0; i < n; i++) printf("%-16s %14llu %7.2f%%\n", rows[i].name, rows[i].count, rows[i].count * scale);
+
+	// a loop is a backward jump; its body is every pc from the target to
+	// the jump, and its weight the instructions run there
+	PcCount * byAddress = grow(NULL, (pcs.count + 1) * sizeof(PcCount));
+	ull * below = grow(NULL, (pcs.count + 2) * sizeof(ull));
+	size_t numPcs = 0;
+	for (size_t i = 0; i < pcs.size; i++)
+		if (pcs.keys[i]) byAddress[numPcs++] = (PcCount){pcs.keys[i] - 1, pcs.values[i]};
+	qsort(byAddress, numPcs, sizeof(PcCount), byPc);
+	below[0] = 0;
+	for (size_t i = 0; i < numPcs; i++) below[i + 1] = below[i] + byAddress[i].count;
+	Loop * hot = grow(NULL, (loops.count + 1) * sizeof(Loop));
+	n = 0;
+	for (size_t i = 0; i < loops.size; i++) {
+		if (!loops.keys[i]) continue;
+		ull edge = loops.keys[i] - 1, from = edge >> 32, to = edge & 0xffffffff;
+		size_t lo = 0, hi = numPcs; // first pc at or above to
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (byAddress[mid].pc < to) lo = mid + 1;
+			else hi = mid;
+		}
+		size_t first = lo;
+		hi = numPcs; // first pc above from
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (byAddress[mid].pc <= from) lo = mid + 1;
+			else hi = mid;
+		}
+		hot[n++] = (Loop){from, to, loops.values[i], below[lo] - below[first]};
+	}
+	qsort(hot, n, sizeof(Loop), byWeight);
+	printf("\n%-24s %-24s %12s %14s %8s\n", "loop from", "to", "iterations", "instructions", "%");
+	char a[128], b[128];
+	for (int i = 0; i < n && i < 10; i++)
+		printf("%-24s %-24s %12llu %14llu %7.2f%%\n", where(hot[i].from, a), where(hot[i].to, b), hot[i].iterations,
+			hot[i].instructions, hot[i].instructions * scale);
+
+	ull touches = 0;
+	for (int i = 0; i < 66; i++) touches += reuse[i];
+	printf("\n%-24s %14s %8s %12s\n", "reuse distance (words)", "accesses", "%", "cumulative");
+	double cumulative = 0, wordScale = touches ? 100.0 / touches : 0;
+	for (int i = 1; i < 66; i++) {
+		if (!reuse[i]) continue;
+		char range[48];
+		if (i == 1) snprintf(range, sizeof(range), "0");
+		else if (i == 2) snprintf(range, sizeof(range), "1");
+		else snprintf(range, sizeof(range), "%llu-%llu", 1ULL << (i - 2), (1ULL << (i - 1)) - 1);
+		cumulative += reuse[i] * wordScale;
+		printf("%-24s %14llu %7.2f%% %11.2f%%\n", range, reuse[i], reuse[i] * wordScale, cumulative);
+	}
+	printf("%-24s %14llu %7.2f%%\n", "first touch", reuse[0], reuse[0] * wordScale);
+
+	printf("\nworking set, distinct 64-byte lines\n%12s %12s %10s %10s\n", "from", "instructions", "lines", "KiB");
+	for (size_t i = 0; i < numWindows; i++)
+		printf("%12llu %12llu %10llu %10.1f\n", windows[i].start, windows[i].instructions, windows[i].lines,
+			windows[i].lines * 64 / 1024.0);
+	return 0;
+}